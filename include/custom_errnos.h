@@ -34,7 +34,19 @@ __push_errno_defs
 	EREGUNAVAIL,													\
 	EBUFSIZE,														\
 	EDELETE,														\
-	EHANDLE,
+	EHANDLE,														\
+	EFILE,															\
+	EWRITE,															\
+	EIMPORT,														\
+	ESNAPSHOT,														\
+	EIPC,															\
+	EMESSAGE,														\
+	EHIVEFILE,														\
+	EIOCFILE,														\
+	EALLOWFILE,														\
+	ETRACEFILE,														\
+	ECHECKPOINT,													\
+	EVALUE,
 
 __push_errno_strs
 #undef __CUSTOM_ERRNO_STRS
@@ -51,6 +63,18 @@ __push_errno_strs
 	"Registry key is unavailable",									\
 	"The query buffer is too small",								\
 	"Unable to delete the registry key",							\
-	"Invalid handle",
+	"Invalid handle",												\
+	"Unable to open the file",										\
+	"Unable to write the file",										\
+	"Malformed registry file",										\
+	"Malformed snapshot file",										\
+	"Unable to reach the server",									\
+	"Malformed IPC message",										\
+	"Malformed hive file",											\
+	"Malformed IOC file",											\
+	"Malformed allowlist file",										\
+	"Malformed or unwritable trace file",							\
+	"Malformed checkpoint file, or one of another operation",		\
+	"Value is malformed for its type",
 
 #endif
@@ -0,0 +1,101 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ALLOW_H_
+#define _ALLOW_H_
+
+#include <stdint.h>
+#include <invis/compat.h>
+
+#include <invis/intern.h>
+#include <invis/reg.h>
+
+// Bits of the Bloom filter per entry, about a 1% false positive rate with ALLOW_BLOOM_PROBES
+#define ALLOW_BLOOM_BITS	10
+#define ALLOW_BLOOM_PROBES	6
+
+/*
+ * A list of values known to be benign, as (hive, key path, value name,
+ * hash64() of the data) tuples, where the hive and the data may also be
+ * left open to match any. Paths and names match without regard to ASCII
+ * case, like the registry.
+ * Lookups go through a blocked Bloom filter first, where every probe of a
+ * tuple falls in the same 64 byte block so that a miss costs one cache
+ * line, and only what passes it is looked up in the exact set.
+ */
+struct allow_entry_t
+{
+	uint64_t hash;		// Of the whole tuple
+	HKEY hive;			// 0 for any
+	uint32_t path;		// Interned id in paths
+	uint32_t name;		// Offset into the pool
+	uint32_t name_size;
+	uint8_t any_data;
+	uint64_t data;
+};
+
+struct allow_t
+{
+	uint64_t *bloom;
+	uint32_t blocks;	// Of 8 uint64_t, a power of two
+
+	struct allow_entry_t *entries;
+	uint32_t num_entries;
+	uint32_t *table;	// ids + 1 into entries
+	uint32_t table_size;
+
+	// Paths are kept once however many values of a key are listed
+	struct intern_t paths;
+
+	wchar_t *pool;		// Value names
+	uint32_t pool_len;	// In characters
+	uint32_t pool_max;
+
+	uint8_t any_hive;	// Some entries match any hive, so lookups probe for those too
+	uint8_t any_data;
+};
+
+// The parts of a lookup that are the same for every value of a key
+struct allow_key_t
+{
+	HKEY hive;			// 0 for hive files
+	uint32_t path;		// Interned id, INTERN_NONE when nothing under the key is listed
+};
+
+/*
+ * Load a file with one tuple per line, separated by tabs:
+ *  HKLM:\Key\Path<TAB>Value name<TAB>hash64 in hex
+ * The path and name are escaped the same way as in exported files. The
+ * hive may be * for any hive, which is the only kind that matches values
+ * of hive files, and the hash may be * for any data. Empty lines and lines
+ * starting with '#' are skipped.
+ */
+int allow_load(struct allow_t *a, const char *file);
+
+void allow_free(struct allow_t *a);
+
+// Set up a lookup for the values of a key, once per key
+void allow_key(const struct allow_t *a, HKEY hive, const wchar_t *path, uint32_t path_size, struct allow_key_t *k);
+
+/*
+ * Whether an entry is in the list. Only hashes and compares the entry where
+ * it is, so it can be called straight from the enumeration buffer.
+ */
+uint8_t allow_match(const struct allow_t *a, const struct allow_key_t *k, const struct key_data_t *entry);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CARVE_H_
+#define _CARVE_H_
+
+#include <stdint.h>
+#include <invis/compat.h>
+
+#include <invis/hive.h>
+
+// Images are read sequentially in pieces this large
+#define CARVE_READ_SIZE		(16 * 1024 * 1024)
+
+// Hive files start on a sector in disk images and bins on a page in memory
+#define CARVE_ALIGN			512
+
+// Larger hives than the registry allows are not hives
+#define CARVE_MAX_HIVE		0x80000000ULL
+
+struct carve_hive_t
+{
+	uint64_t offset;	// Of the base block in the image, or of the first bin without one
+	uint8_t base;		// A base block was found, otherwise the bins were found on their own
+	uint16_t name[32];	// From the base block, NUL padded
+	uint64_t size;		// Size of the bins
+	uint64_t missing;	// Bytes of the bins that were not found, left zeroed
+	uint32_t fragments;	// Runs of bins the hive was put back together from
+};
+
+/*
+ * Called once for every hive that was put back together, hive can be
+ * walked with hive_sweep() and is closed once the call returns.
+ * Returning non-zero stops the carving, and carve_image() returns that value.
+ */
+typedef int (*carve_cb_t)(void *ctx, struct carve_hive_t *info, struct hive_t *hive);
+
+/*
+ * Find hives in a raw disk or memory image of any size.
+ * The image is read once from start to end, checking every CARVE_ALIGN
+ * bytes for a base block or a bin header, four at a time. Only where the
+ * runs of bins are is remembered, 40 bytes for every run that does not
+ * carry on from the one before it, so memory use grows with how fragmented
+ * the image is rather than with its size.
+ * Each base block is then followed by the bins after it, with gaps filled
+ * in by runs elsewhere in the image that start at the missing offset,
+ * closest first. Runs that start a hive but have no base block, as hives
+ * in memory do, become hives of their own rooted at their root key.
+ * Only one hive is held in memory at a time.
+ */
+int carve_image(const char *file, carve_cb_t cb, void *ctx);
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <invis/compat.h>
+
+/*
+ * Checkpoint file layout, all integers are little endian:
+ *  struct checkpoint_header_t
+ *  size bytes of state, laid out by whichever sweep wrote it
+ * A checkpoint is written to a file next to the last one, flushed to the
+ * disk and only then renamed over it, so a process killed at any point
+ * leaves either the previous checkpoint or the new one, never a mix.
+ * The output is flushed to the disk before its offset is taken, so the
+ * output is never shorter than a checkpoint says it is.
+ */
+#define CHECKPOINT_MAGIC		"INVCHKPT"
+#define CHECKPOINT_VERSION		1
+
+// Kinds of state
+#define CHECKPOINT_SWEEP		1	// sweep_checkpoint()
+#define CHECKPOINT_HIVE			2	// hive_sweep_checkpoint()
+
+// Default time between checkpoints in microseconds
+#define CHECKPOINT_INTERVAL		10000000
+
+struct checkpoint_header_t
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t kind;
+	uint64_t id;		// Of the operation, see checkpoint_init()
+	uint64_t offset;	// Of the end of the output written so far
+	uint64_t size;		// Of the state
+	uint64_t hash;		// hash64() of the state
+};
+
+struct checkpoint_t
+{
+	char *file;
+	char *tmp;
+	uint64_t id;
+	uint64_t interval;
+	uint64_t next;		// thread_now() once the next checkpoint is due
+
+	// Flushes the output to the disk and returns the offset it ends at
+	int (*flush)(void *ctx, uint64_t *offset);
+	void *ctx;
+
+	// Loaded by checkpoint_load(), and read back with checkpoint_get()
+	uint32_t kind;
+	uint8_t *state;
+	uint64_t size;
+	uint64_t pos;
+	uint64_t offset;
+
+	// State being put together by checkpoint_put()
+	uint8_t *buf;
+	uint64_t len;
+	uint64_t max;
+	int8_t err;
+};
+
+/*
+ * Checkpoints of an operation go to file every interval microseconds.
+ * id identifies the operation, such as a hash of its arguments, so that a
+ * checkpoint of another one is never resumed from.
+ */
+int checkpoint_init(struct checkpoint_t *c, const char *file, uint64_t id, uint64_t interval);
+void checkpoint_free(struct checkpoint_t *c);
+
+/*
+ * Load the last checkpoint to resume from, c->offset is where the output
+ * is cut back to. Without one the operation starts over from offset 0.
+ */
+int checkpoint_load(struct checkpoint_t *c);
+
+// Whether a checkpoint is due, cheap enough to ask once per key
+static inline int8_t checkpoint_due(struct checkpoint_t *c, uint64_t now)
+{
+	return c && now >= c->next;
+}
+
+// Build up the state, then write it along with the offset of the output
+void checkpoint_begin(struct checkpoint_t *c);
+void checkpoint_put(struct checkpoint_t *c, const void *data, uint64_t size);
+int checkpoint_commit(struct checkpoint_t *c, uint32_t kind);
+
+// Read the loaded state back in the order it was put, failing once it runs out
+int checkpoint_get(struct checkpoint_t *c, void *data, uint64_t size);
+
+// Remove the checkpoint once the operation has completed
+int checkpoint_done(struct checkpoint_t *c);
+
+// Flush a file to the disk, take the offset it ends at, and cut it back to an offset
+int checkpoint_sync(FILE *f);
+int checkpoint_offset(FILE *f, uint64_t *offset);
+int checkpoint_truncate(FILE *f, uint64_t offset);
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CLASSIFY_H_
+#define _CLASSIFY_H_
+
+#include <stdint.h>
+#include <invis/compat.h>
+
+#define ANOMALY_LEADING_NUL		(1<<0)	// First character is a NUL, the classic invisible name
+#define ANOMALY_EMBEDDED_NUL	(1<<1)	// NUL between two non-NUL characters
+#define ANOMALY_TRAILING_NUL	(1<<2)	// Last character is a NUL
+#define ANOMALY_ALL_NUL			(1<<3)	// Every character is a NUL
+#define ANOMALY_LENGTH			(1<<4)	// NameLength exceeds the C-string length of the name
+#define ANOMALY_ODD_LENGTH		(1<<5)	// NameLength is not a whole number of UTF-16 characters
+#define ANOMALY_TRAILING_SPACE	(1<<6)	// Last non-NUL character is whitespace
+#define ANOMALY_CONTROL			(1<<7)	// Contains a C0 or C1 control character other than NUL, or DEL
+#define ANOMALY_FORMAT			(1<<8)	// Contains a zero-width or bidi formatting character
+#define ANOMALY_LOOKALIKE		(1<<9)	// Contains a character commonly used as a latin lookalike
+
+#define ANOMALY_COUNT			10
+
+// Names that userland registry tools fail to render
+#define ANOMALY_INVISIBLE		(ANOMALY_LEADING_NUL | ANOMALY_ALL_NUL)
+
+/*
+ * Classify a counted UTF-16LE name, as returned in the Name/NameLength
+ * fields of the KEY_*_INFORMATION structures or stored in a hive cell.
+ * size is in bytes and the name does not need to be NUL terminated.
+ * Returns a bitmask of the ANOMALY_* flags above, 0 for an ordinary name.
+ */
+uint32_t classify_name(const wchar_t *name, uint32_t size);
+
+// Short name of a single ANOMALY_* bit, or 0 if the bit is unknown
+const char *anomaly_str(uint32_t anomaly);
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CODEC_H_
+#define _CODEC_H_
+
+#include <stdint.h>
+#include <invis/compat.h>
+
+// Worst case length of the text of size bytes of data of any type, including the terminating NUL
+#define CODEC_FORMAT_SIZE(size) ((uint64_t) (size) * 4 + 64)
+
+/*
+ * Text forms of each value type, shared by --value and --query:
+ *  REG_SZ, REG_EXPAND_SZ, REG_LINK: the string, escaped as by reg_escape()
+ *                                   when printed, and stored with a NUL
+ *                                   terminator except for links
+ *  REG_MULTI_SZ:                    the strings separated by a literal \0,
+ *                                   as with reg.exe
+ *  REG_DWORD, REG_DWORD_BIG_ENDIAN,
+ *  REG_QWORD:                       an unsigned number, decimal or 0x hex
+ *  REG_RESOURCE_LIST,
+ *  REG_FULL_RESOURCE_DESCRIPTOR,
+ *  REG_RESOURCE_REQUIREMENTS_LIST:  decoded into the resources they describe
+ *                                   when printed
+ *  REG_NONE, REG_BINARY:            comma separated hex bytes when printed
+ * Data that doesn't fit its type, such as a DWORD that isn't 4 bytes, and
+ * data of unknown types is printed as hex bytes too.
+ */
+
+// Name of a type, or 0 if it has none
+const char *codec_name(ULONG type);
+
+// Type with the given name, or -1 if there is none
+int codec_type(const char *name, ULONG *type);
+
+// Whether the --value of a type is the name of a file holding the data, rather than text
+uint8_t codec_file(ULONG type);
+
+/*
+ * Write the text form of data of the given type into out, which is always
+ * NUL terminated, CODEC_FORMAT_SIZE(size) bytes is always enough.
+ * Returns the length of the text, or -1 if out is too small.
+ */
+int64_t codec_format(ULONG type, const void *data, uint32_t size, char *out, uint64_t out_size);
+
+/*
+ * Convert the text form of a type into its data, which is only written
+ * when out_size is large enough to hold all of it.
+ * Returns the size of the data, or -1 if the text is malformed.
+ */
+int64_t codec_parse(ULONG type, const char *text, void *out, uint32_t out_size);
+
+#endif
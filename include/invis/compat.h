@@ -0,0 +1,117 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _COMPAT_H_
+#define _COMPAT_H_
+
+/*
+ * Everything outside of Windows builds against the in-memory registry from
+ * memreg.c, which stands in for both the Win32 and the internals functions.
+ * Only the subset of windows.h used by this project is provided, and names
+ * are UTF-16LE everywhere, so those builds need -fshort-wchar.
+ */
+#ifdef _WIN32
+
+#include <windows.h>
+
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(sizeof(wchar_t) == 2, "wchar_t must be UTF-16, build with -fshort-wchar");
+
+typedef void *HANDLE, **PHANDLE, *PVOID, *LPVOID;
+typedef struct HKEY__ *HKEY, **PHKEY;
+
+typedef int BOOL;
+typedef int32_t LONG;
+typedef LONG NTSTATUS;
+typedef uint32_t ULONG, *PULONG, DWORD, *LPDWORD, ACCESS_MASK, REGSAM, UINT;
+typedef uint16_t USHORT;
+typedef wchar_t WCHAR, *PWSTR, *LPWSTR;
+typedef const wchar_t *LPCWSTR;
+typedef char *LPSTR;
+typedef const char *LPCSTR;
+
+typedef union _LARGE_INTEGER
+{
+	struct
+	{
+		DWORD LowPart;
+		LONG HighPart;
+	};
+	int64_t QuadPart;
+} LARGE_INTEGER;
+
+#define HKEY_CLASSES_ROOT				((HKEY) (intptr_t) (int32_t) 0x80000000)
+#define HKEY_CURRENT_USER				((HKEY) (intptr_t) (int32_t) 0x80000001)
+#define HKEY_LOCAL_MACHINE				((HKEY) (intptr_t) (int32_t) 0x80000002)
+#define HKEY_USERS						((HKEY) (intptr_t) (int32_t) 0x80000003)
+#define HKEY_CURRENT_CONFIG				((HKEY) (intptr_t) (int32_t) 0x80000005)
+
+#define REG_NONE						0
+#define REG_SZ							1
+#define REG_EXPAND_SZ					2
+#define REG_BINARY						3
+#define REG_DWORD						4
+#define REG_DWORD_BIG_ENDIAN			5
+#define REG_LINK						6
+#define REG_MULTI_SZ					7
+#define REG_RESOURCE_LIST				8
+#define REG_FULL_RESOURCE_DESCRIPTOR	9
+#define REG_RESOURCE_REQUIREMENTS_LIST	10
+#define REG_QWORD						11
+
+#define REG_OPTION_NON_VOLATILE			0
+#define REG_CREATED_NEW_KEY				1
+#define REG_OPENED_EXISTING_KEY			2
+
+#define KEY_SET_VALUE					0x00002
+#define KEY_READ						0x20019
+#define KEY_ALL_ACCESS					0xF003F
+
+#define ERROR_SUCCESS					0
+#define ERROR_FILE_NOT_FOUND			2
+#define ERROR_ACCESS_DENIED				5
+
+#define CP_OEMCP						1
+#define CP_UTF8							65001
+
+#define STATUS_INVALID_HANDLE			0xC0000008
+#define STATUS_INVALID_PARAMETER		0xC000000D
+
+#define MAX_COMPUTERNAME_LENGTH			15
+
+// memreg.c
+LONG RegOpenKeyExA(HKEY hive, LPCSTR path, DWORD options, REGSAM access, PHKEY key);
+LONG RegOpenKeyExW(HKEY hive, LPCWSTR path, DWORD options, REGSAM access, PHKEY key);
+LONG RegCreateKeyExW(HKEY hive, LPCWSTR path, DWORD reserved, LPWSTR class, DWORD options,
+					 REGSAM access, void *security, PHKEY key, LPDWORD disposition);
+LONG RegOpenCurrentUser(REGSAM access, PHKEY key);
+LONG RegCloseKey(HKEY key);
+
+// compat.c
+int MultiByteToWideChar(UINT code_page, DWORD flags, LPCSTR str, int len, LPWSTR out, int out_len);
+BOOL GetComputerNameA(LPSTR name, LPDWORD size);
+
+#endif
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GLOB_H_
+#define _GLOB_H_
+
+#include <stdint.h>
+#include <invis/compat.h>
+
+#include <invis/reg.h>
+
+// Segments after the literal prefix, ** counts as one
+#define GLOB_MAX_SEGMENTS	63
+
+/*
+ * Called once for every key that matched, in sorted order within each
+ * depth. key is opened with the access given to glob_keys() and is closed
+ * once the call returns. path is the counted UTF-16LE path of the key
+ * relative to the hive, path_size is in bytes.
+ * Returning non-zero stops the expansion, and glob_keys() returns that value.
+ */
+typedef int (*glob_cb_t)(void          *ctx,
+						 HANDLE         key,
+						 const wchar_t *path,
+						 uint32_t       path_size);
+
+/*
+ * Expand a key path pattern. Each segment between backslashes may use
+ * * and ? to match within a single key name, or be ** to match any number
+ * of keys. Names are compared without regard to ASCII case.
+ * The literal prefix is opened directly, and literal segments after a
+ * wildcard are opened rather than enumerated. The keys of each depth are
+ * enumerated by up to threads threads (0 for one per processor), a batch at
+ * a time with every key opened relative to the prefix, so only a batch of
+ * keys is open however wide the depth gets.
+ */
+int glob_keys(HKEY         hive,
+			  const char  *pattern,
+			  ACCESS_MASK  access,
+			  uint32_t     threads,
+			  glob_cb_t    cb,
+			  void        *ctx);
+
+// Match a single counted name against a single segment, sizes are in bytes
+int8_t glob_match(const wchar_t *pattern,
+				  uint32_t       pattern_size,
+				  const wchar_t *name,
+				  uint32_t       name_size);
+
+/*
+ * Bytes taken up by a key path and the backslash after it at the start of
+ * a value name, as reg() names values, or 0 when the name doesn't start
+ * with them. Sizes are in bytes and the path is compared without case.
+ */
+uint32_t glob_prefix(const wchar_t *path,
+					 uint32_t       path_size,
+					 const wchar_t *name,
+					 uint32_t       name_size);
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fast non-cryptographic 64-bit hash, 16 bytes per 64x64->128 multiply.
+ * Only suitable for tables and deduplication, not for anything that an
+ * attacker could benefit from colliding.
+ */
+uint64_t hash64(const void *data, size_t size, uint64_t seed);
+
+#define SHA256_SIZE	32
+
+struct sha256_t
+{
+	uint32_t state[8];
+	uint64_t size;		// Bytes hashed so far
+	uint8_t block[64];
+};
+
+// FIPS 180-4 SHA-256, for matching data against published hashes
+void sha256_init(struct sha256_t *s);
+void sha256_update(struct sha256_t *s, const void *data, size_t size);
+void sha256_final(struct sha256_t *s, uint8_t digest[SHA256_SIZE]);
+
+// The same in one call
+void sha256(const void *data, size_t size, uint8_t digest[SHA256_SIZE]);
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HIVE_H_
+#define _HIVE_H_
+
+#include <stdint.h>
+#include <invis/compat.h>
+
+#include <invis/reg.h>
+#include <invis/sweep.h>
+
+/*
+ * Hive file layout, all integers are little endian:
+ *  struct hive_base_t, padded to HIVE_BLOCK_SIZE
+ *  Hive bins, each a struct hive_bin_t followed by cells
+ * A cell is an int32 size, negative while it is allocated, followed by the
+ * cell data. Cells reference each other by their offset from the first
+ * hive bin, HIVE_NO_CELL for none.
+ */
+#define HIVE_BASE_MAGIC		"regf"
+#define HIVE_BIN_MAGIC		"hbin"
+#define HIVE_BLOCK_SIZE		4096
+#define HIVE_NO_CELL		0xFFFFFFFF
+
+// The registry allows no deeper keys than this
+#define HIVE_MAX_DEPTH		512
+
+// struct hive_nk_t flags
+#define HIVE_KEY_ROOT		0x0004	// The root key of the hive
+#define HIVE_KEY_ASCII		0x0020	// Name is stored one byte per character
+
+// struct hive_vk_t flags
+#define HIVE_VALUE_ASCII	0x0001
+
+// Set in hive_vk_t.size when the data is stored in hive_vk_t.data itself
+#define HIVE_DATA_INLINE	0x80000000
+// Larger data is split into segments behind a "db" cell from version 1.4 on
+#define HIVE_DATA_SEGMENT	16344
+
+struct hive_base_t
+{
+	char magic[4];
+	uint32_t sequence1;
+	uint32_t sequence2;	// Differs from sequence1 while a write is in progress
+	uint32_t last_write[2];
+	uint32_t major;
+	uint32_t minor;
+	uint32_t type;
+	uint32_t format;
+	uint32_t root;		// Offset of the root key cell
+	uint32_t size;		// Size of the hive bins
+	uint32_t clustering;
+	uint16_t name[32];	// End of the path of the file, NUL padded
+};
+
+struct hive_bin_t
+{
+	char magic[4];
+	uint32_t offset;	// Of this bin from the first one
+	uint32_t size;		// Multiple of HIVE_BLOCK_SIZE
+	uint32_t reserved[2];
+	uint32_t timestamp[2];
+	uint32_t spare;
+};
+
+struct hive_nk_t
+{
+	char magic[2];		// "nk"
+	uint16_t flags;
+	uint32_t last_write[2];
+	uint32_t access;
+	uint32_t parent;
+	uint32_t subkeys;
+	uint32_t volatile_subkeys;
+	uint32_t subkey_list;
+	uint32_t volatile_subkey_list;
+	uint32_t values;
+	uint32_t value_list;
+	uint32_t security;
+	uint32_t class_name;
+	uint32_t max_name;
+	uint32_t max_class;
+	uint32_t max_value_name;
+	uint32_t max_value_data;
+	uint32_t work;
+	uint16_t name_size;
+	uint16_t class_size;
+	uint8_t name[];
+};
+
+struct hive_vk_t
+{
+	char magic[2];		// "vk"
+	uint16_t name_size;	// 0 for the default value
+	uint32_t size;
+	uint32_t data;		// Offset of the data cell, or the data with HIVE_DATA_INLINE
+	uint32_t type;
+	uint16_t flags;
+	uint16_t spare;
+	uint8_t name[];
+};
+
+// "lf" and "lh" lists hold an offset and a hash of the name per subkey, "li" and "ri" only offsets
+struct hive_list_t
+{
+	char magic[2];
+	uint16_t count;
+	uint32_t offsets[];
+};
+
+// "db" cells point at a list of the offsets of the data segments
+struct hive_db_t
+{
+	char magic[2];
+	uint16_t count;
+	uint32_t list;
+};
+
+struct hive_t
+{
+	const uint8_t *bins;
+	uint64_t size;		// Size of the bins
+	uint32_t root;
+	uint32_t minor;
+
+	// The hive is either a mapped file or owned heap memory
+	uint8_t *base;
+	uint64_t base_size;
+	HANDLE file;
+	HANDLE mapping;
+	uint8_t *owned;
+
+	// Names and data that don't appear as-is in the hive
+	wchar_t *name;
+	uint32_t name_max;
+	uint8_t *data;
+	uint32_t data_max;
+	wchar_t *path;
+	uint32_t path_max;
+};
+
+struct hive_slack_t
+{
+	uint32_t offset;	// Of the cell that was found
+	uint8_t key;		// A deleted key rather than a deleted value
+	uint8_t intact;		// All of the data of a value was still in free cells
+
+	// For keys, the path of the key through its parents as far as they can still be found
+	const wchar_t *path;
+	uint32_t path_size;
+
+	// For keys, only the name and anomalies are set
+	struct key_data_t entry;
+};
+
+// Returning non-zero stops the scan, and hive_slack() returns that value
+typedef int (*hive_slack_cb_t)(void *ctx, struct hive_slack_t *found);
+
+// Map a hive file, the base block has to be intact
+int hive_open(struct hive_t *h, const char *file);
+
+// Take ownership of hive bins that were put back together in memory
+int hive_load(struct hive_t  *h,
+			  uint8_t        *bins,
+			  uint64_t        size,
+			  uint32_t        root,
+			  uint32_t        minor);
+
+void hive_close(struct hive_t *h);
+
+// Data of an allocated cell and its size, or 0 if it isn't wholly within the bins
+const uint8_t *hive_cell(struct hive_t *h, uint32_t offset, uint32_t *size);
+
+/*
+ * Decode a vk cell into entry the same way sweep() would have enumerated
+ * it, anomalies included. The name and value point into the hive or into
+ * buffers of h, and are only valid until the next call.
+ * Returns non-zero if the cell isn't a valid vk cell.
+ */
+int hive_value(struct hive_t *h, const uint8_t *cell, uint32_t size, struct key_data_t *entry);
+
+/*
+ * Walk every key and value under the root key, calling cb exactly like
+ * sweep() with SWEEP_RECURSIVE does, with paths relative to the root.
+ * Cells that are missing or corrupt are skipped rather than failing the
+ * walk, so that carved and damaged hives give up as much as they can.
+ */
+int hive_sweep(struct hive_t *h, sweep_cb_t cb, void *ctx);
+
+// The same, with checkpoints like sweep_checkpoint()
+int hive_sweep_checkpoint(struct hive_t *h, sweep_cb_t cb, void *ctx, struct checkpoint_t *cp);
+
+/*
+ * Recover deleted keys and values from the free cells of every bin.
+ * Freed cells keep their contents until they are reused, and neighbouring
+ * free cells are merged, so each free cell is searched for the vk and nk
+ * records of the cells that used to be there. Records are only believed
+ * when their old cell size, names and offsets all fit. Allocated cells are
+ * stepped over by their size, so this costs a single pass over the bins.
+ * found, and everything it points to, is only valid for the duration of
+ * the call.
+ */
+int hive_slack(struct hive_t *h, hive_slack_cb_t cb, void *ctx);
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _INTERN_H_
+#define _INTERN_H_
+
+#include <stdint.h>
+#include <invis/compat.h>
+
+// The empty path that every other path is under
+#define INTERN_ROOT	0
+
+// Returned by intern_find() for a path that was never interned
+#define INTERN_NONE	0xFFFFFFFF
+
+/*
+ * Key paths interned as a tree, where each path is its last name under the
+ * id of its parent. A parent shared by any number of paths is stored once,
+ * and every path costs one node plus its last name. Names are counted
+ * UTF-16, so embedded NULs are kept, and compare without regard to ASCII
+ * case like the registry, keeping the first spelling that was seen.
+ * Ids are handed out in order from INTERN_ROOT, so a parent always has a
+ * lower id than its children.
+ */
+struct intern_node_t
+{
+	uint64_t hash;		// intern_hash() of the name, seeded with the parent
+	uint32_t parent;
+	uint32_t offset;	// Of the name in the pool, in characters
+	uint32_t size;		// Of the name in bytes
+	uint32_t path_size;	// Of the whole path in bytes
+};
+
+struct intern_t
+{
+	struct intern_node_t *nodes;
+	uint32_t num_nodes;
+	uint32_t max_nodes;
+
+	uint32_t *table;	// ids + 1
+	uint32_t table_size;
+
+	wchar_t *pool;
+	uint32_t pool_len;	// In characters
+	uint32_t pool_max;
+};
+
+static inline uint16_t intern_lower(uint16_t c)
+{
+	return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+/*
+ * Case insensitive hash and comparison of counted UTF-16 names, ASCII is
+ * folded 8 characters at a time where SSE2 is available.
+ */
+uint64_t intern_hash(const wchar_t *name, uint32_t size, uint64_t seed);
+uint8_t intern_equal(const wchar_t *a, const wchar_t *b, uint32_t size);
+
+int intern_init(struct intern_t *in);
+void intern_free(struct intern_t *in);
+
+// Id of a path of names separated by backslashes under parent, interning whatever part of it is new
+int intern_path(struct intern_t *in, uint32_t parent, const wchar_t *path, uint32_t size, uint32_t *id);
+
+// Id of a path under parent without interning it, or INTERN_NONE
+uint32_t intern_find(const struct intern_t *in, uint32_t parent, const wchar_t *path, uint32_t size);
+
+// Size in bytes of the whole path of an id, and the path itself written to out
+uint32_t intern_size(const struct intern_t *in, uint32_t id);
+void intern_copy(const struct intern_t *in, uint32_t id, wchar_t *out);
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IOC_H_
+#define _IOC_H_
+
+#include <stdint.h>
+
+#include <invis/hash.h>
+
+// What an IOC matched on
+#define IOC_FAST	(1<<0)	// hash64() of the data, with a seed of 0 like the hashes in snapshots
+#define IOC_SHA256	(1<<1)
+
+/*
+ * A set of hashes of known bad value data, loaded once and then only read.
+ * Each kind is kept as a dense array and an open addressed table of ids + 1
+ * into it, probed from the low bits of the hash itself.
+ */
+struct ioc_t
+{
+	uint64_t *fast;
+	uint32_t num_fast;
+	uint32_t *fast_table;
+	uint32_t fast_size;
+
+	uint8_t (*strong)[SHA256_SIZE];
+	uint32_t num_strong;
+	uint32_t *strong_table;
+	uint32_t strong_size;
+};
+
+struct ioc_match_t
+{
+	uint8_t kind;		// IOC_* of the hash that matched, 0 for none
+	uint64_t fast;
+	uint8_t sha256[SHA256_SIZE];
+};
+
+/*
+ * Load a file with one hash per line in hex, 16 digits for a hash64() and
+ * 64 for a SHA-256. Anything after the hash is ignored, as are empty lines
+ * and lines starting with '#'.
+ */
+int ioc_load(struct ioc_t *ioc, const char *file);
+
+void ioc_free(struct ioc_t *ioc);
+
+/*
+ * Hash the data where it is and look it up, only computing a SHA-256 when
+ * the set has any. Returns the IOC_* that matched, or 0, and m holds the
+ * hashes either way.
+ */
+uint8_t ioc_match(const struct ioc_t *ioc, const void *data, uint32_t size, struct ioc_match_t *m);
+
+#endif
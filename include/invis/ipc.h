@@ -0,0 +1,172 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IPC_H_
+#define _IPC_H_
+
+#include <stdint.h>
+#include <invis/compat.h>
+
+#include <invis/reg.h>
+
+/*
+ * Every message is an ipc_header_t followed by size bytes of payload, all
+ * little endian. Requests carry an id chosen by the client that is echoed
+ * in the reply, and a connection may have any number of requests in
+ * flight: replies come back in the order the requests were sent.
+ *
+ * IPC_REG payload:
+ *  struct ipc_request_t
+ *  path        UTF-16LE, counted, relative to the hive, ending in the value name.
+ *              The value is named by the whole path, like with reg()
+ *  value       size bytes
+ *
+ * IPC_REPLY payload:
+ *  struct ipc_reply_t
+ *  count times:
+ *   struct ipc_entry_t
+ *   name       UTF-16LE, counted, including the leading NUL of invisible names
+ *   value      size bytes
+ */
+
+#define IPC_REG		1	// reg() on a single value
+#define IPC_REPLY	2
+
+// Anything larger is treated as a broken stream
+#define IPC_MAX_MESSAGE	(64 << 20)
+
+struct ipc_header_t
+{
+	uint32_t size;
+	uint32_t id;
+	uint8_t op;
+	uint8_t operation;	// OPERATION_* and MAKE_VISIBLE for IPC_REG
+	uint16_t reserved;
+};
+
+struct ipc_request_t
+{
+	uint32_t hive;		// Low 32 bits of the predefined HKEY
+	uint32_t type;
+	uint32_t path_size;
+	uint32_t value_size;
+};
+
+struct ipc_reply_t
+{
+	int32_t status;		// What reg() returned
+	int32_t error;		// errno when status is non-zero
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct ipc_entry_t
+{
+	uint32_t type;
+	uint32_t anomalies;
+	uint32_t name_size;
+	uint32_t size;
+};
+
+// A connection, with buffering in both directions
+struct ipc_t
+{
+#ifdef _WIN32
+	HANDLE pipe;
+	uint8_t server;
+#else
+	int fd;
+#endif
+
+	uint8_t *in;
+	uint32_t in_len;
+	uint32_t in_pos;
+	uint32_t in_max;
+
+	uint8_t *out;
+	uint32_t out_len;
+	uint32_t out_max;
+};
+
+struct ipc_listener_t
+{
+#ifdef _WIN32
+	char *name;
+	HANDLE next;	// The instance the next client connects to
+#else
+	int fd;
+#endif
+};
+
+/*
+ * name is a named pipe on Windows, \\.\pipe\ is added unless it's already
+ * there, and the path of a Unix domain socket everywhere else.
+ * ipc_listen() fails when another server already answers on the name, and
+ * outside of Windows when the path is anything but a stale socket.
+ */
+int ipc_listen(struct ipc_listener_t *l, const char *name);
+int ipc_accept(struct ipc_listener_t *l, struct ipc_t *c);
+void ipc_unlisten(struct ipc_listener_t *l);
+
+int ipc_connect(struct ipc_t *c, const char *name);
+void ipc_close(struct ipc_t *c);
+
+/*
+ * Queue bytes to be sent, they are only written once the buffer is full,
+ * on ipc_flush(), or when ipc_recv() would otherwise wait.
+ */
+int ipc_write(struct ipc_t *c, const void *data, uint32_t size);
+int ipc_flush(struct ipc_t *c);
+
+/*
+ * Read the next message. payload points into the connection buffer and is
+ * only valid until the next call. Returns 1 once the other side has
+ * closed the connection between messages.
+ */
+int ipc_recv(struct ipc_t *c, struct ipc_header_t *h, uint8_t **payload);
+
+/*
+ * Client side of IPC_REG, with the same arguments as reg().
+ * ipc_reg_send() only queues the request, so that many can be in flight,
+ * and ipc_reg_recv() reads the next reply. ipc_reg() does both.
+ */
+int ipc_reg_send(struct ipc_t *c,
+				 uint32_t      id,
+				 int8_t        operation,
+				 HKEY          hive,
+				 const char   *path,
+				 ULONG         type,
+				 void         *value,
+				 uint32_t      size);
+
+int ipc_reg_recv(struct ipc_t       *c,
+				 uint32_t           *id,
+				 struct key_data_t **key_data,
+				 uint64_t           *num_keys);
+
+int ipc_reg(struct ipc_t       *c,
+			int8_t              operation,
+			HKEY                hive,
+			const char         *path,
+			ULONG               type,
+			void               *value,
+			uint32_t            size,
+			struct key_data_t **key_data,
+			uint64_t           *num_keys);
+
+#endif
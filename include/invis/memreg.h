@@ -0,0 +1,43 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MEMREG_H_
+#define _MEMREG_H_
+
+#include <stdint.h>
+#include <invis/compat.h>
+
+/*
+ * An in-memory registry behind the same internals and Win32 functions as
+ * the real one, so that everything above it, the server included, can be
+ * run and tested away from Windows. Keys are case-insensitive counted
+ * names like the real registry, and invisible names behave the same.
+ * Every call takes a single lock, which is all a stand-in needs.
+ */
+
+// Point the internals functions at the in-memory registry, called by init_ntdll()
+void memreg_init(void);
+
+/*
+ * Make every enumeration call take usec microseconds, outside of the lock,
+ * and proportionally longer once more than capacity calls are in flight,
+ * the way a busy host slows down. 0 turns it off again.
+ */
+void memreg_latency(uint32_t usec, uint32_t capacity);
+
+#endif
@@ -19,7 +19,7 @@
 #ifndef _NTDLL_H_
 #define _NTDLL_H_
 
-#include <windows.h>
+#include <invis/compat.h>
 
 typedef struct _UNICODE_STRING {
 	USHORT Length;
@@ -36,6 +36,13 @@ typedef struct _OBJECT_ATTRIBUTES {
 	PVOID SecurityQualityOfService;
 } OBJECT_ATTRIBUTES, * POBJECT_ATTRIBUTES;
 
+typedef struct _KEY_BASIC_INFORMATION {
+	LARGE_INTEGER LastWriteTime;
+	ULONG TitleIndex;
+	ULONG NameLength;
+	WCHAR Name[1];
+} KEY_BASIC_INFORMATION, * PKEY_BASIC_INFORMATION;
+
 typedef struct _KEY_VALUE_FULL_INFORMATION {
 	ULONG TitleIndex;
 	ULONG Type;
@@ -45,32 +52,48 @@ typedef struct _KEY_VALUE_FULL_INFORMATION {
 	WCHAR Name[1];
 } KEY_VALUE_FULL_INFORMATION, * PKEY_VALUE_FULL_INFORMATION;
 
+typedef struct _KEY_NAME_INFORMATION {
+	ULONG NameLength;
+	WCHAR Name[1];
+} KEY_NAME_INFORMATION, * PKEY_NAME_INFORMATION;
+
 #define OBJ_KERNEL_HANDLE				0x00000200
 
+// KEY_INFORMATION_CLASS and KEY_VALUE_INFORMATION_CLASS
+#define KeyBasicInformation				0
+#define KeyValueFullInformation			1
+#define KeyNameInformation				3
+
 #define STATUS_SUCCESS					0x00000000
 #define STATUS_BUFFER_OVERFLOW			0x80000005
 #define STATUS_NO_MORE_ENTRIES			0x8000001A
 #define STATUS_ACCESS_DENIED			0xC0000022
 #define STATUS_BUFFER_TOO_SMALL			0xC0000023
 #define STATUS_OBJECT_NAME_NOT_FOUND	0xC0000034
+#define STATUS_INSUFFICIENT_RESOURCES	0xC000009A
 #define STATUS_CANNOT_DELETE			0xC0000121
+#define STATUS_KEY_DELETED				0xC000017C
 
 // Internals function declarations
 typedef NTSTATUS (*_NtCreateKey)(PHANDLE, ACCESS_MASK, POBJECT_ATTRIBUTES, ULONG, PUNICODE_STRING, ULONG, PULONG);
+typedef NTSTATUS (*_NtOpenKey)(PHANDLE, ACCESS_MASK, POBJECT_ATTRIBUTES);
 typedef NTSTATUS (*_NtSetValueKey)(HANDLE, PUNICODE_STRING, ULONG, ULONG, PVOID, ULONG);
 typedef NTSTATUS (*_NtDeleteKey)(HANDLE);
 typedef NTSTATUS (*_NtDeleteValueKey)(HANDLE, PUNICODE_STRING);
 typedef NTSTATUS (*_NtQueryKey)(HANDLE, ULONG, PVOID, ULONG, PULONG);
+typedef NTSTATUS (*_NtEnumerateKey)(HANDLE, ULONG, ULONG, PVOID, ULONG, PULONG);
 typedef NTSTATUS (*_NtQueryValueKey)(HANDLE, PUNICODE_STRING, ULONG, PVOID, ULONG, PULONG);
 typedef NTSTATUS (*_NtEnumerateValueKey)(HANDLE, ULONG, ULONG, PVOID, ULONG, PULONG);
 typedef NTSTATUS (*_NtClose)(HANDLE);
 
 // Internals functions
 extern _NtCreateKey         NtCreateKey;
+extern _NtOpenKey           NtOpenKey;
 extern _NtSetValueKey       NtSetValueKey;
 extern _NtDeleteKey         NtDeleteKey;
 extern _NtDeleteValueKey    NtDeleteValueKey;
 extern _NtQueryKey          NtQueryKey;
+extern _NtEnumerateKey      NtEnumerateKey;
 extern _NtQueryValueKey     NtQueryValueKey;
 extern _NtEnumerateValueKey NtEnumerateValueKey;
 extern _NtClose             NtClose;
@@ -0,0 +1,121 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stdint.h>
+#include <invis/compat.h>
+
+#include <invis/ioc.h>
+#include <invis/reg.h>
+#include <invis/ring.h>
+#include <invis/thread.h>
+
+// Stages after enumeration, each on a thread of its own
+#define PIPELINE_STAGES		3
+
+// Of each ring between two stages
+#define PIPELINE_RING_SIZE	(256 * 1024)
+
+// Kinds of item
+#define PIPELINE_KEY		1
+#define PIPELINE_VALUE		2
+
+/*
+ * A key, followed by an item for each of its values. Items pass through
+ * the stages in the order they were enumerated in, and only point into the
+ * ring they came from, so they are valid for the duration of the call.
+ */
+struct pipeline_item_t
+{
+	uint8_t kind;
+	const wchar_t *path;		// Of the key, or of the key the value is in
+	uint32_t path_size;
+	struct key_data_t entry;	// Of a value, a key only has the anomalies of its own name
+	struct ioc_match_t ioc;		// For whichever stage matches IOCs
+};
+
+/*
+ * Returns 1 to pass the item on to the next stage, 0 to drop it, or
+ * negative to stop the pipeline, which pipeline_finish() then returns.
+ */
+typedef int (*pipeline_cb_t)(void *ctx, struct pipeline_item_t *item);
+
+struct pipeline_stage_t
+{
+	const char *name;
+	pipeline_cb_t cb;
+	void *ctx;
+};
+
+struct pipeline_worker_t
+{
+	struct pipeline_t *p;
+	struct pipeline_stage_t stage;
+	struct ring_t *in;
+	struct ring_t *out;		// 0 for the last stage
+	struct thread_t thread;
+	uint8_t started;
+
+	// The key values are in, which outlives the record it came in
+	wchar_t *path;
+	uint32_t path_size;
+	uint32_t path_max;
+
+	int r;
+	int err;
+};
+
+struct pipeline_t
+{
+	struct ring_t rings[PIPELINE_STAGES];
+	struct pipeline_worker_t workers[PIPELINE_STAGES];
+	uint8_t stop;	// Set once a stage fails, everything after is dropped
+};
+
+struct pipeline_stats_t
+{
+	const char *name;
+	uint64_t records;	// Taken from the ring in front of it, or put in the one after it by enumeration
+	uint64_t starved;	// Times it waited on an empty ring in front of it
+	uint64_t blocked;	// Times it waited on a full ring after it
+	uint32_t occupancy;	// Average fill of the ring in front of it, in tenths of a percent
+	uint32_t peak;
+};
+
+/*
+ * Start a thread for each of the PIPELINE_STAGES stages, fed by the calling
+ * thread with pipeline_key() and pipeline_value() from its enumeration.
+ */
+int pipeline_start(struct pipeline_t *p, const struct pipeline_stage_t *stages);
+
+// Copy an item into the first ring, failing once a stage has
+int pipeline_key(struct pipeline_t *p, const wchar_t *path, uint32_t path_size);
+int pipeline_value(struct pipeline_t *p, const struct key_data_t *entry);
+
+// A sweep_cb_t that does either, with ctx being the pipeline
+int pipeline_sweep_cb(void *ctx, const wchar_t *path, uint32_t path_size, struct key_data_t *entry);
+
+// Wait for every item to pass through, returns the error of the first stage to fail
+int pipeline_finish(struct pipeline_t *p);
+
+// Enumeration followed by each stage, once finished
+void pipeline_stats(struct pipeline_t *p, struct pipeline_stats_t stats[PIPELINE_STAGES + 1]);
+
+#endif
@@ -20,9 +20,11 @@
 #define _REG_H_
 
 #include <stdint.h>
-#include <windows.h>
+#include <invis/compat.h>
 #include <error.h>
 
+#include <invis/classify.h>
+
 #define OPERATION_CREATE	0
 #define OPERATION_EDIT   	0
 #define OPERATION_DELETE 	1
@@ -35,11 +37,12 @@
 struct key_data_t
 {
 	ULONG type;
-	wchar_t *name;
+	wchar_t *name;		// Full counted name, always followed by a terminating NUL
+	uint32_t name_size;	// Size of the name in bytes, without the terminating NUL
 	void *value;
 	uint32_t size;
 
-	int8_t invis;
+	uint32_t anomalies;	// ANOMALY_* flags from classify_name()
 };
 
 /*
@@ -47,9 +50,15 @@ struct key_data_t
  *  On create/edit: type, value, and size are input variables and are required.
  *                  key_data and num_keys are always ignored
  *  On delete/query: type, value, and size are ignored
- *  On query: key_data and num_keys are outputs
+ *  On query: key_data and num_keys are outputs, and a path that isn't a
+ *            value, or has no key above it, lists the values of the key
+ *            at that path instead
  * For keys (MAKE_KEY):
- *  type, value, and size are all ignored
+ *  type, value, and size are all ignored, and the key is created or
+ *  deleted with reg_tree(). Only the last key of the path is invisible.
+ *  On delete: the key is removed along with all of its subkeys, where it
+ *             used to fail with STATUS_CANNOT_DELETE if it had any
+ *  On query: fails with EINVAL, as keys have no data of their own
  */
 int reg(int8_t              operation,
 		HKEY                hive,
@@ -60,6 +69,59 @@ int reg(int8_t              operation,
 		struct key_data_t **key_data,
 		uint64_t           *num_keys);
 
+/*
+ * The same as reg() for a single value of an already open key.
+ * name is counted and does not include the leading NUL, which is added
+ * unless MAKE_VISIBLE is set. A query only returns that value.
+ * reg() names a value by its whole path relative to the hive, which is
+ * what name has to be to reach the same value.
+ */
+int reg_at(int8_t              operation,
+		   HANDLE              key,
+		   const wchar_t      *name,
+		   uint32_t            name_size,
+		   ULONG               type,
+		   void               *value,
+		   uint32_t            size,
+		   struct key_data_t **key_data,
+		   uint64_t           *num_keys);
+
+// Every value of an already open key, like a query of a key with reg()
+int reg_values(HANDLE key, struct key_data_t **key_data, uint64_t *num_keys);
+
+/*
+ * Create or delete a chain of keys with a single walk down a counted path.
+ * Each key is opened relative to the one above it with RootDirectory, so
+ * no level is ever resolved from the root again, and components may hold
+ * NULs to be invisible.
+ *  On create: every missing key along the path is created, count is set
+ *             to the number that did not exist yet
+ *  On delete: the key at the end of the path is deleted along with all of
+ *             its subkeys, bottom-up, count is set to the number deleted
+ * The status of every level is checked, and the walk stops at the first
+ * one that fails.
+ */
+int reg_tree(int8_t         operation,
+			 HKEY           hive,
+			 const wchar_t *path,
+			 uint32_t       path_size,
+			 uint32_t      *count);
+
 void free_key_data(struct key_data_t *key_data, uint64_t num_keys);
 
+/*
+ * Look up a hive by its short (HKLM) or full (HKEY_LOCAL_MACHINE) name.
+ * name does not need to be NUL terminated. Returns 0 for unknown hives.
+ */
+HKEY reg_hive(const char *name, size_t len);
+
+// Full name of a hive, or 0 for unknown hives
+const char *reg_hive_name(HKEY hive);
+
+// Open a real handle to the root of a hive, which unlike the predefined handles can be enumerated
+int reg_root(HKEY hive, ACCESS_MASK access, HANDLE *root);
+
+// Map an NTSTATUS onto errno, returns 0 on success and -4 on failure like reg()
+int reg_status(NTSTATUS status);
+
 #endif
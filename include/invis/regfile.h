@@ -0,0 +1,69 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _REGFILE_H_
+#define _REGFILE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <invis/compat.h>
+
+#include <invis/checkpoint.h>
+
+#define REG_ESCAPE_NAME	0
+#define REG_ESCAPE_KEY	(1<<0)
+
+// Worst case size of an escaped name of size bytes, including the terminating NUL
+#define REG_ESCAPE_SIZE(size) ((size) / 2 * 7 + 1)
+
+/*
+ * Escaping of counted UTF-16LE names into UTF-8, so that names survive a
+ * round trip through a .reg file:
+ *  Value names and strings: \0 is a NUL, \xHHHH is any other control
+ *                           character, \\ and \" as in regedit
+ *  Key paths (REG_ESCAPE_KEY): the same escapes with a doubled backslash,
+ *                              \\0 and \\xHHHH, as a single backslash is
+ *                              the path separator and keys can't be empty
+ * out must hold REG_ESCAPE_SIZE(size) bytes, and is always NUL terminated.
+ * Returns the length of the escaped name.
+ */
+size_t reg_escape(const wchar_t *name, uint32_t size, char *out, uint8_t flags);
+
+/*
+ * The reverse of reg_escape(), len is the length of the escaped UTF-8
+ * name and out must hold len characters.
+ * Returns the size of the name in bytes, or -1 if it is malformed.
+ */
+int64_t reg_unescape(const char *name, size_t len, wchar_t *out, uint8_t flags);
+
+/*
+ * Write the key at path and all of its subkeys as a .reg file.
+ * With cp, checkpoints are written as it goes, and a checkpoint loaded
+ * into it is carried on from at the end of f, which has to have been cut
+ * back to the offset of the checkpoint already.
+ */
+int reg_export(HKEY hive, char *path, FILE *f, struct checkpoint_t *cp);
+
+/*
+ * Create the keys and values of a .reg file, either UTF-16LE with a BOM
+ * as written by regedit or UTF-8 as written by reg_export().
+ * On failure line is set to the line number that failed.
+ */
+int reg_import(FILE *f, uint64_t *line);
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <stdint.h>
+
+// Keeps what each side writes on its own cache line
+#define RING_LINE	64
+
+// Records each side handles before the other side is told about them
+#define RING_BATCH	32
+
+// Size of the marker left where a record did not fit before the end
+#define RING_WRAP	UINT64_MAX
+
+/*
+ * A bounded queue of variable sized records between exactly one producer
+ * thread and one consumer thread, without locks.
+ * Positions only ever grow and are masked into the buffer, whose size is a
+ * power of two. Each record is a uint64_t size followed by the record padded
+ * to 8 bytes, and never wraps: a size of RING_WRAP sends the consumer back
+ * to the start of the buffer.
+ * The producer publishes its records in batches and the consumer frees
+ * them in batches, so each side only touches the other's cache line about
+ * once per RING_BATCH records. A full ring makes the producer wait, and an
+ * empty one the consumer, spinning briefly before yielding and sleeping.
+ */
+struct ring_t
+{
+	uint8_t *buf;
+	uint64_t size;
+
+	// Written by the producer
+	uint8_t pad0[RING_LINE];
+	uint64_t head;		// End of the published records
+	uint8_t closed;		// Nothing more will be published
+	uint8_t pad1[RING_LINE];
+
+	// Written by the consumer
+	uint64_t tail;		// End of the freed records
+	uint8_t pad2[RING_LINE];
+
+	// Only used by the producer
+	uint64_t write;
+	uint64_t pending;	// Size of the record last reserved
+	uint64_t tail_cache;
+	uint32_t unpublished;
+	uint64_t blocked;	// Times it waited on a full ring
+	uint8_t pad3[RING_LINE];
+
+	// Only used by the consumer
+	uint64_t read;
+	uint64_t current;	// Size of the record last peeked at
+	uint64_t head_cache;
+	uint32_t unfreed;
+	uint64_t starved;	// Times it waited on an empty ring
+	uint64_t records;
+	uint64_t samples;	// Bytes in use each time the consumer looked at head
+	uint64_t used;
+	uint64_t peak;
+};
+
+// size is rounded up to a power of two
+int ring_init(struct ring_t *r, uint64_t size);
+void ring_free(struct ring_t *r);
+
+// Largest record that fits, anything larger has to be passed another way
+uint64_t ring_max_record(struct ring_t *r);
+
+// Room for a record of size bytes, which is waited for while the ring is full
+void *ring_reserve(struct ring_t *r, uint32_t size);
+// The record last reserved is written and can be published
+void ring_commit(struct ring_t *r);
+// Publish any records still held back, then publish nothing more
+void ring_close(struct ring_t *r);
+
+/*
+ * The next record and its size, which is waited for while the ring is empty.
+ * Returns 0 once the producer has closed the ring and every record is read.
+ */
+void *ring_peek(struct ring_t *r, uint32_t *size);
+// The record last peeked at is done with, and its room can be reused
+void ring_release(struct ring_t *r);
+
+// Average and peak of the bytes in use as seen by the consumer, in tenths of a percent of the ring
+uint32_t ring_occupancy(struct ring_t *r);
+uint32_t ring_peak(struct ring_t *r);
+
+#endif
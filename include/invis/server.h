@@ -0,0 +1,37 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stdint.h>
+#include <invis/compat.h>
+
+// Keys kept open between requests, a power of 2
+#define SERVER_CACHE_SIZE	256
+
+/*
+ * Serve IPC_REG requests on name (see ipc.h) until accepting fails.
+ * Every connection is served by its own thread, one request after another
+ * in the order they were sent. The keys named by requests are opened
+ * relative to the hive with their counted names and stay open in a cache
+ * shared by all connections, so repeated requests skip the path lookup.
+ */
+int server_run(const char *name);
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <invis/compat.h>
+
+#include <invis/intern.h>
+#include <invis/reg.h>
+
+/*
+ * Snapshot file layout, all integers are little endian and every section
+ * starts on an 8 byte boundary:
+ *  struct snapshot_header_t
+ *  Sections, in any order
+ *  struct snapshot_section_t[sections]	(the index)
+ *  struct snapshot_footer_t
+ * A reader maps the file, finds the index through the footer, and then
+ * reads every column in place.
+ */
+#define SNAPSHOT_MAGIC			"INVISNAP"
+#define SNAPSHOT_FOOTER_MAGIC	"INVISEND"
+#define SNAPSHOT_VERSION		1
+
+// Interned key paths including the hive: u64 count, u64 offsets[count + 1], UTF-16LE data
+#define SNAPSHOT_PATHS			1
+// Value names: u64 offsets[rows + 1], UTF-16LE data
+#define SNAPSHOT_NAMES			2
+// u32 per row, index into SNAPSHOT_PATHS
+#define SNAPSHOT_ROW_PATHS		3
+// u32 per row, registry value type
+#define SNAPSHOT_TYPES			4
+// u32 per row, ANOMALY_* flags
+#define SNAPSHOT_ANOMALIES		5
+// u32 per row, index into SNAPSHOT_BLOBS
+#define SNAPSHOT_ROW_BLOBS		6
+// Deduplicated value data: u64 count, struct snapshot_blob_t[count], data
+#define SNAPSHOT_BLOBS			7
+
+#define SNAPSHOT_SECTIONS		7
+
+// Matches any type in a filter
+#define SNAPSHOT_ANY_TYPE		0xFFFFFFFF
+
+struct snapshot_header_t
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t rows;
+	uint64_t created;	// Seconds since the epoch
+	char host[32];		// NUL padded
+};
+
+struct snapshot_section_t
+{
+	uint32_t id;
+	uint32_t reserved;
+	uint64_t offset;	// From the start of the file
+	uint64_t size;
+};
+
+struct snapshot_footer_t
+{
+	uint64_t index;		// Offset of the section index
+	uint32_t sections;
+	uint32_t reserved;
+	char magic[8];
+};
+
+struct snapshot_blob_t
+{
+	uint64_t hash;		// hash64() of the data
+	uint64_t offset;	// From the start of the blob data
+	uint64_t size;
+};
+
+// Growable buffer for the columns of the writer
+struct snapshot_vec_t
+{
+	uint8_t *data;
+	uint64_t len;
+	uint64_t max;
+};
+
+struct snapshot_writer_t
+{
+	uint64_t rows;
+
+	// The hive is the first name of every path, and interned ids are written as path indexes
+	struct intern_t paths;
+	uint32_t path;		// Path of the rows being added
+
+	// Blob deduplication, the table holds blob ids + 1 with 0 for empty slots
+	struct snapshot_vec_t blobs;
+	struct snapshot_vec_t blob_data;
+	uint32_t *blob_table;
+	uint64_t blob_table_size;
+
+	struct snapshot_vec_t name_offsets;
+	struct snapshot_vec_t name_data;
+	struct snapshot_vec_t row_paths;
+	struct snapshot_vec_t types;
+	struct snapshot_vec_t anomalies;
+	struct snapshot_vec_t row_blobs;
+
+	struct snapshot_vec_t scratch;	// One whole path at a time while writing
+};
+
+struct snapshot_t
+{
+	uint8_t *base;
+	uint64_t size;
+	HANDLE file;
+	HANDLE mapping;
+
+	const struct snapshot_header_t *header;
+	uint64_t rows;
+
+	uint64_t paths;
+	const uint64_t *path_offsets;
+	const uint8_t *path_data;
+
+	const uint64_t *name_offsets;
+	const uint8_t *name_data;
+
+	const uint32_t *row_paths;
+	const uint32_t *types;
+	const uint32_t *anomalies;
+	const uint32_t *row_blobs;
+
+	uint64_t blobs;
+	const struct snapshot_blob_t *blob_index;
+	const uint8_t *blob_data;
+};
+
+struct snapshot_filter_t
+{
+	uint32_t type;		// SNAPSHOT_ANY_TYPE for any type
+	uint32_t anomalies;	// Rows must have one of these flags, 0 for any row
+	const char *under;	// Rows must be under a key with this name, 0 for any key
+};
+
+// Return non-zero to stop the query, snapshot_query() returns that value
+typedef int (*snapshot_cb_t)(void *ctx, struct snapshot_t *snap, uint64_t row);
+
+/*
+ * Writing:
+ *  snapshot_key() sets the key of the values added after it, with the key
+ *  path relative to the hive like sweep() gives. Paths are stored once no
+ *  matter how many values they hold, and so are the keys above them, while
+ *  value data is stored once no matter how many values share it. Paths
+ *  that differ only in ASCII case are the same key, as in the registry,
+ *  and are stored as the first spelling that was seen.
+ */
+int snapshot_init(struct snapshot_writer_t *w);
+int snapshot_key(struct snapshot_writer_t *w, HKEY hive, const wchar_t *path, uint32_t path_size);
+int snapshot_value(struct snapshot_writer_t *w, struct key_data_t *entry);
+int snapshot_write(struct snapshot_writer_t *w, FILE *f, const char *host);
+void snapshot_free(struct snapshot_writer_t *w);
+
+/*
+ * Reading:
+ *  snapshot_map() maps and validates the file, nothing is copied out of it.
+ *  The accessors return pointers into the mapping.
+ */
+int snapshot_map(struct snapshot_t *snap, const char *file);
+void snapshot_unmap(struct snapshot_t *snap);
+
+const wchar_t *snapshot_path(struct snapshot_t *snap, uint64_t row, uint32_t *size);
+const wchar_t *snapshot_name(struct snapshot_t *snap, uint64_t row, uint32_t *size);
+const void *snapshot_data(struct snapshot_t *snap, uint64_t row, uint32_t *size);
+
+// Call cb for every row that matches the filter, in row order
+int snapshot_query(struct snapshot_t            *snap,
+				   struct snapshot_filter_t *filter,
+				   snapshot_cb_t             cb,
+				   void                     *ctx);
+
+#endif
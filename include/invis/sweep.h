@@ -0,0 +1,76 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SWEEP_H_
+#define _SWEEP_H_
+
+#include <stdint.h>
+#include <invis/compat.h>
+
+#include <invis/checkpoint.h>
+#include <invis/reg.h>
+
+#define SWEEP_RECURSIVE	(1<<0)
+#define SWEEP_RAW		(1<<1)	// Leave classify_name() to the callback, anomalies is 0
+
+/*
+ * Called once for every key with entry set to 0, followed by once for
+ * every value of that key. path is the counted UTF-16LE path of the key
+ * relative to the hive, path_size is in bytes.
+ * The entry fields point into the enumeration buffer: they are only valid
+ * for the duration of the call and the name is not NUL terminated.
+ * Returning non-zero stops the sweep, and sweep() returns that value.
+ */
+typedef int (*sweep_cb_t)(void              *ctx,
+						  const wchar_t     *path,
+						  uint32_t           path_size,
+						  struct key_data_t *entry);
+
+/*
+ * Walk the values of a key, and of all its subkeys with SWEEP_RECURSIVE.
+ * Subkeys are opened relative to their parent with their counted names,
+ * so keys with invisible names are walked like any other.
+ */
+int sweep(HKEY        hive,
+		  char       *path,
+		  uint8_t     flags,
+		  sweep_cb_t  cb,
+		  void       *ctx);
+
+/*
+ * The same as sweep(), writing the keys still to be walked to cp as it
+ * goes, and starting from the checkpoint loaded into it if there is one.
+ * Keys are only written between keys, never halfway through the values
+ * of one, and are opened again by name when resuming.
+ */
+int sweep_checkpoint(HKEY                 hive,
+					 char                *path,
+					 uint8_t              flags,
+					 sweep_cb_t           cb,
+					 void                *ctx,
+					 struct checkpoint_t *cp);
+
+// The same as sweep(), starting from an open key that stays open
+int sweep_key(HANDLE         key,
+			  const wchar_t *path,
+			  uint32_t       path_size,
+			  uint8_t        flags,
+			  sweep_cb_t     cb,
+			  void          *ctx);
+
+#endif
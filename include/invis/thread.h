@@ -0,0 +1,89 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+#include <stdint.h>
+#include <invis/compat.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+struct thread_t
+{
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+	uint8_t running;
+#endif
+	void (*fn)(void *);
+	void *arg;
+};
+
+struct lock_t
+{
+#ifdef _WIN32
+	SRWLOCK lock;
+#else
+	pthread_mutex_t lock;
+#endif
+};
+
+struct cond_t
+{
+#ifdef _WIN32
+	CONDITION_VARIABLE cond;
+#else
+	pthread_cond_t cond;
+#endif
+};
+
+// t must stay valid until thread_join() returns
+int thread_start(struct thread_t *t, void (*fn)(void *), void *arg);
+void thread_join(struct thread_t *t);
+
+// Start a thread that is never joined
+int thread_spawn(void (*fn)(void *), void *arg);
+
+// Number of processors available to this process
+uint32_t thread_count(void);
+
+void lock_init(struct lock_t *l);
+void lock_acquire(struct lock_t *l);
+void lock_release(struct lock_t *l);
+
+void cond_init(struct cond_t *c);
+// l must be held, and is held again once this returns
+void cond_wait(struct cond_t *c, struct lock_t *l);
+void cond_wake(struct cond_t *c);
+void cond_wake_all(struct cond_t *c);
+
+// Monotonic time in microseconds
+uint64_t thread_now(void);
+// The same clock in nanoseconds, for timing single calls
+uint64_t thread_now_ns(void);
+// Processor time used by every thread of this process in microseconds
+uint64_t thread_cpu_time(void);
+void thread_sleep(uint64_t usec);
+// Give the rest of the time slice to another thread that is ready to run
+void thread_yield(void);
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _THROTTLE_H_
+#define _THROTTLE_H_
+
+#include <stdint.h>
+
+/*
+ * The limit is adjusted once both this many calls have completed and this
+ * many microseconds have gone by, long enough for the processor time of
+ * Windows to have ticked, or otherwise after THROTTLE_PERIOD
+ */
+#define THROTTLE_WINDOW		256
+#define THROTTLE_MIN_PERIOD	20000
+#define THROTTLE_PERIOD		100000
+
+// Pacing between calls once the limit is down to one, in microseconds
+#define THROTTLE_MIN_DELAY	100
+#define THROTTLE_MAX_DELAY	100000
+
+// Pacing is slept off in pieces at least this long, the resolution of Sleep()
+#define THROTTLE_MIN_SLEEP	1000
+
+/*
+ * A process wide limit on the number of enumeration calls in flight, so
+ * that a sweep does not starve the rest of the host. The limit starts at
+ * one and doubles every window until the first time it is exceeded, then
+ * grows by one every window in which every slot was in use, and is halved
+ * whenever the p99 latency of the calls in the window goes over the
+ * ceiling or the process uses more than its share of the processors.
+ * Once it is down to one, calls are paced instead.
+ * Until throttle_init() is called, every call goes through unthrottled.
+ */
+
+struct throttle_stats_t
+{
+	uint32_t limit;
+	uint32_t delay;		// Nanoseconds of pacing before each call
+	uint32_t p99;		// Microseconds, over the last window
+	uint32_t cpu;		// Percent of every processor, over the last window
+	uint64_t calls;
+	uint64_t waited;	// Calls that had to wait for a slot
+};
+
+/*
+ * ceiling is the p99 latency in microseconds to stay under, 0 for none.
+ * cpu is the percent of every processor to stay under, 0 for no budget.
+ * max is the most calls ever allowed in flight, 0 for one per processor.
+ */
+int throttle_init(uint32_t ceiling, uint32_t cpu, uint32_t max);
+
+// Around every call, enter may wait for a slot and returns what leave needs
+uint64_t throttle_enter(void);
+void throttle_leave(uint64_t start);
+
+void throttle_stats(struct throttle_stats_t *stats);
+
+#endif
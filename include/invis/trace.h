@@ -0,0 +1,122 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <invis/compat.h>
+
+/*
+ * Trace file layout, all integers are little endian:
+ *  struct trace_header_t
+ *  Records, in the order the calls returned, each one being
+ *   struct trace_record_t
+ *   name_size bytes of UTF-16LE name, padded to 8 bytes
+ * Value data is never written, only its type and size, so a trace of a
+ * production host holds key and value names but none of their contents.
+ */
+#define TRACE_MAGIC				"INVTRACE"
+#define TRACE_VERSION			1
+
+// Records with a longer buffer or data are treated as a broken trace
+#define TRACE_MAX_LENGTH		(64 << 20)
+
+// One call per internals function
+#define TRACE_CREATE_KEY		1
+#define TRACE_OPEN_KEY			2
+#define TRACE_SET_VALUE			3
+#define TRACE_DELETE_KEY		4
+#define TRACE_DELETE_VALUE		5
+#define TRACE_QUERY_KEY			6
+#define TRACE_ENUMERATE_KEY		7
+#define TRACE_QUERY_VALUE		8
+#define TRACE_ENUMERATE_VALUE	9
+#define TRACE_CLOSE				10
+// Not a call, names a handle opened outside of the traced functions, such as by RegOpenKeyExA()
+#define TRACE_HANDLE			11
+
+#define TRACE_CALLS				12
+
+struct trace_header_t
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t created;	// Seconds since the epoch
+};
+
+/*
+ * Handles are numbered from 1 in the order they are first seen, and an id
+ * is never reused even once its handle is closed. 0 is no handle at all.
+ */
+struct trace_record_t
+{
+	uint8_t call;		// TRACE_*
+	uint8_t class;		// Information class asked for
+	uint16_t name_size;	// Object name, value name, or the name enumerated
+	uint32_t status;
+	uint32_t key;		// Handle the call was made on, or RootDirectory
+	uint32_t result;	// Handle opened by the call
+	uint32_t arg;		// Index or access mask, or the predefined HKEY of a TRACE_HANDLE
+	uint32_t length;	// Of the buffer passed in, or of the data set
+	uint32_t needed;	// ResultLength, or the disposition of a created key
+	uint32_t type;		// Value type set or returned
+	uint32_t data_size;	// Value data returned
+	uint32_t time;		// Nanoseconds spent in the call
+	uint64_t start;		// Nanoseconds since the trace started
+};
+
+struct trace_call_stats_t
+{
+	uint64_t calls;
+	uint64_t mismatches;	// Returned another status than was recorded
+	uint64_t recorded;		// Nanoseconds spent in the recorded calls
+	uint64_t replayed;		// Nanoseconds spent in the same calls when replayed
+};
+
+struct trace_stats_t
+{
+	uint64_t keys;		// Created before replaying, from what the trace saw
+	uint64_t values;
+	struct trace_call_stats_t total;
+	struct trace_call_stats_t call[TRACE_CALLS];
+};
+
+/*
+ * Record every call made through the internals functions to a file, by
+ * pointing them at wrappers around whatever they pointed at before. Safe
+ * to call from any number of threads until trace_stop(), which puts the
+ * functions back and returns an error if any of the trace was not written.
+ */
+int trace_start(const char *file);
+int trace_stop(void);
+
+/*
+ * Replay a trace against the in-memory registry, one call at a time in the
+ * order they returned. The keys and values the recorded calls saw are
+ * created first, with zeroed data of the same size, so the calls find the
+ * same tree they did on the host. Only available outside of Windows, where
+ * the internals are the in-memory registry rather than the real one.
+ */
+int trace_replay(const char *file, struct trace_stats_t *stats);
+
+// Name of a TRACE_* call
+const char *trace_call_name(uint8_t call);
+
+#endif
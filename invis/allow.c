@@ -0,0 +1,378 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <error.h>
+#include <invis/allow.h>
+#include <invis/hash.h>
+#include <invis/regfile.h>
+
+// Longest line of an allowlist, enough for a path of the deepest keys fully escaped
+#define ALLOW_LINE_MAX	65536
+
+static uint64_t allow_tuple(HKEY hive, uint32_t path, uint64_t name, uint8_t any_data, uint64_t data)
+{
+	uint64_t t[5] = { (uint64_t) (uintptr_t) hive, path, name, any_data, any_data ? 0 : data };
+	return hash64(t, sizeof(t), 0);
+}
+
+// Every probe of a tuple is in the block picked by its low bits
+static inline const uint64_t *allow_block(const struct allow_t *a, uint64_t h)
+{
+	return &a->bloom[(h & (a->blocks - 1)) * 8];
+}
+
+static inline uint64_t allow_bits(uint64_t h)
+{
+	return h * 0x9E3779B97F4A7C15ULL;
+}
+
+static void allow_bloom_add(struct allow_t *a, uint64_t h)
+{
+	uint64_t *b = (uint64_t *) allow_block(a, h);
+	uint64_t bits = allow_bits(h);
+
+	for (uint32_t i = 0; i < ALLOW_BLOOM_PROBES; i++, bits >>= 9)
+		b[(bits & 511) / 64] |= 1ULL << (bits & 63);
+}
+
+static uint8_t allow_bloom_test(const struct allow_t *a, uint64_t h)
+{
+	const uint64_t *b = allow_block(a, h);
+	uint64_t bits = allow_bits(h);
+
+	for (uint32_t i = 0; i < ALLOW_BLOOM_PROBES; i++, bits >>= 9)
+		if (!(b[(bits & 511) / 64] & (1ULL << (bits & 63))))
+			return 0;
+
+	return 1;
+}
+
+static int allow_grow(void **buf, uint32_t *max, uint32_t need, uint32_t size)
+{
+	if (need <= *max)
+		return 0;
+
+	uint32_t n = *max ? *max : 64;
+	while (n < need)
+		n *= 2;
+
+	void *b = realloc(*buf, (uint64_t) n * size);
+	if (!b)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	*buf = b;
+	*max = n;
+
+	return 0;
+}
+
+// A table of ids + 1 at most half full, hashes are looked up by id
+static int allow_table(uint32_t **table, uint32_t *size, const uint8_t *items, uint32_t count, uint32_t stride)
+{
+	uint32_t n = 16;
+	while (n < count * 2)
+		n *= 2;
+
+	uint32_t *t = calloc(n, sizeof(uint32_t));
+	if (!t)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint64_t h;
+		memcpy(&h, &items[(uint64_t) i * stride], sizeof(uint64_t));
+
+		uint32_t j = h & (n - 1);
+		while (t[j])
+			j = (j + 1) & (n - 1);
+		t[j] = i + 1;
+	}
+
+	if (*table)
+		free(*table);
+
+	*table = t;
+	*size = n;
+
+	return 0;
+}
+
+static int allow_pool(struct allow_t *a, const wchar_t *s, uint32_t size, uint32_t *offset)
+{
+	if (allow_grow((void **) &a->pool, &a->pool_max, a->pool_len + size / 2, sizeof(wchar_t)))
+		return -2;
+
+	*offset = a->pool_len;
+	memcpy(&a->pool[a->pool_len], s, size);
+	a->pool_len += size / 2;
+
+	return 0;
+}
+
+// A field up to the next tab, or the end of the line
+static char *allow_field(char **s)
+{
+	char *f = *s;
+	char *end = strchr(f, '\t');
+
+	if (end)
+	{
+		*end = 0;
+		*s = end + 1;
+	}
+	else
+		*s = f + strlen(f);
+
+	return f;
+}
+
+static int allow_line(struct allow_t *a, char *line, wchar_t *buf, uint32_t *max_entries)
+{
+	char *s = line;
+	char *key = allow_field(&s);
+	char *name = allow_field(&s);
+	char *data = allow_field(&s);
+
+	char *sep = strchr(key, ':');
+	if (!sep || !*data)
+		return -1;
+
+	struct allow_entry_t e;
+	memset(&e, 0, sizeof(struct allow_entry_t));
+
+	if (sep - key != 1 || *key != '*')
+	{
+		if (!(e.hive = reg_hive(key, sep - key)))
+			return -1;
+	}
+	else
+		a->any_hive = 1;
+
+	// The backslash after the hive is optional, like with --key
+	char *path = sep + 1;
+	if (*path == '\\')
+		path++;
+
+	int64_t path_size = reg_unescape(path, strlen(path), buf, REG_ESCAPE_KEY);
+	if (path_size < 0 || intern_path(&a->paths, INTERN_ROOT, buf, path_size, &e.path))
+		return path_size < 0 ? -1 : -2;
+
+	int64_t name_size = reg_unescape(name, strlen(name), buf, REG_ESCAPE_NAME);
+	if (name_size < 0)
+		return -1;
+
+	e.name_size = name_size;
+	if (allow_pool(a, buf, name_size, &e.name))
+		return -2;
+
+	if (!strcmp(data, "*"))
+	{
+		e.any_data = 1;
+		a->any_data = 1;
+	}
+	else
+	{
+		char *end;
+		e.data = strtoull(data, &end, 16);
+		if (end - data != 16 || *end)
+			return -1;
+	}
+
+	e.hash = allow_tuple(e.hive, e.path, intern_hash(buf, name_size, 0), e.any_data, e.data);
+
+	if (allow_grow((void **) &a->entries, max_entries, a->num_entries + 1, sizeof(struct allow_entry_t)))
+		return -2;
+
+	a->entries[a->num_entries++] = e;
+
+	return 0;
+}
+
+int allow_load(struct allow_t *a, const char *file)
+{
+	int r = 0;
+
+	memset(a, 0, sizeof(struct allow_t));
+
+	FILE *f = fopen(file, "rb");
+	if (!f)
+	{
+		set_errno(EFILE);
+		return -1;
+	}
+
+	if (intern_init(&a->paths))
+	{
+		fclose(f);
+		return -2;
+	}
+
+	char *line = malloc(ALLOW_LINE_MAX);
+	wchar_t *buf = malloc(ALLOW_LINE_MAX * sizeof(wchar_t));
+	uint32_t max_entries = 0;
+
+	if (!line || !buf)
+	{
+		set_errno(ENOMEM);
+		r = -2;
+	}
+
+	while (!r && fgets(line, ALLOW_LINE_MAX, f))
+	{
+		size_t len = strlen(line);
+		if (len == ALLOW_LINE_MAX - 1 && line[len - 1] != '\n')
+		{
+			set_errno(EALLOWFILE);
+			r = -1;
+			break;
+		}
+
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' '))
+			line[--len] = 0;
+
+		if (!len || *line == '#')
+			continue;
+
+		if ((r = allow_line(a, line, buf, &max_entries)) == -1)
+			set_errno(EALLOWFILE);
+	}
+
+	fclose(f);
+
+	if (line)
+		free(line);
+
+	if (buf)
+		free(buf);
+
+	if (!r)
+		r = allow_table(&a->table, &a->table_size, (const uint8_t *) a->entries, a->num_entries, sizeof(struct allow_entry_t));
+
+	if (!r)
+	{
+		uint64_t bits = (uint64_t) a->num_entries * ALLOW_BLOOM_BITS;
+		a->blocks = 1;
+		while ((uint64_t) a->blocks * 512 < bits)
+			a->blocks *= 2;
+
+		if ((a->bloom = calloc((uint64_t) a->blocks * 8, sizeof(uint64_t))))
+		{
+			for (uint32_t i = 0; i < a->num_entries; i++)
+				allow_bloom_add(a, a->entries[i].hash);
+		}
+		else
+		{
+			set_errno(ENOMEM);
+			r = -2;
+		}
+	}
+
+	if (r)
+		allow_free(a);
+	else
+		set_errno(ESUCCESS);
+
+	return r;
+}
+
+void allow_free(struct allow_t *a)
+{
+	if (a->bloom)
+		free(a->bloom);
+
+	if (a->entries)
+		free(a->entries);
+
+	if (a->table)
+		free(a->table);
+
+	intern_free(&a->paths);
+
+	if (a->pool)
+		free(a->pool);
+
+	memset(a, 0, sizeof(struct allow_t));
+}
+
+void allow_key(const struct allow_t *a, HKEY hive, const wchar_t *path, uint32_t path_size, struct allow_key_t *k)
+{
+	k->hive = hive;
+	k->path = a->num_entries ? intern_find(&a->paths, INTERN_ROOT, path, path_size) : INTERN_NONE;
+}
+
+static uint8_t allow_find(const struct allow_t     *a,
+						  const struct allow_key_t *k,
+						  const struct key_data_t  *entry,
+						  uint64_t                  tuple,
+						  HKEY                      hive,
+						  uint8_t                   any_data,
+						  uint64_t                  data)
+{
+	if (!allow_bloom_test(a, tuple))
+		return 0;
+
+	for (uint32_t j = tuple & (a->table_size - 1); a->table[j]; j = (j + 1) & (a->table_size - 1))
+	{
+		const struct allow_entry_t *e = &a->entries[a->table[j] - 1];
+
+		if (e->hash == tuple
+		&&  e->hive == hive
+		&&  e->path == k->path
+		&&  e->any_data == any_data
+		&& (any_data || e->data == data)
+		&&  e->name_size == entry->name_size
+		&&  intern_equal(&a->pool[e->name], entry->name, entry->name_size))
+			return 1;
+	}
+
+	return 0;
+}
+
+uint8_t allow_match(const struct allow_t *a, const struct allow_key_t *k, const struct key_data_t *entry)
+{
+	if (!a->num_entries || k->path == INTERN_NONE)
+		return 0;
+
+	uint64_t name = intern_hash(entry->name, entry->name_size, 0);
+	uint64_t data = hash64(entry->value, entry->size, 0);
+
+	// The exact hive first, and the entries for any hive only if there are some
+	for (uint32_t h = 0; h < 2; h++)
+	{
+		HKEY hive = h ? 0 : k->hive;
+		if (h && (!a->any_hive || !k->hive))
+			break;
+
+		if (allow_find(a, k, entry, allow_tuple(hive, k->path, name, 0, data), hive, 0, data)
+		|| (a->any_data
+		&&  allow_find(a, k, entry, allow_tuple(hive, k->path, name, 1, 0), hive, 1, 0)))
+			return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,535 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <error.h>
+#include <invis/carve.h>
+
+struct carve_run_t
+{
+	uint64_t image;		// Offset of the first bin in the image
+	uint64_t start;		// Offset of the first bin in the hive
+	uint64_t end;		// Offset in the hive after the last bin
+	uint8_t used;
+};
+
+struct carve_base_t
+{
+	uint64_t image;
+	uint32_t root;
+	uint32_t size;
+	uint32_t minor;
+	uint16_t name[32];
+};
+
+struct carve_t
+{
+	FILE *f;
+
+	struct carve_run_t *runs;
+	uint64_t num_runs;
+	uint64_t max_runs;
+
+	struct carve_base_t *bases;
+	uint64_t num_bases;
+	uint64_t max_bases;
+
+	// Runs sorted by where they go in the hive, then where they are in the image
+	struct carve_run_t **order;
+};
+
+// Bins taken for one hive, in the order of the hive
+struct carve_piece_t
+{
+	struct carve_run_t *run;
+	uint64_t start;
+	uint64_t end;
+};
+
+static int carve_grow(void **items, uint64_t *max, uint64_t len, size_t size)
+{
+	if (len < *max)
+		return 0;
+
+	uint64_t m = *max ? *max * 2 : 64;
+	void *i = realloc(*items, size * m);
+	if (!i)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	*items = i;
+	*max = m;
+
+	return 0;
+}
+
+static int carve_seek(FILE *f, uint64_t offset)
+{
+#ifdef _WIN32
+	return _fseeki64(f, offset, SEEK_SET);
+#else
+	return fseeko(f, offset, SEEK_SET);
+#endif
+}
+
+// Bit i is set when there is a signature CARVE_ALIGN * i bytes in, for i up to 3
+static inline uint32_t carve_match(const uint8_t *p)
+{
+	uint32_t d[4];
+	for (uint32_t i = 0; i < 4; i++)
+		memcpy(&d[i], &p[CARVE_ALIGN * i], sizeof(uint32_t));
+
+#ifdef __SSE2__
+	const __m128i regf = _mm_set1_epi32(0x66676572);
+	const __m128i hbin = _mm_set1_epi32(0x6E696268);
+
+	__m128i v = _mm_set_epi32(d[3], d[2], d[1], d[0]);
+	__m128i m = _mm_or_si128(_mm_cmpeq_epi32(v, regf), _mm_cmpeq_epi32(v, hbin));
+
+	return _mm_movemask_ps(_mm_castsi128_ps(m));
+#else
+	uint32_t m = 0;
+	for (uint32_t i = 0; i < 4; i++)
+		if (d[i] == 0x66676572 || d[i] == 0x6E696268)
+			m |= 1 << i;
+
+	return m;
+#endif
+}
+
+// A base block is only believed with a valid checksum, so that stray "regf" strings are ignored
+static int carve_base(struct carve_t *c, const uint8_t *p, uint64_t image)
+{
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < 127; i++)
+	{
+		uint32_t d;
+		memcpy(&d, &p[i * 4], sizeof(uint32_t));
+		sum ^= d;
+	}
+
+	if (sum == 0)
+		sum = 1;
+	else if (sum == 0xFFFFFFFF)
+		sum = 0xFFFFFFFE;
+
+	uint32_t checksum;
+	memcpy(&checksum, &p[508], sizeof(uint32_t));
+
+	struct hive_base_t base;
+	memcpy(&base, p, sizeof(struct hive_base_t));
+
+	if (sum != checksum
+	||  base.major != 1
+	||  base.size % HIVE_BLOCK_SIZE
+	||  base.size > CARVE_MAX_HIVE
+	||  base.root >= base.size)
+		return 0;
+
+	if (carve_grow((void **) &c->bases, &c->max_bases, c->num_bases, sizeof(struct carve_base_t)))
+		return -2;
+
+	struct carve_base_t *b = &c->bases[c->num_bases++];
+	b->image = image;
+	b->root = base.root;
+	b->size = base.size;
+	b->minor = base.minor;
+	memcpy(b->name, base.name, sizeof(b->name));
+
+	return 0;
+}
+
+static int carve_bin(struct carve_t *c, const uint8_t *p, uint64_t image)
+{
+	struct hive_bin_t bin;
+	memcpy(&bin, p, sizeof(struct hive_bin_t));
+
+	if (!bin.size
+	||  bin.size % HIVE_BLOCK_SIZE
+	||  bin.offset % HIVE_BLOCK_SIZE
+	||  (uint64_t) bin.offset + bin.size > CARVE_MAX_HIVE)
+		return 0;
+
+	// Carry on the last run when this bin follows it both in the image and in the hive
+	if (c->num_runs)
+	{
+		struct carve_run_t *run = &c->runs[c->num_runs - 1];
+		if (run->image + (run->end - run->start) == image
+		&&  run->end == bin.offset)
+		{
+			run->end += bin.size;
+			return 0;
+		}
+	}
+
+	if (carve_grow((void **) &c->runs, &c->max_runs, c->num_runs, sizeof(struct carve_run_t)))
+		return -2;
+
+	struct carve_run_t *run = &c->runs[c->num_runs++];
+	run->image = image;
+	run->start = bin.offset;
+	run->end = (uint64_t) bin.offset + bin.size;
+	run->used = 0;
+
+	return 0;
+}
+
+// One sequential pass over the image, remembering base blocks and runs of bins
+static int carve_scan(struct carve_t *c)
+{
+	int r = 0;
+
+	uint8_t *buf = malloc(CARVE_READ_SIZE);
+	if (!buf)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	uint64_t pos = 0;
+	size_t len;
+
+	// Whole reads stay aligned, only the end of the image can come up short
+	while (!r && (len = fread(buf, 1, CARVE_READ_SIZE, c->f)) > 0)
+	{
+		for (size_t i = 0; !r && i + sizeof(struct hive_bin_t) <= len; i += CARVE_ALIGN)
+		{
+			if (i + CARVE_ALIGN * 3 + 4 <= len)
+			{
+				uint32_t m = carve_match(&buf[i]);
+				if (!m)
+				{
+					i += CARVE_ALIGN * 3;
+					continue;
+				}
+
+				i += CARVE_ALIGN * __builtin_ctz(m);
+			}
+
+			if (!memcmp(&buf[i], HIVE_BIN_MAGIC, 4))
+				r = carve_bin(c, &buf[i], pos + i);
+			else if (!memcmp(&buf[i], HIVE_BASE_MAGIC, 4) && i + 512 <= len)
+				r = carve_base(c, &buf[i], pos + i);
+		}
+
+		pos += len;
+	}
+
+	if (!r && ferror(c->f))
+	{
+		set_errno(EFILE);
+		r = -1;
+	}
+
+	free(buf);
+
+	return r;
+}
+
+static int carve_compare(const void *a, const void *b)
+{
+	const struct carve_run_t *x = *(struct carve_run_t * const *) a;
+	const struct carve_run_t *y = *(struct carve_run_t * const *) b;
+
+	if (x->start != y->start)
+		return x->start < y->start ? -1 : 1;
+
+	return x->image < y->image ? -1 : x->image > y->image;
+}
+
+/*
+ * The unused run that starts at start, or with exact unset the first
+ * one after it. Of those, the closest one after image, otherwise the
+ * closest one before it.
+ */
+static struct carve_run_t *carve_find(struct carve_t *c, uint64_t start, uint64_t image, int8_t exact)
+{
+	// First run starting at or after start
+	uint64_t lo = 0, hi = c->num_runs;
+	while (lo < hi)
+	{
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (c->order[mid]->start < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	struct carve_run_t *before = 0;
+
+	for (uint64_t i = lo; i < c->num_runs; i++)
+	{
+		struct carve_run_t *run = c->order[i];
+
+		if (run->start != start)
+		{
+			if (exact || before)
+				break;
+
+			start = run->start;
+		}
+
+		if (run->used)
+			continue;
+
+		if (run->image >= image)
+			return run;
+
+		before = run;
+	}
+
+	return before;
+}
+
+// The root key of bins without a base block, looked for cell by cell
+static uint32_t carve_root(struct hive_t *h)
+{
+	for (uint64_t bin = 0; bin + sizeof(struct hive_bin_t) <= h->size;)
+	{
+		struct hive_bin_t header;
+		memcpy(&header, &h->bins[bin], sizeof(struct hive_bin_t));
+
+		// Missing bins were left zeroed
+		if (memcmp(header.magic, HIVE_BIN_MAGIC, 4) || !header.size || header.size % HIVE_BLOCK_SIZE)
+		{
+			bin += HIVE_BLOCK_SIZE;
+			continue;
+		}
+
+		uint64_t end = bin + header.size < h->size ? bin + header.size : h->size;
+
+		for (uint64_t offset = bin + sizeof(struct hive_bin_t); offset + 8 <= end;)
+		{
+			int32_t cell;
+			memcpy(&cell, &h->bins[offset], sizeof(int32_t));
+
+			uint32_t size = cell < 0 ? (uint32_t) -(int64_t) cell : (uint32_t) cell;
+			if (size < 8 || size & 7)
+				break;
+
+			uint32_t data_size;
+			const struct hive_nk_t *nk = (const struct hive_nk_t *) hive_cell(h, offset, &data_size);
+
+			if (nk
+			&&  data_size >= sizeof(struct hive_nk_t)
+			&& !memcmp(nk->magic, "nk", 2)
+			&&  nk->flags & HIVE_KEY_ROOT)
+				return offset;
+
+			offset += size;
+		}
+
+		bin += header.size;
+	}
+
+	return HIVE_NO_CELL;
+}
+
+/*
+ * Put one hive back together from the runs, starting with first, and pass
+ * it on. size is 0 when there is no base block to tell it.
+ */
+static int carve_hive(struct carve_t    *c,
+					  struct carve_hive_t *info,
+					  struct carve_run_t  *first,
+					  uint32_t             root,
+					  uint32_t             minor,
+					  carve_cb_t           cb,
+					  void                *ctx)
+{
+	int r = 0;
+
+	struct carve_piece_t *pieces = 0;
+	uint64_t num_pieces = 0;
+	uint64_t max_pieces = 0;
+
+	uint64_t at = 0;
+	struct carve_run_t *run = first;
+
+	while (!r && run && (!info->size || run->start < info->size))
+	{
+		if ((r = carve_grow((void **) &pieces, &max_pieces, num_pieces, sizeof(struct carve_piece_t))))
+			break;
+
+		run->used = 1;
+		info->missing += run->start - at;
+
+		struct carve_piece_t *p = &pieces[num_pieces++];
+		p->run = run;
+		p->start = run->start;
+		p->end = info->size && run->end > info->size ? info->size : run->end;
+		at = p->end;
+
+		// Without a base block there is no telling how much is missing, so stop at the first gap
+		run = carve_find(c, at, run->image + (run->end - run->start), !info->size);
+	}
+
+	// Nothing to show for it
+	if (!num_pieces)
+	{
+		if (pieces)
+			free(pieces);
+
+		return r;
+	}
+
+	if (!info->size)
+		info->size = at;
+	else
+		info->missing += info->size - at;
+
+	info->fragments = num_pieces;
+
+	uint8_t *bins = 0;
+	if (!r && info->size && !(bins = calloc(1, info->size)))
+	{
+		set_errno(ENOMEM);
+		r = -2;
+	}
+
+	for (uint64_t i = 0; !r && i < num_pieces; i++)
+	{
+		struct carve_piece_t *p = &pieces[i];
+
+		if (carve_seek(c->f, p->run->image)
+		||  fread(&bins[p->start], 1, p->end - p->start, c->f) != p->end - p->start)
+		{
+			set_errno(EFILE);
+			r = -1;
+		}
+	}
+
+	if (!r && bins)
+	{
+		struct hive_t h;
+		r = hive_load(&h, bins, info->size, root, minor);
+
+		if (!r)
+		{
+			if (h.root == HIVE_NO_CELL)
+				h.root = carve_root(&h);
+
+			if (h.root != HIVE_NO_CELL)
+				r = cb(ctx, info, &h);
+
+			hive_close(&h);
+		}
+	}
+	else if (bins)
+		free(bins);
+
+	if (pieces)
+		free(pieces);
+
+	return r;
+}
+
+int carve_image(const char *file, carve_cb_t cb, void *ctx)
+{
+	int r = 0;
+
+	if (!file || !cb)
+	{
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	struct carve_t c;
+	memset(&c, 0, sizeof(struct carve_t));
+
+	if (!(c.f = fopen(file, "rb")))
+	{
+		set_errno(EFILE);
+		return -1;
+	}
+
+	// Reads are large enough already, and stdio would only copy them again
+	setvbuf(c.f, 0, _IONBF, 0);
+
+	r = carve_scan(&c);
+
+	if (!r && c.num_runs && !(c.order = malloc(sizeof(struct carve_run_t *) * c.num_runs)))
+	{
+		set_errno(ENOMEM);
+		r = -2;
+	}
+
+	if (!r && c.num_runs)
+	{
+		for (uint64_t i = 0; i < c.num_runs; i++)
+			c.order[i] = &c.runs[i];
+
+		qsort(c.order, c.num_runs, sizeof(struct carve_run_t *), carve_compare);
+	}
+
+	// Hives with a base block first, their first bin follows it directly
+	for (uint64_t i = 0; !r && i < c.num_bases; i++)
+	{
+		struct carve_base_t *b = &c.bases[i];
+
+		struct carve_hive_t info;
+		memset(&info, 0, sizeof(struct carve_hive_t));
+		info.offset = b->image;
+		info.base = 1;
+		info.size = b->size;
+		memcpy(info.name, b->name, sizeof(info.name));
+
+		struct carve_run_t *first = carve_find(&c, 0, b->image + HIVE_BLOCK_SIZE, 0);
+		r = carve_hive(&c, &info, first, b->root, b->minor, cb, ctx);
+	}
+
+	// Then whatever starts a hive and is left over
+	for (uint64_t i = 0; !r && i < c.num_runs; i++)
+	{
+		struct carve_run_t *run = &c.runs[i];
+		if (run->used || run->start)
+			continue;
+
+		struct carve_hive_t info;
+		memset(&info, 0, sizeof(struct carve_hive_t));
+		info.offset = run->image;
+
+		// Without a version, assume 1.5 like every hive since Windows XP
+		r = carve_hive(&c, &info, run, HIVE_NO_CELL, 5, cb, ctx);
+	}
+
+	if (c.runs)
+		free(c.runs);
+
+	if (c.bases)
+		free(c.bases);
+
+	if (c.order)
+		free(c.order);
+
+	fclose(c.f);
+
+	if (!r)
+		set_errno(ESUCCESS);
+
+	return r;
+}
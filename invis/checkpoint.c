@@ -0,0 +1,298 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <error.h>
+#include <invis/checkpoint.h>
+#include <invis/hash.h>
+#include <invis/thread.h>
+
+int checkpoint_init(struct checkpoint_t *c, const char *file, uint64_t id, uint64_t interval)
+{
+	memset(c, 0, sizeof(struct checkpoint_t));
+	c->id = id;
+	c->interval = interval;
+	c->next = thread_now() + interval;
+
+	size_t len = strlen(file);
+	c->file = malloc(len + 1);
+	c->tmp = malloc(len + 5);
+
+	if (!c->file || !c->tmp)
+	{
+		checkpoint_free(c);
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	memcpy(c->file, file, len + 1);
+	memcpy(c->tmp, file, len);
+	memcpy(&c->tmp[len], ".tmp", 5);
+
+	return 0;
+}
+
+void checkpoint_free(struct checkpoint_t *c)
+{
+	free(c->file);
+	free(c->tmp);
+	free(c->state);
+	free(c->buf);
+
+	c->file = 0;
+	c->tmp = 0;
+	c->state = 0;
+	c->buf = 0;
+}
+
+int checkpoint_load(struct checkpoint_t *c)
+{
+	// Stopped before the first checkpoint, so everything starts over
+	FILE *f = fopen(c->file, "rb");
+	if (!f)
+	{
+		set_errno(ESUCCESS);
+		return 0;
+	}
+
+	int r = 0;
+	struct checkpoint_header_t header;
+
+	if (fread(&header, sizeof(struct checkpoint_header_t), 1, f) != 1
+	||  memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic))
+	||  header.version != CHECKPOINT_VERSION
+	||  header.id != c->id
+	||  header.size > 0xFFFFFFFF)
+	{
+		set_errno(ECHECKPOINT);
+		r = -1;
+	}
+	else if (!(c->state = malloc(header.size ? header.size : 1)))
+	{
+		set_errno(ENOMEM);
+		r = -2;
+	}
+	else if (fread(c->state, 1, header.size, f) != header.size
+	||       hash64(c->state, header.size, 0) != header.hash)
+	{
+		set_errno(ECHECKPOINT);
+		r = -1;
+	}
+
+	fclose(f);
+
+	if (r)
+	{
+		free(c->state);
+		c->state = 0;
+		return r;
+	}
+
+	c->kind = header.kind;
+	c->size = header.size;
+	c->pos = 0;
+	c->offset = header.offset;
+
+	return 0;
+}
+
+void checkpoint_begin(struct checkpoint_t *c)
+{
+	c->len = 0;
+	c->err = 0;
+}
+
+void checkpoint_put(struct checkpoint_t *c, const void *data, uint64_t size)
+{
+	if (c->len + size > c->max)
+	{
+		uint64_t max = c->max ? c->max : 4096;
+		while (max < c->len + size)
+			max *= 2;
+
+		uint8_t *b = realloc(c->buf, max);
+		if (!b)
+		{
+			c->err = 1;
+			return;
+		}
+
+		c->buf = b;
+		c->max = max;
+	}
+
+	memcpy(&c->buf[c->len], data, size);
+	c->len += size;
+}
+
+int checkpoint_get(struct checkpoint_t *c, void *data, uint64_t size)
+{
+	if (!c->state || c->size - c->pos < size)
+	{
+		set_errno(ECHECKPOINT);
+		return -1;
+	}
+
+	memcpy(data, &c->state[c->pos], size);
+	c->pos += size;
+
+	return 0;
+}
+
+int checkpoint_commit(struct checkpoint_t *c, uint32_t kind)
+{
+	struct checkpoint_header_t header;
+	memset(&header, 0, sizeof(struct checkpoint_header_t));
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.kind = kind;
+	header.id = c->id;
+	header.size = c->len;
+	header.hash = hash64(c->buf, c->len, 0);
+
+	if (c->err)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	// Everything written up to here has to be on the disk before a checkpoint can say so
+	if (c->flush && c->flush(c->ctx, &header.offset))
+	{
+		set_errno(EWRITE);
+		return -8;
+	}
+
+	FILE *f = fopen(c->tmp, "wb");
+	if (!f)
+	{
+		set_errno(EFILE);
+		return -1;
+	}
+
+	int8_t failed = fwrite(&header, sizeof(struct checkpoint_header_t), 1, f) != 1
+				 || fwrite(c->buf, 1, c->len, f) != c->len
+				 || checkpoint_sync(f);
+
+	if (fclose(f) || failed)
+	{
+		remove(c->tmp);
+		set_errno(EWRITE);
+		return -8;
+	}
+
+#ifdef _WIN32
+	if (!MoveFileExA(c->tmp, c->file, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+#else
+	if (rename(c->tmp, c->file))
+#endif
+	{
+		remove(c->tmp);
+		set_errno(EWRITE);
+		return -8;
+	}
+
+	c->next = thread_now() + c->interval;
+
+	return 0;
+}
+
+int checkpoint_done(struct checkpoint_t *c)
+{
+	// Finished before the first checkpoint was due
+	FILE *f = fopen(c->file, "rb");
+	if (!f)
+	{
+		set_errno(ESUCCESS);
+		return 0;
+	}
+
+	fclose(f);
+
+	if (remove(c->file))
+	{
+		set_errno(EFILE);
+		return -1;
+	}
+
+	return 0;
+}
+
+int checkpoint_sync(FILE *f)
+{
+	if (fflush(f))
+		return -1;
+
+#ifdef _WIN32
+	return _commit(_fileno(f)) ? -1 : 0;
+#else
+	return fsync(fileno(f)) ? -1 : 0;
+#endif
+}
+
+int checkpoint_offset(FILE *f, uint64_t *offset)
+{
+	if (checkpoint_sync(f))
+		return -1;
+
+#ifdef _WIN32
+	int64_t o = _ftelli64(f);
+#else
+	off_t o = ftello(f);
+#endif
+
+	if (o < 0)
+		return -1;
+
+	*offset = o;
+
+	return 0;
+}
+
+// Output shorter than the checkpoint was not written by it, and is never padded out to it
+int checkpoint_truncate(FILE *f, uint64_t offset)
+{
+	if (fflush(f))
+		return -1;
+
+#ifdef _WIN32
+	if (_fseeki64(f, 0, SEEK_END)
+	||  (uint64_t) _ftelli64(f) < offset
+	||  _chsize_s(_fileno(f), offset))
+		return -1;
+
+	return _fseeki64(f, 0, SEEK_END) ? -1 : 0;
+#else
+	off_t end = lseek(fileno(f), 0, SEEK_END);
+
+	if (end < 0
+	||  (uint64_t) end < offset
+	||  ftruncate(fileno(f), offset))
+		return -1;
+
+	return fseek(f, 0, SEEK_END) ? -1 : 0;
+#endif
+}
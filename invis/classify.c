@@ -0,0 +1,194 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <invis/classify.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const char *anomaly_strs[ANOMALY_COUNT] =
+{
+	"leading-nul",
+	"embedded-nul",
+	"trailing-nul",
+	"all-nul",
+	"length",
+	"odd-length",
+	"trailing-space",
+	"control",
+	"format",
+	"lookalike",
+};
+
+static inline int is_space(uint16_t c)
+{
+	return c == 0x0020 || c == 0x0009 || c == 0x00A0 || c == 0x1680
+	||    (c >= 0x2000 && c <= 0x200A)
+	||     c == 0x2028 || c == 0x2029 || c == 0x202F || c == 0x205F || c == 0x3000;
+}
+
+// Only called for characters outside of the printable ASCII range, which are rare in real names
+static uint32_t classify_char(uint16_t c)
+{
+	// C0 and C1 control characters, and DEL
+	if (c < 0x20 || c == 0x7F || (c >= 0x80 && c <= 0x9F))
+		return ANOMALY_CONTROL;
+
+	// Soft hyphen, zero-width and bidi controls, BOM
+	if (c == 0x00AD || c == 0x034F || c == 0x061C || c == 0x180E
+	|| (c >= 0x200B && c <= 0x200F)
+	|| (c >= 0x202A && c <= 0x202E)
+	|| (c >= 0x2060 && c <= 0x206F)
+	||  c == 0xFEFF)
+		return ANOMALY_FORMAT;
+
+	// Scripts and forms that contain latin lookalikes, and non-ASCII spaces
+	if ((c >= 0x0370 && c <= 0x052F)	// Greek, Cyrillic
+	||  (c >= 0x1D00 && c <= 0x1DBF)	// Phonetic extensions (small capitals)
+	||  (c >= 0xFF01 && c <= 0xFF5E)	// Fullwidth ASCII
+	||  is_space(c))
+		return ANOMALY_LOOKALIKE;
+
+	return 0;
+}
+
+uint32_t classify_name(const wchar_t *name, uint32_t size)
+{
+	uint32_t r = 0;
+
+	if (size & 1)
+		r |= ANOMALY_ODD_LENGTH;
+
+	const uint16_t *n = (const uint16_t *) name;
+	uint32_t len = size / 2;
+
+	if (!n || !len)
+		return r;
+
+	// Number of NULs, and the first and last non-NUL characters
+	uint32_t nuls = 0;
+	int64_t first = -1;
+	int64_t last = -1;
+
+	uint32_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i not_c0 = _mm_set1_epi16((short) 0xFFE0);
+	const __m128i not_ascii = _mm_set1_epi16((short) 0xFF80);
+	const __m128i del = _mm_set1_epi16(0x7F);
+
+	// Names shorter than a block are copied out so that it never reads past the end of the name
+	uint16_t tail[8] = { 0 };
+
+	// 8 characters at a time, movemask yields 2 bits per character
+	for (; i < len; i += 8)
+	{
+		const uint16_t *block = &n[i];
+		uint32_t valid = 0xFFFF;
+
+		if (len < 8)
+		{
+			memcpy(tail, n, len * 2);
+			block = tail;
+			valid = (1 << (len * 2)) - 1;
+		}
+		// The final partial block overlaps the previous one, and ignores the characters already seen
+		else if (len - i < 8)
+		{
+			valid = 0xFFFF << ((8 - (len - i)) * 2) & 0xFFFF;
+			i = len - 8;
+			block = &n[i];
+		}
+
+		__m128i v = _mm_loadu_si128((const __m128i *) block);
+
+		uint32_t z = _mm_movemask_epi8(_mm_cmpeq_epi16(v, zero)) & valid;
+		uint32_t nz = ~z & valid;
+		uint32_t c0 = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, not_c0), zero));
+		uint32_t wide = ~_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, not_ascii), zero)) & valid;
+		uint32_t dels = _mm_movemask_epi8(_mm_cmpeq_epi16(v, del)) & valid;
+
+		nuls += __builtin_popcount(z) / 2;
+
+		if (nz)
+		{
+			if (first < 0)
+				first = i + __builtin_ctz(nz) / 2;
+			last = i + (31 - __builtin_clz(nz)) / 2;
+		}
+
+		// Fall back to the scalar check only for the blocks that need it
+		if ((c0 & nz) | wide | dels)
+			for (uint32_t j = 0; j < 8; j++)
+				if ((nz >> (j * 2)) & 1 && (block[j] < 0x20 || block[j] >= 0x7F))
+					r |= classify_char(block[j]);
+	}
+#else
+	for (; i < len; i++)
+	{
+		if (!n[i])
+			nuls++;
+		else
+		{
+			if (first < 0)
+				first = i;
+			last = i;
+
+			if (n[i] < 0x20 || n[i] >= 0x7F)
+				r |= classify_char(n[i]);
+		}
+	}
+#endif
+
+	if (nuls)
+	{
+		r |= ANOMALY_LENGTH;
+
+		if (first < 0)
+			r |= ANOMALY_ALL_NUL | ANOMALY_LEADING_NUL;
+		else
+		{
+			if (!n[0])
+				r |= ANOMALY_LEADING_NUL;
+
+			if (!n[len - 1])
+				r |= ANOMALY_TRAILING_NUL;
+
+			// Any NUL that isn't part of the leading or trailing run is embedded
+			if (nuls > (uint32_t) first + (len - 1 - (uint32_t) last))
+				r |= ANOMALY_EMBEDDED_NUL;
+		}
+	}
+
+	if (last >= 0 && is_space(n[last]))
+		r |= ANOMALY_TRAILING_SPACE;
+
+	return r;
+}
+
+const char *anomaly_str(uint32_t anomaly)
+{
+	if (anomaly && !(anomaly & (anomaly - 1)) && __builtin_ctz(anomaly) < ANOMALY_COUNT)
+		return anomaly_strs[__builtin_ctz(anomaly)];
+
+	return 0;
+}
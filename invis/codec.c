@@ -0,0 +1,735 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <error.h>
+#include <invis/codec.h>
+#include <invis/regfile.h>
+
+// CM_PARTIAL_RESOURCE_DESCRIPTOR and IO_RESOURCE_DESCRIPTOR types
+#define RES_PORT				1
+#define RES_INTERRUPT			2
+#define RES_MEMORY				3
+#define RES_DMA					4
+#define RES_DEVICE_SPECIFIC		5
+#define RES_BUS_NUMBER			6
+#define RES_MEMORY_LARGE		7
+
+// Flags of RES_MEMORY_LARGE, its length is stored shifted right by this many bits
+#define RES_MEMORY_LARGE_40		0x200
+#define RES_MEMORY_LARGE_48		0x400
+#define RES_MEMORY_LARGE_64		0x800
+
+// Sizes of the fixed parts of the resource structures
+#define RES_FULL_HEADER			16	// CM_FULL_RESOURCE_DESCRIPTOR up to its descriptors
+#define RES_PARTIAL_32			16	// CM_PARTIAL_RESOURCE_DESCRIPTOR written by 32-bit Windows
+#define RES_PARTIAL_64			20	// CM_PARTIAL_RESOURCE_DESCRIPTOR written by 64-bit Windows
+#define RES_REQUIREMENTS_HEADER	32	// IO_RESOURCE_REQUIREMENTS_LIST up to its lists
+#define RES_IO_LIST_HEADER		8	// IO_RESOURCE_LIST up to its descriptors
+#define RES_IO					32	// IO_RESOURCE_DESCRIPTOR
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// Bounded writer over the caller's buffer, which keeps a byte back for the NUL
+struct codec_out_t
+{
+	char *buf;
+	uint64_t len;
+	uint64_t max;
+	int8_t err;
+};
+
+typedef void (*codec_format_t)(struct codec_out_t *o, const uint8_t *data, uint32_t size);
+typedef int64_t (*codec_parse_t)(const char *text, uint8_t *out, uint32_t out_size);
+
+struct codec_t
+{
+	const char *name;
+	codec_format_t format;
+	codec_parse_t parse;	// 0 when the --value is a file
+};
+
+static uint16_t get16(const uint8_t *d)
+{
+	uint16_t v;
+	memcpy(&v, d, sizeof(v));
+	return v;
+}
+
+static uint32_t get32(const uint8_t *d)
+{
+	uint32_t v;
+	memcpy(&v, d, sizeof(v));
+	return v;
+}
+
+static uint64_t get64(const uint8_t *d)
+{
+	uint64_t v;
+	memcpy(&v, d, sizeof(v));
+	return v;
+}
+
+static char *out_reserve(struct codec_out_t *o, uint64_t n)
+{
+	if (o->err || o->max - o->len < n)
+	{
+		o->err = 1;
+		return 0;
+	}
+
+	char *p = &o->buf[o->len];
+	o->len += n;
+
+	return p;
+}
+
+static void out_write(struct codec_out_t *o, const char *s, uint64_t n)
+{
+	char *p = out_reserve(o, n);
+	if (p)
+		memcpy(p, s, n);
+}
+
+static void out_puts(struct codec_out_t *o, const char *s)
+{
+	out_write(o, s, strlen(s));
+}
+
+static void out_dec(struct codec_out_t *o, uint64_t v)
+{
+	char tmp[20];
+	uint8_t n = 0;
+
+	do
+	{
+		tmp[sizeof(tmp) - ++n] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+
+	out_write(o, &tmp[sizeof(tmp) - n], n);
+}
+
+static void out_hex(struct codec_out_t *o, uint64_t v)
+{
+	char tmp[18];
+	uint8_t n = 0;
+
+	do
+	{
+		tmp[sizeof(tmp) - ++n] = hex_digits[v & 0xF];
+		v >>= 4;
+	} while (v);
+
+	tmp[sizeof(tmp) - ++n] = 'x';
+	tmp[sizeof(tmp) - ++n] = '0';
+
+	out_write(o, &tmp[sizeof(tmp) - n], n);
+}
+
+// Comma separated bytes, as in the hex: lines of a .reg file
+static void format_hex(struct codec_out_t *o, const uint8_t *data, uint32_t size)
+{
+	if (!size)
+		return;
+
+	char *p = out_reserve(o, (uint64_t) size * 3 - 1);
+	if (!p)
+		return;
+
+	for (uint32_t i = 0; i < size; i++)
+	{
+		if (i)
+			*p++ = ',';
+		*p++ = hex_digits[data[i] >> 4];
+		*p++ = hex_digits[data[i] & 0xF];
+	}
+}
+
+static void format_escaped(struct codec_out_t *o, const uint8_t *data, uint32_t len)
+{
+	char *p = out_reserve(o, REG_ESCAPE_SIZE(len * 2));
+	if (p)
+		o->len -= REG_ESCAPE_SIZE(len * 2) - reg_escape((const wchar_t *) data, len * 2, p, REG_ESCAPE_NAME);
+}
+
+// Strings aren't always terminated, or even a whole number of characters
+static void format_string(struct codec_out_t *o, const uint8_t *data, uint32_t size)
+{
+	uint32_t len = size / 2;
+
+	while (len && !get16(&data[(len - 1) * 2]))
+		len--;
+
+	format_escaped(o, data, len);
+}
+
+// Only the terminator of the last string and of the list are dropped, so empty strings still show
+static void format_multi(struct codec_out_t *o, const uint8_t *data, uint32_t size)
+{
+	uint32_t len = size / 2;
+
+	for (uint8_t i = 0; i < 2 && len && !get16(&data[(len - 1) * 2]); i++)
+		len--;
+
+	format_escaped(o, data, len);
+}
+
+static void format_dword(struct codec_out_t *o, const uint8_t *data, uint32_t size)
+{
+	if (size == sizeof(uint32_t))
+		out_dec(o, get32(data));
+	else
+		format_hex(o, data, size);
+}
+
+static void format_dword_be(struct codec_out_t *o, const uint8_t *data, uint32_t size)
+{
+	if (size == sizeof(uint32_t))
+		out_dec(o, ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | data[3]);
+	else
+		format_hex(o, data, size);
+}
+
+static void format_qword(struct codec_out_t *o, const uint8_t *data, uint32_t size)
+{
+	if (size == sizeof(uint64_t))
+		out_dec(o, get64(data));
+	else
+		format_hex(o, data, size);
+}
+
+// A resource of a CM_PARTIAL_RESOURCE_DESCRIPTOR, whose union starts at u
+static void format_partial(struct codec_out_t *o, const uint8_t *r, const uint8_t *u)
+{
+	uint64_t length;
+
+	switch (r[0])
+	{
+		case RES_PORT:
+			out_puts(o, "port ");
+			out_hex(o, get64(u));
+			out_puts(o, "+");
+			out_hex(o, get32(&u[8]));
+			break;
+		case RES_INTERRUPT:
+			out_puts(o, "interrupt ");
+			out_dec(o, get32(&u[4]));
+			break;
+		case RES_MEMORY:
+			out_puts(o, "memory ");
+			out_hex(o, get64(u));
+			out_puts(o, "+");
+			out_hex(o, get32(&u[8]));
+			break;
+		case RES_DMA:
+			out_puts(o, "dma ");
+			out_dec(o, get32(u));
+			break;
+		case RES_DEVICE_SPECIFIC:
+			out_puts(o, "device data ");
+			out_dec(o, get32(u));
+			out_puts(o, " bytes");
+			break;
+		case RES_BUS_NUMBER:
+			out_puts(o, "bus ");
+			out_dec(o, get32(u));
+			out_puts(o, "+");
+			out_dec(o, get32(&u[4]));
+			break;
+		case RES_MEMORY_LARGE:
+			length = get32(&u[8]);
+			if      (get16(&r[2]) & RES_MEMORY_LARGE_40)
+				length <<= 8;
+			else if (get16(&r[2]) & RES_MEMORY_LARGE_48)
+				length <<= 16;
+			else if (get16(&r[2]) & RES_MEMORY_LARGE_64)
+				length <<= 32;
+
+			out_puts(o, "memory ");
+			out_hex(o, get64(u));
+			out_puts(o, "+");
+			out_hex(o, length);
+			break;
+		default:
+			out_puts(o, "type ");
+			out_dec(o, r[0]);
+			break;
+	};
+}
+
+/*
+ * A CM_FULL_RESOURCE_DESCRIPTOR at *pos, whose descriptors are stride bytes
+ * apart depending on the bitness of the Windows that wrote it.
+ * Returns 0 if it runs past the end of the data.
+ */
+static int8_t format_full(struct codec_out_t *o, const uint8_t *data, uint32_t size, uint32_t *pos, uint32_t stride)
+{
+	uint32_t p = *pos;
+
+	if (size - p < RES_FULL_HEADER)
+		return 0;
+
+	uint32_t count = get32(&data[p + 12]);
+
+	out_puts(o, "interface ");
+	out_dec(o, get32(&data[p]));
+	out_puts(o, " bus ");
+	out_dec(o, get32(&data[p + 4]));
+	out_puts(o, " version ");
+	out_dec(o, get16(&data[p + 8]));
+	out_puts(o, ".");
+	out_dec(o, get16(&data[p + 10]));
+	out_puts(o, ":");
+	p += RES_FULL_HEADER;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (size - p < stride)
+			return 0;
+
+		const uint8_t *r = &data[p];
+		out_puts(o, i ? ", " : " ");
+		format_partial(o, r, &r[4]);
+		p += stride;
+
+		// Device specific data follows its descriptor
+		if (r[0] == RES_DEVICE_SPECIFIC)
+		{
+			if (size - p < get32(&r[4]))
+				return 0;
+			p += get32(&r[4]);
+		}
+	}
+
+	*pos = p;
+
+	return 1;
+}
+
+// Nothing says which bitness wrote a descriptor, so the first one that accounts for every byte wins
+static void format_resources(struct codec_out_t *o, const uint8_t *data, uint32_t size, uint8_t list)
+{
+	static const uint32_t strides[] = { RES_PARTIAL_64, RES_PARTIAL_32 };
+	uint64_t start = o->len;
+
+	for (uint8_t s = 0; s < sizeof(strides) / sizeof(strides[0]); s++)
+	{
+		uint32_t pos = 0;
+		uint32_t count = 1;
+		int8_t ok = 1;
+
+		o->len = start;
+		o->err = 0;
+
+		if (list)
+		{
+			if (size < sizeof(uint32_t))
+				break;
+
+			count = get32(data);
+			pos = sizeof(uint32_t);
+		}
+
+		for (uint32_t i = 0; ok && i < count; i++)
+		{
+			if (i)
+				out_puts(o, "; ");
+			ok = format_full(o, data, size, &pos, strides[s]);
+		}
+
+		if (ok && pos == size)
+			return;
+	}
+
+	o->len = start;
+	o->err = 0;
+	format_hex(o, data, size);
+}
+
+static void format_resource_list(struct codec_out_t *o, const uint8_t *data, uint32_t size)
+{
+	format_resources(o, data, size, 1);
+}
+
+static void format_full_resource(struct codec_out_t *o, const uint8_t *data, uint32_t size)
+{
+	format_resources(o, data, size, 0);
+}
+
+// A resource of an IO_RESOURCE_DESCRIPTOR, as the range it may be placed in
+static void format_io(struct codec_out_t *o, const uint8_t *r)
+{
+	const uint8_t *u = &r[8];
+
+	switch (r[1])
+	{
+		case RES_PORT:
+		case RES_MEMORY:
+			out_puts(o, r[1] == RES_PORT ? "port " : "memory ");
+			out_hex(o, get64(&u[8]));
+			out_puts(o, "-");
+			out_hex(o, get64(&u[16]));
+			out_puts(o, " length ");
+			out_hex(o, get32(u));
+			break;
+		case RES_INTERRUPT:
+			out_puts(o, "interrupt ");
+			out_dec(o, get32(u));
+			out_puts(o, "-");
+			out_dec(o, get32(&u[4]));
+			break;
+		case RES_DMA:
+			out_puts(o, "dma ");
+			out_dec(o, get32(u));
+			out_puts(o, "-");
+			out_dec(o, get32(&u[4]));
+			break;
+		case RES_BUS_NUMBER:
+			out_puts(o, "bus ");
+			out_dec(o, get32(&u[4]));
+			out_puts(o, "-");
+			out_dec(o, get32(&u[8]));
+			break;
+		default:
+			out_puts(o, "type ");
+			out_dec(o, r[1]);
+			break;
+	};
+}
+
+static void format_requirements(struct codec_out_t *o, const uint8_t *data, uint32_t size)
+{
+	if (size < RES_REQUIREMENTS_HEADER)
+	{
+		format_hex(o, data, size);
+		return;
+	}
+
+	uint64_t start = o->len;
+	uint32_t lists = get32(&data[28]);
+	uint32_t pos = RES_REQUIREMENTS_HEADER;
+
+	out_puts(o, "interface ");
+	out_dec(o, get32(&data[4]));
+	out_puts(o, " bus ");
+	out_dec(o, get32(&data[8]));
+	out_puts(o, " slot ");
+	out_dec(o, get32(&data[12]));
+
+	for (uint32_t l = 0; l < lists; l++)
+	{
+		if (size - pos < RES_IO_LIST_HEADER)
+			break;
+
+		uint32_t count = get32(&data[pos + 4]);
+		pos += RES_IO_LIST_HEADER;
+
+		if ((size - pos) / RES_IO < count)
+			break;
+
+		out_puts(o, l ? "; alternative " : ": alternative ");
+		out_dec(o, l + 1);
+		out_puts(o, ":");
+
+		for (uint32_t i = 0; i < count; i++, pos += RES_IO)
+		{
+			out_puts(o, i ? ", " : " ");
+			format_io(o, &data[pos]);
+		}
+
+		if (l + 1 == lists)
+			return;
+	}
+
+	// Ran out of data before the last list
+	if (lists)
+	{
+		o->len = start;
+		o->err = 0;
+		format_hex(o, data, size);
+	}
+}
+
+// Text up to len bytes as UTF-16LE at out, or only its size without out
+static int64_t parse_chars(const char *text, int len, uint8_t *out)
+{
+	if (!len)
+		return 0;
+
+	int n = MultiByteToWideChar(CP_OEMCP, 0, text, len, 0, 0);
+	if (n <= 0)
+		return -1;
+
+	if (out)
+		MultiByteToWideChar(CP_OEMCP, 0, text, len, (wchar_t *) out, n);
+
+	return (int64_t) n * 2;
+}
+
+static int64_t parse_string(const char *text, uint8_t *out, uint32_t out_size)
+{
+	int64_t size = parse_chars(text, -1, 0);
+
+	if (size > 0 && size <= out_size)
+		parse_chars(text, -1, out);
+
+	return size;
+}
+
+// Links are stored without a terminator
+static int64_t parse_link(const char *text, uint8_t *out, uint32_t out_size)
+{
+	int64_t size = parse_chars(text, strlen(text), 0);
+
+	if (size >= 0 && size <= out_size)
+		parse_chars(text, strlen(text), out);
+
+	return size;
+}
+
+static int64_t parse_multi(const char *text, uint8_t *out, uint32_t out_size)
+{
+	int64_t size = 0;
+
+	// Sized first, so that nothing is written unless all of it fits
+	for (uint8_t write = 0; write < 2; write++)
+	{
+		const char *s = text;
+		int64_t pos = 0;
+
+		for (;;)
+		{
+			const char *end = strstr(s, "\\0");
+			int len = end ? (int) (end - s) : (int) strlen(s);
+
+			int64_t n = parse_chars(s, len, write ? &out[pos] : 0);
+			if (n < 0)
+				return -1;
+
+			if (write)
+				memset(&out[pos + n], 0, 2);
+			pos += n + 2;
+
+			if (!end)
+				break;
+			s = end + 2;
+		}
+
+		// The list ends with an empty string
+		if (write)
+			memset(&out[pos], 0, 2);
+		size = pos + 2;
+
+		if (size > out_size)
+			break;
+	}
+
+	return size;
+}
+
+// Unsigned decimal or 0x hex up to max, strtoull() would take a sign and leading spaces
+static int8_t parse_number(const char *text, uint64_t max, uint64_t *v)
+{
+	uint8_t base = 10;
+	uint64_t n = 0;
+
+	if (text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+	{
+		base = 16;
+		text += 2;
+	}
+
+	if (!*text)
+		return 0;
+
+	for (; *text; text++)
+	{
+		uint8_t d;
+		if      (*text >= '0' && *text <= '9')
+			d = *text - '0';
+		else if (base == 16 && *text >= 'a' && *text <= 'f')
+			d = *text - 'a' + 10;
+		else if (base == 16 && *text >= 'A' && *text <= 'F')
+			d = *text - 'A' + 10;
+		else
+			return 0;
+
+		if (n > (max - d) / base)
+			return 0;
+
+		n = n * base + d;
+	}
+
+	*v = n;
+
+	return 1;
+}
+
+static int64_t parse_dword(const char *text, uint8_t *out, uint32_t out_size)
+{
+	uint64_t v;
+	if (!parse_number(text, UINT32_MAX, &v))
+		return -1;
+
+	if (out_size >= sizeof(uint32_t))
+	{
+		uint32_t d = v;
+		memcpy(out, &d, sizeof(d));
+	}
+
+	return sizeof(uint32_t);
+}
+
+static int64_t parse_dword_be(const char *text, uint8_t *out, uint32_t out_size)
+{
+	uint64_t v;
+	if (!parse_number(text, UINT32_MAX, &v))
+		return -1;
+
+	if (out_size >= sizeof(uint32_t))
+	{
+		out[0] = v >> 24;
+		out[1] = v >> 16;
+		out[2] = v >> 8;
+		out[3] = v;
+	}
+
+	return sizeof(uint32_t);
+}
+
+static int64_t parse_qword(const char *text, uint8_t *out, uint32_t out_size)
+{
+	uint64_t v;
+	if (!parse_number(text, UINT64_MAX, &v))
+		return -1;
+
+	if (out_size >= sizeof(uint64_t))
+		memcpy(out, &v, sizeof(v));
+
+	return sizeof(uint64_t);
+}
+
+// The value of REG_NONE is ignored
+static int64_t parse_none(const char *text, uint8_t *out, uint32_t out_size)
+{
+	(void) text;
+	(void) out;
+	(void) out_size;
+
+	return 0;
+}
+
+static const struct codec_t codecs[] =
+{
+	[REG_NONE]							= { "REG_NONE",							format_hex,				parse_none },
+	[REG_SZ]							= { "REG_SZ",							format_string,			parse_string },
+	[REG_EXPAND_SZ]						= { "REG_EXPAND_SZ",					format_string,			parse_string },
+	[REG_BINARY]						= { "REG_BINARY",						format_hex,				0 },
+	[REG_DWORD]							= { "REG_DWORD",						format_dword,			parse_dword },
+	[REG_DWORD_BIG_ENDIAN]				= { "REG_DWORD_BIG_ENDIAN",				format_dword_be,		parse_dword_be },
+	[REG_LINK]							= { "REG_LINK",							format_string,			parse_link },
+	[REG_MULTI_SZ]						= { "REG_MULTI_SZ",						format_multi,			parse_multi },
+	[REG_RESOURCE_LIST]					= { "REG_RESOURCE_LIST",				format_resource_list,	0 },
+	[REG_FULL_RESOURCE_DESCRIPTOR]		= { "REG_FULL_RESOURCE_DESCRIPTOR",		format_full_resource,	0 },
+	[REG_RESOURCE_REQUIREMENTS_LIST]	= { "REG_RESOURCE_REQUIREMENTS_LIST",	format_requirements,	0 },
+	[REG_QWORD]							= { "REG_QWORD",						format_qword,			parse_qword },
+};
+
+#define CODEC_COUNT (sizeof(codecs) / sizeof(codecs[0]))
+
+// Unknown types have their data shown, but can't be given
+static const struct codec_t codec_unknown = { 0, format_hex, 0 };
+
+static const struct codec_t *codec_get(ULONG type)
+{
+	return type < CODEC_COUNT ? &codecs[type] : &codec_unknown;
+}
+
+const char *codec_name(ULONG type)
+{
+	return codec_get(type)->name;
+}
+
+int codec_type(const char *name, ULONG *type)
+{
+	for (ULONG t = 0; t < CODEC_COUNT; t++)
+	{
+		if (!strcmp(name, codecs[t].name))
+		{
+			*type = t;
+			return 0;
+		}
+	}
+
+	// Aliases from winnt.h
+	if      (!strcmp(name, "REG_DWORD_LITTLE_ENDIAN"))
+		*type = REG_DWORD;
+	else if (!strcmp(name, "REG_QWORD_LITTLE_ENDIAN"))
+		*type = REG_QWORD;
+	else
+	{
+		set_errno(ETYPE);
+		return -1;
+	}
+
+	return 0;
+}
+
+uint8_t codec_file(ULONG type)
+{
+	return type < CODEC_COUNT && !codecs[type].parse;
+}
+
+int64_t codec_format(ULONG type, const void *data, uint32_t size, char *out, uint64_t out_size)
+{
+	if (!out_size)
+	{
+		set_errno(EBUFSIZE);
+		return -1;
+	}
+
+	struct codec_out_t o = { out, 0, out_size - 1, 0 };
+	codec_get(type)->format(&o, (const uint8_t *) data, size);
+
+	if (o.err)
+	{
+		out[0] = 0;
+		set_errno(EBUFSIZE);
+		return -1;
+	}
+
+	out[o.len] = 0;
+
+	return o.len;
+}
+
+int64_t codec_parse(ULONG type, const char *text, void *out, uint32_t out_size)
+{
+	const struct codec_t *c = codec_get(type);
+	int64_t size = c->parse ? c->parse(text, (uint8_t *) out, out ? out_size : 0) : -1;
+
+	if (size < 0 || size > UINT32_MAX)
+	{
+		set_errno(EVALUE);
+		return -1;
+	}
+
+	return size;
+}
@@ -0,0 +1,87 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WIN32
+
+#include <unistd.h>
+
+#include <invis/compat.h>
+
+// Every code page is read as UTF-8, which is what terminals outside of Windows use
+int MultiByteToWideChar(UINT code_page, DWORD flags, LPCSTR str, int len, LPWSTR out, int out_len)
+{
+	const uint8_t *s = (const uint8_t *) str;
+	int n = 0;
+
+	if (len < 0)
+		len = strlen(str) + 1;
+
+	for (int i = 0; i < len; i++)
+	{
+		uint32_t c = s[i];
+		int extra = 0;
+
+		if      (c >= 0xF0 && c < 0xF8)
+			c &= 0x07, extra = 3;
+		else if (c >= 0xE0)
+			c &= 0x0F, extra = 2;
+		else if (c >= 0xC0)
+			c &= 0x1F, extra = 1;
+		else if (c >= 0x80)
+			c = 0xFFFD;
+
+		for (; extra && i + 1 < len && (s[i + 1] & 0xC0) == 0x80; extra--)
+			c = (c << 6) | (s[++i] & 0x3F);
+
+		if (extra)
+			c = 0xFFFD;
+
+		// Characters outside the BMP become surrogate pairs
+		int units = c > 0xFFFF ? 2 : 1;
+
+		if (out_len)
+		{
+			if (n + units > out_len)
+				return 0;
+
+			if (units == 2)
+			{
+				out[n] = 0xD800 + ((c - 0x10000) >> 10);
+				out[n + 1] = 0xDC00 + ((c - 0x10000) & 0x3FF);
+			}
+			else
+				out[n] = c;
+		}
+
+		n += units;
+	}
+
+	return n;
+}
+
+BOOL GetComputerNameA(LPSTR name, LPDWORD size)
+{
+	if (gethostname(name, *size) || !memchr(name, 0, *size))
+		return 0;
+
+	*size = strlen(name);
+
+	return 1;
+}
+
+#endif
@@ -0,0 +1,698 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <invis/glob.h>
+#include <invis/ntdll.h>
+#include <invis/thread.h>
+#include <invis/throttle.h>
+
+// Large enough for nearly every key name, so that each subkey costs a single call
+#define GLOB_BUFFER_SIZE	4096
+
+// Threads beyond this only wait on the registry lock
+#define GLOB_MAX_THREADS	64
+
+// Keys of a depth that are open at once, the rest of the depth waits as paths
+#define GLOB_BATCH		512
+
+#define GLOB_LITERAL	0
+#define GLOB_WILD		1
+#define GLOB_ANY		2
+
+struct glob_segment_t
+{
+	const wchar_t *name;
+	uint32_t size;		// Size of the name in bytes
+	uint8_t kind;		// GLOB_LITERAL, GLOB_WILD or GLOB_ANY
+};
+
+struct glob_node_t
+{
+	HANDLE key;			// 0 until the node's batch is opened
+	wchar_t *path;
+	uint32_t path_size;
+	uint64_t states;	// Bit n is set when the path has matched the first n segments
+};
+
+struct glob_vec_t
+{
+	struct glob_node_t *nodes;
+	uint64_t count;
+	uint64_t max;
+};
+
+struct glob_t
+{
+	struct glob_segment_t segments[GLOB_MAX_SEGMENTS];
+	uint32_t count;
+	ACCESS_MASK access;
+
+	// The literal prefix, every other key is opened relative to it
+	HANDLE root;
+	uint32_t root_size;
+
+	// Keys of the current depth, shared by all of the workers up to the end of the batch
+	struct glob_vec_t *frontier;
+	uint64_t next;
+	uint64_t end;
+	uint8_t stop;
+};
+
+struct glob_worker_t
+{
+	struct glob_t *g;
+	struct thread_t thread;
+	uint8_t started;
+
+	// Matching subkeys, which become the next depth
+	struct glob_vec_t children;
+
+	uint8_t *buf;
+	ULONG buf_size;
+
+	int r;
+	int err;
+};
+
+// Only ASCII is folded, which covers the names of every well-known key
+static inline wchar_t glob_fold(wchar_t c)
+{
+	return (c >= L'a' && c <= L'z') ? c - (L'a' - L'A') : c;
+}
+
+int8_t glob_match(const wchar_t *pattern,
+				  uint32_t       pattern_size,
+				  const wchar_t *name,
+				  uint32_t       name_size)
+{
+	uint32_t p = 0;
+	uint32_t n = 0;
+	uint32_t p_len = pattern_size / 2;
+	uint32_t n_len = name_size / 2;
+
+	// Position of the last * and the name it was retried at
+	uint32_t star = UINT32_MAX;
+	uint32_t mark = 0;
+
+	while (n < n_len)
+	{
+		if (p < p_len && pattern[p] == L'*')
+		{
+			star = p++;
+			mark = n;
+		}
+		else if (p < p_len
+		&&      (pattern[p] == L'?' || glob_fold(pattern[p]) == glob_fold(name[n])))
+		{
+			p++;
+			n++;
+		}
+		// Let the last * swallow one more character and try again
+		else if (star != UINT32_MAX)
+		{
+			p = star + 1;
+			n = ++mark;
+		}
+		else
+			return 0;
+	}
+
+	while (p < p_len && pattern[p] == L'*')
+		p++;
+
+	return p == p_len;
+}
+
+uint32_t glob_prefix(const wchar_t *path,
+					 uint32_t       path_size,
+					 const wchar_t *name,
+					 uint32_t       name_size)
+{
+	uint32_t len = path_size / 2;
+
+	if (!len || name_size / 2 <= len || name[len] != L'\\')
+		return 0;
+
+	for (uint32_t i = 0; i < len; i++)
+		if (glob_fold(path[i]) != glob_fold(name[i]))
+			return 0;
+
+	return path_size + 2;
+}
+
+// ** also matches no keys at all
+static uint64_t glob_close(struct glob_t *g, uint64_t states)
+{
+	for (uint32_t i = 0; i < g->count; i++)
+		if ((states & (1ULL << i)) && g->segments[i].kind == GLOB_ANY)
+			states |= 1ULL << (i + 1);
+
+	return states;
+}
+
+// States of a subkey with this name, given the states of its parent
+static uint64_t glob_step(struct glob_t *g, uint64_t states, const wchar_t *name, uint32_t size)
+{
+	uint64_t next = 0;
+
+	for (uint32_t i = 0; i < g->count; i++)
+	{
+		if (!(states & (1ULL << i)))
+			continue;
+
+		if (g->segments[i].kind == GLOB_ANY)
+			next |= 1ULL << i;
+		else if (glob_match(g->segments[i].name, g->segments[i].size, name, size))
+			next |= 1ULL << (i + 1);
+	}
+
+	return glob_close(g, next);
+}
+
+static int glob_push(struct glob_vec_t *v, struct glob_node_t *node)
+{
+	if (v->count == v->max)
+	{
+		uint64_t max = v->max ? v->max * 2 : 64;
+		struct glob_node_t *n = realloc(v->nodes, sizeof(struct glob_node_t) * max);
+		if (!n)
+		{
+			set_errno(ENOMEM);
+			return -2;
+		}
+
+		v->nodes = n;
+		v->max = max;
+	}
+
+	v->nodes[v->count++] = *node;
+
+	return 0;
+}
+
+static int glob_append(struct glob_vec_t *v, struct glob_vec_t *src)
+{
+	if (!src->count)
+		return 0;
+
+	if (v->count + src->count > v->max)
+	{
+		uint64_t max = v->count + src->count;
+		struct glob_node_t *n = realloc(v->nodes, sizeof(struct glob_node_t) * max);
+		if (!n)
+		{
+			set_errno(ENOMEM);
+			return -2;
+		}
+
+		v->nodes = n;
+		v->max = max;
+	}
+
+	memcpy(&v->nodes[v->count], src->nodes, sizeof(struct glob_node_t) * src->count);
+	v->count += src->count;
+	src->count = 0;
+
+	return 0;
+}
+
+static void glob_clear(struct glob_vec_t *v)
+{
+	for (uint64_t i = 0; i < v->count; i++)
+	{
+		if (v->nodes[i].key)
+			NtClose(v->nodes[i].key);
+		free(v->nodes[i].path);
+	}
+
+	v->count = 0;
+}
+
+// Queue a subkey for the next depth, it is only opened once its batch comes up
+static int glob_queue(struct glob_node_t *parent,
+					  const wchar_t      *name,
+					  uint32_t            name_size,
+					  uint64_t            states,
+					  struct glob_vec_t  *out)
+{
+	struct glob_node_t node;
+	node.key = 0;
+	node.states = states;
+	node.path_size = parent->path_size + (parent->path_size ? 2 : 0) + name_size;
+	node.path = malloc(node.path_size + 2);
+
+	if (!node.path)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	if (parent->path_size)
+	{
+		memcpy(node.path, parent->path, parent->path_size);
+		node.path[parent->path_size / 2] = L'\\';
+	}
+
+	memcpy(&node.path[(node.path_size - name_size) / 2], name, name_size);
+	node.path[node.path_size / 2] = 0;
+
+	int r = glob_push(out, &node);
+	if (r)
+		free(node.path);
+
+	return r;
+}
+
+// Open a queued key relative to the prefix, keys that are missing or protected are left closed
+static int glob_open(struct glob_t *g, struct glob_node_t *node)
+{
+	// The path of the prefix and the separator after it, the prefix itself is opened again by an empty name
+	uint32_t skip = g->root_size ? g->root_size + 2 : 0;
+	if (skip > node->path_size)
+		skip = node->path_size;
+
+	UNICODE_STRING n = { 0 };
+	n.Buffer = &node->path[skip / 2];
+	n.Length = node->path_size - skip;
+	n.MaximumLength = n.Length;
+
+	OBJECT_ATTRIBUTES attribs = { 0 };
+	attribs.Length = sizeof(OBJECT_ATTRIBUTES);
+	attribs.RootDirectory = g->root;
+	attribs.Attributes = OBJ_KERNEL_HANDLE;
+	attribs.ObjectName = &n;
+	attribs.SecurityDescriptor = 0;
+	attribs.SecurityQualityOfService = 0;
+
+	// Only keys that match need more than enumeration
+	ACCESS_MASK access = KEY_READ;
+	if (node->states & (1ULL << g->count))
+		access |= g->access;
+
+	NTSTATUS status = NtOpenKey(&node->key, access, &attribs);
+
+	if (status == STATUS_SUCCESS)
+		return 0;
+
+	node->key = 0;
+
+	if (status == STATUS_OBJECT_NAME_NOT_FOUND
+	||  status == STATUS_ACCESS_DENIED)
+		return 0;
+
+	return reg_status(status);
+}
+
+static NTSTATUS glob_enumerate(struct glob_worker_t *w, HANDLE key, ULONG index)
+{
+	NTSTATUS status;
+	ULONG needed = 0;
+
+	while (1)
+	{
+		uint64_t start = throttle_enter();
+		status = NtEnumerateKey(key, index, KeyBasicInformation, w->buf, w->buf_size, &needed);
+		throttle_leave(start);
+
+		if ((status == STATUS_BUFFER_TOO_SMALL || status == STATUS_BUFFER_OVERFLOW)
+		&&   needed > w->buf_size)
+		{
+			uint8_t *b = realloc(w->buf, needed);
+			if (!b)
+				break;
+
+			w->buf = b;
+			w->buf_size = needed;
+		}
+		else
+			break;
+	}
+
+	return status;
+}
+
+static int glob_expand(struct glob_worker_t *w, struct glob_node_t *node)
+{
+	struct glob_t *g = w->g;
+	int r = 0;
+
+	if (!node->key && ((r = glob_open(g, node)) || !node->key))
+		return r;
+
+	// The key itself matching has no bearing on its subkeys
+	uint64_t states = node->states & ~(1ULL << g->count);
+	if (!states)
+		return 0;
+
+	// When every remaining segment is literal the subkeys are opened by name instead of enumerated
+	uint8_t literal = 1;
+	for (uint32_t i = 0; i < g->count; i++)
+		if ((states & (1ULL << i)) && g->segments[i].kind != GLOB_LITERAL)
+			literal = 0;
+
+	if (literal)
+	{
+		for (uint32_t i = 0; !r && i < g->count; i++)
+		{
+			if (!(states & (1ULL << i)))
+				continue;
+
+			struct glob_segment_t *s = &g->segments[i];
+
+			// Another state may have already opened the same name
+			uint8_t seen = 0;
+			for (uint32_t j = 0; j < i; j++)
+				if ((states & (1ULL << j)) && glob_match(g->segments[j].name, g->segments[j].size, s->name, s->size))
+					seen = 1;
+
+			if (!seen)
+				r = glob_queue(node, s->name, s->size, glob_step(g, states, s->name, s->size), &w->children);
+		}
+
+		return r;
+	}
+
+	if (!w->buf)
+	{
+		w->buf_size = GLOB_BUFFER_SIZE;
+		if (!(w->buf = malloc(w->buf_size)))
+		{
+			set_errno(ENOMEM);
+			return -2;
+		}
+	}
+
+	for (ULONG i = 0; !r; i++)
+	{
+		NTSTATUS status = glob_enumerate(w, node->key, i);
+
+		if (status == STATUS_NO_MORE_ENTRIES)
+			break;
+		else if (status != STATUS_SUCCESS)
+			r = reg_status(status);
+		else
+		{
+			PKEY_BASIC_INFORMATION info = (PKEY_BASIC_INFORMATION) w->buf;
+
+			uint64_t next = glob_step(g, states, info->Name, info->NameLength);
+			if (next)
+				r = glob_queue(node, info->Name, info->NameLength, next, &w->children);
+		}
+	}
+
+	return r;
+}
+
+static void glob_worker(void *arg)
+{
+	struct glob_worker_t *w = (struct glob_worker_t *) arg;
+	struct glob_t *g = w->g;
+
+	while (!__atomic_load_n(&g->stop, __ATOMIC_RELAXED))
+	{
+		uint64_t i = __atomic_fetch_add(&g->next, 1, __ATOMIC_RELAXED);
+		if (i >= g->end)
+			break;
+
+		if ((w->r = glob_expand(w, &g->frontier->nodes[i])))
+		{
+			w->err = errno;
+			__atomic_store_n(&g->stop, 1, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static int glob_compare(const void *a, const void *b)
+{
+	const struct glob_node_t *x = (const struct glob_node_t *) a;
+	const struct glob_node_t *y = (const struct glob_node_t *) b;
+
+	uint32_t len = (x->path_size < y->path_size ? x->path_size : y->path_size) / 2;
+	for (uint32_t i = 0; i < len; i++)
+		if (x->path[i] != y->path[i])
+			return x->path[i] < y->path[i] ? -1 : 1;
+
+	return (x->path_size > y->path_size) - (x->path_size < y->path_size);
+}
+
+int glob_keys(HKEY         hive,
+			  const char  *pattern,
+			  ACCESS_MASK  access,
+			  uint32_t     threads,
+			  glob_cb_t    cb,
+			  void        *ctx)
+{
+	// Load the internals functions
+	init_ntdll();
+
+	int r = 0;
+
+	if (!pattern || !cb)
+	{
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	if (!threads)
+		threads = thread_count();
+
+	if (threads > GLOB_MAX_THREADS)
+		threads = GLOB_MAX_THREADS;
+
+	struct glob_t g;
+	memset(&g, 0, sizeof(struct glob_t));
+	g.access = access;
+
+	struct glob_vec_t frontier = { 0 };
+
+	// *2 here for UTF-16LE
+	uint32_t pattern_max = strlen(pattern) + 1;
+	wchar_t *wpattern = malloc(pattern_max * 2);
+	struct glob_worker_t *workers = malloc(sizeof(struct glob_worker_t) * threads);
+
+	if (wpattern && workers)
+		memset(workers, 0, sizeof(struct glob_worker_t) * threads);
+	else
+	{
+		set_errno(ENOMEM);
+		r = -2;
+	}
+
+	// Literal segments up to the first wildcard are moved to the front of the pattern as the prefix
+	uint32_t prefix_size = 0;
+	if (!r)
+	{
+		uint32_t len = MultiByteToWideChar(CP_OEMCP, 0, pattern, -1, wpattern, pattern_max) - 1;
+
+		for (uint32_t start = 0, end = 0; !r && start < len; start = end + 1)
+		{
+			for (end = start; end < len && wpattern[end] != L'\\'; end++);
+
+			// Doubled and trailing backslashes
+			if (end == start)
+				continue;
+
+			struct glob_segment_t s;
+			s.name = &wpattern[start];
+			s.size = (end - start) * 2;
+			s.kind = GLOB_LITERAL;
+
+			for (uint32_t i = start; i < end; i++)
+				if (wpattern[i] == L'*' || wpattern[i] == L'?')
+					s.kind = GLOB_WILD;
+
+			if (end - start == 2 && wpattern[start] == L'*' && wpattern[start + 1] == L'*')
+				s.kind = GLOB_ANY;
+
+			if (s.kind == GLOB_LITERAL && !g.count)
+			{
+				if (prefix_size)
+				{
+					wpattern[prefix_size / 2] = L'\\';
+					prefix_size += 2;
+				}
+
+				memmove(&wpattern[prefix_size / 2], s.name, s.size);
+				prefix_size += s.size;
+			}
+			// Repeated ** matches the same keys
+			else if (s.kind == GLOB_ANY && g.count && g.segments[g.count - 1].kind == GLOB_ANY)
+				continue;
+			else if (g.count == GLOB_MAX_SEGMENTS)
+			{
+				set_errno(EKEY);
+				r = -1;
+			}
+			else
+				g.segments[g.count++] = s;
+		}
+	}
+
+	if (!r)
+	{
+		struct glob_node_t root = { 0 };
+		root.states = glob_close(&g, 1);
+
+		ACCESS_MASK a = KEY_READ;
+		if (root.states & (1ULL << g.count))
+			a |= access;
+
+		if (prefix_size)
+		{
+			// The prefix always ends before the first segment, so the separator can hold the NUL
+			wchar_t c = wpattern[prefix_size / 2];
+			wpattern[prefix_size / 2] = 0;
+
+			HKEY key;
+			if (RegOpenKeyExW(hive, wpattern, 0, a, &key) == ERROR_SUCCESS)
+				g.root = (HANDLE) key;
+			else
+			{
+				set_errno(EOPENKEY);
+				r = -3;
+			}
+
+			wpattern[prefix_size / 2] = c;
+		}
+		else
+			r = reg_root(hive, a, &g.root);
+
+		if (!r)
+		{
+			g.root_size = prefix_size;
+
+			root.path_size = prefix_size;
+			root.path = malloc(prefix_size + 2);
+
+			if (root.path)
+			{
+				memcpy(root.path, wpattern, prefix_size);
+				root.path[prefix_size / 2] = 0;
+				r = glob_push(&frontier, &root);
+			}
+			else
+			{
+				set_errno(ENOMEM);
+				r = -2;
+			}
+
+			if (r && root.path)
+				free(root.path);
+		}
+	}
+
+	/*
+	 * Each pass expands one depth. The depth is sorted and then opened and
+	 * expanded a batch at a time, so the matches come out in sorted order
+	 * regardless of the scheduling while only a batch of keys is ever open.
+	 */
+	while (!r && frontier.count)
+	{
+		qsort(frontier.nodes, frontier.count, sizeof(struct glob_node_t), glob_compare);
+
+		for (uint64_t start = 0; !r && start < frontier.count; start += GLOB_BATCH)
+		{
+			uint64_t end = start + GLOB_BATCH < frontier.count ? start + GLOB_BATCH : frontier.count;
+			uint32_t n = end - start < threads ? end - start : threads;
+
+			g.frontier = &frontier;
+			g.next = start;
+			g.end = end;
+			g.stop = 0;
+
+			// The calling thread is the first worker, the rest of the work falls to it if a thread fails to start
+			for (uint32_t i = 0; i < n; i++)
+			{
+				workers[i].g = &g;
+				workers[i].r = 0;
+				workers[i].started = 0;
+
+				if (i)
+					workers[i].started = !thread_start(&workers[i].thread, glob_worker, &workers[i]);
+			}
+
+			glob_worker(&workers[0]);
+
+			for (uint32_t i = 1; i < n; i++)
+				if (workers[i].started)
+					thread_join(&workers[i].thread);
+
+			for (uint32_t i = 0; i < n; i++)
+			{
+				if (workers[i].r && !r)
+				{
+					r = workers[i].r;
+					set_errno(workers[i].err);
+				}
+			}
+
+			// Keys that could not be opened were left closed and are skipped
+			for (uint64_t i = start; !r && i < end; i++)
+				if (frontier.nodes[i].key && (frontier.nodes[i].states & (1ULL << g.count)))
+					r = cb(ctx, frontier.nodes[i].key, frontier.nodes[i].path, frontier.nodes[i].path_size);
+
+			for (uint64_t i = start; i < end; i++)
+			{
+				if (frontier.nodes[i].key)
+					NtClose(frontier.nodes[i].key);
+				frontier.nodes[i].key = 0;
+			}
+		}
+
+		glob_clear(&frontier);
+
+		for (uint32_t i = 0; i < threads; i++)
+		{
+			if (!r)
+				r = glob_append(&frontier, &workers[i].children);
+
+			glob_clear(&workers[i].children);
+		}
+	}
+
+	glob_clear(&frontier);
+	if (frontier.nodes)
+		free(frontier.nodes);
+
+	if (workers)
+	{
+		for (uint32_t i = 0; i < threads; i++)
+		{
+			glob_clear(&workers[i].children);
+
+			if (workers[i].children.nodes)
+				free(workers[i].children.nodes);
+
+			if (workers[i].buf)
+				free(workers[i].buf);
+		}
+
+		free(workers);
+	}
+
+	if (g.root)
+		NtClose(g.root);
+
+	if (wpattern)
+		free(wpattern);
+
+	if (!r)
+		set_errno(ESUCCESS);
+
+	return r;
+}
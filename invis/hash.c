@@ -0,0 +1,183 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <invis/hash.h>
+
+#define HASH_P1	0x9E3779B185EBCA87ULL
+#define HASH_P2	0xC2B2AE3D27D4EB4FULL
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b)
+{
+	unsigned __int128 m = (unsigned __int128) a * b;
+	return (uint64_t) m ^ (uint64_t) (m >> 64);
+}
+
+static inline uint64_t hash_read64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(uint64_t));
+	return v;
+}
+
+uint64_t hash64(const void *data, size_t size, uint64_t seed)
+{
+	const uint8_t *p = (const uint8_t *) data;
+	uint64_t h = seed ^ hash_mix(size ^ HASH_P1, HASH_P2);
+
+	for (; size >= 16; size -= 16, p += 16)
+		h = hash_mix(hash_read64(p) ^ HASH_P1, hash_read64(p + 8) ^ h);
+
+	// Zero padded tail, the length is already part of the seed
+	uint64_t tail[2] = { 0 };
+	if (size)
+		memcpy(tail, p, size);
+	h = hash_mix(tail[0] ^ HASH_P2, tail[1] ^ h);
+
+	return hash_mix(h ^ HASH_P1, h ^ HASH_P2);
+}
+
+static const uint32_t sha256_k[64] =
+{
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+#define ROR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t state[8], const uint8_t *p)
+{
+	uint32_t w[64];
+
+	for (uint32_t i = 0; i < 16; i++)
+		w[i] = (uint32_t) p[i * 4] << 24 | (uint32_t) p[i * 4 + 1] << 16
+			 | (uint32_t) p[i * 4 + 2] << 8 | p[i * 4 + 3];
+
+	for (uint32_t i = 16; i < 64; i++)
+	{
+		uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+	for (uint32_t i = 0; i < 64; i++)
+	{
+		uint32_t t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha256_init(struct sha256_t *s)
+{
+	static const uint32_t iv[8] =
+	{
+		0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+	};
+
+	memcpy(s->state, iv, sizeof(iv));
+	s->size = 0;
+}
+
+void sha256_update(struct sha256_t *s, const void *data, size_t size)
+{
+	const uint8_t *p = (const uint8_t *) data;
+	uint32_t used = s->size & 63;
+
+	s->size += size;
+
+	if (used)
+	{
+		uint32_t n = 64 - used;
+		if (n > size)
+			n = size;
+
+		memcpy(&s->block[used], p, n);
+		p += n;
+		size -= n;
+
+		if (used + n < 64)
+			return;
+
+		sha256_block(s->state, s->block);
+	}
+
+	// Whole blocks straight from the data, without copying them
+	for (; size >= 64; size -= 64, p += 64)
+		sha256_block(s->state, p);
+
+	memcpy(s->block, p, size);
+}
+
+void sha256_final(struct sha256_t *s, uint8_t digest[SHA256_SIZE])
+{
+	uint64_t bits = s->size * 8;
+	uint32_t used = s->size & 63;
+
+	s->block[used++] = 0x80;
+	if (used > 56)
+	{
+		memset(&s->block[used], 0, 64 - used);
+		sha256_block(s->state, s->block);
+		used = 0;
+	}
+
+	memset(&s->block[used], 0, 56 - used);
+	for (uint32_t i = 0; i < 8; i++)
+		s->block[56 + i] = bits >> (56 - i * 8);
+
+	sha256_block(s->state, s->block);
+
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		digest[i * 4]     = s->state[i] >> 24;
+		digest[i * 4 + 1] = s->state[i] >> 16;
+		digest[i * 4 + 2] = s->state[i] >> 8;
+		digest[i * 4 + 3] = s->state[i];
+	}
+}
+
+void sha256(const void *data, size_t size, uint8_t digest[SHA256_SIZE])
+{
+	struct sha256_t s;
+
+	sha256_init(&s);
+	sha256_update(&s, data, size);
+	sha256_final(&s, digest);
+}
@@ -0,0 +1,831 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <error.h>
+#include <invis/hive.h>
+#include <invis/classify.h>
+#include <invis/thread.h>
+
+struct hive_pending_t
+{
+	uint32_t cell;
+	uint32_t depth;
+};
+
+struct hive_stack_t
+{
+	struct hive_pending_t *items;
+	uint64_t len;
+	uint64_t max;
+};
+
+// Grow a scratch buffer of h, keeping its contents
+static int hive_grow(void **buf, uint32_t *max, uint32_t need)
+{
+	if (need <= *max)
+		return 0;
+
+	void *b = realloc(*buf, need);
+	if (!b)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	*buf = b;
+	*max = need;
+
+	return 0;
+}
+
+static int hive_push(struct hive_stack_t *s, uint32_t cell, uint32_t depth)
+{
+	if (s->len == s->max)
+	{
+		uint64_t max = s->max ? s->max * 2 : 64;
+		struct hive_pending_t *items = realloc(s->items, sizeof(struct hive_pending_t) * max);
+		if (!items)
+		{
+			set_errno(ENOMEM);
+			return -2;
+		}
+
+		s->items = items;
+		s->max = max;
+	}
+
+	s->items[s->len].cell = cell;
+	s->items[s->len].depth = depth;
+	s->len++;
+
+	return 0;
+}
+
+int hive_open(struct hive_t *h, const char *file)
+{
+	memset(h, 0, sizeof(struct hive_t));
+
+#ifdef _WIN32
+	h->file = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (h->file == INVALID_HANDLE_VALUE)
+	{
+		h->file = 0;
+		set_errno(EFILE);
+		return -1;
+	}
+
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(h->file, &size) && size.QuadPart)
+	{
+		h->base_size = size.QuadPart;
+		h->mapping = CreateFileMappingA(h->file, 0, PAGE_READONLY, 0, 0, 0);
+		if (h->mapping)
+			h->base = MapViewOfFile(h->mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+#else
+	// The mapping outlives the descriptor, so nothing but the view is kept
+	int fd = open(file, O_RDONLY);
+	if (fd < 0)
+	{
+		set_errno(EFILE);
+		return -1;
+	}
+
+	struct stat st;
+	if (!fstat(fd, &st) && st.st_size)
+	{
+		h->base_size = st.st_size;
+		h->base = mmap(0, h->base_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (h->base == MAP_FAILED)
+			h->base = 0;
+	}
+
+	close(fd);
+#endif
+
+	if (!h->base)
+	{
+		hive_close(h);
+		set_errno(EFILE);
+		return -1;
+	}
+
+	const struct hive_base_t *base = (const struct hive_base_t *) h->base;
+
+	if (h->base_size < HIVE_BLOCK_SIZE * 2
+	||  memcmp(base->magic, HIVE_BASE_MAGIC, 4)
+	||  memcmp(&h->base[HIVE_BLOCK_SIZE], HIVE_BIN_MAGIC, 4))
+	{
+		hive_close(h);
+		set_errno(EHIVEFILE);
+		return -1;
+	}
+
+	h->bins = &h->base[HIVE_BLOCK_SIZE];
+	h->size = h->base_size - HIVE_BLOCK_SIZE;
+	h->root = base->root;
+	h->minor = base->minor;
+
+	// Anything past the bins the base block knows about is left over
+	if (base->size && base->size < h->size)
+		h->size = base->size;
+
+	return 0;
+}
+
+int hive_load(struct hive_t  *h,
+			  uint8_t        *bins,
+			  uint64_t        size,
+			  uint32_t        root,
+			  uint32_t        minor)
+{
+	memset(h, 0, sizeof(struct hive_t));
+
+	if (!bins)
+	{
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	h->owned = bins;
+	h->bins = bins;
+	h->size = size;
+	h->root = root;
+	h->minor = minor;
+
+	return 0;
+}
+
+void hive_close(struct hive_t *h)
+{
+#ifdef _WIN32
+	if (h->base)
+		UnmapViewOfFile(h->base);
+
+	if (h->mapping)
+		CloseHandle(h->mapping);
+
+	if (h->file)
+		CloseHandle(h->file);
+#else
+	if (h->base)
+		munmap(h->base, h->base_size);
+#endif
+
+	if (h->owned)
+		free(h->owned);
+
+	if (h->name)
+		free(h->name);
+
+	if (h->data)
+		free(h->data);
+
+	if (h->path)
+		free(h->path);
+
+	memset(h, 0, sizeof(struct hive_t));
+}
+
+// An allocated cell, or with deleted set a free one
+static const uint8_t *hive_find(struct hive_t *h, uint32_t offset, uint32_t *size, int8_t deleted)
+{
+	// Cells are 8 byte aligned and hold at least their size
+	if (offset == HIVE_NO_CELL
+	||  offset & 7
+	||  (uint64_t) offset + 8 > h->size)
+		return 0;
+
+	int32_t cell;
+	memcpy(&cell, &h->bins[offset], sizeof(int32_t));
+
+	// Free cells have a positive size
+	if (cell == INT32_MIN || (deleted ? cell <= 0 : cell >= 0))
+		return 0;
+
+	uint32_t cell_size = cell < 0 ? -cell : cell;
+	if (cell_size < 8 || (uint64_t) offset + cell_size > h->size)
+		return 0;
+
+	*size = cell_size - 4;
+
+	return &h->bins[offset + 4];
+}
+
+const uint8_t *hive_cell(struct hive_t *h, uint32_t offset, uint32_t *size)
+{
+	return hive_find(h, offset, size, 0);
+}
+
+// The segments of data larger than HIVE_DATA_SEGMENT, copied together
+static int hive_segments(struct hive_t            *h,
+						 const struct hive_db_t   *db,
+						 uint32_t                  length,
+						 int8_t                    deleted,
+						 struct key_data_t        *entry)
+{
+	uint32_t list_size;
+	const uint32_t *list = (const uint32_t *) hive_find(h, db->list, &list_size, deleted);
+	if (!list)
+		return -1;
+
+	if (hive_grow((void **) &h->data, &h->data_max, length))
+		return -2;
+
+	uint32_t count = db->count < list_size / 4 ? db->count : list_size / 4;
+	uint32_t done = 0;
+
+	for (uint32_t i = 0; i < count && done < length; i++)
+	{
+		uint32_t size;
+		const uint8_t *segment = hive_find(h, list[i], &size, deleted);
+
+		// Whatever came before a missing segment is still worth having
+		if (!segment)
+			break;
+
+		uint32_t n = length - done;
+		if (n > size)
+			n = size;
+		if (n > HIVE_DATA_SEGMENT)
+			n = HIVE_DATA_SEGMENT;
+
+		memcpy(&h->data[done], segment, n);
+		done += n;
+	}
+
+	entry->value = h->data;
+	entry->size = done;
+
+	return 0;
+}
+
+// With deleted set the data has to be in free cells, as it is once a value is deleted
+static int hive_decode(struct hive_t       *h,
+					   const uint8_t       *cell,
+					   uint32_t             size,
+					   int8_t               deleted,
+					   struct key_data_t   *entry)
+{
+	const struct hive_vk_t *vk = (const struct hive_vk_t *) cell;
+
+	if (!cell
+	||  size < sizeof(struct hive_vk_t)
+	||  memcmp(vk->magic, "vk", 2)
+	||  size - sizeof(struct hive_vk_t) < vk->name_size)
+		return -1;
+
+	if (vk->flags & HIVE_VALUE_ASCII)
+	{
+		if (hive_grow((void **) &h->name, &h->name_max, vk->name_size * 2 + 2))
+			return -2;
+
+		for (uint32_t i = 0; i < vk->name_size; i++)
+			h->name[i] = vk->name[i];
+
+		entry->name = h->name;
+		entry->name_size = vk->name_size * 2;
+	}
+	else
+	{
+		entry->name = (wchar_t *) vk->name;
+		entry->name_size = vk->name_size;
+	}
+
+	entry->type = vk->type;
+	entry->anomalies = classify_name(entry->name, entry->name_size);
+
+	uint32_t length = vk->size & ~HIVE_DATA_INLINE;
+
+	// Values without data point at their name, so that the value is never 0
+	entry->value = (void *) vk->name;
+	entry->size = 0;
+
+	if (vk->size & HIVE_DATA_INLINE)
+	{
+		entry->value = (void *) &vk->data;
+		entry->size = length < sizeof(uint32_t) ? length : sizeof(uint32_t);
+	}
+	else if (length)
+	{
+		uint32_t data_size;
+		const uint8_t *data = hive_find(h, vk->data, &data_size, deleted);
+
+		// Only a cell too small for the data can be a db cell, older hives have no such thing
+		if (data
+		&&  length > data_size
+		&&  length > HIVE_DATA_SEGMENT
+		&&  data_size >= sizeof(struct hive_db_t)
+		&& !memcmp(data, "db", 2))
+			return hive_segments(h, (const struct hive_db_t *) data, length, deleted, entry) == -2 ? -2 : 0;
+
+		// The name alone is enough to find a hidden value, so missing data is not an error
+		if (data)
+		{
+			entry->value = (void *) data;
+			entry->size = length < data_size ? length : data_size;
+		}
+	}
+
+	return 0;
+}
+
+int hive_value(struct hive_t *h, const uint8_t *cell, uint32_t size, struct key_data_t *entry)
+{
+	return hive_decode(h, cell, size, 0, entry);
+}
+
+// Queue the subkeys of a list, ri lists hold further lists but never another ri list
+static int hive_subkeys(struct hive_t *h, struct hive_stack_t *s, uint32_t list, uint32_t depth, uint8_t nested)
+{
+	uint32_t size;
+	const struct hive_list_t *l = (const struct hive_list_t *) hive_cell(h, list, &size);
+
+	if (!l || size < sizeof(struct hive_list_t))
+		return 0;
+
+	uint8_t hashed = !memcmp(l->magic, "lf", 2) || !memcmp(l->magic, "lh", 2);
+	uint8_t indirect = !memcmp(l->magic, "ri", 2);
+
+	if ((!hashed && !indirect && memcmp(l->magic, "li", 2))
+	||  (indirect && nested))
+		return 0;
+
+	uint32_t stride = hashed ? 2 : 1;
+	uint32_t count = (size - sizeof(struct hive_list_t)) / (stride * 4);
+	if (count > l->count)
+		count = l->count;
+
+	int r = 0;
+	for (uint32_t i = 0; !r && i < count; i++)
+	{
+		if (indirect)
+			r = hive_subkeys(h, s, l->offsets[i], depth, 1);
+		else
+			r = hive_push(s, l->offsets[i * stride], depth);
+	}
+
+	return r;
+}
+
+/*
+ * The keys still to be walked, and the path of the last one walked, which
+ * the paths of all of them start with. Cells never move in a hive file, so
+ * that is all it takes to carry on.
+ */
+static int hive_save(struct checkpoint_t *cp,
+					 struct hive_t       *h,
+					 struct hive_stack_t *s,
+					 uint64_t             budget,
+					 const wchar_t       *path,
+					 const uint32_t      *sizes,
+					 uint32_t             depth)
+{
+	checkpoint_begin(cp);
+	checkpoint_put(cp, &h->size, sizeof(uint64_t));
+	checkpoint_put(cp, &h->root, sizeof(uint32_t));
+	checkpoint_put(cp, &budget, sizeof(uint64_t));
+	checkpoint_put(cp, &depth, sizeof(uint32_t));
+	checkpoint_put(cp, sizes, sizeof(uint32_t) * (depth + 1));
+	checkpoint_put(cp, path, sizes[depth]);
+	checkpoint_put(cp, &s->len, sizeof(uint64_t));
+	checkpoint_put(cp, s->items, sizeof(struct hive_pending_t) * s->len);
+
+	return checkpoint_commit(cp, CHECKPOINT_HIVE);
+}
+
+static int hive_restore(struct checkpoint_t  *cp,
+						struct hive_t        *h,
+						struct hive_stack_t  *s,
+						uint64_t             *budget,
+						wchar_t             **path,
+						uint32_t             *path_max,
+						uint32_t             *sizes,
+						uint32_t             *depth)
+{
+	uint64_t size, len;
+	uint32_t root;
+
+	if (cp->kind != CHECKPOINT_HIVE
+	||  checkpoint_get(cp, &size, sizeof(uint64_t))
+	||  checkpoint_get(cp, &root, sizeof(uint32_t))
+	||  checkpoint_get(cp, budget, sizeof(uint64_t))
+	||  checkpoint_get(cp, depth, sizeof(uint32_t))
+	||  size != h->size
+	||  root != h->root
+	||  *depth >= HIVE_MAX_DEPTH
+	||  checkpoint_get(cp, sizes, sizeof(uint32_t) * (*depth + 1)))
+	{
+		set_errno(ECHECKPOINT);
+		return -1;
+	}
+
+	for (uint32_t i = 0; i <= *depth; i++)
+	{
+		if (sizes[i] > sizes[*depth] || (sizes[i] & 1))
+		{
+			set_errno(ECHECKPOINT);
+			return -1;
+		}
+	}
+
+	int r = hive_grow((void **) path, path_max, sizes[*depth] + 2);
+	if (r)
+		return r;
+
+	if (checkpoint_get(cp, *path, sizes[*depth])
+	||  checkpoint_get(cp, &len, sizeof(uint64_t))
+	||  len > cp->size / sizeof(struct hive_pending_t))
+	{
+		set_errno(ECHECKPOINT);
+		return -1;
+	}
+
+	for (uint64_t i = 0; !r && i < len; i++)
+	{
+		struct hive_pending_t p;
+
+		// Every pending key is a child of the last key walked or of one of its parents
+		if (checkpoint_get(cp, &p, sizeof(struct hive_pending_t))
+		||  p.depth > *depth + 1
+		||  p.depth >= HIVE_MAX_DEPTH)
+		{
+			set_errno(ECHECKPOINT);
+			return -1;
+		}
+
+		r = hive_push(s, p.cell, p.depth);
+	}
+
+	return r;
+}
+
+int hive_sweep(struct hive_t *h, sweep_cb_t cb, void *ctx)
+{
+	return hive_sweep_checkpoint(h, cb, ctx, 0);
+}
+
+int hive_sweep_checkpoint(struct hive_t *h, sweep_cb_t cb, void *ctx, struct checkpoint_t *cp)
+{
+	int r = 0;
+
+	if (!h->bins || !cb)
+	{
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	struct hive_stack_t s = { 0 };
+	uint32_t sizes[HIVE_MAX_DEPTH];
+	uint32_t depth = 0;
+
+	wchar_t *path = 0;
+	uint32_t path_max = 0;
+
+	// No hive can hold more keys than this, which ends any cycle in a damaged one
+	uint64_t budget = h->size / (sizeof(struct hive_nk_t) + 4) + 1;
+
+	sizes[0] = 0;
+
+	r = hive_grow((void **) &path, &path_max, 512);
+	if (!r && cp && cp->state)
+	{
+		r = hive_restore(cp, h, &s, &budget, &path, &path_max, sizes, &depth);
+		free(cp->state);
+		cp->state = 0;
+	}
+	else if (!r)
+		r = hive_push(&s, h->root, 0);
+
+	while (!r && s.len && budget--)
+	{
+		if (checkpoint_due(cp, thread_now())
+		&& (r = hive_save(cp, h, &s, budget + 1, path, sizes, depth)))
+			break;
+
+		struct hive_pending_t p = s.items[--s.len];
+
+		uint32_t size;
+		const struct hive_nk_t *nk = (const struct hive_nk_t *) hive_cell(h, p.cell, &size);
+
+		if (!nk
+		||  size < sizeof(struct hive_nk_t)
+		||  memcmp(nk->magic, "nk", 2)
+		||  size - sizeof(struct hive_nk_t) < nk->name_size)
+			continue;
+
+		// The root key itself has no part in the path, like the hive itself
+		uint32_t path_size = 0;
+		if (p.depth)
+		{
+			uint32_t parent_size = sizes[p.depth - 1];
+			uint32_t name_size = nk->flags & HIVE_KEY_ASCII ? nk->name_size * 2 : nk->name_size;
+			path_size = parent_size + (parent_size ? 2 : 0) + name_size;
+
+			if ((r = hive_grow((void **) &path, &path_max, path_size + 2)))
+				break;
+
+			if (parent_size)
+				path[parent_size / 2] = L'\\';
+
+			uint8_t *name = (uint8_t *) path + path_size - name_size;
+			if (nk->flags & HIVE_KEY_ASCII)
+				for (uint32_t i = 0; i < nk->name_size; i++)
+					((wchar_t *) name)[i] = nk->name[i];
+			else
+				memcpy(name, nk->name, name_size);
+		}
+
+		sizes[p.depth] = path_size;
+		depth = p.depth;
+
+		if ((r = cb(ctx, path, path_size, 0)))
+			break;
+
+		uint32_t list_size;
+		const uint32_t *list = (const uint32_t *) hive_cell(h, nk->value_list, &list_size);
+		uint32_t values = list ? list_size / 4 : 0;
+		if (values > nk->values)
+			values = nk->values;
+
+		for (uint32_t i = 0; !r && i < values; i++)
+		{
+			struct key_data_t entry;
+			const uint8_t *vk = hive_cell(h, list[i], &size);
+
+			int v = hive_value(h, vk, size, &entry);
+			if (!v)
+				r = cb(ctx, path, path_size, &entry);
+			else if (v == -2)
+				r = v;
+		}
+
+		// Queued backwards, so that they come off the stack in the order of the list
+		if (!r && p.depth + 1 < HIVE_MAX_DEPTH)
+		{
+			uint64_t start = s.len;
+			r = hive_subkeys(h, &s, nk->subkey_list, p.depth + 1, 0);
+
+			for (uint64_t a = start, b = s.len; a + 1 < b; a++, b--)
+			{
+				struct hive_pending_t t = s.items[a];
+				s.items[a] = s.items[b - 1];
+				s.items[b - 1] = t;
+			}
+		}
+	}
+
+	if (s.items)
+		free(s.items);
+
+	if (path)
+		free(path);
+
+	if (!r)
+		set_errno(ESUCCESS);
+
+	return r;
+}
+
+// An nk record in a cell of either kind, or 0
+static const struct hive_nk_t *hive_key(struct hive_t *h, uint32_t offset)
+{
+	uint32_t size;
+	const uint8_t *cell = hive_find(h, offset, &size, 0);
+	if (!cell)
+		cell = hive_find(h, offset, &size, 1);
+
+	const struct hive_nk_t *nk = (const struct hive_nk_t *) cell;
+	if (!nk
+	||  size < sizeof(struct hive_nk_t)
+	||  memcmp(nk->magic, "nk", 2)
+	||  size - sizeof(struct hive_nk_t) < nk->name_size)
+		return 0;
+
+	return nk;
+}
+
+// The path of a deleted key through whatever is left of its parents, into h->path
+static int hive_slack_path(struct hive_t *h, const struct hive_nk_t *nk, struct hive_slack_t *found)
+{
+	const struct hive_nk_t *chain[HIVE_MAX_DEPTH];
+	uint32_t depth = 0;
+	uint32_t path_size = 0;
+
+	// The root key has no part in the path, just like in hive_sweep(), unless it was the one deleted
+	while (nk && depth < HIVE_MAX_DEPTH && (!depth || !(nk->flags & HIVE_KEY_ROOT)))
+	{
+		chain[depth++] = nk;
+		path_size += (nk->flags & HIVE_KEY_ASCII ? nk->name_size * 2 : nk->name_size) + 2;
+		nk = hive_key(h, nk->parent);
+	}
+
+	if (hive_grow((void **) &h->path, &h->path_max, path_size + 2))
+		return -2;
+
+	wchar_t *p = h->path;
+	while (depth--)
+	{
+		nk = chain[depth];
+
+		if (nk->flags & HIVE_KEY_ASCII)
+		{
+			for (uint32_t i = 0; i < nk->name_size; i++)
+				*p++ = nk->name[i];
+		}
+		else
+		{
+			memcpy(p, nk->name, nk->name_size & ~1);
+			p += nk->name_size / 2;
+		}
+
+		if (depth)
+			*p++ = L'\\';
+	}
+
+	found->path = h->path;
+	found->path_size = (p - h->path) * sizeof(wchar_t);
+
+	// The name of the key itself is the last component
+	found->entry.name = p - (chain[0]->flags & HIVE_KEY_ASCII ? chain[0]->name_size : chain[0]->name_size / 2);
+	found->entry.name_size = (p - found->entry.name) * sizeof(wchar_t);
+	found->entry.anomalies = classify_name(found->entry.name, found->entry.name_size);
+
+	return 0;
+}
+
+// Whether the record at a free offset still looks like the cell it once was, and how far it goes
+static uint32_t hive_slack_record(struct hive_t *h, uint32_t offset, uint32_t end)
+{
+	int32_t old;
+	memcpy(&old, &h->bins[offset], sizeof(int32_t));
+
+	// A cell merged into a free one before it kept its own size, freed or not
+	if (old == INT32_MIN)
+		return 0;
+
+	uint32_t size = old < 0 ? -old : old;
+	if (size & 7 || size < 8 || size > end - offset)
+		return 0;
+
+	const uint8_t *cell = &h->bins[offset + 4];
+	size -= 4;
+
+	if (!memcmp(cell, "vk", 2))
+	{
+		const struct hive_vk_t *vk = (const struct hive_vk_t *) cell;
+		uint32_t length = vk->size & ~HIVE_DATA_INLINE;
+
+		if (size < sizeof(struct hive_vk_t)
+		||  !vk->name_size
+		||  size - sizeof(struct hive_vk_t) < vk->name_size
+		||  vk->flags > 3)
+			return 0;
+
+		if (vk->size & HIVE_DATA_INLINE ? length > sizeof(uint32_t)
+		                                : length && (vk->data & 7 || vk->data >= h->size))
+			return 0;
+	}
+	else if (!memcmp(cell, "nk", 2))
+	{
+		const struct hive_nk_t *nk = (const struct hive_nk_t *) cell;
+
+		if (size < sizeof(struct hive_nk_t)
+		||  !nk->name_size
+		||  size - sizeof(struct hive_nk_t) < nk->name_size
+		||  nk->parent & 7 || nk->parent >= h->size
+		||  (nk->subkey_list != HIVE_NO_CELL && (nk->subkey_list & 7 || nk->subkey_list >= h->size))
+		||  (nk->value_list != HIVE_NO_CELL && (nk->value_list & 7 || nk->value_list >= h->size)))
+			return 0;
+	}
+	else
+		return 0;
+
+	return size + 4;
+}
+
+static int hive_slack_found(struct hive_t *h, uint32_t offset, hive_slack_cb_t cb, void *ctx)
+{
+	struct hive_slack_t found = { 0 };
+	const uint8_t *cell = &h->bins[offset + 4];
+
+	found.offset = offset;
+
+	if (!memcmp(cell, "nk", 2))
+	{
+		found.key = 1;
+		found.intact = 1;
+
+		if (hive_slack_path(h, (const struct hive_nk_t *) cell, &found))
+			return -2;
+	}
+	else
+	{
+		const struct hive_vk_t *vk = (const struct hive_vk_t *) cell;
+		uint32_t length = vk->size & ~HIVE_DATA_INLINE;
+
+		int32_t size;
+		memcpy(&size, &h->bins[offset], sizeof(int32_t));
+
+		int r = hive_decode(h, cell, (size < 0 ? 0u - (uint32_t) size : (uint32_t) size) - 4, 1, &found.entry);
+		if (r)
+			return r == -2 ? r : 0;
+
+		found.intact = vk->size & HIVE_DATA_INLINE || found.entry.size == length;
+	}
+
+	return cb(ctx, &found);
+}
+
+int hive_slack(struct hive_t *h, hive_slack_cb_t cb, void *ctx)
+{
+	int r = 0;
+
+	if (!h->bins || !cb)
+	{
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	for (uint64_t bin = 0; !r && bin + sizeof(struct hive_bin_t) <= h->size;)
+	{
+		const struct hive_bin_t *b = (const struct hive_bin_t *) &h->bins[bin];
+
+		// Bins that were never recovered are zeroed, step over them a block at a time
+		if (memcmp(b->magic, HIVE_BIN_MAGIC, 4)
+		||  !b->size
+		||  b->size % HIVE_BLOCK_SIZE
+		||  bin + b->size > h->size)
+		{
+			bin += HIVE_BLOCK_SIZE;
+			continue;
+		}
+
+		uint32_t end = bin + b->size;
+		uint32_t offset = bin + sizeof(struct hive_bin_t);
+
+		while (!r && offset + 8 <= end)
+		{
+			int32_t cell;
+			memcpy(&cell, &h->bins[offset], sizeof(int32_t));
+
+			// Negated unsigned so that INT32_MIN gets as far as the check
+			uint32_t size = cell < 0 ? 0u - (uint32_t) cell : (uint32_t) cell;
+			if (cell == INT32_MIN || size < 8 || size & 7 || size > end - offset)
+				break;
+
+			// Only free cells hold anything deleted
+			if (cell > 0)
+			{
+				uint32_t stop = offset + size;
+
+				for (uint32_t at = offset; !r && at + 8 <= stop;)
+				{
+					uint32_t record = hive_slack_record(h, at, stop);
+					if (!record)
+					{
+						at += 8;
+						continue;
+					}
+
+					r = hive_slack_found(h, at, cb, ctx);
+					at += record;
+				}
+			}
+
+			offset += size;
+		}
+
+		bin += b->size;
+	}
+
+	if (!r)
+		set_errno(ESUCCESS);
+
+	return r;
+}
@@ -0,0 +1,364 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <error.h>
+#include <invis/hash.h>
+#include <invis/intern.h>
+
+#define INTERN_TABLE_SIZE	1024
+
+// Names are folded this many characters at a time to be hashed
+#define INTERN_CHUNK		128
+
+#ifdef __SSE2__
+// Signed compares leave 0x8000 and up alone, none of which is ASCII anyway
+static inline __m128i intern_lower8(__m128i v)
+{
+	const __m128i below = _mm_set1_epi16('A' - 1);
+	const __m128i above = _mm_set1_epi16('Z' + 1);
+	const __m128i delta = _mm_set1_epi16('a' - 'A');
+
+	__m128i upper = _mm_and_si128(_mm_cmpgt_epi16(v, below), _mm_cmpgt_epi16(above, v));
+
+	return _mm_add_epi16(v, _mm_and_si128(upper, delta));
+}
+#endif
+
+static void intern_fold(uint16_t *out, const uint16_t *s, uint32_t len)
+{
+	uint32_t i = 0;
+
+#ifdef __SSE2__
+	for (; i + 8 <= len; i += 8)
+		_mm_storeu_si128((__m128i *) &out[i], intern_lower8(_mm_loadu_si128((const __m128i *) &s[i])));
+#endif
+
+	for (; i < len; i++)
+		out[i] = intern_lower(s[i]);
+}
+
+// Index of the next backslash from i, or len if there is none
+static uint32_t intern_separator(const uint16_t *p, uint32_t i, uint32_t len)
+{
+#ifdef __SSE2__
+	const __m128i sep = _mm_set1_epi16('\\');
+
+	for (; i + 8 <= len; i += 8)
+	{
+		uint32_t m = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *) &p[i]), sep));
+		if (m)
+			return i + __builtin_ctz(m) / 2;
+	}
+#endif
+
+	while (i < len && p[i] != '\\')
+		i++;
+
+	return i;
+}
+
+uint64_t intern_hash(const wchar_t *name, uint32_t size, uint64_t seed)
+{
+	const uint16_t *s = (const uint16_t *) name;
+	uint32_t len = size / 2;
+	uint16_t buf[INTERN_CHUNK];
+	uint64_t h = seed;
+
+	// Long names are chained through the seed a chunk at a time, rather than folded into a copy of their own
+	do
+	{
+		uint32_t n = len < INTERN_CHUNK ? len : INTERN_CHUNK;
+
+		intern_fold(buf, s, n);
+		h = hash64(buf, n * 2, h);
+
+		s += n;
+		len -= n;
+	} while (len);
+
+	return h;
+}
+
+uint8_t intern_equal(const wchar_t *a, const wchar_t *b, uint32_t size)
+{
+	const uint16_t *x = (const uint16_t *) a;
+	const uint16_t *y = (const uint16_t *) b;
+	uint32_t len = size / 2;
+	uint32_t i = 0;
+
+#ifdef __SSE2__
+	for (; i + 8 <= len; i += 8)
+	{
+		__m128i u = _mm_loadu_si128((const __m128i *) &x[i]);
+		__m128i v = _mm_loadu_si128((const __m128i *) &y[i]);
+
+		// Most names are spelled the same way, which doesn't need folding
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(u, v)) != 0xFFFF
+		&&  _mm_movemask_epi8(_mm_cmpeq_epi16(intern_lower8(u), intern_lower8(v))) != 0xFFFF)
+			return 0;
+	}
+#endif
+
+	for (; i < len; i++)
+		if (x[i] != y[i] && intern_lower(x[i]) != intern_lower(y[i]))
+			return 0;
+
+	return 1;
+}
+
+static int intern_grow(void **buf, uint32_t *max, uint64_t need, uint32_t size)
+{
+	if (need <= *max)
+		return 0;
+
+	if (need > 0xFFFFFFFF)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	uint64_t n = *max ? *max : 64;
+	while (n < need)
+		n *= 2;
+
+	if (n > 0xFFFFFFFF)
+		n = 0xFFFFFFFF;
+
+	void *b = realloc(*buf, n * size);
+	if (!b)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	*buf = b;
+	*max = n;
+
+	return 0;
+}
+
+// Doubled once it is half full, the root is never in it
+static int intern_rehash(struct intern_t *in)
+{
+	if (in->table_size >= 0x80000000)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	uint32_t n = in->table_size * 2;
+	uint32_t *t = calloc(n, sizeof(uint32_t));
+	if (!t)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	for (uint32_t id = INTERN_ROOT + 1; id < in->num_nodes; id++)
+	{
+		uint32_t j = in->nodes[id].hash & (n - 1);
+		while (t[j])
+			j = (j + 1) & (n - 1);
+		t[j] = id + 1;
+	}
+
+	free(in->table);
+	in->table = t;
+	in->table_size = n;
+
+	return 0;
+}
+
+// Id of a name under parent, or INTERN_NONE with the empty slot it would go in
+static uint32_t intern_lookup(const struct intern_t *in,
+							  uint32_t               parent,
+							  const wchar_t         *name,
+							  uint32_t               size,
+							  uint64_t               h,
+							  uint32_t              *slot)
+{
+	uint32_t j = h & (in->table_size - 1);
+
+	for (; in->table[j]; j = (j + 1) & (in->table_size - 1))
+	{
+		const struct intern_node_t *n = &in->nodes[in->table[j] - 1];
+		if (n->hash == h
+		&&  n->parent == parent
+		&&  n->size == size
+		&&  intern_equal(&in->pool[n->offset], name, size))
+			return in->table[j] - 1;
+	}
+
+	if (slot)
+		*slot = j;
+
+	return INTERN_NONE;
+}
+
+static int intern_name(struct intern_t *in, uint32_t parent, const wchar_t *name, uint32_t size, uint32_t *id)
+{
+	uint64_t h = intern_hash(name, size, parent);
+	uint32_t slot;
+
+	*id = intern_lookup(in, parent, name, size, h, &slot);
+	if (*id != INTERN_NONE)
+		return 0;
+
+	uint64_t path_size = (parent == INTERN_ROOT ? 0 : in->nodes[parent].path_size + 2ULL) + size;
+	if (path_size > 0xFFFFFFFF || in->num_nodes >= INTERN_NONE - 1)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	// Odd sizes keep their last byte in a character of its own
+	if (intern_grow((void **) &in->nodes, &in->max_nodes, in->num_nodes + 1ULL, sizeof(struct intern_node_t))
+	||  intern_grow((void **) &in->pool, &in->pool_max, in->pool_len + (size + 1ULL) / 2, sizeof(wchar_t)))
+		return -2;
+
+	struct intern_node_t *n = &in->nodes[in->num_nodes];
+	n->hash = h;
+	n->parent = parent;
+	n->offset = in->pool_len;
+	n->size = size;
+	n->path_size = path_size;
+
+	if (size)
+		memcpy(&in->pool[in->pool_len], name, size);
+	in->pool_len += (size + 1) / 2;
+
+	*id = in->num_nodes++;
+	in->table[slot] = *id + 1;
+
+	if (in->num_nodes * 2ULL > in->table_size)
+		return intern_rehash(in);
+
+	return 0;
+}
+
+int intern_init(struct intern_t *in)
+{
+	memset(in, 0, sizeof(struct intern_t));
+
+	in->table_size = INTERN_TABLE_SIZE;
+	in->table = calloc(in->table_size, sizeof(uint32_t));
+
+	if (!in->table
+	||   intern_grow((void **) &in->nodes, &in->max_nodes, 1, sizeof(struct intern_node_t)))
+	{
+		intern_free(in);
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	memset(&in->nodes[INTERN_ROOT], 0, sizeof(struct intern_node_t));
+	in->num_nodes = 1;
+
+	return 0;
+}
+
+void intern_free(struct intern_t *in)
+{
+	if (in->nodes)
+		free(in->nodes);
+
+	if (in->table)
+		free(in->table);
+
+	if (in->pool)
+		free(in->pool);
+
+	memset(in, 0, sizeof(struct intern_t));
+}
+
+int intern_path(struct intern_t *in, uint32_t parent, const wchar_t *path, uint32_t size, uint32_t *id)
+{
+	const uint16_t *p = (const uint16_t *) path;
+	uint32_t len = size / 2;
+
+	*id = parent;
+	if (!len)
+		return 0;
+
+	for (uint32_t start = 0; start <= len; )
+	{
+		uint32_t end = intern_separator(p, start, len);
+
+		if (intern_name(in, *id, (const wchar_t *) &p[start], (end - start) * 2, id))
+			return -2;
+
+		start = end + 1;
+	}
+
+	return 0;
+}
+
+uint32_t intern_find(const struct intern_t *in, uint32_t parent, const wchar_t *path, uint32_t size)
+{
+	const uint16_t *p = (const uint16_t *) path;
+	uint32_t len = size / 2;
+	uint32_t id = parent;
+
+	if (!len)
+		return id;
+
+	// Most paths looked up aren't interned, and stop at their first unknown name
+	for (uint32_t start = 0; start <= len && id != INTERN_NONE; )
+	{
+		uint32_t end = intern_separator(p, start, len);
+		uint32_t name = (end - start) * 2;
+
+		id = intern_lookup(in, id, (const wchar_t *) &p[start], name, intern_hash((const wchar_t *) &p[start], name, id), 0);
+		start = end + 1;
+	}
+
+	return id;
+}
+
+uint32_t intern_size(const struct intern_t *in, uint32_t id)
+{
+	return in->nodes[id].path_size;
+}
+
+// Filled in from the end, as the path is only known from the last name up
+void intern_copy(const struct intern_t *in, uint32_t id, wchar_t *out)
+{
+	uint8_t *o = (uint8_t *) out;
+	uint32_t pos = in->nodes[id].path_size;
+
+	for (; id != INTERN_ROOT; id = in->nodes[id].parent)
+	{
+		const struct intern_node_t *n = &in->nodes[id];
+
+		pos -= n->size;
+		memcpy(&o[pos], &in->pool[n->offset], n->size);
+
+		if (n->parent != INTERN_ROOT)
+		{
+			pos -= 2;
+			memcpy(&o[pos], &(uint16_t) { '\\' }, 2);
+		}
+	}
+}
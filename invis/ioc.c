@@ -0,0 +1,235 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <error.h>
+#include <invis/ioc.h>
+
+static int ioc_hex(const char *s, uint32_t digits, uint8_t *out)
+{
+	for (uint32_t i = 0; i < digits; i++)
+	{
+		char c = tolower((unsigned char) s[i]);
+		uint8_t n = c >= 'a' ? c - 'a' + 10 : c - '0';
+
+		if (i & 1)
+			out[i / 2] |= n;
+		else
+			out[i / 2] = n << 4;
+	}
+
+	return 0;
+}
+
+// Tables are built once every hash is known, at most half full
+static uint32_t *ioc_table(const uint8_t *keys, uint32_t count, uint32_t stride, uint32_t *size)
+{
+	uint32_t n = 16;
+	while (n < count * 2)
+		n *= 2;
+
+	uint32_t *t = calloc(n, sizeof(uint32_t));
+	if (!t)
+	{
+		set_errno(ENOMEM);
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint64_t h;
+		memcpy(&h, &keys[(uint64_t) i * stride], sizeof(uint64_t));
+
+		uint32_t j = h & (n - 1);
+		while (t[j])
+			j = (j + 1) & (n - 1);
+		t[j] = i + 1;
+	}
+
+	*size = n;
+
+	return t;
+}
+
+static int ioc_add(void **array, uint32_t *count, uint32_t *max, const void *item, uint32_t size)
+{
+	if (*count == *max)
+	{
+		uint32_t n = *max ? *max * 2 : 64;
+		void *a = realloc(*array, (uint64_t) n * size);
+		if (!a)
+		{
+			set_errno(ENOMEM);
+			return -2;
+		}
+
+		*array = a;
+		*max = n;
+	}
+
+	memcpy((uint8_t *) *array + (uint64_t) *count * size, item, size);
+	(*count)++;
+
+	return 0;
+}
+
+int ioc_load(struct ioc_t *ioc, const char *file)
+{
+	int r = 0;
+
+	memset(ioc, 0, sizeof(struct ioc_t));
+
+	FILE *f = fopen(file, "rb");
+	if (!f)
+	{
+		set_errno(EFILE);
+		return -1;
+	}
+
+	uint32_t max_fast = 0;
+	uint32_t max_strong = 0;
+	uint8_t skip = 0;
+
+	char line[256];
+	while (!r && fgets(line, sizeof(line), f))
+	{
+		// The rest of a long line is never more than a comment
+		uint8_t partial = !strchr(line, '\n');
+		if (skip)
+		{
+			skip = partial;
+			continue;
+		}
+		skip = partial;
+
+		char *s = line;
+		while (*s == ' ' || *s == '\t')
+			s++;
+
+		if (!*s || *s == '#' || *s == '\r' || *s == '\n')
+			continue;
+
+		uint32_t digits = 0;
+		while (isxdigit((unsigned char) s[digits]))
+			digits++;
+
+		uint8_t end = s[digits];
+		if (end && end != ' ' && end != '\t' && end != '\r' && end != '\n')
+			digits = 0;
+
+		if (digits == 16)
+		{
+			uint8_t be[8];
+			ioc_hex(s, 16, be);
+
+			// Written as a number, most significant digit first
+			uint64_t h = 0;
+			for (uint32_t i = 0; i < 8; i++)
+				h = h << 8 | be[i];
+
+			r = ioc_add((void **) &ioc->fast, &ioc->num_fast, &max_fast, &h, sizeof(uint64_t));
+		}
+		else if (digits == SHA256_SIZE * 2)
+		{
+			uint8_t digest[SHA256_SIZE];
+			ioc_hex(s, SHA256_SIZE * 2, digest);
+
+			r = ioc_add((void **) &ioc->strong, &ioc->num_strong, &max_strong, digest, SHA256_SIZE);
+		}
+		else
+		{
+			set_errno(EIOCFILE);
+			r = -1;
+		}
+	}
+
+	fclose(f);
+
+	if (!r && ioc->num_fast
+	&& !(ioc->fast_table = ioc_table((const uint8_t *) ioc->fast, ioc->num_fast, sizeof(uint64_t), &ioc->fast_size)))
+		r = -2;
+
+	if (!r && ioc->num_strong
+	&& !(ioc->strong_table = ioc_table((const uint8_t *) ioc->strong, ioc->num_strong, SHA256_SIZE, &ioc->strong_size)))
+		r = -2;
+
+	if (r)
+		ioc_free(ioc);
+	else
+		set_errno(ESUCCESS);
+
+	return r;
+}
+
+void ioc_free(struct ioc_t *ioc)
+{
+	if (ioc->fast)
+		free(ioc->fast);
+
+	if (ioc->fast_table)
+		free(ioc->fast_table);
+
+	if (ioc->strong)
+		free(ioc->strong);
+
+	if (ioc->strong_table)
+		free(ioc->strong_table);
+
+	memset(ioc, 0, sizeof(struct ioc_t));
+}
+
+uint8_t ioc_match(const struct ioc_t *ioc, const void *data, uint32_t size, struct ioc_match_t *m)
+{
+	m->kind = 0;
+	m->fast = hash64(data, size, 0);
+
+	if (ioc->num_fast)
+	{
+		for (uint32_t j = m->fast & (ioc->fast_size - 1); ioc->fast_table[j]; j = (j + 1) & (ioc->fast_size - 1))
+		{
+			if (ioc->fast[ioc->fast_table[j] - 1] == m->fast)
+			{
+				m->kind |= IOC_FAST;
+				break;
+			}
+		}
+	}
+
+	if (ioc->num_strong)
+	{
+		sha256(data, size, m->sha256);
+
+		uint64_t h;
+		memcpy(&h, m->sha256, sizeof(uint64_t));
+
+		for (uint32_t j = h & (ioc->strong_size - 1); ioc->strong_table[j]; j = (j + 1) & (ioc->strong_size - 1))
+		{
+			if (!memcmp(ioc->strong[ioc->strong_table[j] - 1], m->sha256, SHA256_SIZE))
+			{
+				m->kind |= IOC_SHA256;
+				break;
+			}
+		}
+	}
+
+	return m->kind;
+}
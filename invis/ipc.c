@@ -0,0 +1,675 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <error.h>
+#include <invis/ipc.h>
+
+// Initial size of both buffers, writes are flushed once this much is queued
+#define IPC_BUFFER_SIZE	65536
+
+static void ipc_init(struct ipc_t *c)
+{
+	memset(c, 0, sizeof(struct ipc_t));
+#ifndef _WIN32
+	c->fd = -1;
+#endif
+}
+
+#ifdef _WIN32
+
+static char *ipc_name(const char *name)
+{
+	const char *prefix = "\\\\.\\pipe\\";
+	if (!strncmp(name, prefix, strlen(prefix)))
+		prefix = "";
+
+	char *full = malloc(strlen(prefix) + strlen(name) + 1);
+	if (!full)
+	{
+		set_errno(ENOMEM);
+		return 0;
+	}
+
+	strcpy(full, prefix);
+	strcat(full, name);
+
+	return full;
+}
+
+// A new instance for every client, only reachable from this host
+static HANDLE ipc_instance(const char *name, DWORD flags)
+{
+	return CreateNamedPipeA(name,
+							PIPE_ACCESS_DUPLEX | flags,
+							PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+							PIPE_UNLIMITED_INSTANCES,
+							IPC_BUFFER_SIZE,
+							IPC_BUFFER_SIZE,
+							0,
+							0);
+}
+
+int ipc_listen(struct ipc_listener_t *l, const char *name)
+{
+	l->next = 0;
+	if (!(l->name = ipc_name(name)))
+		return -2;
+
+	// The first instance is there before anything is accepted, and fails if another server has the name
+	l->next = ipc_instance(l->name, FILE_FLAG_FIRST_PIPE_INSTANCE);
+	if (l->next == INVALID_HANDLE_VALUE)
+	{
+		l->next = 0;
+		ipc_unlisten(l);
+		set_errno(EIPC);
+		return -1;
+	}
+
+	return 0;
+}
+
+int ipc_accept(struct ipc_listener_t *l, struct ipc_t *c)
+{
+	ipc_init(c);
+
+	// Only missing when creating it after the last client failed
+	if (!l->next)
+	{
+		l->next = ipc_instance(l->name, 0);
+		if (l->next == INVALID_HANDLE_VALUE)
+		{
+			l->next = 0;
+			set_errno(EIPC);
+			return -1;
+		}
+	}
+
+	HANDLE pipe = l->next;
+	if (!ConnectNamedPipe(pipe, 0)
+	&&   GetLastError() != ERROR_PIPE_CONNECTED)
+	{
+		CloseHandle(pipe);
+		l->next = 0;
+		set_errno(EIPC);
+		return -1;
+	}
+
+	// The next client always finds an instance waiting, even while this one is being handed off
+	l->next = ipc_instance(l->name, 0);
+	if (l->next == INVALID_HANDLE_VALUE)
+		l->next = 0;
+
+	c->pipe = pipe;
+	c->server = 1;
+
+	return 0;
+}
+
+void ipc_unlisten(struct ipc_listener_t *l)
+{
+	if (l->next)
+		CloseHandle(l->next);
+
+	if (l->name)
+		free(l->name);
+
+	l->next = 0;
+	l->name = 0;
+}
+
+int ipc_connect(struct ipc_t *c, const char *name)
+{
+	ipc_init(c);
+
+	char *full = ipc_name(name);
+	int r = full ? 0 : -2;
+
+	// Every instance may be busy with another client
+	while (!r)
+	{
+		c->pipe = CreateFileA(full, GENERIC_READ | GENERIC_WRITE, 0, 0, OPEN_EXISTING, 0, 0);
+		if (c->pipe != INVALID_HANDLE_VALUE)
+			break;
+
+		c->pipe = 0;
+		if (GetLastError() != ERROR_PIPE_BUSY
+		|| !WaitNamedPipeA(full, 5000))
+		{
+			set_errno(EIPC);
+			r = -1;
+		}
+	}
+
+	if (full)
+		free(full);
+
+	return r;
+}
+
+static int ipc_read_raw(struct ipc_t *c, uint8_t *buf, uint32_t size)
+{
+	DWORD read = 0;
+	if (ReadFile(c->pipe, buf, size, &read, 0))
+		return read;
+
+	return GetLastError() == ERROR_BROKEN_PIPE ? 0 : -1;
+}
+
+static int ipc_write_raw(struct ipc_t *c, const uint8_t *buf, uint32_t size)
+{
+	while (size)
+	{
+		DWORD written = 0;
+		if (!WriteFile(c->pipe, buf, size, &written, 0))
+			return -1;
+
+		buf += written;
+		size -= written;
+	}
+
+	return 0;
+}
+
+static void ipc_close_raw(struct ipc_t *c)
+{
+	if (c->pipe)
+	{
+		if (c->server)
+		{
+			FlushFileBuffers(c->pipe);
+			DisconnectNamedPipe(c->pipe);
+		}
+
+		CloseHandle(c->pipe);
+	}
+}
+
+#else
+
+static int ipc_address(struct sockaddr_un *addr, const char *name)
+{
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+
+	if (strlen(name) >= sizeof(addr->sun_path))
+	{
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	strcpy(addr->sun_path, name);
+
+	return 0;
+}
+
+int ipc_listen(struct ipc_listener_t *l, const char *name)
+{
+	l->fd = -1;
+
+	struct sockaddr_un addr;
+	if (ipc_address(&addr, name))
+		return -1;
+
+	// Only a socket left behind by a server that didn't exit cleanly is replaced
+	struct stat st;
+	if (!lstat(name, &st))
+	{
+		struct ipc_t probe;
+		if (!S_ISSOCK(st.st_mode) || !ipc_connect(&probe, name))
+		{
+			if (S_ISSOCK(st.st_mode))
+				ipc_close(&probe);
+
+			set_errno(EIPC);
+			return -1;
+		}
+
+		unlink(name);
+	}
+
+	if ((l->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	{
+		set_errno(EIPC);
+		return -1;
+	}
+
+	// Only the owner may talk to the server
+	mode_t mask = umask(0177);
+	int failed = bind(l->fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un))
+	          || listen(l->fd, 64);
+	umask(mask);
+
+	if (failed)
+	{
+		close(l->fd);
+		l->fd = -1;
+		set_errno(EIPC);
+		return -1;
+	}
+
+	return 0;
+}
+
+int ipc_accept(struct ipc_listener_t *l, struct ipc_t *c)
+{
+	ipc_init(c);
+
+	do
+		c->fd = accept(l->fd, 0, 0);
+	while (c->fd < 0 && errno == EINTR);
+
+	if (c->fd < 0)
+	{
+		set_errno(EIPC);
+		return -1;
+	}
+
+	return 0;
+}
+
+void ipc_unlisten(struct ipc_listener_t *l)
+{
+	if (l->fd >= 0)
+		close(l->fd);
+
+	l->fd = -1;
+}
+
+int ipc_connect(struct ipc_t *c, const char *name)
+{
+	ipc_init(c);
+
+	struct sockaddr_un addr;
+	if (ipc_address(&addr, name))
+		return -1;
+
+	if ((c->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+	||  connect(c->fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)))
+	{
+		if (c->fd >= 0)
+			close(c->fd);
+
+		c->fd = -1;
+		set_errno(EIPC);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int ipc_read_raw(struct ipc_t *c, uint8_t *buf, uint32_t size)
+{
+	ssize_t n;
+
+	do
+		n = recv(c->fd, buf, size, 0);
+	while (n < 0 && errno == EINTR);
+
+	return n;
+}
+
+static int ipc_write_raw(struct ipc_t *c, const uint8_t *buf, uint32_t size)
+{
+	while (size)
+	{
+		// A client that went away shouldn't take the server with it
+		ssize_t n = send(c->fd, buf, size, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		else if (n <= 0)
+			return -1;
+
+		buf += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+static void ipc_close_raw(struct ipc_t *c)
+{
+	if (c->fd >= 0)
+		close(c->fd);
+}
+
+#endif
+
+void ipc_close(struct ipc_t *c)
+{
+	ipc_close_raw(c);
+
+	if (c->in)
+		free(c->in);
+
+	if (c->out)
+		free(c->out);
+
+	ipc_init(c);
+}
+
+int ipc_flush(struct ipc_t *c)
+{
+	if (c->out_len && ipc_write_raw(c, c->out, c->out_len))
+	{
+		set_errno(EIPC);
+		return -1;
+	}
+
+	c->out_len = 0;
+
+	return 0;
+}
+
+int ipc_write(struct ipc_t *c, const void *data, uint32_t size)
+{
+	if (c->out_len + size > c->out_max)
+	{
+		if (ipc_flush(c))
+			return -1;
+
+		// Anything larger than the buffer bypasses it
+		if (size >= IPC_BUFFER_SIZE)
+		{
+			if (ipc_write_raw(c, data, size))
+			{
+				set_errno(EIPC);
+				return -1;
+			}
+
+			return 0;
+		}
+
+		if (!c->out)
+		{
+			if (!(c->out = malloc(IPC_BUFFER_SIZE)))
+			{
+				set_errno(ENOMEM);
+				return -2;
+			}
+
+			c->out_max = IPC_BUFFER_SIZE;
+		}
+	}
+
+	memcpy(&c->out[c->out_len], data, size);
+	c->out_len += size;
+
+	return 0;
+}
+
+int ipc_recv(struct ipc_t *c, struct ipc_header_t *h, uint8_t **payload)
+{
+	while (1)
+	{
+		uint32_t avail = c->in_len - c->in_pos;
+		uint32_t needed = sizeof(struct ipc_header_t);
+
+		if (avail >= sizeof(struct ipc_header_t))
+		{
+			memcpy(h, &c->in[c->in_pos], sizeof(struct ipc_header_t));
+
+			if (h->size > IPC_MAX_MESSAGE)
+			{
+				set_errno(EMESSAGE);
+				return -1;
+			}
+
+			needed += h->size;
+			if (avail >= needed)
+			{
+				*payload = &c->in[c->in_pos + sizeof(struct ipc_header_t)];
+				c->in_pos += needed;
+				return 0;
+			}
+		}
+
+		// Nothing complete is buffered, so whatever is queued goes out before waiting on the other side
+		if (ipc_flush(c))
+			return -1;
+
+		if (c->in_pos)
+		{
+			memmove(c->in, &c->in[c->in_pos], avail);
+			c->in_len = avail;
+			c->in_pos = 0;
+		}
+
+		if (needed > c->in_max || c->in_max - c->in_len < IPC_BUFFER_SIZE / 4)
+		{
+			uint32_t max = c->in_max ? c->in_max : IPC_BUFFER_SIZE;
+			while (max < needed || max - c->in_len < IPC_BUFFER_SIZE / 4)
+				max *= 2;
+
+			uint8_t *in = realloc(c->in, max);
+			if (!in)
+			{
+				set_errno(ENOMEM);
+				return -2;
+			}
+
+			c->in = in;
+			c->in_max = max;
+		}
+
+		int n = ipc_read_raw(c, &c->in[c->in_len], c->in_max - c->in_len);
+		if (n < 0 || (!n && avail))
+		{
+			set_errno(n ? EIPC : EMESSAGE);
+			return -1;
+		}
+		else if (!n)
+			return 1;
+
+		c->in_len += n;
+	}
+}
+
+int ipc_reg_send(struct ipc_t *c,
+				 uint32_t      id,
+				 int8_t        operation,
+				 HKEY          hive,
+				 const char   *path,
+				 ULONG         type,
+				 void         *value,
+				 uint32_t      size)
+{
+	// *2 here for UTF-16LE
+	uint32_t path_max = strlen(path) + 1;
+	wchar_t *wpath = malloc(path_max * 2);
+	if (!wpath)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	struct ipc_request_t req;
+	req.hive = (uint32_t) (uintptr_t) hive;
+	req.type = type;
+	req.path_size = (MultiByteToWideChar(CP_OEMCP, 0, path, -1, wpath, path_max) - 1) * 2;
+	req.value_size = value ? size : 0;
+
+	struct ipc_header_t h;
+	memset(&h, 0, sizeof(struct ipc_header_t));
+	h.size = sizeof(struct ipc_request_t) + req.path_size + req.value_size;
+	h.id = id;
+	h.op = IPC_REG;
+	h.operation = operation;
+
+	int r = ipc_write(c, &h, sizeof(struct ipc_header_t));
+	if (!r)
+		r = ipc_write(c, &req, sizeof(struct ipc_request_t));
+	if (!r)
+		r = ipc_write(c, wpath, req.path_size);
+	if (!r && req.value_size)
+		r = ipc_write(c, value, req.value_size);
+
+	free(wpath);
+
+	return r;
+}
+
+int ipc_reg_recv(struct ipc_t       *c,
+				 uint32_t           *id,
+				 struct key_data_t **key_data,
+				 uint64_t           *num_keys)
+{
+	struct ipc_header_t h;
+	uint8_t *payload;
+
+	int r = ipc_recv(c, &h, &payload);
+	if (r > 0)
+	{
+		// The server went away with requests in flight
+		set_errno(EIPC);
+		return -1;
+	}
+	else if (r)
+		return r;
+
+	struct ipc_reply_t reply;
+	if (h.op != IPC_REPLY || h.size < sizeof(struct ipc_reply_t))
+	{
+		set_errno(EMESSAGE);
+		return -1;
+	}
+
+	memcpy(&reply, payload, sizeof(struct ipc_reply_t));
+
+	if (id)
+		*id = h.id;
+
+	if (key_data)
+		*key_data = 0;
+
+	if (num_keys)
+		*num_keys = 0;
+
+	if (reply.status)
+	{
+		set_errno(reply.error);
+		return reply.status;
+	}
+
+	if (!reply.count || !key_data || !num_keys)
+	{
+		set_errno(ESUCCESS);
+		return 0;
+	}
+
+	// Bounded by the message, so a bad count can't cause a huge allocation
+	if (reply.count > (h.size - sizeof(struct ipc_reply_t)) / sizeof(struct ipc_entry_t))
+	{
+		set_errno(EMESSAGE);
+		return -1;
+	}
+
+	struct key_data_t *k = malloc(sizeof(struct key_data_t) * reply.count);
+	if (!k)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	memset(k, 0, sizeof(struct key_data_t) * reply.count);
+
+	uint64_t pos = sizeof(struct ipc_reply_t);
+	for (uint32_t i = 0; !r && i < reply.count; i++)
+	{
+		struct ipc_entry_t e;
+		if (pos + sizeof(struct ipc_entry_t) > h.size)
+		{
+			set_errno(EMESSAGE);
+			r = -1;
+			break;
+		}
+
+		memcpy(&e, &payload[pos], sizeof(struct ipc_entry_t));
+		pos += sizeof(struct ipc_entry_t);
+
+		if (pos + (uint64_t) e.name_size + e.size > h.size)
+		{
+			set_errno(EMESSAGE);
+			r = -1;
+			break;
+		}
+
+		k[i].type = e.type;
+		k[i].anomalies = e.anomalies;
+		k[i].name_size = e.name_size;
+		k[i].size = e.size;
+
+		// +2 so that names and strings are always terminated, like reg()
+		k[i].name = malloc(e.name_size + 2);
+		k[i].value = malloc(e.size + 2);
+
+		if (k[i].name && k[i].value)
+		{
+			memset(k[i].name, 0, e.name_size + 2);
+			memcpy(k[i].name, &payload[pos], e.name_size);
+			pos += e.name_size;
+
+			memset(k[i].value, 0, e.size + 2);
+			memcpy(k[i].value, &payload[pos], e.size);
+			pos += e.size;
+		}
+		else
+		{
+			set_errno(ENOMEM);
+			r = -2;
+		}
+	}
+
+	if (r)
+		free_key_data(k, reply.count);
+	else
+	{
+		*key_data = k;
+		*num_keys = reply.count;
+		set_errno(ESUCCESS);
+	}
+
+	return r;
+}
+
+int ipc_reg(struct ipc_t       *c,
+			int8_t              operation,
+			HKEY                hive,
+			const char         *path,
+			ULONG               type,
+			void               *value,
+			uint32_t            size,
+			struct key_data_t **key_data,
+			uint64_t           *num_keys)
+{
+	int r = ipc_reg_send(c, 0, operation, hive, path, type, value, size);
+	if (!r)
+		r = ipc_reg_recv(c, 0, key_data, num_keys);
+
+	return r;
+}
@@ -0,0 +1,771 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WIN32
+
+#include <pthread.h>
+
+#include <invis/memreg.h>
+#include <invis/ntdll.h>
+#include <invis/thread.h>
+
+struct memreg_value_t
+{
+	wchar_t *name;
+	uint32_t name_size;
+	ULONG type;
+	uint8_t *data;
+	uint32_t size;
+};
+
+struct memreg_key_t
+{
+	wchar_t *name;
+	uint32_t name_size;
+	struct memreg_key_t *parent;
+
+	struct memreg_key_t **keys;
+	uint32_t num_keys;
+	uint32_t max_keys;
+
+	struct memreg_value_t *values;
+	uint32_t num_values;
+	uint32_t max_values;
+
+	// Open handles, a deleted key is freed once the last one is closed
+	uint32_t refs;
+	uint8_t deleted;
+};
+
+static pthread_mutex_t memreg_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t memreg_once = PTHREAD_ONCE_INIT;
+
+// Injected enumeration latency, see memreg_latency()
+static uint32_t memreg_delay;
+static uint32_t memreg_capacity;
+static uint32_t memreg_inflight;
+
+// \Registry, which holds Machine and User
+static struct memreg_key_t *memreg_root;
+
+static const struct
+{
+	HKEY hive;
+	const char *path;	// Relative to \Registry
+} memreg_hives_init[] =
+{
+	{ HKEY_LOCAL_MACHINE,  "Machine"                                                 },
+	{ HKEY_USERS,          "User"                                                    },
+	{ HKEY_CURRENT_USER,   "User\\S-1-5-21-0-0-0-1000"                               },
+	{ HKEY_CLASSES_ROOT,   "Machine\\SOFTWARE\\Classes"                              },
+	{ HKEY_CURRENT_CONFIG, "Machine\\SYSTEM\\CurrentControlSet\\Hardware Profiles\\Current" },
+};
+
+#define MEMREG_HIVES	(sizeof(memreg_hives_init) / sizeof(memreg_hives_init[0]))
+
+static struct memreg_key_t *memreg_hives[MEMREG_HIVES];
+
+// Only ASCII is folded, like the names this stands in for
+static inline wchar_t memreg_fold(wchar_t c)
+{
+	return (c >= L'a' && c <= L'z') ? c - (L'a' - L'A') : c;
+}
+
+static int8_t memreg_equal(const wchar_t *a, uint32_t a_size, const wchar_t *b, uint32_t b_size)
+{
+	if (a_size != b_size)
+		return 0;
+
+	for (uint32_t i = 0; i < a_size / 2; i++)
+		if (memreg_fold(a[i]) != memreg_fold(b[i]))
+			return 0;
+
+	return 1;
+}
+
+static struct memreg_key_t *memreg_find(struct memreg_key_t *key, const wchar_t *name, uint32_t size)
+{
+	for (uint32_t i = 0; i < key->num_keys; i++)
+		if (memreg_equal(key->keys[i]->name, key->keys[i]->name_size, name, size))
+			return key->keys[i];
+
+	return 0;
+}
+
+static struct memreg_key_t *memreg_add(struct memreg_key_t *parent, const wchar_t *name, uint32_t size)
+{
+	struct memreg_key_t *key = malloc(sizeof(struct memreg_key_t));
+	if (!key)
+		return 0;
+
+	memset(key, 0, sizeof(struct memreg_key_t));
+	key->parent = parent;
+	key->name_size = size;
+
+	if (!(key->name = malloc(size + 2)))
+	{
+		free(key);
+		return 0;
+	}
+
+	memcpy(key->name, name, size);
+	key->name[size / 2] = 0;
+
+	if (parent)
+	{
+		if (parent->num_keys == parent->max_keys)
+		{
+			uint32_t max = parent->max_keys ? parent->max_keys * 2 : 8;
+			struct memreg_key_t **k = realloc(parent->keys, sizeof(struct memreg_key_t *) * max);
+			if (!k)
+			{
+				free(key->name);
+				free(key);
+				return 0;
+			}
+
+			parent->keys = k;
+			parent->max_keys = max;
+		}
+
+		parent->keys[parent->num_keys++] = key;
+	}
+
+	return key;
+}
+
+static void memreg_free(struct memreg_key_t *key)
+{
+	for (uint32_t i = 0; i < key->num_values; i++)
+	{
+		free(key->values[i].name);
+		free(key->values[i].data);
+	}
+
+	if (key->values)
+		free(key->values);
+
+	if (key->keys)
+		free(key->keys);
+
+	free(key->name);
+	free(key);
+}
+
+/*
+ * Walk a counted path from key, one component per backslash.
+ * With create the missing keys are added on the way, otherwise the walk
+ * stops at the first one, returning 0. last is set when only the final
+ * component was missing, which is what NtCreateKey may create.
+ */
+static struct memreg_key_t *memreg_walk(struct memreg_key_t *key,
+										const wchar_t       *path,
+										uint32_t             size,
+										int8_t               create,
+										uint8_t             *created)
+{
+	uint32_t len = size / 2;
+
+	if (created)
+		*created = 0;
+
+	for (uint32_t start = 0, end = 0; key && start < len; start = end + 1)
+	{
+		for (end = start; end < len && path[end] != L'\\'; end++);
+
+		if (end == start)
+			continue;
+
+		struct memreg_key_t *next = memreg_find(key, &path[start], (end - start) * 2);
+
+		// NtCreateKey only creates the last key of the path
+		if (!next && (create > 1 || (create && end == len)))
+		{
+			next = memreg_add(key, &path[start], (end - start) * 2);
+			if (next && created)
+				*created = 1;
+		}
+
+		key = next;
+	}
+
+	return key;
+}
+
+// Resolve a handle, including the predefined HKEY_* handles
+static struct memreg_key_t *memreg_key(HANDLE handle)
+{
+	for (uint32_t i = 0; i < MEMREG_HIVES; i++)
+		if ((HKEY) handle == memreg_hives_init[i].hive)
+			return memreg_hives[i];
+
+	return (struct memreg_key_t *) handle;
+}
+
+static void memreg_setup(void)
+{
+	const wchar_t registry[] = L"Registry";
+	memreg_root = memreg_add(0, registry, sizeof(registry) - 2);
+
+	for (uint32_t i = 0; memreg_root && i < MEMREG_HIVES; i++)
+	{
+		wchar_t path[128];
+		uint32_t len = 0;
+
+		for (const char *c = memreg_hives_init[i].path; *c; c++)
+			path[len++] = *c;
+
+		memreg_hives[i] = memreg_walk(memreg_root, path, len * 2, 2, 0);
+		if (memreg_hives[i])
+			memreg_hives[i]->refs = 1;
+	}
+}
+
+// Absolute object names start with \Registry, relative ones start from RootDirectory
+static NTSTATUS memreg_attribs(POBJECT_ATTRIBUTES attribs, struct memreg_key_t **base, const wchar_t **path, uint32_t *size)
+{
+	*path = attribs->ObjectName ? attribs->ObjectName->Buffer : 0;
+	*size = attribs->ObjectName ? attribs->ObjectName->Length : 0;
+
+	if (attribs->RootDirectory)
+	{
+		*base = memreg_key(attribs->RootDirectory);
+		return (*base)->deleted ? STATUS_KEY_DELETED : STATUS_SUCCESS;
+	}
+
+	const wchar_t prefix[] = L"\\Registry";
+	uint32_t prefix_size = sizeof(prefix) - 2;
+
+	if (*size < prefix_size
+	|| !memreg_equal(*path, prefix_size, prefix, prefix_size)
+	|| (*size > prefix_size && (*path)[prefix_size / 2] != L'\\'))
+		return STATUS_OBJECT_NAME_NOT_FOUND;
+
+	*base = memreg_root;
+	*path += prefix_size / 2;
+	*size -= prefix_size;
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS memreg_open(PHANDLE handle, ACCESS_MASK access, POBJECT_ATTRIBUTES attribs)
+{
+	pthread_mutex_lock(&memreg_lock);
+
+	struct memreg_key_t *base;
+	const wchar_t *path;
+	uint32_t size;
+
+	NTSTATUS status = memreg_attribs(attribs, &base, &path, &size);
+	if (status == STATUS_SUCCESS)
+	{
+		struct memreg_key_t *key = memreg_walk(base, path, size, 0, 0);
+		if (key)
+		{
+			key->refs++;
+			*handle = key;
+		}
+		else
+			status = STATUS_OBJECT_NAME_NOT_FOUND;
+	}
+
+	pthread_mutex_unlock(&memreg_lock);
+
+	return status;
+}
+
+static NTSTATUS memreg_create(PHANDLE            handle,
+							  ACCESS_MASK        access,
+							  POBJECT_ATTRIBUTES attribs,
+							  ULONG              index,
+							  PUNICODE_STRING    class,
+							  ULONG              options,
+							  PULONG             disposition)
+{
+	pthread_mutex_lock(&memreg_lock);
+
+	struct memreg_key_t *base;
+	const wchar_t *path;
+	uint32_t size;
+	uint8_t created = 0;
+
+	NTSTATUS status = memreg_attribs(attribs, &base, &path, &size);
+	if (status == STATUS_SUCCESS)
+	{
+		struct memreg_key_t *key = memreg_walk(base, path, size, 1, &created);
+		if (key)
+		{
+			key->refs++;
+			*handle = key;
+
+			if (disposition)
+				*disposition = created ? REG_CREATED_NEW_KEY : REG_OPENED_EXISTING_KEY;
+		}
+		else
+			status = STATUS_OBJECT_NAME_NOT_FOUND;
+	}
+
+	pthread_mutex_unlock(&memreg_lock);
+
+	return status;
+}
+
+static NTSTATUS memreg_close(HANDLE handle)
+{
+	pthread_mutex_lock(&memreg_lock);
+
+	// The predefined handles are never closed
+	struct memreg_key_t *key = memreg_key(handle);
+	if (key == (struct memreg_key_t *) handle && key->refs)
+		key->refs--;
+
+	if (!key->refs && key->deleted)
+		memreg_free(key);
+
+	pthread_mutex_unlock(&memreg_lock);
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS memreg_delete(HANDLE handle)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+
+	pthread_mutex_lock(&memreg_lock);
+
+	struct memreg_key_t *key = memreg_key(handle);
+
+	if (key->deleted)
+		status = STATUS_KEY_DELETED;
+	else if (key->num_keys || !key->parent)
+		status = STATUS_CANNOT_DELETE;
+	else
+	{
+		for (uint32_t i = 0; i < MEMREG_HIVES; i++)
+			if (key == memreg_hives[i])
+				status = STATUS_CANNOT_DELETE;
+	}
+
+	if (status == STATUS_SUCCESS)
+	{
+		struct memreg_key_t *parent = key->parent;
+		for (uint32_t i = 0; i < parent->num_keys; i++)
+		{
+			if (parent->keys[i] == key)
+			{
+				memmove(&parent->keys[i], &parent->keys[i + 1], sizeof(struct memreg_key_t *) * (parent->num_keys - i - 1));
+				parent->num_keys--;
+				break;
+			}
+		}
+
+		key->deleted = 1;
+		key->parent = 0;
+	}
+
+	pthread_mutex_unlock(&memreg_lock);
+
+	return status;
+}
+
+static struct memreg_value_t *memreg_value(struct memreg_key_t *key, PUNICODE_STRING name)
+{
+	uint32_t size = name ? name->Length : 0;
+
+	for (uint32_t i = 0; i < key->num_values; i++)
+		if (memreg_equal(key->values[i].name, key->values[i].name_size, name ? name->Buffer : 0, size))
+			return &key->values[i];
+
+	return 0;
+}
+
+static NTSTATUS memreg_set_value(HANDLE handle, PUNICODE_STRING name, ULONG index, ULONG type, PVOID data, ULONG size)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+
+	pthread_mutex_lock(&memreg_lock);
+
+	struct memreg_key_t *key = memreg_key(handle);
+	struct memreg_value_t *value = 0;
+
+	uint8_t *copy = malloc(size ? size : 1);
+	if (copy && size)
+		memcpy(copy, data, size);
+
+	if (key->deleted)
+		status = STATUS_KEY_DELETED;
+	else if (!copy)
+		status = STATUS_INSUFFICIENT_RESOURCES;
+	else if (!(value = memreg_value(key, name)))
+	{
+		if (key->num_values == key->max_values)
+		{
+			uint32_t max = key->max_values ? key->max_values * 2 : 8;
+			struct memreg_value_t *v = realloc(key->values, sizeof(struct memreg_value_t) * max);
+			if (v)
+			{
+				key->values = v;
+				key->max_values = max;
+			}
+		}
+
+		uint32_t name_size = name ? name->Length : 0;
+		wchar_t *n = malloc(name_size + 2);
+
+		if (n && key->num_values < key->max_values)
+		{
+			if (name_size)
+				memcpy(n, name->Buffer, name_size);
+			n[name_size / 2] = 0;
+
+			value = &key->values[key->num_values++];
+			value->name = n;
+			value->name_size = name_size;
+			value->data = 0;
+		}
+		else
+		{
+			if (n)
+				free(n);
+
+			status = STATUS_INSUFFICIENT_RESOURCES;
+		}
+	}
+
+	if (value)
+	{
+		if (value->data)
+			free(value->data);
+
+		value->type = type;
+		value->data = copy;
+		value->size = size;
+	}
+	else if (copy)
+		free(copy);
+
+	pthread_mutex_unlock(&memreg_lock);
+
+	return status;
+}
+
+static NTSTATUS memreg_delete_value(HANDLE handle, PUNICODE_STRING name)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+
+	pthread_mutex_lock(&memreg_lock);
+
+	struct memreg_key_t *key = memreg_key(handle);
+	struct memreg_value_t *value = 0;
+
+	if (key->deleted)
+		status = STATUS_KEY_DELETED;
+	else if (!(value = memreg_value(key, name)))
+		status = STATUS_OBJECT_NAME_NOT_FOUND;
+	else
+	{
+		free(value->name);
+		free(value->data);
+
+		uint32_t i = value - key->values;
+		memmove(value, value + 1, sizeof(struct memreg_value_t) * (key->num_values - i - 1));
+		key->num_values--;
+	}
+
+	pthread_mutex_unlock(&memreg_lock);
+
+	return status;
+}
+
+// KEY_VALUE_FULL_INFORMATION, the only value class used here
+static NTSTATUS memreg_value_info(struct memreg_value_t *value, ULONG class, PVOID buf, ULONG len, PULONG needed)
+{
+	if (class != KeyValueFullInformation)
+		return STATUS_INVALID_PARAMETER;
+
+	ULONG header = offsetof(KEY_VALUE_FULL_INFORMATION, Name);
+	ULONG offset = (header + value->name_size + 7) & ~7;
+	*needed = offset + value->size;
+
+	if (len < header)
+		return STATUS_BUFFER_TOO_SMALL;
+
+	PKEY_VALUE_FULL_INFORMATION info = (PKEY_VALUE_FULL_INFORMATION) buf;
+	info->TitleIndex = 0;
+	info->Type = value->type;
+	info->DataOffset = offset;
+	info->DataLength = value->size;
+	info->NameLength = value->name_size;
+
+	if (len < *needed)
+		return STATUS_BUFFER_OVERFLOW;
+
+	memcpy(info->Name, value->name, value->name_size);
+	memcpy((uint8_t *) buf + offset, value->data, value->size);
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS memreg_query_value(HANDLE handle, PUNICODE_STRING name, ULONG class, PVOID buf, ULONG len, PULONG needed)
+{
+	NTSTATUS status = STATUS_OBJECT_NAME_NOT_FOUND;
+
+	pthread_mutex_lock(&memreg_lock);
+
+	struct memreg_key_t *key = memreg_key(handle);
+	struct memreg_value_t *value;
+
+	if (key->deleted)
+		status = STATUS_KEY_DELETED;
+	else if ((value = memreg_value(key, name)))
+		status = memreg_value_info(value, class, buf, len, needed);
+
+	pthread_mutex_unlock(&memreg_lock);
+
+	return status;
+}
+
+static void memreg_wait(void)
+{
+	uint32_t delay = __atomic_load_n(&memreg_delay, __ATOMIC_RELAXED);
+	if (!delay)
+		return;
+
+	uint32_t capacity = __atomic_load_n(&memreg_capacity, __ATOMIC_RELAXED);
+	uint32_t inflight = __atomic_add_fetch(&memreg_inflight, 1, __ATOMIC_RELAXED);
+
+	if (capacity && inflight > capacity)
+		thread_sleep((uint64_t) delay * inflight / capacity);
+	else
+		thread_sleep(delay);
+
+	__atomic_sub_fetch(&memreg_inflight, 1, __ATOMIC_RELAXED);
+}
+
+static NTSTATUS memreg_enumerate_value(HANDLE handle, ULONG index, ULONG class, PVOID buf, ULONG len, PULONG needed)
+{
+	NTSTATUS status = STATUS_NO_MORE_ENTRIES;
+
+	memreg_wait();
+
+	pthread_mutex_lock(&memreg_lock);
+
+	struct memreg_key_t *key = memreg_key(handle);
+
+	if (key->deleted)
+		status = STATUS_KEY_DELETED;
+	else if (index < key->num_values)
+		status = memreg_value_info(&key->values[index], class, buf, len, needed);
+
+	pthread_mutex_unlock(&memreg_lock);
+
+	return status;
+}
+
+// The full object name, \Registry\Machine\..., built from the parents up
+static NTSTATUS memreg_key_name(struct memreg_key_t *key, PVOID buf, ULONG len, PULONG needed)
+{
+	ULONG size = 0;
+	for (struct memreg_key_t *k = key; k; k = k->parent)
+		size += 2 + k->name_size;
+
+	ULONG header = offsetof(KEY_NAME_INFORMATION, Name);
+	*needed = header + size;
+
+	if (len < header)
+		return STATUS_BUFFER_TOO_SMALL;
+
+	PKEY_NAME_INFORMATION info = (PKEY_NAME_INFORMATION) buf;
+	info->NameLength = size;
+
+	if (len < *needed)
+		return STATUS_BUFFER_OVERFLOW;
+
+	for (struct memreg_key_t *k = key; k; k = k->parent)
+	{
+		size -= k->name_size;
+		memcpy(&info->Name[size / 2], k->name, k->name_size);
+		size -= 2;
+		info->Name[size / 2] = L'\\';
+	}
+
+	return STATUS_SUCCESS;
+}
+
+// KEY_BASIC_INFORMATION, or the name of the key for tracing
+static NTSTATUS memreg_key_info(struct memreg_key_t *key, ULONG class, PVOID buf, ULONG len, PULONG needed)
+{
+	if (class == KeyNameInformation)
+		return memreg_key_name(key, buf, len, needed);
+
+	if (class != KeyBasicInformation)
+		return STATUS_INVALID_PARAMETER;
+
+	ULONG header = offsetof(KEY_BASIC_INFORMATION, Name);
+	*needed = header + key->name_size;
+
+	if (len < header)
+		return STATUS_BUFFER_TOO_SMALL;
+
+	PKEY_BASIC_INFORMATION info = (PKEY_BASIC_INFORMATION) buf;
+	info->LastWriteTime.QuadPart = 0;
+	info->TitleIndex = 0;
+	info->NameLength = key->name_size;
+
+	if (len < *needed)
+		return STATUS_BUFFER_OVERFLOW;
+
+	memcpy(info->Name, key->name, key->name_size);
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS memreg_query_key(HANDLE handle, ULONG class, PVOID buf, ULONG len, PULONG needed)
+{
+	NTSTATUS status = STATUS_KEY_DELETED;
+
+	pthread_mutex_lock(&memreg_lock);
+
+	struct memreg_key_t *key = memreg_key(handle);
+	if (!key->deleted)
+		status = memreg_key_info(key, class, buf, len, needed);
+
+	pthread_mutex_unlock(&memreg_lock);
+
+	return status;
+}
+
+static NTSTATUS memreg_enumerate_key(HANDLE handle, ULONG index, ULONG class, PVOID buf, ULONG len, PULONG needed)
+{
+	NTSTATUS status = STATUS_NO_MORE_ENTRIES;
+
+	memreg_wait();
+
+	pthread_mutex_lock(&memreg_lock);
+
+	struct memreg_key_t *key = memreg_key(handle);
+
+	if (key->deleted)
+		status = STATUS_KEY_DELETED;
+	else if (index < key->num_keys)
+		status = memreg_key_info(key->keys[index], class, buf, len, needed);
+
+	pthread_mutex_unlock(&memreg_lock);
+
+	return status;
+}
+
+void memreg_init(void)
+{
+	pthread_once(&memreg_once, memreg_setup);
+
+	NtCreateKey         = memreg_create;
+	NtOpenKey           = memreg_open;
+	NtSetValueKey       = memreg_set_value;
+	NtDeleteKey         = memreg_delete;
+	NtDeleteValueKey    = memreg_delete_value;
+	NtQueryKey          = memreg_query_key;
+	NtEnumerateKey      = memreg_enumerate_key;
+	NtQueryValueKey     = memreg_query_value;
+	NtEnumerateValueKey = memreg_enumerate_value;
+	NtClose             = memreg_close;
+}
+
+void memreg_latency(uint32_t usec, uint32_t capacity)
+{
+	__atomic_store_n(&memreg_capacity, capacity, __ATOMIC_RELAXED);
+	__atomic_store_n(&memreg_delay, usec, __ATOMIC_RELAXED);
+}
+
+// The Win32 functions only differ in taking the predefined handles and returning error codes
+static LONG memreg_win32(HKEY hive, const wchar_t *path, uint32_t size, int8_t create, PHKEY out, LPDWORD disposition)
+{
+	LONG r = ERROR_SUCCESS;
+	uint8_t created = 0;
+
+	// Not memreg_init(), which would replace a trace being recorded
+	init_ntdll();
+	pthread_mutex_lock(&memreg_lock);
+
+	struct memreg_key_t *key = memreg_key(hive);
+
+	if (key->deleted)
+		r = ERROR_FILE_NOT_FOUND;
+	else if (!(key = memreg_walk(key, path, size, create ? 2 : 0, &created)))
+		r = ERROR_FILE_NOT_FOUND;
+	else
+	{
+		key->refs++;
+		*out = (HKEY) key;
+
+		if (disposition)
+			*disposition = created ? REG_CREATED_NEW_KEY : REG_OPENED_EXISTING_KEY;
+	}
+
+	pthread_mutex_unlock(&memreg_lock);
+
+	return r;
+}
+
+LONG RegOpenKeyExA(HKEY hive, LPCSTR path, DWORD options, REGSAM access, PHKEY key)
+{
+	uint32_t len = path ? strlen(path) + 1 : 1;
+	wchar_t *wpath = malloc(len * 2);
+	if (!wpath)
+		return ERROR_ACCESS_DENIED;
+
+	uint32_t size = path ? (MultiByteToWideChar(CP_OEMCP, 0, path, -1, wpath, len) - 1) * 2 : 0;
+	LONG r = memreg_win32(hive, wpath, size, 0, key, 0);
+	free(wpath);
+
+	return r;
+}
+
+LONG RegOpenKeyExW(HKEY hive, LPCWSTR path, DWORD options, REGSAM access, PHKEY key)
+{
+	uint32_t len = 0;
+	while (path && path[len])
+		len++;
+
+	return memreg_win32(hive, path, len * 2, 0, key, 0);
+}
+
+LONG RegCreateKeyExW(HKEY hive, LPCWSTR path, DWORD reserved, LPWSTR class, DWORD options,
+					 REGSAM access, void *security, PHKEY key, LPDWORD disposition)
+{
+	uint32_t len = 0;
+	while (path && path[len])
+		len++;
+
+	return memreg_win32(hive, path, len * 2, 1, key, disposition);
+}
+
+LONG RegOpenCurrentUser(REGSAM access, PHKEY key)
+{
+	return memreg_win32(HKEY_CURRENT_USER, 0, 0, 0, key, 0);
+}
+
+LONG RegCloseKey(HKEY key)
+{
+	init_ntdll();
+	memreg_close((HANDLE) key);
+
+	return ERROR_SUCCESS;
+}
+
+#endif
@@ -17,12 +17,15 @@
  */
 
 #include <invis/ntdll.h>
+#include <invis/memreg.h>
 
 _NtCreateKey         NtCreateKey;
+_NtOpenKey           NtOpenKey;
 _NtSetValueKey       NtSetValueKey;
 _NtDeleteKey         NtDeleteKey;
 _NtDeleteValueKey    NtDeleteValueKey;
 _NtQueryKey          NtQueryKey;
+_NtEnumerateKey      NtEnumerateKey;
 _NtQueryValueKey     NtQueryValueKey;
 _NtEnumerateValueKey NtEnumerateValueKey;
 _NtClose             NtClose;
@@ -30,22 +33,30 @@ _NtClose             NtClose;
 void init_ntdll(void)
 {
 	if (!NtCreateKey
+	||  !NtOpenKey
 	||  !NtSetValueKey
 	||  !NtDeleteKey
 	||  !NtDeleteValueKey
 	||  !NtQueryKey
+	||  !NtEnumerateKey
 	||  !NtQueryValueKey
 	||  !NtEnumerateValueKey
 	||  !NtClose)
 	{
+#ifdef _WIN32
 		HANDLE ntdll        = LoadLibraryA("ntdll.dll");
 		NtCreateKey         = (_NtCreateKey)         GetProcAddress(ntdll, "NtCreateKey");
+		NtOpenKey           = (_NtOpenKey)           GetProcAddress(ntdll, "NtOpenKey");
 	    NtSetValueKey       = (_NtSetValueKey)       GetProcAddress(ntdll, "NtSetValueKey");
 	    NtDeleteKey         = (_NtDeleteKey)         GetProcAddress(ntdll, "NtDeleteKey");
 	    NtDeleteValueKey    = (_NtDeleteValueKey)    GetProcAddress(ntdll, "NtDeleteValueKey");
 		NtQueryKey          = (_NtQueryKey)          GetProcAddress(ntdll, "NtQueryKey");
+		NtEnumerateKey      = (_NtEnumerateKey)      GetProcAddress(ntdll, "NtEnumerateKey");
 		NtQueryValueKey     = (_NtQueryValueKey)     GetProcAddress(ntdll, "NtQueryValueKey");
 		NtEnumerateValueKey = (_NtEnumerateValueKey) GetProcAddress(ntdll, "NtEnumerateValueKey");
 		NtClose             = (_NtClose)             GetProcAddress(ntdll, "NtClose");
+#else
+		memreg_init();
+#endif
 	}
 }
@@ -0,0 +1,287 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <error.h>
+#include <invis/pipeline.h>
+
+// Names are padded so that the data after them is aligned
+#define PIPELINE_ALIGN(size)	(((uint64_t) (size) + 7) & ~7ULL)
+
+/*
+ * Each record is this header followed by the name and the data of a value,
+ * or the path of a key. A record too large for the ring has them on the
+ * heap instead, owned by the record until a stage drops it or the last
+ * stage is done with it.
+ */
+struct pipeline_record_t
+{
+	uint8_t kind;
+	ULONG type;
+	uint32_t anomalies;
+	uint32_t name_size;		// Or path_size of a key
+	uint32_t size;
+	struct ioc_match_t ioc;
+	uint8_t *heap;
+};
+
+static int pipeline_put(struct ring_t *ring, struct pipeline_item_t *item, uint8_t *heap)
+{
+	const void *name = item->kind == PIPELINE_KEY ? (const void *) item->path : (const void *) item->entry.name;
+	uint32_t name_size = item->kind == PIPELINE_KEY ? item->path_size : item->entry.name_size;
+	uint32_t size = item->kind == PIPELINE_KEY ? 0 : item->entry.size;
+
+	uint64_t payload = PIPELINE_ALIGN(name_size) + size;
+	if (!heap && sizeof(struct pipeline_record_t) + payload > ring_max_record(ring))
+	{
+		if (!(heap = malloc(payload)))
+		{
+			set_errno(ENOMEM);
+			return -2;
+		}
+
+		memcpy(heap, name, name_size);
+		if (size)
+			memcpy(&heap[PIPELINE_ALIGN(name_size)], item->entry.value, size);
+	}
+
+	struct pipeline_record_t *h = ring_reserve(ring, sizeof(struct pipeline_record_t) + (heap ? 0 : payload));
+	h->kind = item->kind;
+	h->type = item->entry.type;
+	h->anomalies = item->entry.anomalies;
+	h->name_size = name_size;
+	h->size = size;
+	h->ioc = item->ioc;
+	h->heap = heap;
+
+	if (!heap)
+	{
+		uint8_t *p = (uint8_t *) &h[1];
+		memcpy(p, name, name_size);
+		if (size)
+			memcpy(&p[PIPELINE_ALIGN(name_size)], item->entry.value, size);
+	}
+
+	ring_commit(ring);
+
+	return 0;
+}
+
+// Returns 1 once the item is passed on, along with the heap of its record
+static int pipeline_item(struct pipeline_worker_t *w, struct pipeline_record_t *h)
+{
+	uint8_t *payload = h->heap ? h->heap : (uint8_t *) &h[1];
+
+	struct pipeline_item_t item;
+	memset(&item, 0, sizeof(struct pipeline_item_t));
+	item.kind = h->kind;
+	item.ioc = h->ioc;
+	item.entry.anomalies = h->anomalies;
+
+	if (h->kind == PIPELINE_KEY)
+	{
+		if (!w->path || h->name_size > w->path_max)
+		{
+			wchar_t *p = realloc(w->path, h->name_size + 2);
+			if (!p)
+			{
+				set_errno(ENOMEM);
+				return -2;
+			}
+
+			w->path = p;
+			w->path_max = h->name_size;
+		}
+
+		memcpy(w->path, payload, h->name_size);
+		w->path_size = h->name_size;
+	}
+	else
+	{
+		item.entry.type = h->type;
+		item.entry.name = (wchar_t *) payload;
+		item.entry.name_size = h->name_size;
+		item.entry.value = &payload[PIPELINE_ALIGN(h->name_size)];
+		item.entry.size = h->size;
+	}
+
+	item.path = w->path;
+	item.path_size = w->path_size;
+
+	int r = w->stage.cb(w->stage.ctx, &item);
+	if (r <= 0 || !w->out)
+		return r < 0 ? r : 0;
+
+	if ((r = pipeline_put(w->out, &item, h->heap)))
+		return r;
+
+	return 1;
+}
+
+static void pipeline_worker(void *arg)
+{
+	struct pipeline_worker_t *w = (struct pipeline_worker_t *) arg;
+	struct pipeline_record_t *h;
+	uint32_t size;
+
+	// Once stopped, the rest is still read so that nothing before it waits on a full ring
+	while ((h = ring_peek(w->in, &size)))
+	{
+		int r = 0;
+		if (!__atomic_load_n(&w->p->stop, __ATOMIC_RELAXED)
+		&&  (r = pipeline_item(w, h)) < 0)
+		{
+			w->r = r;
+			w->err = errno;
+			__atomic_store_n(&w->p->stop, 1, __ATOMIC_RELAXED);
+		}
+
+		if (h->heap && r != 1)
+			free(h->heap);
+
+		ring_release(w->in);
+	}
+
+	if (w->out)
+		ring_close(w->out);
+}
+
+int pipeline_start(struct pipeline_t *p, const struct pipeline_stage_t *stages)
+{
+	int r = 0;
+	memset(p, 0, sizeof(struct pipeline_t));
+
+	for (uint32_t i = 0; !r && i < PIPELINE_STAGES; i++)
+		r = ring_init(&p->rings[i], PIPELINE_RING_SIZE);
+
+	for (uint32_t i = 0; !r && i < PIPELINE_STAGES; i++)
+	{
+		struct pipeline_worker_t *w = &p->workers[i];
+		w->p = p;
+		w->stage = stages[i];
+		w->in = &p->rings[i];
+		w->out = i + 1 < PIPELINE_STAGES ? &p->rings[i + 1] : 0;
+
+		if (!(r = thread_start(&w->thread, pipeline_worker, w)))
+			w->started = 1;
+	}
+
+	// Whatever did start drains out once it is closed
+	if (r)
+		pipeline_finish(p);
+
+	return r;
+}
+
+int pipeline_key(struct pipeline_t *p, const wchar_t *path, uint32_t path_size)
+{
+	if (__atomic_load_n(&p->stop, __ATOMIC_RELAXED))
+		return -1;
+
+	struct pipeline_item_t item;
+	memset(&item, 0, sizeof(struct pipeline_item_t));
+	item.kind = PIPELINE_KEY;
+	item.path = path;
+	item.path_size = path_size;
+
+	return pipeline_put(&p->rings[0], &item, 0);
+}
+
+int pipeline_value(struct pipeline_t *p, const struct key_data_t *entry)
+{
+	if (__atomic_load_n(&p->stop, __ATOMIC_RELAXED))
+		return -1;
+
+	struct pipeline_item_t item;
+	memset(&item, 0, sizeof(struct pipeline_item_t));
+	item.kind = PIPELINE_VALUE;
+	item.entry = *entry;
+
+	return pipeline_put(&p->rings[0], &item, 0);
+}
+
+int pipeline_sweep_cb(void *ctx, const wchar_t *path, uint32_t path_size, struct key_data_t *entry)
+{
+	struct pipeline_t *p = (struct pipeline_t *) ctx;
+
+	if (!entry)
+		return pipeline_key(p, path, path_size);
+
+	return pipeline_value(p, entry);
+}
+
+int pipeline_finish(struct pipeline_t *p)
+{
+	int r = 0;
+
+	// Closing the first ring closes each one after it as its stage drains
+	ring_close(&p->rings[0]);
+
+	for (uint32_t i = 0; i < PIPELINE_STAGES; i++)
+	{
+		struct pipeline_worker_t *w = &p->workers[i];
+
+		if (w->started)
+			thread_join(&w->thread);
+		else if (w->out)
+			ring_close(w->out);
+
+		w->started = 0;
+
+		if (w->r && !r)
+		{
+			r = w->r;
+			set_errno(w->err);
+		}
+
+		if (w->path)
+			free(w->path);
+
+		w->path = 0;
+	}
+
+	for (uint32_t i = 0; i < PIPELINE_STAGES; i++)
+		ring_free(&p->rings[i]);
+
+	return r;
+}
+
+void pipeline_stats(struct pipeline_t *p, struct pipeline_stats_t stats[PIPELINE_STAGES + 1])
+{
+	memset(stats, 0, sizeof(struct pipeline_stats_t) * (PIPELINE_STAGES + 1));
+
+	stats[0].name = "Enumerate";
+	stats[0].records = p->rings[0].records;
+	stats[0].blocked = p->rings[0].blocked;
+
+	for (uint32_t i = 0; i < PIPELINE_STAGES; i++)
+	{
+		struct ring_t *in = &p->rings[i];
+
+		stats[i + 1].name = p->workers[i].stage.name;
+		stats[i + 1].records = in->records;
+		stats[i + 1].starved = in->starved;
+		stats[i + 1].occupancy = ring_occupancy(in);
+		stats[i + 1].peak = ring_peak(in);
+
+		if (i + 1 < PIPELINE_STAGES)
+			stats[i + 1].blocked = p->rings[i + 1].blocked;
+	}
+}
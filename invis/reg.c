@@ -18,6 +18,125 @@
 
 #include <invis/reg.h>
 #include <invis/ntdll.h>
+#include <invis/sweep.h>
+
+static const struct
+{
+	HKEY hive;
+	const char *name;
+	const char *full_name;
+	const wchar_t *nt_path;	// 0 for hives that depend on the user
+} hives[] =
+{
+	{ HKEY_LOCAL_MACHINE,  "HKLM", "HKEY_LOCAL_MACHINE",  L"\\Registry\\Machine" },
+	{ HKEY_CURRENT_USER,   "HKCU", "HKEY_CURRENT_USER",   0 },
+	{ HKEY_CURRENT_USER,   "HCU",  "HKEY_CURRENT_USER",   0 },
+	{ HKEY_CLASSES_ROOT,   "HKCR", "HKEY_CLASSES_ROOT",   L"\\Registry\\Machine\\SOFTWARE\\Classes" },
+	{ HKEY_CURRENT_CONFIG, "HKCC", "HKEY_CURRENT_CONFIG", L"\\Registry\\Machine\\SYSTEM\\CurrentControlSet\\Hardware Profiles\\Current" },
+	{ HKEY_USERS,          "HKU",  "HKEY_USERS",          L"\\Registry\\User" },
+};
+
+HKEY reg_hive(const char *name, size_t len)
+{
+	for (size_t i = 0; i < sizeof(hives) / sizeof(hives[0]); i++)
+		if ((strlen(hives[i].name) == len && !strncmp(hives[i].name, name, len))
+		||  (strlen(hives[i].full_name) == len && !strncmp(hives[i].full_name, name, len)))
+			return hives[i].hive;
+
+	return 0;
+}
+
+const char *reg_hive_name(HKEY hive)
+{
+	for (size_t i = 0; i < sizeof(hives) / sizeof(hives[0]); i++)
+		if (hives[i].hive == hive)
+			return hives[i].full_name;
+
+	return 0;
+}
+
+int reg_root(HKEY hive, ACCESS_MASK access, HANDLE *root)
+{
+	// Load the internals functions
+	init_ntdll();
+
+	for (size_t i = 0; i < sizeof(hives) / sizeof(hives[0]); i++)
+	{
+		if (hives[i].hive != hive)
+			continue;
+
+		// The predefined handles can't be enumerated, so the hive is opened by its kernel name
+		if (!hives[i].nt_path)
+		{
+			if (RegOpenCurrentUser(access, (PHKEY) root) == ERROR_SUCCESS)
+				return 0;
+
+			set_errno(EOPENKEY);
+			return -3;
+		}
+
+		UNICODE_STRING name = { 0 };
+		name.Buffer = (PWSTR) hives[i].nt_path;
+		name.Length = 0;
+		while (hives[i].nt_path[name.Length / 2])
+			name.Length += 2;
+		name.MaximumLength = name.Length;
+
+		OBJECT_ATTRIBUTES attribs = { 0 };
+		attribs.Length = sizeof(OBJECT_ATTRIBUTES);
+		attribs.RootDirectory = 0;
+		attribs.Attributes = OBJ_KERNEL_HANDLE;
+		attribs.ObjectName = &name;
+		attribs.SecurityDescriptor = 0;
+		attribs.SecurityQualityOfService = 0;
+
+		return reg_status(NtOpenKey(root, access, &attribs));
+	}
+
+	set_errno(EHIVE);
+	return -1;
+}
+
+int reg_status(NTSTATUS status)
+{
+	int r = -4;
+
+	switch (status)
+	{
+		// Not a valid error, really
+		case STATUS_NO_MORE_ENTRIES:
+			/* fall through */
+		case STATUS_SUCCESS:
+			r = 0;
+			set_errno(ESUCCESS);
+			break;
+		case STATUS_CANNOT_DELETE:
+			set_errno(EDELETE);
+			break;
+		case STATUS_ACCESS_DENIED:
+			set_errno(EACCES);
+			break;
+		case STATUS_INVALID_HANDLE:
+			set_errno(EHANDLE);
+			break;
+		case STATUS_OBJECT_NAME_NOT_FOUND:
+			set_errno(EREGUNAVAIL);
+			break;
+		case STATUS_BUFFER_OVERFLOW:
+			/* fall through */
+		case STATUS_BUFFER_TOO_SMALL:
+			set_errno(EBUFSIZE);
+			break;
+		case STATUS_INVALID_PARAMETER:
+			set_errno(EINVAL);
+			break;
+		default:
+			set_errno(ENTUNK);
+			break;
+	};
+
+	return r;
+}
 
 int reg(int8_t              operation,
 		HKEY                hive,
@@ -45,19 +164,12 @@ int reg(int8_t              operation,
 	// Ensure the needed arguments are correct
 	if (path && path_len)
 	{
-		// Ok, so for some fucking reason when path_len == 102 (becomes 104 later), the final free() at the end
-		// of this function will crash. I have no idea why, but lets just avoid path_len == 102 I guess
-		// smh my head
-		// This is probably due to some type of heap corruption, but this works for now
-		if (path_len == 102)
-			path_len += 2;
-
-		// The trick key buffer needs 2 null bytes at the start to become invis
-		trick_key.Buffer = malloc(path_len + 2);
+		// The trick key buffer needs 2 null bytes at the start to become invis, and 2 more for the terminator
+		trick_key.Buffer = malloc(path_len + 4);
 
 		if (trick_key.Buffer)
 		{
-			memset(trick_key.Buffer, 0, path_len + 2);
+			memset(trick_key.Buffer, 0, path_len + 4);
 
 			// To make the key invis, set the offset to 1 on the trick_keyBuffer
 			offset = 1;
@@ -66,7 +178,7 @@ int reg(int8_t              operation,
 
 			// Its important to set the trick key buffer here before we remove the key name
 			// trick_keyBuffer[0] needs to be 0x0000 for the key to be invisible
-			MultiByteToWideChar(CP_OEMCP, 0, path, -1, &trick_key.Buffer[offset], path_len + 2);
+			MultiByteToWideChar(CP_OEMCP, 0, path, -1, &trick_key.Buffer[offset], path_len / 2 + 1);
 			trick_key.Length = 2 * (strlen(path) + offset); // Length is the number of bytes - the null byte at the *END* of the trick key path
 			trick_key.MaximumLength = 0;
 
@@ -76,7 +188,15 @@ int reg(int8_t              operation,
 				if (*a == '\\')
 					key_name = a;
 
-			(*key_name) = 0x00; // This removes the key name
+			// Values directly under a hive can't be set, a query lists the key instead
+			if (key_name)
+				(*key_name) = 0x00; // This removes the key name
+			else if (!(operation & MAKE_KEY)
+			&&       (operation & OPERATION_MASK) != OPERATION_QUERY)
+			{
+				set_errno(EKEY);
+				r = -1;
+			}
 		}
 		else
 			r = -2;
@@ -99,39 +219,35 @@ int reg(int8_t              operation,
 		// VERY EXPERIMENTAL, USE WITH CAUTION
 		if (operation & MAKE_KEY)
 		{
-			HANDLE key;
-
-			OBJECT_ATTRIBUTES attribs = { 0 };
-
-			// Weird structure for NtCreateKey
-			attribs.Length = sizeof(OBJECT_ATTRIBUTES);
-			attribs.RootDirectory = hive;
-			attribs.Attributes = OBJ_KERNEL_HANDLE;
-			attribs.ObjectName = &trick_key;
-			attribs.SecurityDescriptor = 0;
-			attribs.SecurityQualityOfService = 0;
-
-			// Open (or create) the key
-			NtCreateKey(&key, KEY_ALL_ACCESS, &attribs, 0, 0, REG_OPTION_NON_VOLATILE, 0);
-
-			// Perform the operation
 			switch (operation & OPERATION_MASK)
 			{
 				case OPERATION_CREATE:
-					// This was done above, and is needed for both delete and query anyways
-					break;
+					/* fall through */
 				case OPERATION_DELETE:
-					NtDeleteKey(key);
+				{
+					// Only the last key is invisible, so move the NUL from the start to just after the last backslash
+					uint32_t last = trick_key.Length / 2;
+					while (last > (uint32_t) offset && trick_key.Buffer[last - 1] != L'\\')
+						last--;
+
+					if (offset)
+					{
+						memmove(trick_key.Buffer, &trick_key.Buffer[1], (last - 1) * 2);
+						trick_key.Buffer[last - 1] = 0;
+					}
+
+					r = reg_tree(operation, hive, trick_key.Buffer, trick_key.Length, 0);
 					break;
+				}
 				case OPERATION_QUERY:
-					// TODO
+					// Keys have no data of their own, query their values instead
+					set_errno(EINVAL);
+					r = -1;
 					break;
 				default:
 					r = 3;
 					break;
 			};
-
-			NtClose(key);
 		}
 		// Perform the operation
 		else
@@ -149,8 +265,11 @@ int reg(int8_t              operation,
 						status = NtDeleteValueKey(key, &trick_key);
 						break;
 					case OPERATION_QUERY:
-						// Get the size of the buffer
-						status = NtQueryValueKey(key, &trick_key, 1, 0, 0, (PULONG) &size);
+						// Get the size of the buffer, a key directly under the hive has no key above it to hold the value
+						if (key_name)
+							status = NtQueryValueKey(key, &trick_key, 1, 0, 0, (PULONG) &size);
+						else
+							status = STATUS_OBJECT_NAME_NOT_FOUND;
 
 						// Expect buffer too small here if the key exists
 						if (status == STATUS_BUFFER_TOO_SMALL)
@@ -178,19 +297,13 @@ int reg(int8_t              operation,
 								else
 									r = -5;
 
-								if ((*key_data)[0].name = malloc(info->NameLength))
+								// Keep the whole counted name, the anomaly flags say how it's hidden
+								(*key_data)[0].anomalies = classify_name(info->Name, info->NameLength);
+								(*key_data)[0].name_size = info->NameLength;
+								if ((*key_data)[0].name = malloc(info->NameLength + 2))
 								{
-									// This is a trick key, probably
-									if (((uint8_t *) info->Name)[0] == 0)
-									{
-										(*key_data)[0].invis = 1;
-										offset = 2;
-									}
-									else
-										offset = 0;
-
-									memset((*key_data)[0].name, 0, info->NameLength);
-									memcpy((*key_data)[0].name, ((uint8_t *) info->Name) + offset, info->NameLength - offset);
+									memset((*key_data)[0].name, 0, info->NameLength + 2);
+									memcpy((*key_data)[0].name, info->Name, info->NameLength);
 								}
 								else
 									r = -6;
@@ -205,7 +318,8 @@ int reg(int8_t              operation,
 							// To check if this is truly a key, close the old HKEY
 							// Then append the key name again, before attempting to open the key again
 							RegCloseKey(key);
-							*key_name = '\\';
+							if (key_name)
+								*key_name = '\\';
 							if (RegOpenKeyExA(hive, path, 0, KEY_ALL_ACCESS, &key) == ERROR_SUCCESS)
 							{
 								// Fetch the number of subkeys
@@ -247,20 +361,13 @@ int reg(int8_t              operation,
 												else
 													r = -6;
 
-												if ((*key_data)[i].name = malloc(info->NameLength))
+												// Keep the whole counted name, the anomaly flags say how it's hidden
+												(*key_data)[i].anomalies = classify_name(info->Name, info->NameLength);
+												(*key_data)[i].name_size = info->NameLength;
+												if ((*key_data)[i].name = malloc(info->NameLength + 2))
 												{
-													// This is a trick key, probably
-													if (((uint8_t *) info->Name)[0] == 0)
-													{
-														(*key_data)[i].invis = 1;
-														offset = 2;
-													}
-													else
-														offset = 0;
-
-													memset((*key_data)[i].name, 0, info->NameLength);
-													memcpy((*key_data)[i].name, ((uint8_t *) info->Name) + offset,
-																						info->NameLength - offset);
+													memset((*key_data)[i].name, 0, info->NameLength + 2);
+													memcpy((*key_data)[i].name, info->Name, info->NameLength);
 												}
 												else
 													r = -7;
@@ -283,53 +390,389 @@ int reg(int8_t              operation,
 						break;
 				};
 
-				r = -4;
-				switch (status)
-				{
-					// Not a valid error, really
-					case STATUS_NO_MORE_ENTRIES:
-						/* fall through */
-					case STATUS_SUCCESS:
-						r = 0;
-						set_errno(ESUCCESS);
-						break;
-					case STATUS_CANNOT_DELETE:
-						set_errno(EDELETE);
-						break;
-					case STATUS_ACCESS_DENIED:
-						set_errno(EACCES);
-						break;
-					case STATUS_INVALID_HANDLE:
-						set_errno(EHANDLE);
-						break;
-					case STATUS_OBJECT_NAME_NOT_FOUND:
-						set_errno(EREGUNAVAIL);
-						break;
-					case STATUS_BUFFER_OVERFLOW:
-						/* fall through */
-					case STATUS_BUFFER_TOO_SMALL:
-						set_errno(EBUFSIZE);
-						break;
-					case STATUS_INVALID_PARAMETER:
-						set_errno(EINVAL);
-						break;
-					default:
-						set_errno(ENTUNK);
-						break;
-				};
+				r = reg_status(status);
+				RegCloseKey(key);
 			}
 			else
 			{
 				r = -3;
 				set_errno(EOPENKEY);
 			}
+		}
+	}
+
+	if (trick_key.Buffer)
+		free(trick_key.Buffer);
+
+	return r;
+}
+
+// Open or create a single level of a path relative to its parent
+static int reg_tree_open(HANDLE         parent,
+						 const wchar_t *name,
+						 uint32_t       size,
+						 int8_t         create,
+						 HANDLE        *key,
+						 ULONG         *disposition)
+{
+	UNICODE_STRING u = { 0 };
+	u.Buffer = (PWSTR) name;
+	u.Length = size;
+	u.MaximumLength = size;
+
+	OBJECT_ATTRIBUTES attribs = { 0 };
+	attribs.Length = sizeof(OBJECT_ATTRIBUTES);
+	attribs.RootDirectory = parent;
+	attribs.Attributes = OBJ_KERNEL_HANDLE;
+	attribs.ObjectName = &u;
+	attribs.SecurityDescriptor = 0;
+	attribs.SecurityQualityOfService = 0;
+
+	NTSTATUS status;
+	if (create)
+		status = NtCreateKey(key, KEY_ALL_ACCESS, &attribs, 0, 0, REG_OPTION_NON_VOLATILE, disposition);
+	else
+		status = NtOpenKey(key, KEY_ALL_ACCESS, &attribs);
+
+	return reg_status(status);
+}
+
+/*
+ * Delete a key and everything under it, always taking the first subkey of
+ * the deepest open key, as deleting shifts the ones after it. Every key is
+ * opened relative to its parent, whose handle stays open until it is
+ * deleted in turn. Takes ownership of key.
+ */
+static int reg_tree_delete(HANDLE key, uint32_t *count)
+{
+	int r = 0;
+
+	HANDLE *stack = malloc(sizeof(HANDLE) * 16);
+	uint32_t depth = 0;
+	uint32_t max_depth = 16;
+
+	ULONG buf_size = 512;
+	uint8_t *buf = malloc(buf_size);
+
+	if (!stack || !buf)
+	{
+		set_errno(ENOMEM);
+		NtClose(key);
+		r = -2;
+	}
+	else
+		stack[depth++] = key;
+
+	while (!r && depth)
+	{
+		HANDLE top = stack[depth - 1];
+
+		ULONG needed = 0;
+		NTSTATUS status = NtEnumerateKey(top, 0, KeyBasicInformation, buf, buf_size, &needed);
+
+		if ((status == STATUS_BUFFER_TOO_SMALL || status == STATUS_BUFFER_OVERFLOW) && needed > buf_size)
+		{
+			uint8_t *b = realloc(buf, needed);
+			if (!b)
+			{
+				set_errno(ENOMEM);
+				r = -2;
+				break;
+			}
+
+			buf = b;
+			buf_size = needed;
+		}
+		else if (status == STATUS_SUCCESS)
+		{
+			if (depth == max_depth)
+			{
+				HANDLE *s = realloc(stack, sizeof(HANDLE) * max_depth * 2);
+				if (!s)
+				{
+					set_errno(ENOMEM);
+					r = -2;
+					break;
+				}
+
+				stack = s;
+				max_depth *= 2;
+			}
+
+			PKEY_BASIC_INFORMATION info = (PKEY_BASIC_INFORMATION) buf;
+			if (!(r = reg_tree_open(top, info->Name, info->NameLength, 0, &stack[depth], 0)))
+				depth++;
+		}
+		else if (status == STATUS_NO_MORE_ENTRIES)
+		{
+			r = reg_status(NtDeleteKey(top));
+			NtClose(top);
+			depth--;
 
-			RegCloseKey(key);
+			if (!r)
+				(*count)++;
 		}
+		else
+			r = reg_status(status);
+	}
+
+	// Whatever is left after a failure
+	while (depth)
+		NtClose(stack[--depth]);
+
+	if (stack)
+		free(stack);
+
+	if (buf)
+		free(buf);
+
+	return r;
+}
+
+int reg_tree(int8_t         operation,
+			 HKEY           hive,
+			 const wchar_t *path,
+			 uint32_t       path_size,
+			 uint32_t      *count)
+{
+	uint8_t op = operation & OPERATION_MASK;
+	uint32_t done = 0;
+	uint32_t len = path_size / 2;
+
+	if (count)
+		*count = 0;
+
+	// The hive itself is never deleted
+	if (!path || !len || (op != OPERATION_CREATE && op != OPERATION_DELETE))
+	{
+		set_errno(EINVAL);
+		return -1;
 	}
 
+	HANDLE key = 0;
+	int r = reg_root(hive, KEY_ALL_ACCESS, &key);
+
+	// A single walk, each level only relative to the one before it
+	for (uint32_t start = 0, end = 0; !r && start < len; start = end + 1)
+	{
+		for (end = start; end < len && path[end] != L'\\'; end++);
+
+		if (end == start)
+			continue;
+
+		HANDLE next = 0;
+		ULONG disposition = 0;
+
+		r = reg_tree_open(key, &path[start], (end - start) * 2, op == OPERATION_CREATE, &next, &disposition);
+		if (!r && op == OPERATION_CREATE)
+		{
+			if (disposition == REG_CREATED_NEW_KEY)
+				done++;
+			else if (disposition != REG_OPENED_EXISTING_KEY)
+			{
+				NtClose(next);
+				set_errno(ENTUNK);
+				r = -4;
+			}
+		}
+
+		NtClose(key);
+		key = r ? 0 : next;
+	}
+
+	if (!r && op == OPERATION_DELETE)
+		r = reg_tree_delete(key, &done);
+	else if (key)
+		NtClose(key);
+
+	if (count)
+		*count = done;
+
+	return r;
+}
+
+// Copy an entry out of an enumeration buffer, +2 so that strings are always terminated
+static int reg_copy(struct key_data_t *dst, const struct key_data_t *src)
+{
+	memset(dst, 0, sizeof(struct key_data_t));
+	dst->type = src->type;
+	dst->size = src->size;
+	dst->name_size = src->name_size;
+	dst->anomalies = src->anomalies;
+
+	dst->name = malloc(src->name_size + 2);
+	dst->value = malloc(src->size + 2);
+
+	if (!dst->name || !dst->value)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	memset(dst->name, 0, src->name_size + 2);
+	memcpy(dst->name, src->name, src->name_size);
+
+	memset(dst->value, 0, src->size + 2);
+	memcpy(dst->value, src->value, src->size);
+
+	return 0;
+}
+
+int reg_at(int8_t              operation,
+		   HANDLE              key,
+		   const wchar_t      *name,
+		   uint32_t            name_size,
+		   ULONG               type,
+		   void               *value,
+		   uint32_t            size,
+		   struct key_data_t **key_data,
+		   uint64_t           *num_keys)
+{
+	// Load the internals functions
+	init_ntdll();
+
+	int r = 0;
+
+	// The trick key buffer needs 2 null bytes at the start to become invis
+	int8_t offset = 1;
+	if (operation & MAKE_VISIBLE)
+		offset = 0;
+
+	UNICODE_STRING trick_key = { 0 };
+	trick_key.Buffer = malloc(name_size + 2);
+	trick_key.Length = name_size + offset * 2;
+	trick_key.MaximumLength = 0;
+
 	if (trick_key.Buffer)
+	{
+		trick_key.Buffer[0] = 0;
+		memcpy(&trick_key.Buffer[offset], name, name_size);
+
+		switch (operation & OPERATION_MASK)
+		{
+			case OPERATION_CREATE:
+				r = reg_status(NtSetValueKey(key, &trick_key, 0, type, value, size));
+				break;
+			case OPERATION_DELETE:
+				r = reg_status(NtDeleteValueKey(key, &trick_key));
+				break;
+			case OPERATION_QUERY:
+				if (!key_data || !num_keys)
+				{
+					set_errno(EINVAL);
+					r = -1;
+					break;
+				}
+
+				ULONG needed = 0;
+				uint8_t *raw = 0;
+				NTSTATUS status = NtQueryValueKey(key, &trick_key, KeyValueFullInformation, 0, 0, &needed);
+
+				if (status == STATUS_BUFFER_TOO_SMALL
+				||  status == STATUS_BUFFER_OVERFLOW)
+				{
+					if ((raw = malloc(needed)))
+						status = NtQueryValueKey(key, &trick_key, KeyValueFullInformation, raw, needed, &needed);
+					else
+						status = STATUS_INSUFFICIENT_RESOURCES;
+				}
+
+				if (!(r = reg_status(status)))
+				{
+					PKEY_VALUE_FULL_INFORMATION info = (PKEY_VALUE_FULL_INFORMATION) raw;
+
+					struct key_data_t entry;
+					entry.type = info->Type;
+					entry.name = info->Name;
+					entry.name_size = info->NameLength;
+					entry.value = &raw[info->DataOffset];
+					entry.size = info->DataLength;
+					entry.anomalies = classify_name(info->Name, info->NameLength);
+
+					*num_keys = 1;
+					if ((*key_data = malloc(sizeof(struct key_data_t))))
+					{
+						if ((r = reg_copy(*key_data, &entry)))
+						{
+							free_key_data(*key_data, 1);
+							*key_data = 0;
+							*num_keys = 0;
+						}
+					}
+					else
+					{
+						*num_keys = 0;
+						set_errno(ENOMEM);
+						r = -2;
+					}
+				}
+
+				if (raw)
+					free(raw);
+				break;
+			default:
+				set_errno(EINVAL);
+				r = -1;
+				break;
+		};
+
 		free(trick_key.Buffer);
+	}
+	else
+	{
+		set_errno(ENOMEM);
+		r = -2;
+	}
+
+	return r;
+}
+
+struct reg_values_t
+{
+	struct key_data_t *key_data;
+	uint64_t num_keys;
+	uint64_t max_keys;
+};
+
+static int reg_values_cb(void *ctx, const wchar_t *path, uint32_t path_size, struct key_data_t *entry)
+{
+	struct reg_values_t *v = (struct reg_values_t *) ctx;
+
+	if (!entry)
+		return 0;
+
+	if (v->num_keys == v->max_keys)
+	{
+		uint64_t max = v->max_keys ? v->max_keys * 2 : 16;
+		struct key_data_t *k = realloc(v->key_data, sizeof(struct key_data_t) * max);
+		if (!k)
+		{
+			set_errno(ENOMEM);
+			return -2;
+		}
+
+		v->key_data = k;
+		v->max_keys = max;
+	}
+
+	// Counted first, so that a failed copy is still freed
+	return reg_copy(&v->key_data[v->num_keys++], entry);
+}
+
+int reg_values(HANDLE key, struct key_data_t **key_data, uint64_t *num_keys)
+{
+	struct reg_values_t v = { 0 };
+
+	int r = sweep_key(key, 0, 0, 0, reg_values_cb, &v);
+	if (r)
+	{
+		free_key_data(v.key_data, v.num_keys);
+		v.key_data = 0;
+		v.num_keys = 0;
+	}
+
+	*key_data = v.key_data;
+	*num_keys = v.num_keys;
 
 	return r;
 }
@@ -0,0 +1,1047 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <error.h>
+#include <invis/regfile.h>
+#include <invis/reg.h>
+#include <invis/sweep.h>
+#include <invis/ntdll.h>
+
+// Both directions stream through buffers of this size, independent of the file size
+#define REG_IO_BUFFER	(1 << 20)
+
+// regedit wraps hex data at this column
+#define REG_HEX_COLUMN	76
+
+#define REG_HEADER		"Windows Registry Editor Version 5.00"
+#define REG_HEADER4		"REGEDIT4"
+
+static const char hex_digits[] = "0123456789abcdef";
+
+struct bufwriter_t
+{
+	FILE *f;
+	char *buf;
+	size_t len;
+	int8_t err;
+};
+
+static void bw_flush(struct bufwriter_t *w)
+{
+	if (w->len && fwrite(w->buf, 1, w->len, w->f) != w->len)
+		w->err = 1;
+
+	w->len = 0;
+}
+
+// Space for n bytes at the end of the buffer, n must be less than REG_IO_BUFFER
+static char *bw_reserve(struct bufwriter_t *w, size_t n)
+{
+	if (w->len + n > REG_IO_BUFFER)
+		bw_flush(w);
+
+	return &w->buf[w->len];
+}
+
+static void bw_write(struct bufwriter_t *w, const char *data, size_t n)
+{
+	while (n)
+	{
+		size_t chunk = REG_IO_BUFFER - w->len;
+		if (chunk > n)
+			chunk = n;
+
+		memcpy(&w->buf[w->len], data, chunk);
+		w->len += chunk;
+		data += chunk;
+		n -= chunk;
+
+		if (w->len == REG_IO_BUFFER)
+			bw_flush(w);
+	}
+}
+
+static void bw_puts(struct bufwriter_t *w, const char *s)
+{
+	bw_write(w, s, strlen(s));
+}
+
+static void bw_escape(struct bufwriter_t *w, const wchar_t *name, uint32_t size, uint8_t flags)
+{
+	w->len += reg_escape(name, size, bw_reserve(w, REG_ESCAPE_SIZE(size)), flags);
+}
+
+size_t reg_escape(const wchar_t *name, uint32_t size, char *out, uint8_t flags)
+{
+	const uint16_t *n = (const uint16_t *) name;
+	uint32_t len = size / 2;
+	char *o = out;
+
+	for (uint32_t i = 0; i < len; i++)
+	{
+		uint16_t c = n[i];
+
+		if (c == 0 || c < 0x20 || c == 0x7F
+		|| (c >= 0xD800 && c <= 0xDBFF && (i + 1 == len || n[i + 1] < 0xDC00 || n[i + 1] > 0xDFFF))
+		|| (c >= 0xDC00 && c <= 0xDFFF))
+		{
+			*o++ = '\\';
+			if (flags & REG_ESCAPE_KEY)
+				*o++ = '\\';
+
+			if (!c)
+				*o++ = '0';
+			else
+			{
+				*o++ = 'x';
+				*o++ = hex_digits[(c >> 12) & 0xF];
+				*o++ = hex_digits[(c >> 8) & 0xF];
+				*o++ = hex_digits[(c >> 4) & 0xF];
+				*o++ = hex_digits[c & 0xF];
+			}
+		}
+		else if (c < 0x80)
+		{
+			if (!(flags & REG_ESCAPE_KEY) && (c == '\\' || c == '"'))
+				*o++ = '\\';
+			*o++ = (char) c;
+		}
+		else if (c < 0x800)
+		{
+			*o++ = 0xC0 | (c >> 6);
+			*o++ = 0x80 | (c & 0x3F);
+		}
+		else if (c >= 0xD800 && c <= 0xDBFF)
+		{
+			// Surrogate pair, the low surrogate was checked above
+			uint32_t cp = 0x10000 + ((c - 0xD800) << 10) + (n[++i] - 0xDC00);
+			*o++ = 0xF0 | (cp >> 18);
+			*o++ = 0x80 | ((cp >> 12) & 0x3F);
+			*o++ = 0x80 | ((cp >> 6) & 0x3F);
+			*o++ = 0x80 | (cp & 0x3F);
+		}
+		else
+		{
+			*o++ = 0xE0 | (c >> 12);
+			*o++ = 0x80 | ((c >> 6) & 0x3F);
+			*o++ = 0x80 | (c & 0x3F);
+		}
+	}
+
+	*o = 0;
+
+	return o - out;
+}
+
+static int8_t hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+int64_t reg_unescape(const char *name, size_t len, wchar_t *out, uint8_t flags)
+{
+	const uint8_t *s = (const uint8_t *) name;
+	uint16_t *o = (uint16_t *) out;
+	size_t i = 0;
+
+	while (i < len)
+	{
+		uint32_t cp = s[i];
+
+		if (cp == '\\')
+		{
+			// In key paths a single backslash is the separator
+			size_t e = i + 1;
+			if (flags & REG_ESCAPE_KEY)
+			{
+				// A separator can be followed by an escape, as in \\\0
+				if (e >= len || s[e] != '\\' || (e + 1 < len && s[e + 1] == '\\'))
+				{
+					*o++ = '\\';
+					i++;
+					continue;
+				}
+				e++;
+			}
+
+			if (e >= len)
+				return -1;
+
+			if (s[e] == '0')
+			{
+				*o++ = 0;
+				i = e + 1;
+			}
+			else if (s[e] == 'x')
+			{
+				if (e + 4 >= len)
+					return -1;
+
+				uint16_t c = 0;
+				for (size_t j = e + 1; j <= e + 4; j++)
+				{
+					int8_t v = hex_value(s[j]);
+					if (v < 0)
+						return -1;
+					c = (c << 4) | v;
+				}
+
+				*o++ = c;
+				i = e + 5;
+			}
+			else if (!(flags & REG_ESCAPE_KEY) && (s[e] == '\\' || s[e] == '"'))
+			{
+				*o++ = s[e];
+				i = e + 1;
+			}
+			else
+				return -1;
+
+			continue;
+		}
+
+		// UTF-8, anything that doesn't decode is taken as Latin-1 like regedit does with ANSI files
+		uint8_t extra = 0;
+		if      ((cp & 0xE0) == 0xC0)
+			extra = 1;
+		else if ((cp & 0xF0) == 0xE0)
+			extra = 2;
+		else if ((cp & 0xF8) == 0xF0)
+			extra = 3;
+
+		if (extra && i + extra < len)
+		{
+			uint32_t d = cp & (0x3F >> extra);
+			uint8_t ok = 1;
+
+			for (uint8_t j = 1; j <= extra && ok; j++)
+			{
+				if ((s[i + j] & 0xC0) != 0x80)
+					ok = 0;
+				d = (d << 6) | (s[i + j] & 0x3F);
+			}
+
+			if (ok)
+			{
+				cp = d;
+				i += extra;
+			}
+		}
+
+		if (cp >= 0x10000)
+		{
+			cp -= 0x10000;
+			*o++ = 0xD800 + (cp >> 10);
+			*o++ = 0xDC00 + (cp & 0x3FF);
+		}
+		else
+			*o++ = cp;
+
+		i++;
+	}
+
+	return (uint8_t *) o - (uint8_t *) out;
+}
+
+struct export_t
+{
+	struct bufwriter_t w;
+	const char *hive_name;
+};
+
+// Strings are only written as strings if they read back byte for byte
+static int8_t export_is_string(struct key_data_t *entry)
+{
+	const uint16_t *v = (const uint16_t *) entry->value;
+	uint32_t len = entry->size / 2;
+
+	if (entry->type != REG_SZ
+	|| (entry->size & 1)
+	||  !len
+	||  v[len - 1]
+	||  REG_ESCAPE_SIZE(entry->size) > REG_IO_BUFFER / 2)
+		return 0;
+
+	for (uint32_t i = 0; i + 1 < len; i++)
+		if (!v[i])
+			return 0;
+
+	return 1;
+}
+
+static int export_cb(void              *ctx,
+					 const wchar_t     *path,
+					 uint32_t           path_size,
+					 struct key_data_t *entry)
+{
+	struct export_t *e = (struct export_t *) ctx;
+	struct bufwriter_t *w = &e->w;
+
+	if (!entry)
+	{
+		bw_puts(w, "\r\n[");
+		bw_puts(w, e->hive_name);
+		if (path_size)
+		{
+			bw_puts(w, "\\");
+			bw_escape(w, path, path_size, REG_ESCAPE_KEY);
+		}
+		bw_puts(w, "]\r\n");
+	}
+	else
+	{
+		size_t start = w->len;
+
+		if (entry->name_size)
+		{
+			bw_puts(w, "\"");
+			bw_escape(w, entry->name, entry->name_size, REG_ESCAPE_NAME);
+			bw_puts(w, "\"=");
+		}
+		else
+			bw_puts(w, "@=");
+
+		if (export_is_string(entry))
+		{
+			bw_puts(w, "\"");
+			bw_escape(w, entry->value, entry->size - 2, REG_ESCAPE_NAME);
+			bw_puts(w, "\"");
+		}
+		else if (entry->type == REG_DWORD && entry->size == sizeof(uint32_t))
+		{
+			uint32_t v;
+			memcpy(&v, entry->value, sizeof(uint32_t));
+
+			char *o = bw_reserve(w, 14);
+			memcpy(o, "dword:", 6);
+			for (int8_t i = 0; i < 8; i++)
+				o[6 + i] = hex_digits[(v >> (28 - i * 4)) & 0xF];
+			w->len += 14;
+		}
+		else
+		{
+			char type[16];
+			if (entry->type == REG_BINARY)
+				strcpy(type, "hex:");
+			else
+				snprintf(type, sizeof(type), "hex(%lx):", (unsigned long) entry->type);
+			bw_puts(w, type);
+
+			// The column is only approximate after a flush, which only affects the wrapping
+			size_t column = (w->len > start) ? w->len - start : REG_HEX_COLUMN;
+			const uint8_t *v = (const uint8_t *) entry->value;
+
+			for (uint32_t i = 0; i < entry->size; i++)
+			{
+				char *o = bw_reserve(w, 8);
+				uint8_t n = 0;
+
+				o[n++] = hex_digits[v[i] >> 4];
+				o[n++] = hex_digits[v[i] & 0xF];
+				column += 2;
+
+				if (i + 1 < entry->size)
+				{
+					o[n++] = ',';
+					column++;
+
+					if (column >= REG_HEX_COLUMN)
+					{
+						memcpy(&o[n], "\\\r\n  ", 5);
+						n += 5;
+						column = 2;
+					}
+				}
+
+				w->len += n;
+			}
+		}
+
+		bw_puts(w, "\r\n");
+	}
+
+	if (w->err)
+	{
+		set_errno(EWRITE);
+		return -8;
+	}
+
+	return 0;
+}
+
+// Everything exported so far goes to the disk before a checkpoint is taken
+static int export_flush(void *ctx, uint64_t *offset)
+{
+	struct export_t *e = (struct export_t *) ctx;
+
+	bw_flush(&e->w);
+
+	return e->w.err ? -1 : checkpoint_offset(e->w.f, offset);
+}
+
+int reg_export(HKEY hive, char *path, FILE *f, struct checkpoint_t *cp)
+{
+	int r = 0;
+
+	struct export_t e;
+	memset(&e, 0, sizeof(struct export_t));
+	e.w.f = f;
+	e.hive_name = reg_hive_name(hive);
+
+	if (!f || !e.hive_name)
+	{
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	e.w.buf = malloc(REG_IO_BUFFER);
+	if (!e.w.buf)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	// A resumed export already has the header, and continues at the end of the file
+	if (!cp || !cp->state)
+		bw_puts(&e.w, REG_HEADER "\r\n");
+
+	if (cp)
+	{
+		cp->flush = export_flush;
+		cp->ctx = &e;
+	}
+
+	r = sweep_checkpoint(hive, path, SWEEP_RECURSIVE, export_cb, &e, cp);
+
+	if (cp)
+		cp->flush = 0;
+
+	if (!r)
+	{
+		bw_puts(&e.w, "\r\n");
+		bw_flush(&e.w);
+
+		if (e.w.err || fflush(f))
+		{
+			set_errno(EWRITE);
+			r = -8;
+		}
+	}
+
+	free(e.w.buf);
+
+	return r;
+}
+
+struct import_t
+{
+	FILE *f;
+	int8_t utf16;
+
+	// Bytes read while looking for a BOM that wasn't there, read again before the file
+	int ahead[2];
+	uint8_t ahead_pos;
+	uint8_t ahead_len;
+
+	// A high surrogate without its low half is followed by a unit that starts the next character
+	int32_t unit;
+
+	// Current logical line
+	char *line;
+	size_t line_max;
+
+	// Current key, either from RegCreateKeyExW or NtCreateKey
+	HANDLE key;
+	int8_t nt;
+
+	// Value being built up across continuation lines
+	int8_t pending;
+	ULONG type;
+	wchar_t *name;
+	uint32_t name_size;
+	size_t name_max;
+	uint8_t *data;
+	uint32_t size;
+	size_t data_max;
+};
+
+static int8_t grow(void **buf, size_t *max, size_t need)
+{
+	if (need <= *max)
+		return 0;
+
+	size_t n = *max ? *max : 256;
+	while (n < need)
+		n *= 2;
+
+	void *b = realloc(*buf, n);
+	if (!b)
+		return -1;
+
+	*buf = b;
+	*max = n;
+
+	return 0;
+}
+
+// Next UTF-16LE code unit, or -1 at the end of the file
+static int32_t import_unit(struct import_t *im)
+{
+	if (im->unit >= 0)
+	{
+		int32_t c = im->unit;
+		im->unit = -1;
+		return c;
+	}
+
+	int lo = getc(im->f);
+	int hi = getc(im->f);
+
+	if (lo == EOF || hi == EOF)
+		return -1;
+
+	return lo | (hi << 8);
+}
+
+// Read a line as UTF-8 without its line ending, returns its length or -1 at the end of the file
+static int64_t import_read_line(struct import_t *im)
+{
+	size_t len = 0;
+
+	if (im->utf16)
+	{
+		int32_t c;
+		while ((c = import_unit(im)) >= 0)
+		{
+			// Surrogate pairs are combined here so they encode as a single UTF-8 sequence
+			if (c >= 0xD800 && c <= 0xDBFF)
+			{
+				int32_t c2 = import_unit(im);
+
+				if (c2 >= 0xDC00 && c2 <= 0xDFFF)
+					c = 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00);
+				else
+					im->unit = c2;
+			}
+
+			if (c == '\n')
+				break;
+
+			if (grow((void **) &im->line, &im->line_max, len + 5))
+				return -2;
+
+			if (c < 0x80)
+				im->line[len++] = c;
+			else if (c < 0x800)
+			{
+				im->line[len++] = 0xC0 | (c >> 6);
+				im->line[len++] = 0x80 | (c & 0x3F);
+			}
+			else if (c < 0x10000)
+			{
+				im->line[len++] = 0xE0 | (c >> 12);
+				im->line[len++] = 0x80 | ((c >> 6) & 0x3F);
+				im->line[len++] = 0x80 | (c & 0x3F);
+			}
+			else
+			{
+				im->line[len++] = 0xF0 | (c >> 18);
+				im->line[len++] = 0x80 | ((c >> 12) & 0x3F);
+				im->line[len++] = 0x80 | ((c >> 6) & 0x3F);
+				im->line[len++] = 0x80 | (c & 0x3F);
+			}
+		}
+
+		if (c < 0 && !len)
+			return -1;
+	}
+	else
+	{
+		int8_t done = 0;
+
+		while (im->ahead_len && !done)
+		{
+			int c = im->ahead[im->ahead_pos++];
+			im->ahead_len--;
+
+			if (grow((void **) &im->line, &im->line_max, len + 256))
+				return -2;
+
+			if (c == '\n')
+				done = 1;
+			else
+				im->line[len++] = c;
+		}
+
+		while (!done)
+		{
+			if (grow((void **) &im->line, &im->line_max, len + 256))
+				return -2;
+
+			if (!fgets(&im->line[len], im->line_max - len, im->f))
+			{
+				if (!len)
+					return -1;
+				break;
+			}
+
+			len += strlen(&im->line[len]);
+			if (len && im->line[len - 1] == '\n')
+			{
+				len--;
+				break;
+			}
+		}
+	}
+
+	// Strip the rest of the line ending and trailing whitespace
+	while (len && (im->line[len - 1] == '\r' || im->line[len - 1] == ' ' || im->line[len - 1] == '\t'))
+		len--;
+
+	im->line[len] = 0;
+
+	return len;
+}
+
+static void import_close(struct import_t *im)
+{
+	if (im->key)
+	{
+		if (im->nt)
+			NtClose(im->key);
+		else
+			RegCloseKey((HKEY) im->key);
+	}
+
+	im->key = 0;
+	im->nt = 0;
+}
+
+/*
+ * Open or create the key of a [HIVE\path] line.
+ * The longest prefix that userland can name goes through RegCreateKeyExW in
+ * one call, any remaining components with invisible names are created
+ * relative to their parent with NtCreateKey. When the first component is
+ * already invisible, every component is created that way from the hive.
+ */
+static int import_open(struct import_t *im, char *path, size_t len)
+{
+	size_t hive_len = 0;
+	while (hive_len < len && path[hive_len] != '\\')
+		hive_len++;
+
+	HKEY hive = reg_hive(path, hive_len);
+	if (!hive)
+	{
+		set_errno(EHIVE);
+		return -1;
+	}
+
+	if (hive_len + 1 >= len)
+	{
+		// Values directly under a hive can't be set
+		set_errno(EKEY);
+		return -1;
+	}
+
+	path += hive_len + 1;
+	len -= hive_len + 1;
+
+	wchar_t *wpath = malloc((len + 1) * sizeof(wchar_t));
+	if (!wpath)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	int r = 0;
+	int64_t size = reg_unescape(path, len, wpath, REG_ESCAPE_KEY);
+	uint32_t wlen = size / 2;
+
+	// Find the end of the prefix that has no NULs
+	uint32_t prefix = 0;
+	for (uint32_t i = 0; size > 0 && i <= wlen; i++)
+	{
+		if (i == wlen || wpath[i] == L'\\')
+			prefix = i;
+		if (i < wlen && !wpath[i])
+			break;
+	}
+
+	if (size <= 0)
+	{
+		set_errno(EKEY);
+		r = -1;
+	}
+	else if (!prefix)
+	{
+		// Nothing userland can name, so every component is created from the hive
+		HANDLE root = 0;
+		if (!(r = reg_root(hive, KEY_ALL_ACCESS, &root)))
+		{
+			im->key = root;
+			im->nt = 1;
+		}
+	}
+	else
+	{
+		wchar_t saved = (prefix < wlen) ? wpath[prefix] : 0;
+		wpath[prefix] = 0;
+
+		HKEY key;
+		if (RegCreateKeyExW(hive, wpath, 0, 0, REG_OPTION_NON_VOLATILE, KEY_ALL_ACCESS, 0, &key, 0) == ERROR_SUCCESS)
+		{
+			im->key = (HANDLE) key;
+			im->nt = 0;
+		}
+		else
+		{
+			set_errno(EOPENKEY);
+			r = -3;
+		}
+
+		wpath[prefix] = saved;
+	}
+
+	if (!r)
+	{
+		// Skip the separator after the prefix
+		uint32_t start = prefix ? prefix + 1 : 0;
+		for (uint32_t i = start; !r && start < wlen && i <= wlen; i++)
+		{
+			if (i < wlen && wpath[i] != L'\\')
+				continue;
+
+			UNICODE_STRING name = { 0 };
+			name.Buffer = &wpath[start];
+			name.Length = (i - start) * 2;
+			name.MaximumLength = name.Length;
+
+			OBJECT_ATTRIBUTES attribs = { 0 };
+			attribs.Length = sizeof(OBJECT_ATTRIBUTES);
+			attribs.RootDirectory = im->key;
+			attribs.Attributes = OBJ_KERNEL_HANDLE;
+			attribs.ObjectName = &name;
+			attribs.SecurityDescriptor = 0;
+			attribs.SecurityQualityOfService = 0;
+
+			HANDLE key;
+			NTSTATUS status = NtCreateKey(&key, KEY_ALL_ACCESS, &attribs, 0, 0, REG_OPTION_NON_VOLATILE, 0);
+
+			import_close(im);
+			if (!(r = reg_status(status)))
+			{
+				im->key = key;
+				im->nt = 1;
+			}
+
+			start = i + 1;
+		}
+	}
+
+	free(wpath);
+
+	return r;
+}
+
+// Parse comma separated hex bytes, returns 1 if the data continues on the next line
+static int import_hex(struct import_t *im, const char *s)
+{
+	while (*s)
+	{
+		if (*s == ' ' || *s == '\t' || *s == ',')
+			s++;
+		else if (*s == '\\' && !s[1])
+			return 1;
+		else
+		{
+			int8_t hi = hex_value(s[0]);
+			int8_t lo = hi < 0 ? -1 : hex_value(s[1]);
+			if (lo < 0)
+				return -1;
+
+			if (grow((void **) &im->data, &im->data_max, im->size + 1))
+				return -2;
+
+			im->data[im->size++] = (hi << 4) | lo;
+			s += 2;
+		}
+	}
+
+	return 0;
+}
+
+static int import_commit(struct import_t *im)
+{
+	UNICODE_STRING name = { 0 };
+	name.Buffer = im->name;
+	name.Length = im->name_size;
+	name.MaximumLength = im->name_size;
+
+	im->pending = 0;
+
+	return reg_status(NtSetValueKey(im->key, &name, 0, im->type, im->data, im->size));
+}
+
+// Find the closing quote of a quoted name or string, s points past the opening quote
+static char *import_quote_end(char *s)
+{
+	for (; *s; s++)
+	{
+		if (*s == '\\' && s[1])
+			s++;
+		else if (*s == '"')
+			return s;
+	}
+
+	return 0;
+}
+
+static int import_value(struct import_t *im, char *s)
+{
+	// The name
+	if (*s == '@')
+	{
+		im->name_size = 0;
+		s++;
+	}
+	else
+	{
+		char *end = import_quote_end(++s);
+		if (!end)
+			return -1;
+
+		if (grow((void **) &im->name, &im->name_max, (end - s + 1) * sizeof(wchar_t)))
+			return -2;
+
+		int64_t size = reg_unescape(s, end - s, im->name, REG_ESCAPE_NAME);
+		if (size < 0)
+			return -1;
+
+		im->name_size = size;
+		s = end + 1;
+	}
+
+	if (*s++ != '=')
+		return -1;
+
+	if (!im->key)
+	{
+		set_errno(EKEY);
+		return -3;
+	}
+
+	im->size = 0;
+
+	if (!strcmp(s, "-"))
+	{
+		UNICODE_STRING name = { 0 };
+		name.Buffer = im->name;
+		name.Length = im->name_size;
+		name.MaximumLength = im->name_size;
+
+		return reg_status(NtDeleteValueKey(im->key, &name));
+	}
+	else if (*s == '"')
+	{
+		char *end = import_quote_end(++s);
+		if (!end || end[1])
+			return -1;
+
+		// Strings are stored with their terminating NUL, like regedit does
+		if (grow((void **) &im->data, &im->data_max, (end - s + 1) * sizeof(wchar_t)))
+			return -2;
+
+		int64_t size = reg_unescape(s, end - s, (wchar_t *) im->data, REG_ESCAPE_NAME);
+		if (size < 0)
+			return -1;
+
+		memset(&im->data[size], 0, 2);
+		im->size = size + 2;
+		im->type = REG_SZ;
+
+		return import_commit(im);
+	}
+	else if (!strncmp(s, "dword:", 6))
+	{
+		char *end = 0;
+		uint32_t v = strtoul(s + 6, &end, 16);
+		if (end == s + 6 || *end || end - (s + 6) > 8)
+			return -1;
+
+		if (grow((void **) &im->data, &im->data_max, sizeof(uint32_t)))
+			return -2;
+
+		memcpy(im->data, &v, sizeof(uint32_t));
+		im->size = sizeof(uint32_t);
+		im->type = REG_DWORD;
+
+		return import_commit(im);
+	}
+	else if (!strncmp(s, "hex", 3))
+	{
+		s += 3;
+		im->type = REG_BINARY;
+
+		if (*s == '(')
+		{
+			char *end = 0;
+			im->type = strtoul(s + 1, &end, 16);
+			if (end == s + 1 || *end != ')')
+				return -1;
+			s = end + 1;
+		}
+
+		if (*s++ != ':')
+			return -1;
+
+		int r = import_hex(im, s);
+		if (r == 1)
+		{
+			im->pending = 1;
+			return 0;
+		}
+		else if (r)
+			return r;
+
+		return import_commit(im);
+	}
+
+	return -1;
+}
+
+int reg_import(FILE *f, uint64_t *line)
+{
+	// Load the internals functions
+	init_ntdll();
+
+	set_errno(ESUCCESS);
+
+	int r = 0;
+	uint64_t n = 0;
+	int64_t len = 0;
+
+	struct import_t im;
+	memset(&im, 0, sizeof(struct import_t));
+	im.f = f;
+	im.unit = -1;
+
+	if (!f)
+	{
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	setvbuf(f, 0, _IOFBF, REG_IO_BUFFER);
+
+	// A BOM decides the encoding, regedit writes UTF-16LE
+	int c0 = getc(f);
+	int c1 = getc(f);
+	if (c0 == 0xFF && c1 == 0xFE)
+		im.utf16 = 1;
+	else if (c0 == 0xEF && c1 == 0xBB)
+	{
+		if (getc(f) != 0xBF)
+			r = -1;
+	}
+	else
+	{
+		// ungetc() only promises a single byte, so these are kept to be read back first
+		if (c0 != EOF)
+			im.ahead[im.ahead_len++] = c0;
+		if (c1 != EOF)
+			im.ahead[im.ahead_len++] = c1;
+	}
+
+	while (!r && (len = import_read_line(&im)) >= 0)
+	{
+		n++;
+		char *s = im.line;
+
+		if (im.pending)
+		{
+			r = import_hex(&im, s);
+			if (r == 1)
+				r = 0;
+			else if (!r)
+				r = import_commit(&im);
+
+			continue;
+		}
+
+		while (*s == ' ' || *s == '\t')
+			s++;
+
+		if (!*s || *s == ';' || !strcmp(s, REG_HEADER) || !strcmp(s, REG_HEADER4))
+			continue;
+
+		if (*s == '[')
+		{
+			import_close(&im);
+
+			len = strlen(s);
+			if (s[len - 1] != ']' || s[1] == '-')
+				r = -1;
+			else
+				r = import_open(&im, s + 1, len - 2);
+		}
+		else if (*s == '"' || *s == '@')
+			r = import_value(&im, s);
+		else
+			r = -1;
+	}
+
+	if (len == -2)
+		r = -2;
+
+	// A hex value that was still expecting more lines
+	if (!r && im.pending)
+		r = -1;
+
+	// Parse errors don't set errno themselves
+	if (r == -1 && errno == ESUCCESS)
+		set_errno(EIMPORT);
+	else if (r == -2)
+		set_errno(ENOMEM);
+
+	if (r && line)
+		*line = n;
+
+	import_close(&im);
+
+	if (im.line)
+		free(im.line);
+
+	if (im.name)
+		free(im.name);
+
+	if (im.data)
+		free(im.data);
+
+	return r;
+}
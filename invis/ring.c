@@ -0,0 +1,228 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <error.h>
+#include <invis/ring.h>
+#include <invis/thread.h>
+
+// A wait spins this many times, then yields this many times, then sleeps this long in microseconds
+#define RING_SPIN	256
+#define RING_YIELD	16
+#define RING_SLEEP	50
+
+// Records start and end on 8 bytes
+static uint64_t ring_record_size(uint64_t size)
+{
+	return sizeof(uint64_t) + ((size + 7) & ~7ULL);
+}
+
+static void ring_wait(uint32_t *spins)
+{
+	if (*spins >= RING_SPIN + RING_YIELD)
+		thread_sleep(RING_SLEEP);
+	else if (*spins >= RING_SPIN)
+		thread_yield();
+
+	(*spins)++;
+}
+
+int ring_init(struct ring_t *r, uint64_t size)
+{
+	memset(r, 0, sizeof(struct ring_t));
+
+	r->size = 4096;
+	while (r->size < size)
+		r->size *= 2;
+
+	if (!(r->buf = malloc(r->size)))
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	return 0;
+}
+
+void ring_free(struct ring_t *r)
+{
+	if (r->buf)
+		free(r->buf);
+
+	r->buf = 0;
+}
+
+// Half the ring, so that a record that has to wrap still fits with the room skipped before it
+uint64_t ring_max_record(struct ring_t *r)
+{
+	return r->size / 2 - sizeof(uint64_t);
+}
+
+static void ring_publish(struct ring_t *r)
+{
+	if (r->unpublished)
+	{
+		__atomic_store_n(&r->head, r->write, __ATOMIC_RELEASE);
+		r->unpublished = 0;
+	}
+}
+
+void *ring_reserve(struct ring_t *r, uint32_t size)
+{
+	uint64_t need = ring_record_size(size);
+	uint64_t pos = r->write & (r->size - 1);
+	uint64_t left = r->size - pos;
+	uint64_t total = need > left ? need + left : need;
+	uint32_t spins = 0;
+
+	while (r->write + total - r->tail_cache > r->size)
+	{
+		r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		if (r->write + total - r->tail_cache <= r->size)
+			break;
+
+		// The consumer can only make room out of what it has been given
+		ring_publish(r);
+
+		if (!spins)
+			r->blocked++;
+
+		ring_wait(&spins);
+	}
+
+	if (need > left)
+	{
+		*(uint64_t *) &r->buf[pos] = RING_WRAP;
+		r->write += left;
+		pos = 0;
+	}
+
+	*(uint64_t *) &r->buf[pos] = size;
+	r->pending = need;
+
+	return &r->buf[pos + sizeof(uint64_t)];
+}
+
+void ring_commit(struct ring_t *r)
+{
+	r->write += r->pending;
+	r->pending = 0;
+
+	if (++r->unpublished >= RING_BATCH)
+		ring_publish(r);
+}
+
+void ring_close(struct ring_t *r)
+{
+	ring_publish(r);
+	__atomic_store_n(&r->closed, 1, __ATOMIC_RELEASE);
+}
+
+static void ring_free_records(struct ring_t *r)
+{
+	if (r->unfreed)
+	{
+		__atomic_store_n(&r->tail, r->read, __ATOMIC_RELEASE);
+		r->unfreed = 0;
+	}
+}
+
+void *ring_peek(struct ring_t *r, uint32_t *size)
+{
+	uint32_t spins = 0;
+
+	for (;;)
+	{
+		if (r->read == r->head_cache)
+		{
+			r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+			// How far behind the consumer is each time it catches up with what it last saw, counting a wait once
+			uint64_t used = r->head_cache - r->read;
+			if (used || !spins)
+			{
+				r->samples++;
+				r->used += used;
+				if (used > r->peak)
+					r->peak = used;
+			}
+
+			if (r->read == r->head_cache)
+			{
+				// The producer can only carry on into room that has been given back
+				ring_free_records(r);
+
+				// Everything published before closing is seen once it is closed
+				if (__atomic_load_n(&r->closed, __ATOMIC_ACQUIRE))
+				{
+					r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+					if (r->read == r->head_cache)
+						return 0;
+				}
+				else
+				{
+					if (!spins)
+						r->starved++;
+
+					ring_wait(&spins);
+				}
+
+				continue;
+			}
+		}
+
+		uint64_t pos = r->read & (r->size - 1);
+		uint64_t s = *(uint64_t *) &r->buf[pos];
+
+		if (s == RING_WRAP)
+		{
+			r->read += r->size - pos;
+			continue;
+		}
+
+		*size = s;
+		r->current = ring_record_size(s);
+
+		return &r->buf[pos + sizeof(uint64_t)];
+	}
+}
+
+void ring_release(struct ring_t *r)
+{
+	r->read += r->current;
+	r->current = 0;
+	r->records++;
+
+	if (++r->unfreed >= RING_BATCH)
+		ring_free_records(r);
+}
+
+uint32_t ring_occupancy(struct ring_t *r)
+{
+	if (!r->samples)
+		return 0;
+
+	return r->used * 1000 / (r->samples * r->size);
+}
+
+uint32_t ring_peak(struct ring_t *r)
+{
+	return r->peak * 1000 / r->size;
+}
@@ -0,0 +1,430 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <error.h>
+#include <invis/server.h>
+#include <invis/hash.h>
+#include <invis/ipc.h>
+#include <invis/ntdll.h>
+#include <invis/reg.h>
+#include <invis/thread.h>
+
+struct server_slot_t
+{
+	uint64_t hash;
+	HKEY hive;
+	wchar_t *path;
+	uint32_t path_size;
+
+	HANDLE key;
+	uint32_t refs;		// Requests using the key right now
+	uint8_t stale;		// Closed once the last request is done with it
+};
+
+struct server_t
+{
+	struct lock_t lock;
+	struct server_slot_t cache[SERVER_CACHE_SIZE];
+};
+
+// A key in use by a request, slot is 0 when the key isn't cached
+struct server_key_t
+{
+	HANDLE key;
+	struct server_slot_t *slot;
+};
+
+struct server_conn_t
+{
+	struct server_t *s;
+	struct ipc_t ipc;
+};
+
+static void server_close(struct server_t *s, struct server_key_t *k, uint8_t drop)
+{
+	struct server_slot_t *slot = k->slot;
+
+	if (!slot)
+	{
+		NtClose(k->key);
+		return;
+	}
+
+	lock_acquire(&s->lock);
+
+	if (drop)
+		slot->stale = 1;
+
+	if (!--slot->refs && slot->stale)
+	{
+		NtClose(slot->key);
+		free(slot->path);
+		memset(slot, 0, sizeof(struct server_slot_t));
+	}
+
+	lock_release(&s->lock);
+}
+
+// Keys that can't be written to can still be queried
+static int server_nt_open(HANDLE root, const wchar_t *path, uint32_t size, HANDLE *key)
+{
+	UNICODE_STRING name = { 0 };
+	name.Buffer = (PWSTR) path;
+	name.Length = size;
+	name.MaximumLength = size;
+
+	OBJECT_ATTRIBUTES attribs = { 0 };
+	attribs.Length = sizeof(OBJECT_ATTRIBUTES);
+	attribs.RootDirectory = root;
+	attribs.Attributes = OBJ_KERNEL_HANDLE;
+	attribs.ObjectName = &name;
+	attribs.SecurityDescriptor = 0;
+	attribs.SecurityQualityOfService = 0;
+
+	NTSTATUS status = NtOpenKey(key, KEY_ALL_ACCESS, &attribs);
+	if (status == STATUS_ACCESS_DENIED)
+		status = NtOpenKey(key, KEY_READ, &attribs);
+
+	return reg_status(status);
+}
+
+static int server_open(struct server_t     *s,
+					   HKEY                 hive,
+					   const wchar_t       *path,
+					   uint32_t             size,
+					   struct server_key_t *out)
+{
+	uint64_t hash = hash64(path, size, (uint64_t) (uintptr_t) hive);
+	struct server_slot_t *slot = &s->cache[hash & (SERVER_CACHE_SIZE - 1)];
+
+	lock_acquire(&s->lock);
+
+	if (slot->key
+	&& !slot->stale
+	&&  slot->hash == hash
+	&&  slot->hive == hive
+	&&  slot->path_size == size
+	&& (!size || !memcmp(slot->path, path, size)))
+	{
+		slot->refs++;
+		lock_release(&s->lock);
+
+		out->key = slot->key;
+		out->slot = slot;
+		return 0;
+	}
+
+	lock_release(&s->lock);
+
+	// Keys are opened relative to the root of the hive, which is cached like any other key
+	HANDLE key = 0;
+	int r;
+
+	if (!size)
+	{
+		r = reg_root(hive, KEY_ALL_ACCESS, &key);
+		if (r && errno == EACCES)
+			r = reg_root(hive, KEY_READ, &key);
+	}
+	else
+	{
+		struct server_key_t root;
+		if (!(r = server_open(s, hive, 0, 0, &root)))
+		{
+			r = server_nt_open(root.key, path, size, &key);
+			server_close(s, &root, 0);
+		}
+	}
+
+	if (r)
+		return r;
+
+	out->key = key;
+	out->slot = 0;
+
+	// The slot is only taken over when no request is using what's in it
+	wchar_t *copy = malloc(size + 2);
+
+	lock_acquire(&s->lock);
+
+	if (copy && !slot->refs)
+	{
+		if (slot->key)
+		{
+			NtClose(slot->key);
+			free(slot->path);
+		}
+
+		if (size)
+			memcpy(copy, path, size);
+
+		slot->hash = hash;
+		slot->hive = hive;
+		slot->path = copy;
+		slot->path_size = size;
+		slot->key = key;
+		slot->refs = 1;
+		slot->stale = 0;
+
+		out->slot = slot;
+		copy = 0;
+	}
+
+	lock_release(&s->lock);
+
+	if (copy)
+		free(copy);
+
+	return 0;
+}
+
+static int server_reg(struct server_t     *s,
+					  struct ipc_header_t *h,
+					  uint8_t             *payload,
+					  struct key_data_t  **key_data,
+					  uint64_t            *num_keys)
+{
+	struct ipc_request_t req;
+
+	if (h->size < sizeof(struct ipc_request_t))
+	{
+		set_errno(EMESSAGE);
+		return -1;
+	}
+
+	memcpy(&req, payload, sizeof(struct ipc_request_t));
+
+	if ((uint64_t) sizeof(struct ipc_request_t) + req.path_size + req.value_size != h->size
+	||  req.path_size & 1)
+	{
+		set_errno(EMESSAGE);
+		return -1;
+	}
+
+	// Sign extended, like the predefined handles themselves
+	HKEY hive = (HKEY) (intptr_t) (int32_t) req.hive;
+	if (!reg_hive_name(hive))
+	{
+		set_errno(EHIVE);
+		return -1;
+	}
+
+	// Only values are served
+	if (h->operation & MAKE_KEY)
+	{
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	// Copied out so that the name is aligned
+	wchar_t *path = malloc(req.path_size + 2);
+	if (!path)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	memcpy(path, &payload[sizeof(struct ipc_request_t)], req.path_size);
+	void *value = req.value_size ? &payload[sizeof(struct ipc_request_t) + req.path_size] : 0;
+
+	// Split the key from the value, which like with reg() is named by the whole path
+	uint32_t split = req.path_size / 2;
+	while (split && path[split - 1] != L'\\')
+		split--;
+
+	struct server_key_t key;
+	int r = 0;
+
+	// Nothing directly under a hive is a value, like with reg()
+	if (!split)
+	{
+		set_errno((h->operation & OPERATION_MASK) == OPERATION_QUERY ? EREGUNAVAIL : EKEY);
+		r = -1;
+	}
+	else if (!(r = server_open(s, hive, path, (split - 1) * 2, &key)))
+	{
+		r = reg_at(h->operation, key.key, path, req.path_size, req.type, value, req.value_size, key_data, num_keys);
+
+		// A key that went away under the cache is opened again by the next request
+		int err = errno;
+		server_close(s, &key, r && err != EREGUNAVAIL);
+		set_errno(err);
+	}
+
+	// Querying something that isn't a value lists the key instead, like reg()
+	if (r
+	&&  errno == EREGUNAVAIL
+	&& (h->operation & OPERATION_MASK) == OPERATION_QUERY)
+	{
+		if (!(r = server_open(s, hive, path, req.path_size, &key)))
+		{
+			r = reg_values(key.key, key_data, num_keys);
+
+			int err = errno;
+			server_close(s, &key, r != 0);
+			set_errno(err);
+		}
+	}
+
+	free(path);
+
+	return r;
+}
+
+static int server_reply(struct ipc_t      *c,
+						uint32_t           id,
+						int                status,
+						struct key_data_t *key_data,
+						uint64_t           num_keys)
+{
+	struct ipc_reply_t reply;
+	memset(&reply, 0, sizeof(struct ipc_reply_t));
+	reply.status = status;
+	reply.error = status ? errno : 0;
+
+	uint64_t size = sizeof(struct ipc_reply_t);
+	if (!status)
+	{
+		for (uint64_t i = 0; i < num_keys; i++)
+			size += sizeof(struct ipc_entry_t) + key_data[i].name_size + key_data[i].size;
+
+		reply.count = num_keys;
+	}
+
+	// Too large to send, the client is told rather than left waiting
+	if (size > IPC_MAX_MESSAGE)
+	{
+		reply.status = -1;
+		reply.error = EBUFSIZE;
+		reply.count = 0;
+		size = sizeof(struct ipc_reply_t);
+	}
+
+	struct ipc_header_t h;
+	memset(&h, 0, sizeof(struct ipc_header_t));
+	h.size = size;
+	h.id = id;
+	h.op = IPC_REPLY;
+
+	int r = ipc_write(c, &h, sizeof(struct ipc_header_t));
+	if (!r)
+		r = ipc_write(c, &reply, sizeof(struct ipc_reply_t));
+
+	for (uint32_t i = 0; !r && i < reply.count; i++)
+	{
+		struct ipc_entry_t e;
+		e.type = key_data[i].type;
+		e.anomalies = key_data[i].anomalies;
+		e.name_size = key_data[i].name_size;
+		e.size = key_data[i].size;
+
+		r = ipc_write(c, &e, sizeof(struct ipc_entry_t));
+		if (!r)
+			r = ipc_write(c, key_data[i].name, e.name_size);
+		if (!r)
+			r = ipc_write(c, key_data[i].value, e.size);
+	}
+
+	return r;
+}
+
+static void server_conn(void *arg)
+{
+	struct server_conn_t *conn = (struct server_conn_t *) arg;
+
+	struct ipc_header_t h;
+	uint8_t *payload;
+	int r;
+
+	// Replies are queued, and only written once every request that has arrived is answered
+	while (!(r = ipc_recv(&conn->ipc, &h, &payload)))
+	{
+		struct key_data_t *key_data = 0;
+		uint64_t num_keys = 0;
+		int status;
+
+		if (h.op == IPC_REG)
+			status = server_reg(conn->s, &h, payload, &key_data, &num_keys);
+		else
+		{
+			set_errno(EMESSAGE);
+			status = -1;
+		}
+
+		r = server_reply(&conn->ipc, h.id, status, key_data, num_keys);
+		free_key_data(key_data, num_keys);
+
+		if (r)
+			break;
+	}
+
+	if (r > 0)
+		ipc_flush(&conn->ipc);
+
+	ipc_close(&conn->ipc);
+	free(conn);
+}
+
+int server_run(const char *name)
+{
+	// Load the internals functions
+	init_ntdll();
+
+	struct server_t *s = malloc(sizeof(struct server_t));
+	if (!s)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	memset(s, 0, sizeof(struct server_t));
+	lock_init(&s->lock);
+
+	struct ipc_listener_t l;
+	int r = ipc_listen(&l, name);
+
+	while (!r)
+	{
+		struct server_conn_t *conn = malloc(sizeof(struct server_conn_t));
+		if (!conn)
+		{
+			set_errno(ENOMEM);
+			r = -2;
+			break;
+		}
+
+		conn->s = s;
+
+		if ((r = ipc_accept(&l, &conn->ipc)))
+			free(conn);
+		// A connection that can't get a thread is dropped, the server keeps going
+		else if (thread_spawn(server_conn, conn))
+		{
+			ipc_close(&conn->ipc);
+			free(conn);
+		}
+	}
+
+	ipc_unlisten(&l);
+
+	// Connections may still be running, so the cache is left to the end of the process
+	return r;
+}
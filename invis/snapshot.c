@@ -0,0 +1,702 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <error.h>
+#include <invis/snapshot.h>
+#include <invis/hash.h>
+
+#define SNAPSHOT_TABLE_SIZE	1024
+
+static int vec_reserve(struct snapshot_vec_t *v, uint64_t n)
+{
+	if (v->len + n > v->max)
+	{
+		uint64_t max = v->max ? v->max : 4096;
+		while (max < v->len + n)
+			max *= 2;
+
+		uint8_t *d = realloc(v->data, max);
+		if (!d)
+		{
+			set_errno(ENOMEM);
+			return -2;
+		}
+
+		v->data = d;
+		v->max = max;
+	}
+
+	return 0;
+}
+
+static int vec_append(struct snapshot_vec_t *v, const void *data, uint64_t n)
+{
+	if (vec_reserve(v, n))
+		return -2;
+
+	if (n)
+		memcpy(&v->data[v->len], data, n);
+	v->len += n;
+
+	return 0;
+}
+
+static int vec_u32(struct snapshot_vec_t *v, uint32_t n)
+{
+	return vec_append(v, &n, sizeof(uint32_t));
+}
+
+static int vec_u64(struct snapshot_vec_t *v, uint64_t n)
+{
+	return vec_append(v, &n, sizeof(uint64_t));
+}
+
+static void vec_free(struct snapshot_vec_t *v)
+{
+	if (v->data)
+		free(v->data);
+
+	memset(v, 0, sizeof(struct snapshot_vec_t));
+}
+
+// Double a table of ids + 1 once it is half full, hashes are looked up by id
+static int table_grow(uint32_t        **table,
+					  uint64_t         *size,
+					  uint64_t          count,
+					  const uint8_t    *hashes,
+					  uint64_t          stride)
+{
+	if (count * 2 < *size)
+		return 0;
+
+	uint64_t n = *size * 2;
+	uint32_t *t = malloc(n * sizeof(uint32_t));
+	if (!t)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	memset(t, 0, n * sizeof(uint32_t));
+	for (uint64_t i = 0; i < *size; i++)
+	{
+		if ((*table)[i])
+		{
+			uint64_t h;
+			memcpy(&h, &hashes[((*table)[i] - 1) * stride], sizeof(uint64_t));
+
+			uint64_t j = h & (n - 1);
+			while (t[j])
+				j = (j + 1) & (n - 1);
+			t[j] = (*table)[i];
+		}
+	}
+
+	free(*table);
+	*table = t;
+	*size = n;
+
+	return 0;
+}
+
+int snapshot_init(struct snapshot_writer_t *w)
+{
+	memset(w, 0, sizeof(struct snapshot_writer_t));
+
+	w->blob_table_size = SNAPSHOT_TABLE_SIZE;
+	w->blob_table = malloc(w->blob_table_size * sizeof(uint32_t));
+
+	if (!w->blob_table
+	||   intern_init(&w->paths)
+	||   vec_u64(&w->name_offsets, 0))
+	{
+		snapshot_free(w);
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	memset(w->blob_table, 0, w->blob_table_size * sizeof(uint32_t));
+
+	return 0;
+}
+
+int snapshot_key(struct snapshot_writer_t *w, HKEY hive, const wchar_t *path, uint32_t path_size)
+{
+	const char *hive_name = reg_hive_name(hive);
+	if (!hive_name)
+	{
+		set_errno(EHIVE);
+		return -1;
+	}
+
+	// The stored path includes the hive, so snapshots from different hives can be merged
+	wchar_t name[32];
+	uint32_t len = 0;
+	for (; hive_name[len] && len < sizeof(name) / sizeof(wchar_t); len++)
+		name[len] = hive_name[len];
+
+	uint32_t hive_id;
+	if (intern_path(&w->paths, INTERN_ROOT, name, len * sizeof(wchar_t), &hive_id)
+	||  intern_path(&w->paths, hive_id, path, path_size, &w->path))
+		return -2;
+
+	return 0;
+}
+
+int snapshot_value(struct snapshot_writer_t *w, struct key_data_t *entry)
+{
+	uint64_t h = hash64(entry->value, entry->size, 0);
+	struct snapshot_blob_t *blobs = (struct snapshot_blob_t *) w->blobs.data;
+	uint64_t i = h & (w->blob_table_size - 1);
+	uint32_t blob = 0;
+
+	for (; w->blob_table[i]; i = (i + 1) & (w->blob_table_size - 1))
+	{
+		struct snapshot_blob_t *b = &blobs[w->blob_table[i] - 1];
+		if (b->hash == h
+		&&  b->size == entry->size
+		&& !memcmp(&w->blob_data.data[b->offset], entry->value, entry->size))
+			break;
+	}
+
+	if (w->blob_table[i])
+		blob = w->blob_table[i] - 1;
+	else
+	{
+		struct snapshot_blob_t b;
+		b.hash = h;
+		b.offset = w->blob_data.len;
+		b.size = entry->size;
+
+		blob = w->blobs.len / sizeof(struct snapshot_blob_t);
+		if (blob >= 0xFFFFFFFF - 1)
+		{
+			set_errno(ENOMEM);
+			return -2;
+		}
+
+		if (vec_append(&w->blob_data, entry->value, entry->size)
+		||  vec_append(&w->blobs, &b, sizeof(struct snapshot_blob_t)))
+			return -2;
+
+		w->blob_table[i] = blob + 1;
+
+		if (table_grow(&w->blob_table, &w->blob_table_size, blob + 1, w->blobs.data, sizeof(struct snapshot_blob_t)))
+			return -2;
+	}
+
+	if (vec_append(&w->name_data, entry->name, entry->name_size)
+	||  vec_u64(&w->name_offsets, w->name_data.len)
+	||  vec_u32(&w->row_paths, w->path)
+	||  vec_u32(&w->types, entry->type)
+	||  vec_u32(&w->anomalies, entry->anomalies)
+	||  vec_u32(&w->row_blobs, blob))
+		return -2;
+
+	w->rows++;
+
+	return 0;
+}
+
+struct snapshot_out_t
+{
+	FILE *f;
+	uint64_t offset;
+	int8_t err;
+};
+
+static void out_write(struct snapshot_out_t *o, const void *data, uint64_t n)
+{
+	if (n && fwrite(data, 1, n, o->f) != n)
+		o->err = 1;
+
+	o->offset += n;
+}
+
+static void out_align(struct snapshot_out_t *o)
+{
+	static const uint8_t zero[8] = { 0 };
+	out_write(o, zero, (8 - (o->offset & 7)) & 7);
+}
+
+// Start a section, its size is filled in by out_end()
+static void out_begin(struct snapshot_out_t *o, struct snapshot_section_t *s, uint32_t id)
+{
+	out_align(o);
+	memset(s, 0, sizeof(struct snapshot_section_t));
+	s->id = id;
+	s->offset = o->offset;
+}
+
+static void out_end(struct snapshot_out_t *o, struct snapshot_section_t *s)
+{
+	s->size = o->offset - s->offset;
+}
+
+int snapshot_write(struct snapshot_writer_t *w, FILE *f, const char *host)
+{
+	struct snapshot_out_t o = { f, 0, 0 };
+	struct snapshot_section_t index[SNAPSHOT_SECTIONS];
+	struct snapshot_section_t *s = index;
+
+	struct snapshot_header_t header;
+	memset(&header, 0, sizeof(struct snapshot_header_t));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.rows = w->rows;
+	header.created = time(0);
+	if (host)
+		strncpy(header.host, host, sizeof(header.host) - 1);
+	out_write(&o, &header, sizeof(struct snapshot_header_t));
+
+	// Every interned id is a path, including the root and the keys that only lead to others
+	uint64_t paths = w->paths.num_nodes;
+	uint64_t offset = 0;
+	out_begin(&o, s, SNAPSHOT_PATHS);
+	out_write(&o, &paths, sizeof(uint64_t));
+	out_write(&o, &offset, sizeof(uint64_t));
+	for (uint32_t id = 0; id < paths; id++)
+	{
+		offset += intern_size(&w->paths, id);
+		out_write(&o, &offset, sizeof(uint64_t));
+	}
+
+	for (uint32_t id = 0; id < paths; id++)
+	{
+		uint32_t size = intern_size(&w->paths, id);
+		w->scratch.len = 0;
+
+		if (vec_reserve(&w->scratch, size))
+			return -2;
+
+		intern_copy(&w->paths, id, (wchar_t *) w->scratch.data);
+		out_write(&o, w->scratch.data, size);
+	}
+	out_end(&o, s++);
+
+	out_begin(&o, s, SNAPSHOT_NAMES);
+	out_write(&o, w->name_offsets.data, w->name_offsets.len);
+	out_write(&o, w->name_data.data, w->name_data.len);
+	out_end(&o, s++);
+
+	struct
+	{
+		uint32_t id;
+		struct snapshot_vec_t *v;
+	} columns[] =
+	{
+		{ SNAPSHOT_ROW_PATHS, &w->row_paths },
+		{ SNAPSHOT_TYPES,     &w->types     },
+		{ SNAPSHOT_ANOMALIES, &w->anomalies },
+		{ SNAPSHOT_ROW_BLOBS, &w->row_blobs },
+	};
+
+	for (uint8_t i = 0; i < sizeof(columns) / sizeof(columns[0]); i++)
+	{
+		out_begin(&o, s, columns[i].id);
+		out_write(&o, columns[i].v->data, columns[i].v->len);
+		out_end(&o, s++);
+	}
+
+	uint64_t blobs = w->blobs.len / sizeof(struct snapshot_blob_t);
+	out_begin(&o, s, SNAPSHOT_BLOBS);
+	out_write(&o, &blobs, sizeof(uint64_t));
+	out_write(&o, w->blobs.data, w->blobs.len);
+	out_write(&o, w->blob_data.data, w->blob_data.len);
+	out_end(&o, s++);
+
+	struct snapshot_footer_t footer;
+	memset(&footer, 0, sizeof(struct snapshot_footer_t));
+	out_align(&o);
+	footer.index = o.offset;
+	footer.sections = s - index;
+	memcpy(footer.magic, SNAPSHOT_FOOTER_MAGIC, sizeof(footer.magic));
+
+	out_write(&o, index, sizeof(struct snapshot_section_t) * footer.sections);
+	out_write(&o, &footer, sizeof(struct snapshot_footer_t));
+
+	if (o.err || fflush(f))
+	{
+		set_errno(EWRITE);
+		return -8;
+	}
+
+	return 0;
+}
+
+void snapshot_free(struct snapshot_writer_t *w)
+{
+	intern_free(&w->paths);
+	vec_free(&w->blobs);
+	vec_free(&w->blob_data);
+	vec_free(&w->name_offsets);
+	vec_free(&w->name_data);
+	vec_free(&w->row_paths);
+	vec_free(&w->types);
+	vec_free(&w->anomalies);
+	vec_free(&w->row_blobs);
+	vec_free(&w->scratch);
+
+	if (w->blob_table)
+		free(w->blob_table);
+
+	w->blob_table = 0;
+}
+
+// Check the sections against the file, everything after this only needs to check row level offsets
+static int snapshot_validate(struct snapshot_t *snap)
+{
+	const struct snapshot_footer_t *footer;
+	const struct snapshot_section_t *index;
+
+	if (snap->size < sizeof(struct snapshot_header_t) + sizeof(struct snapshot_footer_t))
+		return -1;
+
+	snap->header = (const struct snapshot_header_t *) snap->base;
+	footer = (const struct snapshot_footer_t *) &snap->base[snap->size - sizeof(struct snapshot_footer_t)];
+
+	if (memcmp(snap->header->magic, SNAPSHOT_MAGIC, sizeof(snap->header->magic))
+	||  memcmp(footer->magic, SNAPSHOT_FOOTER_MAGIC, sizeof(footer->magic))
+	||  snap->header->version != SNAPSHOT_VERSION
+	||  footer->index & 7
+	||  footer->index < sizeof(struct snapshot_header_t)
+	||  footer->index > snap->size - sizeof(struct snapshot_footer_t)
+	||  footer->sections > (snap->size - sizeof(struct snapshot_footer_t) - footer->index) / sizeof(struct snapshot_section_t))
+		return -1;
+
+	snap->rows = snap->header->rows;
+	index = (const struct snapshot_section_t *) &snap->base[footer->index];
+
+	uint32_t found = 0;
+	for (uint32_t i = 0; i < footer->sections; i++)
+	{
+		const struct snapshot_section_t *s = &index[i];
+
+		// Unknown sections are skipped so that newer writers stay readable
+		if (s->offset & 7
+		||  s->offset < sizeof(struct snapshot_header_t)
+		||  s->offset > footer->index
+		||  s->size > footer->index - s->offset)
+			return -1;
+
+		const uint8_t *data = &snap->base[s->offset];
+
+		uint64_t count = 0;
+		if (s->id == SNAPSHOT_PATHS || s->id == SNAPSHOT_BLOBS)
+		{
+			if (s->size < sizeof(uint64_t))
+				return -1;
+			memcpy(&count, data, sizeof(uint64_t));
+		}
+
+		switch (s->id)
+		{
+			case SNAPSHOT_PATHS:
+				if (s->size / sizeof(uint64_t) < 2 || count > s->size / sizeof(uint64_t) - 2)
+					return -1;
+				snap->paths = count;
+				snap->path_offsets = (const uint64_t *) (data + sizeof(uint64_t));
+				snap->path_data = (const uint8_t *) &snap->path_offsets[count + 1];
+				if (snap->path_offsets[count] != s->size - sizeof(uint64_t) * (count + 2))
+					return -1;
+				break;
+			case SNAPSHOT_NAMES:
+				if (s->size / sizeof(uint64_t) < 1 || snap->rows > s->size / sizeof(uint64_t) - 1)
+					return -1;
+				snap->name_offsets = (const uint64_t *) data;
+				snap->name_data = (const uint8_t *) &snap->name_offsets[snap->rows + 1];
+				if (snap->name_offsets[snap->rows] != s->size - sizeof(uint64_t) * (snap->rows + 1))
+					return -1;
+				break;
+			case SNAPSHOT_ROW_PATHS:
+				/* fall through */
+			case SNAPSHOT_TYPES:
+				/* fall through */
+			case SNAPSHOT_ANOMALIES:
+				/* fall through */
+			case SNAPSHOT_ROW_BLOBS:
+				if (s->size / sizeof(uint32_t) != snap->rows || s->size % sizeof(uint32_t))
+					return -1;
+				if (s->id == SNAPSHOT_ROW_PATHS)
+					snap->row_paths = (const uint32_t *) data;
+				else if (s->id == SNAPSHOT_TYPES)
+					snap->types = (const uint32_t *) data;
+				else if (s->id == SNAPSHOT_ANOMALIES)
+					snap->anomalies = (const uint32_t *) data;
+				else
+					snap->row_blobs = (const uint32_t *) data;
+				break;
+			case SNAPSHOT_BLOBS:
+				if (count > (s->size - sizeof(uint64_t)) / sizeof(struct snapshot_blob_t))
+					return -1;
+				snap->blobs = count;
+				snap->blob_index = (const struct snapshot_blob_t *) (data + sizeof(uint64_t));
+				snap->blob_data = (const uint8_t *) &snap->blob_index[count];
+				break;
+			default:
+				continue;
+		};
+
+		found |= 1 << s->id;
+	}
+
+	// Every known section is required
+	if (found != ((1 << (SNAPSHOT_SECTIONS + 1)) - 2))
+		return -1;
+
+	return 0;
+}
+
+int snapshot_map(struct snapshot_t *snap, const char *file)
+{
+	memset(snap, 0, sizeof(struct snapshot_t));
+
+#ifdef _WIN32
+	snap->file = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (snap->file == INVALID_HANDLE_VALUE)
+	{
+		snap->file = 0;
+		set_errno(EFILE);
+		return -1;
+	}
+
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(snap->file, &size) && size.QuadPart)
+	{
+		snap->size = size.QuadPart;
+		snap->mapping = CreateFileMappingA(snap->file, 0, PAGE_READONLY, 0, 0, 0);
+		if (snap->mapping)
+			snap->base = MapViewOfFile(snap->mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+#else
+	// The mapping outlives the descriptor, so nothing but the view is kept
+	int fd = open(file, O_RDONLY);
+	if (fd < 0)
+	{
+		set_errno(EFILE);
+		return -1;
+	}
+
+	struct stat st;
+	if (!fstat(fd, &st) && st.st_size)
+	{
+		snap->size = st.st_size;
+		snap->base = mmap(0, snap->size, PROT_READ, MAP_SHARED, fd, 0);
+		if (snap->base == MAP_FAILED)
+			snap->base = 0;
+	}
+
+	close(fd);
+#endif
+
+	if (!snap->base)
+	{
+		snapshot_unmap(snap);
+		set_errno(EFILE);
+		return -1;
+	}
+
+	if (snapshot_validate(snap))
+	{
+		snapshot_unmap(snap);
+		set_errno(ESNAPSHOT);
+		return -1;
+	}
+
+	return 0;
+}
+
+void snapshot_unmap(struct snapshot_t *snap)
+{
+#ifdef _WIN32
+	if (snap->base)
+		UnmapViewOfFile(snap->base);
+
+	if (snap->mapping)
+		CloseHandle(snap->mapping);
+
+	if (snap->file)
+		CloseHandle(snap->file);
+#else
+	if (snap->base)
+		munmap(snap->base, snap->size);
+#endif
+
+	memset(snap, 0, sizeof(struct snapshot_t));
+}
+
+// Bounds checked lookup of a counted string, offsets[i] to offsets[i + 1]
+static const wchar_t *snapshot_string(const uint64_t *offsets,
+									  const uint8_t  *data,
+									  uint64_t        i,
+									  uint64_t        count,
+									  uint32_t       *size)
+{
+	uint64_t start = offsets[i];
+	uint64_t end = offsets[i + 1];
+
+	// The last offset was checked against the section size
+	if (start > end || end > offsets[count] || end - start > 0xFFFFFFFF)
+	{
+		*size = 0;
+		return 0;
+	}
+
+	*size = end - start;
+
+	return (const wchar_t *) &data[start];
+}
+
+const wchar_t *snapshot_path(struct snapshot_t *snap, uint64_t row, uint32_t *size)
+{
+	uint32_t path = snap->row_paths[row];
+	if (path >= snap->paths)
+	{
+		*size = 0;
+		return 0;
+	}
+
+	return snapshot_string(snap->path_offsets, snap->path_data, path, snap->paths, size);
+}
+
+const wchar_t *snapshot_name(struct snapshot_t *snap, uint64_t row, uint32_t *size)
+{
+	return snapshot_string(snap->name_offsets, snap->name_data, row, snap->rows, size);
+}
+
+const void *snapshot_data(struct snapshot_t *snap, uint64_t row, uint32_t *size)
+{
+	uint32_t blob = snap->row_blobs[row];
+	if (blob >= snap->blobs)
+	{
+		*size = 0;
+		return 0;
+	}
+
+	const struct snapshot_blob_t *b = &snap->blob_index[blob];
+	uint64_t data_size = snap->size - (snap->blob_data - snap->base);
+	if (b->offset > data_size || b->size > data_size - b->offset || b->size > 0xFFFFFFFF)
+	{
+		*size = 0;
+		return 0;
+	}
+
+	*size = b->size;
+
+	return &snap->blob_data[b->offset];
+}
+
+// Whether any component of a path equals name, ignoring ASCII case like the registry does
+static int8_t path_has_key(const uint16_t *path, uint32_t len, const char *name, uint32_t name_len)
+{
+	uint32_t start = 0;
+
+	for (uint32_t i = 0; i <= len; i++)
+	{
+		if (i < len && path[i] != '\\')
+			continue;
+
+		if (i - start == name_len)
+		{
+			uint32_t j = 0;
+			while (j < name_len && intern_lower(path[start + j]) == intern_lower((uint8_t) name[j]))
+				j++;
+
+			if (j == name_len)
+				return 1;
+		}
+
+		start = i + 1;
+	}
+
+	return 0;
+}
+
+int snapshot_query(struct snapshot_t            *snap,
+				   struct snapshot_filter_t *filter,
+				   snapshot_cb_t             cb,
+				   void                     *ctx)
+{
+	int r = 0;
+	uint8_t *match = 0;
+
+	uint32_t type = filter ? filter->type : SNAPSHOT_ANY_TYPE;
+	uint32_t anomalies = filter ? filter->anomalies : 0;
+
+	// Paths are decided once each, rather than once per row
+	if (filter && filter->under)
+	{
+		match = malloc(snap->paths ? snap->paths : 1);
+		if (!match)
+		{
+			set_errno(ENOMEM);
+			return -2;
+		}
+
+		uint32_t name_len = strlen(filter->under);
+		for (uint64_t i = 0; i < snap->paths; i++)
+		{
+			uint32_t size;
+			const wchar_t *path = snapshot_string(snap->path_offsets, snap->path_data, i, snap->paths, &size);
+			match[i] = path && path_has_key((const uint16_t *) path, size / 2, filter->under, name_len);
+		}
+	}
+
+	// Columns are scanned 64 rows at a time into a bitmask, then only the hits are looked at
+	for (uint64_t base = 0; base < snap->rows && !r; base += 64)
+	{
+		uint64_t n = snap->rows - base;
+		if (n > 64)
+			n = 64;
+
+		uint64_t hits = 0;
+		for (uint64_t j = 0; j < n; j++)
+			hits |= (uint64_t) ((type == SNAPSHOT_ANY_TYPE || snap->types[base + j] == type)
+							  & (!anomalies || (snap->anomalies[base + j] & anomalies) != 0)) << j;
+
+		while (hits && !r)
+		{
+			uint64_t row = base + __builtin_ctzll(hits);
+			hits &= hits - 1;
+
+			if (match && (snap->row_paths[row] >= snap->paths || !match[snap->row_paths[row]]))
+				continue;
+
+			r = cb(ctx, snap, row);
+		}
+	}
+
+	if (match)
+		free(match);
+
+	if (!r)
+		set_errno(ESUCCESS);
+
+	return r;
+}
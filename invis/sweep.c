@@ -0,0 +1,531 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <invis/sweep.h>
+#include <invis/ntdll.h>
+#include <invis/thread.h>
+#include <invis/throttle.h>
+
+// Large enough for nearly every entry, so that each entry costs a single call
+#define SWEEP_BUFFER_SIZE	4096
+
+struct sweep_level_t
+{
+	HANDLE key;
+	ULONG index;		// Next subkey to visit
+	uint32_t path_size;	// Size of the path up to and including this key
+	uint8_t visited;	// Values have been walked
+};
+
+// Enumerate into buf, growing it whenever the entry does not fit
+static NTSTATUS sweep_enumerate(HANDLE    key,
+								ULONG     index,
+								int8_t    values,
+								uint8_t **buf,
+								ULONG    *buf_size)
+{
+	NTSTATUS status;
+	ULONG needed = 0;
+
+	while (1)
+	{
+		uint64_t start = throttle_enter();
+
+		if (values)
+			status = NtEnumerateValueKey(key, index, KeyValueFullInformation, *buf, *buf_size, &needed);
+		else
+			status = NtEnumerateKey(key, index, KeyBasicInformation, *buf, *buf_size, &needed);
+
+		throttle_leave(start);
+
+		if ((status == STATUS_BUFFER_TOO_SMALL || status == STATUS_BUFFER_OVERFLOW)
+		&&   needed > *buf_size)
+		{
+			uint8_t *b = realloc(*buf, needed);
+			if (!b)
+				break;
+
+			*buf = b;
+			*buf_size = needed;
+		}
+		else
+			break;
+	}
+
+	return status;
+}
+
+static void sweep_close(struct sweep_level_t *levels, uint32_t depth)
+{
+	// The first key belongs to the caller
+	if (depth > 1)
+		NtClose(levels[depth - 1].key);
+}
+
+/*
+ * The stack of keys being walked: the path of the deepest, and where each
+ * level got to. The keys are opened again by name when resuming.
+ */
+static int sweep_save(struct checkpoint_t   *cp,
+					  struct sweep_level_t  *levels,
+					  uint32_t               depth,
+					  const wchar_t         *path)
+{
+	uint32_t path_size = levels[depth - 1].path_size;
+
+	checkpoint_begin(cp);
+	checkpoint_put(cp, &depth, sizeof(uint32_t));
+	checkpoint_put(cp, &path_size, sizeof(uint32_t));
+	checkpoint_put(cp, path, path_size);
+
+	for (uint32_t i = 0; i < depth; i++)
+	{
+		checkpoint_put(cp, &levels[i].index, sizeof(ULONG));
+		checkpoint_put(cp, &levels[i].path_size, sizeof(uint32_t));
+		checkpoint_put(cp, &levels[i].visited, sizeof(uint8_t));
+	}
+
+	return checkpoint_commit(cp, CHECKPOINT_SWEEP);
+}
+
+static int8_t sweep_is_name(PKEY_BASIC_INFORMATION info, const wchar_t *name, uint32_t size)
+{
+	return info->NameLength == size && !memcmp(info->Name, name, size);
+}
+
+/*
+ * Open a subkey from a checkpoint again. Keys added or removed before it
+ * while the sweep was stopped move it to another index, so it is looked
+ * for by name, and the parent carries on after wherever it is now.
+ * A subkey that is gone leaves the parent at the key that took its place.
+ */
+static NTSTATUS sweep_reopen(struct sweep_level_t *parent,
+							 const wchar_t        *name,
+							 uint32_t              size,
+							 HANDLE               *key,
+							 uint8_t             **buf,
+							 ULONG                *buf_size)
+{
+	NTSTATUS status = STATUS_NO_MORE_ENTRIES;
+	ULONG index = parent->index ? parent->index - 1 : 0;
+
+	if (parent->index)
+		status = sweep_enumerate(parent->key, index, 0, buf, buf_size);
+
+	if (status != STATUS_SUCCESS || !sweep_is_name((PKEY_BASIC_INFORMATION) *buf, name, size))
+	{
+		for (index = 0; (status = sweep_enumerate(parent->key, index, 0, buf, buf_size)) == STATUS_SUCCESS; index++)
+			if (sweep_is_name((PKEY_BASIC_INFORMATION) *buf, name, size))
+				break;
+
+		if (status != STATUS_SUCCESS)
+		{
+			if (parent->index)
+				parent->index--;
+
+			return STATUS_OBJECT_NAME_NOT_FOUND;
+		}
+
+		parent->index = index + 1;
+	}
+
+	UNICODE_STRING u = { 0 };
+	u.Buffer = (PWSTR) name;
+	u.Length = size;
+	u.MaximumLength = size;
+
+	OBJECT_ATTRIBUTES attribs = { 0 };
+	attribs.Length = sizeof(OBJECT_ATTRIBUTES);
+	attribs.RootDirectory = parent->key;
+	attribs.Attributes = OBJ_KERNEL_HANDLE;
+	attribs.ObjectName = &u;
+
+	return NtOpenKey(key, KEY_READ, &attribs);
+}
+
+// Rebuild the stack of a checkpoint, returning the depth reached
+static int sweep_restore(struct checkpoint_t   *cp,
+						 struct sweep_level_t **levels,
+						 uint32_t              *max_depth,
+						 wchar_t              **path,
+						 uint32_t              *path_max,
+						 uint8_t              **buf,
+						 ULONG                 *buf_size,
+						 uint32_t              *depth)
+{
+	uint32_t saved_depth, saved_size;
+
+	if (cp->kind != CHECKPOINT_SWEEP
+	||  checkpoint_get(cp, &saved_depth, sizeof(uint32_t))
+	||  checkpoint_get(cp, &saved_size, sizeof(uint32_t))
+	|| !saved_depth
+	|| (saved_size & 1))
+	{
+		set_errno(ECHECKPOINT);
+		return -1;
+	}
+
+	if (saved_depth > *max_depth)
+	{
+		struct sweep_level_t *l = realloc(*levels, sizeof(struct sweep_level_t) * saved_depth);
+		if (!l)
+		{
+			set_errno(ENOMEM);
+			return -2;
+		}
+
+		*levels = l;
+		*max_depth = saved_depth;
+	}
+
+	if (saved_size + 2 > *path_max)
+	{
+		wchar_t *p = realloc(*path, saved_size + 2);
+		if (!p)
+		{
+			set_errno(ENOMEM);
+			return -2;
+		}
+
+		*path = p;
+		*path_max = saved_size + 2;
+	}
+
+	// The root has to be the same key the checkpoint started from
+	uint32_t root_size = (*levels)[0].path_size;
+	wchar_t *root = malloc(root_size ? root_size : 1);
+	if (!root)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	memcpy(root, *path, root_size);
+
+	int r = checkpoint_get(cp, *path, saved_size);
+	uint32_t start = 0;
+
+	for (uint32_t i = 0; !r && i < saved_depth; i++)
+	{
+		struct sweep_level_t l;
+		memset(&l, 0, sizeof(struct sweep_level_t));
+
+		// Each level is a whole name longer than the one above it
+		if (checkpoint_get(cp, &l.index, sizeof(ULONG))
+		||  checkpoint_get(cp, &l.path_size, sizeof(uint32_t))
+		||  checkpoint_get(cp, &l.visited, sizeof(uint8_t))
+		||  l.path_size > saved_size
+		|| (l.path_size & 1)
+		|| (i && l.path_size <= start)
+		|| (!i && (l.path_size != root_size || memcmp(*path, root, root_size))))
+		{
+			set_errno(ECHECKPOINT);
+			r = -1;
+			break;
+		}
+
+		uint32_t name = start;
+		start = l.path_size + (l.path_size ? 2 : 0);
+
+		// Levels below a key that could not be opened again are gone along with it
+		if (*depth < i)
+			continue;
+
+		if (!i)
+		{
+			(*levels)[0].index = l.index;
+			(*levels)[0].visited = l.visited;
+			continue;
+		}
+
+		NTSTATUS status = sweep_reopen(&(*levels)[i - 1], &(*path)[name / 2], l.path_size - name, &l.key, buf, buf_size);
+
+		if (status == STATUS_SUCCESS)
+		{
+			(*levels)[i] = l;
+			*depth = i + 1;
+		}
+		else if (status != STATUS_OBJECT_NAME_NOT_FOUND && status != STATUS_ACCESS_DENIED)
+			r = reg_status(status);
+	}
+
+	free(root);
+
+	return r;
+}
+
+int sweep(HKEY        hive,
+		  char       *path,
+		  uint8_t     flags,
+		  sweep_cb_t  cb,
+		  void       *ctx)
+{
+	return sweep_checkpoint(hive, path, flags, cb, ctx, 0);
+}
+
+static int sweep_walk(HANDLE               key,
+					  const wchar_t       *path,
+					  uint32_t             path_size,
+					  uint8_t              flags,
+					  sweep_cb_t           cb,
+					  void                *ctx,
+					  struct checkpoint_t *cp);
+
+int sweep_checkpoint(HKEY                 hive,
+					 char                *path,
+					 uint8_t              flags,
+					 sweep_cb_t           cb,
+					 void                *ctx,
+					 struct checkpoint_t *cp)
+{
+	// Load the internals functions
+	init_ntdll();
+
+	int r = 0;
+
+	if (!path || !cb)
+	{
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	HKEY root;
+	if (RegOpenKeyExA(hive, path, 0, KEY_READ, &root) != ERROR_SUCCESS)
+	{
+		set_errno(EOPENKEY);
+		return -3;
+	}
+
+	// *2 here for UTF-16LE
+	uint32_t path_max = (strlen(path) + 1) * 2;
+	wchar_t *wpath = malloc(path_max);
+
+	if (wpath)
+	{
+		uint32_t path_size = (MultiByteToWideChar(CP_OEMCP, 0, path, -1, wpath, path_max / 2) - 1) * 2;
+		r = sweep_walk((HANDLE) root, wpath, path_size, flags, cb, ctx, cp);
+		free(wpath);
+	}
+	else
+	{
+		set_errno(ENOMEM);
+		r = -2;
+	}
+
+	RegCloseKey(root);
+
+	return r;
+}
+
+int sweep_key(HANDLE         key,
+			  const wchar_t *path,
+			  uint32_t       path_size,
+			  uint8_t        flags,
+			  sweep_cb_t     cb,
+			  void          *ctx)
+{
+	return sweep_walk(key, path, path_size, flags, cb, ctx, 0);
+}
+
+static int sweep_walk(HANDLE               key,
+					  const wchar_t       *path,
+					  uint32_t             path_size,
+					  uint8_t              flags,
+					  sweep_cb_t           cb,
+					  void                *ctx,
+					  struct checkpoint_t *cp)
+{
+	// Load the internals functions
+	init_ntdll();
+
+	int r = 0;
+
+	if (!cb)
+	{
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	uint32_t depth = 1;
+	uint32_t max_depth = 16;
+	struct sweep_level_t *levels = malloc(sizeof(struct sweep_level_t) * max_depth);
+
+	uint32_t path_max = path_size + 512;
+	wchar_t *wpath = malloc(path_max);
+
+	ULONG buf_size = SWEEP_BUFFER_SIZE;
+	uint8_t *buf = malloc(buf_size);
+
+	if (levels && wpath && buf)
+	{
+		memset(levels, 0, sizeof(struct sweep_level_t));
+		levels[0].key = key;
+		levels[0].path_size = path_size;
+		if (path_size)
+			memcpy(wpath, path, path_size);
+
+		// Only the first sweep of an operation resumes
+		if (cp && cp->state)
+		{
+			r = sweep_restore(cp, &levels, &max_depth, &wpath, &path_max, &buf, &buf_size, &depth);
+			free(cp->state);
+			cp->state = 0;
+		}
+	}
+	else
+	{
+		set_errno(ENOMEM);
+		r = -2;
+	}
+
+	while (!r && depth)
+	{
+		if (checkpoint_due(cp, thread_now())
+		&& (r = sweep_save(cp, levels, depth, wpath)))
+			break;
+
+		struct sweep_level_t *level = &levels[depth - 1];
+		NTSTATUS status;
+
+		if (!level->visited)
+		{
+			level->visited = 1;
+			r = cb(ctx, wpath, level->path_size, 0);
+
+			for (ULONG i = 0; !r; i++)
+			{
+				status = sweep_enumerate(level->key, i, 1, &buf, &buf_size);
+
+				if (status == STATUS_NO_MORE_ENTRIES)
+					break;
+				else if (status != STATUS_SUCCESS)
+					r = reg_status(status);
+				else
+				{
+					PKEY_VALUE_FULL_INFORMATION info = (PKEY_VALUE_FULL_INFORMATION) buf;
+
+					struct key_data_t entry;
+					entry.type = info->Type;
+					entry.name = info->Name;
+					entry.name_size = info->NameLength;
+					entry.value = &buf[info->DataOffset];
+					entry.size = info->DataLength;
+					entry.anomalies = (flags & SWEEP_RAW) ? 0 : classify_name(info->Name, info->NameLength);
+
+					r = cb(ctx, wpath, level->path_size, &entry);
+				}
+			}
+
+			if (r)
+				break;
+		}
+
+		status = STATUS_NO_MORE_ENTRIES;
+		if (flags & SWEEP_RECURSIVE)
+			status = sweep_enumerate(level->key, level->index++, 0, &buf, &buf_size);
+
+		if (status == STATUS_SUCCESS)
+		{
+			PKEY_BASIC_INFORMATION info = (PKEY_BASIC_INFORMATION) buf;
+
+			// Make room for the subkey, its path, and the separator
+			if (depth == max_depth)
+			{
+				struct sweep_level_t *l = realloc(levels, sizeof(struct sweep_level_t) * max_depth * 2);
+				if (!l)
+				{
+					set_errno(ENOMEM);
+					r = -2;
+					break;
+				}
+
+				levels = l;
+				level = &levels[depth - 1];
+				max_depth *= 2;
+			}
+
+			uint32_t path_size = level->path_size + (level->path_size ? 2 : 0) + info->NameLength;
+			if (path_size + 2 > path_max)
+			{
+				wchar_t *p = realloc(wpath, (path_size + 2) * 2);
+				if (!p)
+				{
+					set_errno(ENOMEM);
+					r = -2;
+					break;
+				}
+
+				wpath = p;
+				path_max = (path_size + 2) * 2;
+			}
+
+			UNICODE_STRING name = { 0 };
+			name.Buffer = info->Name;
+			name.Length = info->NameLength;
+			name.MaximumLength = info->NameLength;
+
+			OBJECT_ATTRIBUTES attribs = { 0 };
+			attribs.Length = sizeof(OBJECT_ATTRIBUTES);
+			attribs.RootDirectory = level->key;
+			attribs.Attributes = OBJ_KERNEL_HANDLE;
+			attribs.ObjectName = &name;
+			attribs.SecurityDescriptor = 0;
+			attribs.SecurityQualityOfService = 0;
+
+			HANDLE key;
+			status = NtOpenKey(&key, KEY_READ, &attribs);
+
+			if (status == STATUS_SUCCESS)
+			{
+				if (level->path_size)
+					wpath[level->path_size / 2] = L'\\';
+				memcpy(&wpath[(path_size - info->NameLength) / 2], info->Name, info->NameLength);
+
+				memset(&levels[depth], 0, sizeof(struct sweep_level_t));
+				levels[depth].key = key;
+				levels[depth].path_size = path_size;
+				depth++;
+			}
+			// Protected keys are skipped rather than failing the whole sweep
+			else if (status != STATUS_ACCESS_DENIED)
+				r = reg_status(status);
+		}
+		else if (status == STATUS_NO_MORE_ENTRIES)
+			sweep_close(levels, depth--);
+		else
+			r = reg_status(status);
+	}
+
+	if (levels)
+		while (depth)
+			sweep_close(levels, depth--);
+
+	if (levels)
+		free(levels);
+
+	if (wpath)
+		free(wpath);
+
+	if (buf)
+		free(buf);
+
+	if (!r)
+		set_errno(ESUCCESS);
+
+	return r;
+}
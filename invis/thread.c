@@ -0,0 +1,349 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include <error.h>
+#include <invis/thread.h>
+
+#ifdef _WIN32
+
+static DWORD WINAPI thread_main(LPVOID arg)
+{
+	struct thread_t *t = (struct thread_t *) arg;
+	t->fn(t->arg);
+
+	return 0;
+}
+
+int thread_start(struct thread_t *t, void (*fn)(void *), void *arg)
+{
+	t->fn = fn;
+	t->arg = arg;
+	t->handle = CreateThread(0, 0, thread_main, t, 0, 0);
+
+	if (!t->handle)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	return 0;
+}
+
+void thread_join(struct thread_t *t)
+{
+	if (t->handle)
+	{
+		WaitForSingleObject(t->handle, INFINITE);
+		CloseHandle(t->handle);
+		t->handle = 0;
+	}
+}
+
+static DWORD WINAPI thread_spawned(LPVOID arg)
+{
+	struct thread_t t = *(struct thread_t *) arg;
+	free(arg);
+	t.fn(t.arg);
+
+	return 0;
+}
+
+int thread_spawn(void (*fn)(void *), void *arg)
+{
+	struct thread_t *t = malloc(sizeof(struct thread_t));
+	HANDLE handle = 0;
+
+	if (t)
+	{
+		t->fn = fn;
+		t->arg = arg;
+
+		if (!(handle = CreateThread(0, 0, thread_spawned, t, 0, 0)))
+			free(t);
+	}
+
+	if (!handle)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	CloseHandle(handle);
+
+	return 0;
+}
+
+uint32_t thread_count(void)
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+
+	return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+}
+
+void lock_init(struct lock_t *l)
+{
+	InitializeSRWLock(&l->lock);
+}
+
+void lock_acquire(struct lock_t *l)
+{
+	AcquireSRWLockExclusive(&l->lock);
+}
+
+void lock_release(struct lock_t *l)
+{
+	ReleaseSRWLockExclusive(&l->lock);
+}
+
+void cond_init(struct cond_t *c)
+{
+	InitializeConditionVariable(&c->cond);
+}
+
+void cond_wait(struct cond_t *c, struct lock_t *l)
+{
+	SleepConditionVariableSRW(&c->cond, &l->lock, INFINITE, 0);
+}
+
+void cond_wake(struct cond_t *c)
+{
+	WakeConditionVariable(&c->cond);
+}
+
+void cond_wake_all(struct cond_t *c)
+{
+	WakeAllConditionVariable(&c->cond);
+}
+
+uint64_t thread_now(void)
+{
+	static LARGE_INTEGER freq;
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	// Split up so that the multiply cannot overflow
+	uint64_t f = freq.QuadPart;
+	uint64_t n = now.QuadPart;
+	return (n / f) * 1000000 + (n % f) * 1000000 / f;
+}
+
+uint64_t thread_now_ns(void)
+{
+	static LARGE_INTEGER freq;
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	uint64_t f = freq.QuadPart;
+	uint64_t n = now.QuadPart;
+	return (n / f) * 1000000000 + (n % f) * 1000000000 / f;
+}
+
+uint64_t thread_cpu_time(void)
+{
+	FILETIME create, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &create, &exit, &kernel, &user))
+		return 0;
+
+	// FILETIME counts 100ns intervals
+	uint64_t k = ((uint64_t) kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+	uint64_t u = ((uint64_t) user.dwHighDateTime << 32) | user.dwLowDateTime;
+	return (k + u) / 10;
+}
+
+void thread_sleep(uint64_t usec)
+{
+	// Sleep() only has millisecond resolution
+	Sleep((usec + 999) / 1000);
+}
+
+void thread_yield(void)
+{
+	SwitchToThread();
+}
+
+#else
+
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+static void *thread_main(void *arg)
+{
+	struct thread_t *t = (struct thread_t *) arg;
+	t->fn(t->arg);
+
+	return 0;
+}
+
+int thread_start(struct thread_t *t, void (*fn)(void *), void *arg)
+{
+	t->fn = fn;
+	t->arg = arg;
+	t->running = !pthread_create(&t->handle, 0, thread_main, t);
+
+	if (!t->running)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	return 0;
+}
+
+void thread_join(struct thread_t *t)
+{
+	if (t->running)
+	{
+		pthread_join(t->handle, 0);
+		t->running = 0;
+	}
+}
+
+static void *thread_spawned(void *arg)
+{
+	struct thread_t t = *(struct thread_t *) arg;
+	free(arg);
+	t.fn(t.arg);
+
+	return 0;
+}
+
+int thread_spawn(void (*fn)(void *), void *arg)
+{
+	struct thread_t *t = malloc(sizeof(struct thread_t));
+	pthread_t handle;
+
+	if (t)
+	{
+		t->fn = fn;
+		t->arg = arg;
+
+		if (pthread_create(&handle, 0, thread_spawned, t))
+		{
+			free(t);
+			t = 0;
+		}
+	}
+
+	if (!t)
+	{
+		set_errno(ENOMEM);
+		return -2;
+	}
+
+	pthread_detach(handle);
+
+	return 0;
+}
+
+uint32_t thread_count(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? n : 1;
+}
+
+void lock_init(struct lock_t *l)
+{
+	pthread_mutex_init(&l->lock, 0);
+}
+
+void lock_acquire(struct lock_t *l)
+{
+	pthread_mutex_lock(&l->lock);
+}
+
+void lock_release(struct lock_t *l)
+{
+	pthread_mutex_unlock(&l->lock);
+}
+
+void cond_init(struct cond_t *c)
+{
+	pthread_cond_init(&c->cond, 0);
+}
+
+void cond_wait(struct cond_t *c, struct lock_t *l)
+{
+	pthread_cond_wait(&c->cond, &l->lock);
+}
+
+void cond_wake(struct cond_t *c)
+{
+	pthread_cond_signal(&c->cond);
+}
+
+void cond_wake_all(struct cond_t *c)
+{
+	pthread_cond_broadcast(&c->cond);
+}
+
+static uint64_t thread_clock(clockid_t clock)
+{
+	struct timespec ts;
+	if (clock_gettime(clock, &ts))
+		return 0;
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t thread_now(void)
+{
+	return thread_clock(CLOCK_MONOTONIC);
+}
+
+uint64_t thread_now_ns(void)
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t thread_cpu_time(void)
+{
+	return thread_clock(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void thread_sleep(uint64_t usec)
+{
+	struct timespec ts;
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+
+	// Carry on sleeping through signals
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+void thread_yield(void)
+{
+	sched_yield();
+}
+
+#endif
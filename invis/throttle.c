@@ -0,0 +1,272 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <error.h>
+#include <invis/throttle.h>
+#include <invis/thread.h>
+
+// Four buckets per power of two, enough to tell 1ms from 1.25ms
+#define THROTTLE_BUCKETS	160
+
+struct throttle_t
+{
+	struct lock_t lock;
+	struct cond_t cond;
+
+	uint8_t enabled;
+	uint32_t ceiling;
+	uint32_t cpu;
+	uint32_t max;
+	uint32_t processors;
+
+	uint32_t limit;
+	uint32_t inflight;
+	uint64_t delay;		// Nanoseconds, calls can be far quicker than a microsecond
+	uint64_t debt;		// Pacing not slept off yet
+	uint8_t growing;	// Doubling, nothing has gone over yet
+	uint8_t saturated;	// Every slot was in use during this window
+
+	uint64_t window_start;
+	uint64_t window_cpu;
+	uint32_t samples;
+	uint32_t histogram[THROTTLE_BUCKETS];
+
+	struct throttle_stats_t stats;
+};
+
+static struct throttle_t throttle;
+
+static uint32_t throttle_bucket(uint64_t usec)
+{
+	if (usec < 4)
+		return usec;
+
+	uint32_t bits = 63 - __builtin_clzll(usec);
+	uint32_t b = (bits - 1) * 4 + ((usec >> (bits - 2)) & 3);
+
+	return b < THROTTLE_BUCKETS ? b : THROTTLE_BUCKETS - 1;
+}
+
+// The largest latency that falls into a bucket
+static uint32_t throttle_bucket_max(uint32_t b)
+{
+	if (b < 4)
+		return b;
+
+	uint32_t bits = b / 4 + 1;
+	uint64_t max = ((uint64_t) (4 + b % 4 + 1) << (bits - 2)) - 1;
+
+	return max < UINT32_MAX ? max : UINT32_MAX;
+}
+
+static uint32_t throttle_p99(void)
+{
+	// Rank of the 99th percentile, rounded up
+	uint32_t rank = throttle.samples - throttle.samples / 100;
+	uint32_t seen = 0;
+
+	for (uint32_t b = 0; b < THROTTLE_BUCKETS; b++)
+	{
+		seen += throttle.histogram[b];
+		if (seen && seen >= rank)
+			return throttle_bucket_max(b);
+	}
+
+	return 0;
+}
+
+/*
+ * The delay between calls that would have brought the processor use of
+ * the window down to the budget, given that calls are one at a time
+ */
+static uint64_t throttle_pace(uint64_t used, uint64_t wall)
+{
+	// Time the window should have taken, spread over its calls in nanoseconds
+	uint64_t want = used * 100 / ((uint64_t) throttle.cpu * throttle.processors);
+	int64_t change = ((int64_t) want - (int64_t) wall) * 1000 / throttle.samples;
+
+	if (change < 0 && (uint64_t) -change >= throttle.delay)
+		return 0;
+
+	return throttle.delay + change;
+}
+
+// Called with the lock held once a window is over
+static void throttle_adjust(uint64_t now)
+{
+	uint64_t cpu = thread_cpu_time();
+	uint64_t used = cpu - throttle.window_cpu;
+	uint64_t wall = now - throttle.window_start;
+
+	throttle.stats.p99 = throttle_p99();
+	throttle.stats.cpu = wall ? used * 100 / (wall * throttle.processors) : 0;
+
+	uint8_t slow = throttle.ceiling && throttle.stats.p99 > throttle.ceiling;
+	uint8_t busy = throttle.cpu && throttle.stats.cpu > throttle.cpu;
+	uint64_t delay = throttle.delay;
+
+	if (slow || busy)
+	{
+		throttle.growing = 0;
+
+		if (throttle.limit > 1)
+			throttle.limit /= 2;
+		else
+		{
+			// Give a slow host more room every window, and pace to the budget straight away
+			if (slow)
+				delay = delay ? delay * 2 : THROTTLE_MIN_DELAY * 1000;
+
+			if (busy && throttle_pace(used, wall) > delay)
+				delay = throttle_pace(used, wall);
+		}
+	}
+	// Stop pacing before allowing more calls, but no faster than the budget allows
+	else if (delay)
+	{
+		delay = delay / 2 >= THROTTLE_MIN_DELAY * 1000 ? delay / 2 : 0;
+
+		if (throttle.cpu && throttle_pace(used, wall) > delay)
+			delay = throttle_pace(used, wall);
+	}
+	else if (throttle.saturated && throttle.limit < throttle.max)
+	{
+		throttle.limit = throttle.growing ? throttle.limit * 2 : throttle.limit + 1;
+		if (throttle.limit > throttle.max)
+			throttle.limit = throttle.max;
+	}
+
+	throttle.delay = delay < THROTTLE_MAX_DELAY * 1000 ? delay : THROTTLE_MAX_DELAY * 1000;
+
+	throttle.stats.limit = throttle.limit;
+	throttle.stats.delay = throttle.delay;
+
+	throttle.window_start = now;
+	throttle.window_cpu = cpu;
+	throttle.samples = 0;
+	throttle.saturated = throttle.inflight >= throttle.limit;
+	memset(throttle.histogram, 0, sizeof(throttle.histogram));
+}
+
+int throttle_init(uint32_t ceiling, uint32_t cpu, uint32_t max)
+{
+	if (cpu > 100)
+	{
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	memset(&throttle, 0, sizeof(struct throttle_t));
+	lock_init(&throttle.lock);
+	cond_init(&throttle.cond);
+
+	throttle.ceiling = ceiling;
+	throttle.cpu = cpu < 100 ? cpu : 0;
+	throttle.processors = thread_count();
+	throttle.max = max ? max : throttle.processors;
+
+	throttle.limit = 1;
+	throttle.growing = 1;
+	throttle.window_start = thread_now();
+	throttle.window_cpu = thread_cpu_time();
+	throttle.stats.limit = 1;
+
+	throttle.enabled = 1;
+
+	return 0;
+}
+
+uint64_t throttle_enter(void)
+{
+	if (!throttle.enabled)
+		return 0;
+
+	lock_acquire(&throttle.lock);
+
+	if (throttle.inflight >= throttle.limit)
+	{
+		throttle.saturated = 1;
+		throttle.stats.waited++;
+
+		while (throttle.inflight >= throttle.limit)
+			cond_wait(&throttle.cond, &throttle.lock);
+	}
+
+	if (++throttle.inflight >= throttle.limit)
+		throttle.saturated = 1;
+
+	uint64_t sleep = 0;
+	throttle.debt += throttle.delay;
+
+	if (throttle.debt >= THROTTLE_MIN_SLEEP * 1000)
+	{
+		sleep = throttle.debt / 1000;
+		throttle.debt = 0;
+	}
+
+	lock_release(&throttle.lock);
+
+	// Pacing holds on to the slot, so that nothing else runs meanwhile
+	if (sleep)
+		thread_sleep(sleep);
+
+	return thread_now();
+}
+
+void throttle_leave(uint64_t start)
+{
+	if (!throttle.enabled)
+		return;
+
+	uint64_t now = thread_now();
+
+	lock_acquire(&throttle.lock);
+
+	throttle.inflight--;
+	throttle.stats.calls++;
+	throttle.histogram[throttle_bucket(now - start)]++;
+	throttle.samples++;
+
+	uint32_t limit = throttle.limit;
+
+	if ((throttle.samples >= THROTTLE_WINDOW && now - throttle.window_start >= THROTTLE_MIN_PERIOD)
+	||   now - throttle.window_start >= THROTTLE_PERIOD)
+		throttle_adjust(now);
+
+	if (throttle.limit > limit)
+		cond_wake_all(&throttle.cond);
+	else
+		cond_wake(&throttle.cond);
+
+	lock_release(&throttle.lock);
+}
+
+void throttle_stats(struct throttle_stats_t *stats)
+{
+	if (!throttle.enabled)
+	{
+		memset(stats, 0, sizeof(struct throttle_stats_t));
+		return;
+	}
+
+	lock_acquire(&throttle.lock);
+	*stats = throttle.stats;
+	lock_release(&throttle.lock);
+}
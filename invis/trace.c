@@ -0,0 +1,1231 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <error.h>
+#include <invis/hash.h>
+#include <invis/ntdll.h>
+#include <invis/thread.h>
+#include <invis/trace.h>
+
+// Records are written out a buffer at a time
+#define TRACE_BUFFER		(1 << 20)
+
+#define TRACE_PAD(n)		(((n) + 7) & ~7)
+
+static const HKEY trace_predefined[] =
+{
+	HKEY_CLASSES_ROOT,
+	HKEY_CURRENT_USER,
+	HKEY_LOCAL_MACHINE,
+	HKEY_USERS,
+	HKEY_CURRENT_CONFIG,
+};
+
+#define TRACE_PREDEFINED	(sizeof(trace_predefined) / sizeof(trace_predefined[0]))
+
+// The functions being wrapped while recording
+static struct
+{
+	_NtCreateKey         create_key;
+	_NtOpenKey           open_key;
+	_NtSetValueKey       set_value;
+	_NtDeleteKey         delete_key;
+	_NtDeleteValueKey    delete_value;
+	_NtQueryKey          query_key;
+	_NtEnumerateKey      enumerate_key;
+	_NtQueryValueKey     query_value;
+	_NtEnumerateValueKey enumerate_value;
+	_NtClose             close;
+} trace_real;
+
+static struct lock_t trace_lock;
+static FILE *trace_file;
+static int8_t trace_failed;
+static uint64_t trace_epoch;
+
+static uint8_t *trace_buf;
+static uint32_t trace_len;
+
+// Open handles and their ids, open addressed with linear probing
+static HANDLE *trace_handles;
+static uint32_t *trace_ids;
+static uint32_t trace_size;
+static uint32_t trace_count;
+static uint32_t trace_next;
+
+const char *trace_call_name(uint8_t call)
+{
+	static const char *names[TRACE_CALLS] =
+	{
+		0,
+		"NtCreateKey",
+		"NtOpenKey",
+		"NtSetValueKey",
+		"NtDeleteKey",
+		"NtDeleteValueKey",
+		"NtQueryKey",
+		"NtEnumerateKey",
+		"NtQueryValueKey",
+		"NtEnumerateValueKey",
+		"NtClose",
+		"Handle",
+	};
+
+	return call && call < TRACE_CALLS ? names[call] : "Unknown";
+}
+
+static inline uint32_t trace_slot(HANDLE handle)
+{
+	return ((uint64_t) (uintptr_t) handle * 0x9E3779B97F4A7C15ULL >> 32) & (trace_size - 1);
+}
+
+static uint32_t trace_find(HANDLE handle)
+{
+	uint32_t i = trace_slot(handle);
+	while (trace_handles[i] && trace_handles[i] != handle)
+		i = (i + 1) & (trace_size - 1);
+
+	return i;
+}
+
+static void trace_insert(HANDLE handle, uint32_t id)
+{
+	// Kept at most half full, growing only fails once memory has run out
+	if ((trace_count + 1) * 2 > trace_size)
+	{
+		uint32_t size = trace_size * 2;
+		HANDLE *handles = calloc(size, sizeof(HANDLE));
+		uint32_t *ids = calloc(size, sizeof(uint32_t));
+
+		if (!handles || !ids)
+		{
+			free(handles);
+			free(ids);
+			trace_failed = 1;
+			return;
+		}
+
+		HANDLE *old_handles = trace_handles;
+		uint32_t *old_ids = trace_ids;
+		uint32_t old_size = trace_size;
+
+		trace_handles = handles;
+		trace_ids = ids;
+		trace_size = size;
+
+		for (uint32_t i = 0; i < old_size; i++)
+		{
+			if (old_handles[i])
+			{
+				uint32_t j = trace_find(old_handles[i]);
+				trace_handles[j] = old_handles[i];
+				trace_ids[j] = old_ids[i];
+			}
+		}
+
+		free(old_handles);
+		free(old_ids);
+	}
+
+	uint32_t i = trace_find(handle);
+	if (!trace_handles[i])
+		trace_count++;
+
+	trace_handles[i] = handle;
+	trace_ids[i] = id;
+}
+
+// Shift the entries after it back so that no probe sequence is broken
+static uint32_t trace_remove(HANDLE handle)
+{
+	uint32_t i = trace_find(handle);
+	uint32_t id = trace_ids[i];
+
+	if (!trace_handles[i])
+		return 0;
+
+	trace_handles[i] = 0;
+	trace_count--;
+
+	for (uint32_t j = (i + 1) & (trace_size - 1); trace_handles[j]; j = (j + 1) & (trace_size - 1))
+	{
+		uint32_t home = trace_slot(trace_handles[j]);
+
+		// Only move entries whose home is not between the hole and themselves
+		if (((j - home) & (trace_size - 1)) >= ((j - i) & (trace_size - 1)))
+		{
+			trace_handles[i] = trace_handles[j];
+			trace_ids[i] = trace_ids[j];
+			trace_handles[j] = 0;
+			i = j;
+		}
+	}
+
+	return id;
+}
+
+static void trace_flush(void)
+{
+	if (trace_len && fwrite(trace_buf, 1, trace_len, trace_file) != trace_len)
+		trace_failed = 1;
+
+	trace_len = 0;
+}
+
+static void trace_append(struct trace_record_t *r, const void *name)
+{
+	uint32_t size = sizeof(struct trace_record_t) + TRACE_PAD(r->name_size);
+
+	if (trace_len + size > TRACE_BUFFER)
+		trace_flush();
+
+	memcpy(&trace_buf[trace_len], r, sizeof(struct trace_record_t));
+	if (r->name_size)
+		memcpy(&trace_buf[trace_len + sizeof(struct trace_record_t)], name, r->name_size);
+	memset(&trace_buf[trace_len + sizeof(struct trace_record_t) + r->name_size], 0, TRACE_PAD(r->name_size) - r->name_size);
+
+	trace_len += size;
+}
+
+// Names are counted in bytes, and a UNICODE_STRING never holds more than this
+static inline uint16_t trace_name_size(uint32_t size)
+{
+	return size > 0xFFFE ? 0xFFFE : size & ~1;
+}
+
+// A handle the trace has not seen opened gets its full name, so that a replay can open it too
+static uint32_t trace_id(HANDLE handle)
+{
+	if (!handle)
+		return 0;
+
+	uint32_t i = trace_find(handle);
+	if (trace_handles[i])
+		return trace_ids[i];
+
+	struct trace_record_t r;
+	memset(&r, 0, sizeof(struct trace_record_t));
+	r.call = TRACE_HANDLE;
+	r.class = KeyNameInformation;
+	r.result = ++trace_next;
+
+	for (uint32_t p = 0; p < TRACE_PREDEFINED; p++)
+		if ((HKEY) handle == trace_predefined[p])
+			r.arg = (uint32_t) (uintptr_t) handle;
+
+	uint8_t stack[512];
+	void *buf = stack;
+	ULONG needed = 0;
+
+	if (!r.arg)
+	{
+		r.status = trace_real.query_key(handle, KeyNameInformation, buf, sizeof(stack), &needed);
+
+		if (r.status == STATUS_BUFFER_OVERFLOW
+		&& (buf = malloc(needed)))
+			r.status = trace_real.query_key(handle, KeyNameInformation, buf, needed, &needed);
+
+		if (!buf)
+			buf = stack;
+		else if (r.status == STATUS_SUCCESS)
+			r.name_size = trace_name_size(((PKEY_NAME_INFORMATION) buf)->NameLength);
+	}
+
+	trace_append(&r, ((PKEY_NAME_INFORMATION) buf)->Name);
+
+	if (buf != stack)
+		free(buf);
+
+	trace_insert(handle, r.result);
+
+	return r.result;
+}
+
+static void trace_init(struct trace_record_t *r, uint8_t call, NTSTATUS status, uint64_t start, uint64_t end)
+{
+	memset(r, 0, sizeof(struct trace_record_t));
+	r->call = call;
+	r->status = status;
+	r->start = start - trace_epoch;
+	r->time = end - start > 0xFFFFFFFF ? 0xFFFFFFFF : end - start;
+}
+
+static void trace_emit(struct trace_record_t *r, HANDLE key, PHANDLE result, const wchar_t *name, uint32_t name_size)
+{
+	r->name_size = trace_name_size(name ? name_size : 0);
+
+	lock_acquire(&trace_lock);
+
+	r->key = trace_id(key);
+
+	if (result)
+	{
+		r->result = ++trace_next;
+		trace_insert(*result, r->result);
+	}
+
+	trace_append(r, name);
+
+	lock_release(&trace_lock);
+}
+
+// The type and size of a value, and its name once the whole of it was returned
+static void trace_value(struct trace_record_t *r, ULONG class, PVOID buf, ULONG len, const wchar_t **name, uint32_t *name_size)
+{
+	PKEY_VALUE_FULL_INFORMATION info = (PKEY_VALUE_FULL_INFORMATION) buf;
+
+	if (class != KeyValueFullInformation
+	||  len < offsetof(KEY_VALUE_FULL_INFORMATION, Name)
+	|| (r->status != STATUS_SUCCESS && r->status != STATUS_BUFFER_OVERFLOW))
+		return;
+
+	r->type = info->Type;
+	r->data_size = info->DataLength;
+
+	if (name && r->status == STATUS_SUCCESS)
+	{
+		*name = info->Name;
+		*name_size = info->NameLength;
+	}
+}
+
+static NTSTATUS trace_create_key(PHANDLE            handle,
+								 ACCESS_MASK        access,
+								 POBJECT_ATTRIBUTES attribs,
+								 ULONG              index,
+								 PUNICODE_STRING    class,
+								 ULONG              options,
+								 PULONG             disposition)
+{
+	ULONG d = 0;
+
+	uint64_t start = thread_now_ns();
+	NTSTATUS status = trace_real.create_key(handle, access, attribs, index, class, options, &d);
+	uint64_t end = thread_now_ns();
+
+	if (disposition)
+		*disposition = d;
+
+	struct trace_record_t r;
+	trace_init(&r, TRACE_CREATE_KEY, status, start, end);
+	r.arg = access;
+	r.needed = d;
+
+	PUNICODE_STRING name = attribs->ObjectName;
+	trace_emit(&r, attribs->RootDirectory, status == STATUS_SUCCESS ? handle : 0, name ? name->Buffer : 0, name ? name->Length : 0);
+
+	return status;
+}
+
+static NTSTATUS trace_open_key(PHANDLE handle, ACCESS_MASK access, POBJECT_ATTRIBUTES attribs)
+{
+	uint64_t start = thread_now_ns();
+	NTSTATUS status = trace_real.open_key(handle, access, attribs);
+	uint64_t end = thread_now_ns();
+
+	struct trace_record_t r;
+	trace_init(&r, TRACE_OPEN_KEY, status, start, end);
+	r.arg = access;
+
+	PUNICODE_STRING name = attribs->ObjectName;
+	trace_emit(&r, attribs->RootDirectory, status == STATUS_SUCCESS ? handle : 0, name ? name->Buffer : 0, name ? name->Length : 0);
+
+	return status;
+}
+
+static NTSTATUS trace_set_value(HANDLE handle, PUNICODE_STRING name, ULONG index, ULONG type, PVOID data, ULONG size)
+{
+	uint64_t start = thread_now_ns();
+	NTSTATUS status = trace_real.set_value(handle, name, index, type, data, size);
+	uint64_t end = thread_now_ns();
+
+	struct trace_record_t r;
+	trace_init(&r, TRACE_SET_VALUE, status, start, end);
+	r.type = type;
+	r.length = size;
+
+	trace_emit(&r, handle, 0, name ? name->Buffer : 0, name ? name->Length : 0);
+
+	return status;
+}
+
+static NTSTATUS trace_delete_key(HANDLE handle)
+{
+	uint64_t start = thread_now_ns();
+	NTSTATUS status = trace_real.delete_key(handle);
+	uint64_t end = thread_now_ns();
+
+	struct trace_record_t r;
+	trace_init(&r, TRACE_DELETE_KEY, status, start, end);
+	trace_emit(&r, handle, 0, 0, 0);
+
+	return status;
+}
+
+static NTSTATUS trace_delete_value(HANDLE handle, PUNICODE_STRING name)
+{
+	uint64_t start = thread_now_ns();
+	NTSTATUS status = trace_real.delete_value(handle, name);
+	uint64_t end = thread_now_ns();
+
+	struct trace_record_t r;
+	trace_init(&r, TRACE_DELETE_VALUE, status, start, end);
+	trace_emit(&r, handle, 0, name ? name->Buffer : 0, name ? name->Length : 0);
+
+	return status;
+}
+
+static NTSTATUS trace_query_key(HANDLE handle, ULONG class, PVOID buf, ULONG len, PULONG needed)
+{
+	ULONG n = 0;
+
+	uint64_t start = thread_now_ns();
+	NTSTATUS status = trace_real.query_key(handle, class, buf, len, &n);
+	uint64_t end = thread_now_ns();
+
+	*needed = n;
+
+	struct trace_record_t r;
+	trace_init(&r, TRACE_QUERY_KEY, status, start, end);
+	r.class = class;
+	r.length = len;
+	r.needed = n;
+	trace_emit(&r, handle, 0, 0, 0);
+
+	return status;
+}
+
+static NTSTATUS trace_enumerate_key(HANDLE handle, ULONG index, ULONG class, PVOID buf, ULONG len, PULONG needed)
+{
+	ULONG n = 0;
+
+	uint64_t start = thread_now_ns();
+	NTSTATUS status = trace_real.enumerate_key(handle, index, class, buf, len, &n);
+	uint64_t end = thread_now_ns();
+
+	*needed = n;
+
+	struct trace_record_t r;
+	trace_init(&r, TRACE_ENUMERATE_KEY, status, start, end);
+	r.class = class;
+	r.arg = index;
+	r.length = len;
+	r.needed = n;
+
+	// The subkey found, so that a replay has it to find as well
+	PKEY_BASIC_INFORMATION info = (PKEY_BASIC_INFORMATION) buf;
+	uint8_t named = status == STATUS_SUCCESS && class == KeyBasicInformation;
+	trace_emit(&r, handle, 0, named ? info->Name : 0, named ? info->NameLength : 0);
+
+	return status;
+}
+
+static NTSTATUS trace_query_value(HANDLE handle, PUNICODE_STRING name, ULONG class, PVOID buf, ULONG len, PULONG needed)
+{
+	ULONG n = 0;
+
+	uint64_t start = thread_now_ns();
+	NTSTATUS status = trace_real.query_value(handle, name, class, buf, len, &n);
+	uint64_t end = thread_now_ns();
+
+	*needed = n;
+
+	struct trace_record_t r;
+	trace_init(&r, TRACE_QUERY_VALUE, status, start, end);
+	r.class = class;
+	r.length = len;
+	r.needed = n;
+	trace_value(&r, class, buf, len, 0, 0);
+	trace_emit(&r, handle, 0, name ? name->Buffer : 0, name ? name->Length : 0);
+
+	return status;
+}
+
+static NTSTATUS trace_enumerate_value(HANDLE handle, ULONG index, ULONG class, PVOID buf, ULONG len, PULONG needed)
+{
+	ULONG n = 0;
+
+	uint64_t start = thread_now_ns();
+	NTSTATUS status = trace_real.enumerate_value(handle, index, class, buf, len, &n);
+	uint64_t end = thread_now_ns();
+
+	*needed = n;
+
+	struct trace_record_t r;
+	trace_init(&r, TRACE_ENUMERATE_VALUE, status, start, end);
+	r.class = class;
+	r.arg = index;
+	r.length = len;
+	r.needed = n;
+
+	const wchar_t *name = 0;
+	uint32_t name_size = 0;
+	trace_value(&r, class, buf, len, &name, &name_size);
+	trace_emit(&r, handle, 0, name, name_size);
+
+	return status;
+}
+
+static NTSTATUS trace_close(HANDLE handle)
+{
+	// Forgotten before it is closed, as the handle may be reused as soon as it is
+	lock_acquire(&trace_lock);
+	uint32_t id = trace_id(handle);
+	trace_remove(handle);
+	lock_release(&trace_lock);
+
+	uint64_t start = thread_now_ns();
+	NTSTATUS status = trace_real.close(handle);
+	uint64_t end = thread_now_ns();
+
+	struct trace_record_t r;
+	trace_init(&r, TRACE_CLOSE, status, start, end);
+	r.key = id;
+
+	lock_acquire(&trace_lock);
+	trace_append(&r, 0);
+	lock_release(&trace_lock);
+
+	return status;
+}
+
+int trace_start(const char *file)
+{
+	if (trace_file)
+	{
+		set_errno(EINVAL);
+		return -1;
+	}
+
+	init_ntdll();
+
+	trace_size = 256;
+	trace_count = 0;
+	trace_next = 0;
+	trace_len = 0;
+	trace_failed = 0;
+
+	trace_buf = malloc(TRACE_BUFFER);
+	trace_handles = calloc(trace_size, sizeof(HANDLE));
+	trace_ids = calloc(trace_size, sizeof(uint32_t));
+
+	if (!trace_buf || !trace_handles || !trace_ids)
+	{
+		set_errno(ENOMEM);
+		goto fail;
+	}
+
+	if (!(trace_file = fopen(file, "wb")))
+	{
+		set_errno(EFILE);
+		goto fail;
+	}
+
+	struct trace_header_t header;
+	memset(&header, 0, sizeof(struct trace_header_t));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.created = time(0);
+
+	if (fwrite(&header, sizeof(struct trace_header_t), 1, trace_file) != 1)
+	{
+		fclose(trace_file);
+		trace_file = 0;
+		set_errno(ETRACEFILE);
+		goto fail;
+	}
+
+	lock_init(&trace_lock);
+	trace_epoch = thread_now_ns();
+
+	trace_real.create_key      = NtCreateKey;
+	trace_real.open_key        = NtOpenKey;
+	trace_real.set_value       = NtSetValueKey;
+	trace_real.delete_key      = NtDeleteKey;
+	trace_real.delete_value    = NtDeleteValueKey;
+	trace_real.query_key       = NtQueryKey;
+	trace_real.enumerate_key   = NtEnumerateKey;
+	trace_real.query_value     = NtQueryValueKey;
+	trace_real.enumerate_value = NtEnumerateValueKey;
+	trace_real.close           = NtClose;
+
+	NtCreateKey         = trace_create_key;
+	NtOpenKey           = trace_open_key;
+	NtSetValueKey       = trace_set_value;
+	NtDeleteKey         = trace_delete_key;
+	NtDeleteValueKey    = trace_delete_value;
+	NtQueryKey          = trace_query_key;
+	NtEnumerateKey      = trace_enumerate_key;
+	NtQueryValueKey     = trace_query_value;
+	NtEnumerateValueKey = trace_enumerate_value;
+	NtClose             = trace_close;
+
+	return 0;
+
+fail:
+	free(trace_buf);
+	free(trace_handles);
+	free(trace_ids);
+	trace_buf = 0;
+	trace_handles = 0;
+	trace_ids = 0;
+
+	return -1;
+}
+
+int trace_stop(void)
+{
+	if (!trace_file)
+		return 0;
+
+	NtCreateKey         = trace_real.create_key;
+	NtOpenKey           = trace_real.open_key;
+	NtSetValueKey       = trace_real.set_value;
+	NtDeleteKey         = trace_real.delete_key;
+	NtDeleteValueKey    = trace_real.delete_value;
+	NtQueryKey          = trace_real.query_key;
+	NtEnumerateKey      = trace_real.enumerate_key;
+	NtQueryValueKey     = trace_real.query_value;
+	NtEnumerateValueKey = trace_real.enumerate_value;
+	NtClose             = trace_real.close;
+
+	lock_acquire(&trace_lock);
+	trace_flush();
+	lock_release(&trace_lock);
+
+	if (fclose(trace_file))
+		trace_failed = 1;
+
+	trace_file = 0;
+
+	free(trace_buf);
+	free(trace_handles);
+	free(trace_ids);
+	trace_buf = 0;
+	trace_handles = 0;
+	trace_ids = 0;
+
+	if (trace_failed)
+	{
+		set_errno(ETRACEFILE);
+		return -1;
+	}
+
+	return 0;
+}
+
+#ifdef _WIN32
+
+int trace_replay(const char *file, struct trace_stats_t *stats)
+{
+	// The internals are the real registry here, which a replay would write to
+	set_errno(EINVAL);
+	return -1;
+}
+
+#else
+
+// A key path seen by the trace
+struct trace_path_t
+{
+	wchar_t *path;
+	uint32_t size;	// Bytes
+};
+
+struct trace_replay_t
+{
+	uint8_t *data;
+	uint64_t size;
+
+	// By handle id
+	struct trace_path_t *paths;
+	HANDLE *handles;
+	uint32_t num_ids;
+
+	// Hashes of the folded paths of keys the trace created itself, open addressed
+	uint64_t *created;
+	uint32_t created_size;
+	uint32_t num_created;
+
+	wchar_t *fold;
+	uint32_t fold_max;
+
+	// Zeroed, both the data set and the buffers calls return into
+	uint8_t *buf;
+
+	struct trace_stats_t *stats;
+};
+
+// Read the whole trace and check every record before anything is run
+static int trace_read(struct trace_replay_t *rp, const char *file)
+{
+	FILE *f = fopen(file, "rb");
+	if (!f)
+	{
+		set_errno(EFILE);
+		return -1;
+	}
+
+	int r = 0;
+	long size = 0;
+
+	if (fseek(f, 0, SEEK_END)
+	|| (size = ftell(f)) < 0
+	||  fseek(f, 0, SEEK_SET))
+	{
+		set_errno(EFILE);
+		r = -1;
+	}
+	else if (!(rp->data = malloc(size ? size : 1)))
+	{
+		set_errno(ENOMEM);
+		r = -1;
+	}
+	else if (fread(rp->data, 1, size, f) != (size_t) size)
+	{
+		set_errno(EFILE);
+		r = -1;
+	}
+
+	fclose(f);
+	rp->size = size;
+
+	struct trace_header_t *header = (struct trace_header_t *) rp->data;
+
+	if (!r
+	&& (rp->size < sizeof(struct trace_header_t)
+	||  memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic))
+	||  header->version != TRACE_VERSION))
+	{
+		set_errno(ETRACEFILE);
+		r = -1;
+	}
+
+	uint32_t max_length = 8;
+	uint64_t records = 0;
+
+	for (uint64_t off = sizeof(struct trace_header_t); !r && off < rp->size;)
+	{
+		struct trace_record_t *t = (struct trace_record_t *) &rp->data[off];
+
+		if (rp->size - off < sizeof(struct trace_record_t)
+		||  rp->size - off - sizeof(struct trace_record_t) < TRACE_PAD(t->name_size)
+		|| !t->call
+		||  t->call >= TRACE_CALLS
+		|| (t->name_size & 1)
+		||  t->key >= 0xFFFFFFFF
+		||  t->result >= 0xFFFFFFFF
+		||  t->length > TRACE_MAX_LENGTH
+		||  t->data_size > TRACE_MAX_LENGTH)
+		{
+			set_errno(ETRACEFILE);
+			r = -1;
+			break;
+		}
+
+		if (t->key >= rp->num_ids)
+			rp->num_ids = t->key + 1;
+
+		if (t->result >= rp->num_ids)
+			rp->num_ids = t->result + 1;
+
+		if (t->length > max_length)
+			max_length = t->length;
+
+		if (t->data_size > max_length)
+			max_length = t->data_size;
+
+		off += sizeof(struct trace_record_t) + TRACE_PAD(t->name_size);
+		records++;
+	}
+
+	// Every id is handed out by a record of its own, counting up from 1
+	if (!r && rp->num_ids > records + 1)
+	{
+		set_errno(ETRACEFILE);
+		r = -1;
+	}
+
+	if (!r
+	&& (!(rp->paths = calloc(rp->num_ids + 1, sizeof(struct trace_path_t)))
+	||  !(rp->handles = calloc(rp->num_ids + 1, sizeof(HANDLE)))
+	||  !(rp->buf = calloc(max_length, 1))))
+	{
+		set_errno(ENOMEM);
+		r = -1;
+	}
+
+	return r;
+}
+
+static void trace_replay_free(struct trace_replay_t *rp)
+{
+	for (uint32_t i = 0; rp->paths && i < rp->num_ids; i++)
+		free(rp->paths[i].path);
+
+	for (uint32_t i = 0; rp->handles && i < rp->num_ids; i++)
+		if (rp->handles[i])
+			NtClose(rp->handles[i]);
+
+	free(rp->paths);
+	free(rp->handles);
+	free(rp->created);
+	free(rp->fold);
+	free(rp->buf);
+	free(rp->data);
+}
+
+static inline const wchar_t *trace_name(struct trace_record_t *t)
+{
+	return (const wchar_t *) (t + 1);
+}
+
+static HANDLE trace_predefined_handle(uint32_t arg)
+{
+	for (uint32_t p = 0; p < TRACE_PREDEFINED; p++)
+		if ((uint32_t) (uintptr_t) trace_predefined[p] == arg)
+			return (HANDLE) trace_predefined[p];
+
+	return 0;
+}
+
+// The path of a handle id, which is left unknown if its parent was
+static void trace_set_path(struct trace_replay_t *rp, uint32_t id, uint32_t parent, const wchar_t *name, uint32_t size)
+{
+	struct trace_path_t *p = &rp->paths[id];
+	struct trace_path_t *base = parent ? &rp->paths[parent] : 0;
+
+	free(p->path);
+	p->path = 0;
+	p->size = 0;
+
+	if (base && !base->path)
+		return;
+
+	// Names relative to a key may still start with a separator, which is dropped
+	uint32_t skip = base && size && name[0] == L'\\' ? 2 : 0;
+	uint32_t total = (base ? base->size + (size > skip ? 2 : 0) : 0) + size - skip;
+
+	if (!(p->path = malloc(total + 2)))
+		return;
+
+	uint32_t len = 0;
+	if (base)
+	{
+		memcpy(p->path, base->path, base->size);
+		len = base->size / 2;
+
+		if (size > skip)
+			p->path[len++] = L'\\';
+	}
+
+	memcpy(&p->path[len], (const uint8_t *) name + skip, size - skip);
+	p->size = total;
+}
+
+// The folded path in rp->fold, so that the hashes of its prefixes can be taken in place
+static int trace_fold(struct trace_replay_t *rp, const wchar_t *path, uint32_t size)
+{
+	if (size / 2 > rp->fold_max)
+	{
+		wchar_t *f = realloc(rp->fold, size);
+		if (!f)
+			return -1;
+
+		rp->fold = f;
+		rp->fold_max = size / 2;
+	}
+
+	for (uint32_t i = 0; i < size / 2; i++)
+		rp->fold[i] = (path[i] >= L'a' && path[i] <= L'z') ? path[i] - (L'a' - L'A') : path[i];
+
+	return 0;
+}
+
+static int8_t trace_is_created(struct trace_replay_t *rp, uint64_t hash)
+{
+	if (!rp->created_size)
+		return 0;
+
+	hash |= 1;
+
+	for (uint32_t i = hash & (rp->created_size - 1); rp->created[i]; i = (i + 1) & (rp->created_size - 1))
+		if (rp->created[i] == hash)
+			return 1;
+
+	return 0;
+}
+
+// A key the trace created, and everything under it, did not exist before the trace
+static void trace_add_created(struct trace_replay_t *rp, const wchar_t *path, uint32_t size)
+{
+	if (trace_fold(rp, path, size))
+		return;
+
+	if ((rp->num_created + 1) * 2 > rp->created_size)
+	{
+		uint32_t max = rp->created_size ? rp->created_size * 2 : 64;
+		uint64_t *c = calloc(max, sizeof(uint64_t));
+		if (!c)
+			return;
+
+		for (uint32_t i = 0; i < rp->created_size; i++)
+		{
+			if (rp->created[i])
+			{
+				uint32_t j = rp->created[i] & (max - 1);
+				while (c[j])
+					j = (j + 1) & (max - 1);
+
+				c[j] = rp->created[i];
+			}
+		}
+
+		free(rp->created);
+		rp->created = c;
+		rp->created_size = max;
+	}
+
+	// 0 marks an empty slot
+	uint64_t hash = hash64(rp->fold, size, 0) | 1;
+	if (trace_is_created(rp, hash))
+		return;
+
+	uint32_t i = hash & (rp->created_size - 1);
+	while (rp->created[i])
+		i = (i + 1) & (rp->created_size - 1);
+
+	rp->created[i] = hash;
+	rp->num_created++;
+}
+
+static int8_t trace_under_created(struct trace_replay_t *rp, const wchar_t *path, uint32_t size)
+{
+	if (!rp->num_created || trace_fold(rp, path, size))
+		return 0;
+
+	for (uint32_t i = 1; i <= size / 2; i++)
+		if ((i == size / 2 || rp->fold[i] == L'\\')
+		&&  trace_is_created(rp, hash64(rp->fold, i * 2, 0)))
+			return 1;
+
+	return 0;
+}
+
+static NTSTATUS trace_open(const wchar_t *path, uint32_t size, PHANDLE key)
+{
+	UNICODE_STRING u;
+	u.Length = size;
+	u.MaximumLength = size;
+	u.Buffer = (PWSTR) path;
+
+	OBJECT_ATTRIBUTES attribs = { 0 };
+	attribs.Length = sizeof(OBJECT_ATTRIBUTES);
+	attribs.ObjectName = &u;
+
+	return NtOpenKey(key, KEY_ALL_ACCESS, &attribs);
+}
+
+// Create a key the trace saw, and each of its parents, leaving it open in *key when asked
+static NTSTATUS trace_make(struct trace_replay_t *rp, const wchar_t *path, uint32_t size, PHANDLE key)
+{
+	HANDLE h;
+	NTSTATUS status;
+
+	if (!size)
+		return STATUS_OBJECT_NAME_NOT_FOUND;
+
+	if ((status = trace_open(path, size, &h)) != STATUS_SUCCESS)
+	{
+		UNICODE_STRING u;
+		u.Buffer = (PWSTR) path;
+
+		OBJECT_ATTRIBUTES attribs = { 0 };
+		attribs.Length = sizeof(OBJECT_ATTRIBUTES);
+		attribs.ObjectName = &u;
+
+		// NtCreateKey only creates the last key of a path
+		for (uint32_t end = 1; end <= size / 2; end++)
+		{
+			if (end < size / 2 && path[end] != L'\\')
+				continue;
+
+			ULONG disposition = 0;
+			u.Length = end * 2;
+			u.MaximumLength = end * 2;
+
+			if ((status = NtCreateKey(&h, KEY_ALL_ACCESS, &attribs, 0, 0, REG_OPTION_NON_VOLATILE, &disposition)) != STATUS_SUCCESS)
+				return status;
+
+			if (disposition == REG_CREATED_NEW_KEY)
+				rp->stats->keys++;
+
+			if (end < size / 2)
+				NtClose(h);
+		}
+	}
+
+	if (key)
+		*key = h;
+	else
+		NtClose(h);
+
+	return STATUS_SUCCESS;
+}
+
+static void trace_make_value(struct trace_replay_t *rp, struct trace_path_t *p, struct trace_record_t *t, const wchar_t *name, uint32_t name_size)
+{
+	HANDLE key;
+	if (!p->path || trace_make(rp, p->path, p->size, &key) != STATUS_SUCCESS)
+		return;
+
+	UNICODE_STRING u;
+	u.Length = name_size;
+	u.MaximumLength = name_size;
+	u.Buffer = (PWSTR) name;
+
+	// Only a record that saw the type and size replaces a value that is already there
+	ULONG needed;
+	NTSTATUS status = NtQueryValueKey(key, &u, KeyValueFullInformation, 0, 0, &needed);
+
+	if (status == STATUS_OBJECT_NAME_NOT_FOUND || t->call != TRACE_DELETE_VALUE)
+	{
+		if (status == STATUS_OBJECT_NAME_NOT_FOUND)
+			rp->stats->values++;
+
+		NtSetValueKey(key, &u, 0, t->type, rp->buf, t->data_size);
+	}
+
+	NtClose(key);
+}
+
+// Build the tree the recorded calls found, from everything they saw exist before the trace changed it
+static void trace_populate(struct trace_replay_t *rp)
+{
+	for (uint64_t off = sizeof(struct trace_header_t); off < rp->size;)
+	{
+		struct trace_record_t *t = (struct trace_record_t *) &rp->data[off];
+		off += sizeof(struct trace_record_t) + TRACE_PAD(t->name_size);
+
+		struct trace_path_t *key = &rp->paths[t->key];
+		struct trace_path_t *result = &rp->paths[t->result];
+
+		switch (t->call)
+		{
+			case TRACE_HANDLE:
+				if (t->arg)
+				{
+					uint8_t stack[512];
+					ULONG needed;
+					HANDLE h = trace_predefined_handle(t->arg);
+
+					if (h && NtQueryKey(h, KeyNameInformation, stack, sizeof(stack), &needed) == STATUS_SUCCESS)
+					{
+						PKEY_NAME_INFORMATION info = (PKEY_NAME_INFORMATION) stack;
+						trace_set_path(rp, t->result, 0, info->Name, info->NameLength);
+					}
+				}
+				else if (t->name_size)
+				{
+					trace_set_path(rp, t->result, 0, trace_name(t), t->name_size);
+
+					if (result->path && !trace_under_created(rp, result->path, result->size))
+						trace_make(rp, result->path, result->size, 0);
+				}
+				break;
+			case TRACE_CREATE_KEY:
+			case TRACE_OPEN_KEY:
+				if (t->result)
+				{
+					trace_set_path(rp, t->result, t->key, trace_name(t), t->name_size);
+
+					if (!result->path)
+						break;
+
+					if (t->call == TRACE_CREATE_KEY && t->needed == REG_CREATED_NEW_KEY)
+						trace_add_created(rp, result->path, result->size);
+					else if (!trace_under_created(rp, result->path, result->size))
+						trace_make(rp, result->path, result->size, 0);
+				}
+				break;
+			case TRACE_ENUMERATE_KEY:
+				if (t->status == STATUS_SUCCESS && t->class == KeyBasicInformation && key->path)
+				{
+					// Parked on id 0, which is never a handle
+					trace_set_path(rp, 0, t->key, trace_name(t), t->name_size);
+
+					if (rp->paths[0].path && !trace_under_created(rp, rp->paths[0].path, rp->paths[0].size))
+						trace_make(rp, rp->paths[0].path, rp->paths[0].size, 0);
+
+					free(rp->paths[0].path);
+					rp->paths[0].path = 0;
+				}
+				break;
+			case TRACE_DELETE_KEY:
+				if (t->status == STATUS_SUCCESS && key->path && !trace_under_created(rp, key->path, key->size))
+					trace_make(rp, key->path, key->size, 0);
+				break;
+			case TRACE_QUERY_VALUE:
+				if (t->status == STATUS_SUCCESS || t->status == STATUS_BUFFER_OVERFLOW || t->status == STATUS_BUFFER_TOO_SMALL)
+					trace_make_value(rp, key, t, trace_name(t), t->name_size);
+				break;
+			case TRACE_ENUMERATE_VALUE:
+				if (t->status == STATUS_SUCCESS && t->class == KeyValueFullInformation)
+					trace_make_value(rp, key, t, trace_name(t), t->name_size);
+				break;
+			case TRACE_DELETE_VALUE:
+				if (t->status == STATUS_SUCCESS)
+					trace_make_value(rp, key, t, trace_name(t), t->name_size);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+static void trace_run(struct trace_replay_t *rp)
+{
+	for (uint64_t off = sizeof(struct trace_header_t); off < rp->size;)
+	{
+		struct trace_record_t *t = (struct trace_record_t *) &rp->data[off];
+		off += sizeof(struct trace_record_t) + TRACE_PAD(t->name_size);
+
+		if (t->call == TRACE_HANDLE)
+		{
+			if (t->arg)
+				rp->handles[t->result] = trace_predefined_handle(t->arg);
+			else if (rp->paths[t->result].path
+			&&       trace_open(rp->paths[t->result].path, rp->paths[t->result].size, &rp->handles[t->result]) != STATUS_SUCCESS)
+				rp->handles[t->result] = 0;
+
+			continue;
+		}
+
+		struct trace_call_stats_t *s = &rp->stats->call[t->call];
+		s->calls++;
+		s->recorded += t->time;
+
+		// Calls on a handle the replay could not open are counted, but not made, only keys are opened by a full name without one
+		HANDLE key = rp->handles[t->key];
+		if (!key
+		&& (t->key || (t->call != TRACE_CREATE_KEY && t->call != TRACE_OPEN_KEY)))
+		{
+			s->mismatches++;
+			continue;
+		}
+
+		UNICODE_STRING u;
+		u.Length = t->name_size;
+		u.MaximumLength = t->name_size;
+		u.Buffer = (PWSTR) trace_name(t);
+
+		OBJECT_ATTRIBUTES attribs = { 0 };
+		attribs.Length = sizeof(OBJECT_ATTRIBUTES);
+		attribs.RootDirectory = key;
+		attribs.ObjectName = &u;
+
+		HANDLE h = 0;
+		ULONG needed = 0;
+		NTSTATUS status = STATUS_SUCCESS;
+
+		uint64_t start = thread_now_ns();
+
+		switch (t->call)
+		{
+			case TRACE_CREATE_KEY:
+				status = NtCreateKey(&h, t->arg, &attribs, 0, 0, REG_OPTION_NON_VOLATILE, &needed);
+				break;
+			case TRACE_OPEN_KEY:
+				status = NtOpenKey(&h, t->arg, &attribs);
+				break;
+			case TRACE_SET_VALUE:
+				status = NtSetValueKey(key, &u, 0, t->type, rp->buf, t->length);
+				break;
+			case TRACE_DELETE_KEY:
+				status = NtDeleteKey(key);
+				break;
+			case TRACE_DELETE_VALUE:
+				status = NtDeleteValueKey(key, &u);
+				break;
+			case TRACE_QUERY_KEY:
+				status = NtQueryKey(key, t->class, rp->buf, t->length, &needed);
+				break;
+			case TRACE_ENUMERATE_KEY:
+				status = NtEnumerateKey(key, t->arg, t->class, rp->buf, t->length, &needed);
+				break;
+			case TRACE_QUERY_VALUE:
+				status = NtQueryValueKey(key, &u, t->class, rp->buf, t->length, &needed);
+				break;
+			case TRACE_ENUMERATE_VALUE:
+				status = NtEnumerateValueKey(key, t->arg, t->class, rp->buf, t->length, &needed);
+				break;
+			case TRACE_CLOSE:
+				status = NtClose(key);
+				break;
+		}
+
+		uint64_t end = thread_now_ns();
+		s->replayed += end - start;
+
+		if ((uint32_t) status != t->status)
+			s->mismatches++;
+
+		if (t->call == TRACE_CLOSE)
+			rp->handles[t->key] = 0;
+		else if (t->result && status == STATUS_SUCCESS)
+			rp->handles[t->result] = h;
+	}
+}
+
+int trace_replay(const char *file, struct trace_stats_t *stats)
+{
+	struct trace_replay_t rp;
+	memset(&rp, 0, sizeof(struct trace_replay_t));
+	memset(stats, 0, sizeof(struct trace_stats_t));
+	rp.stats = stats;
+
+	init_ntdll();
+
+	int r = trace_read(&rp, file);
+	if (!r)
+	{
+		trace_populate(&rp);
+
+		// Values are made from the zeroed buffer, which only needs to be zero until now
+		trace_run(&rp);
+
+		for (uint8_t call = 1; call < TRACE_CALLS; call++)
+		{
+			stats->total.calls += stats->call[call].calls;
+			stats->total.mismatches += stats->call[call].mismatches;
+			stats->total.recorded += stats->call[call].recorded;
+			stats->total.replayed += stats->call[call].replayed;
+		}
+	}
+
+	trace_replay_free(&rp);
+
+	return r;
+}
+
+#endif
@@ -21,7 +21,23 @@
 #include <string.h>
 
 #include <error.h>
+#include <invis/allow.h>
+#include <invis/carve.h>
+#include <invis/checkpoint.h>
+#include <invis/codec.h>
+#include <invis/glob.h>
+#include <invis/hash.h>
+#include <invis/hive.h>
+#include <invis/ioc.h>
+#include <invis/ipc.h>
+#include <invis/pipeline.h>
 #include <invis/reg.h>
+#include <invis/regfile.h>
+#include <invis/server.h>
+#include <invis/snapshot.h>
+#include <invis/sweep.h>
+#include <invis/throttle.h>
+#include <invis/trace.h>
 
 // Name of the program if argv[0] fails
 #define NAME "invisreg"
@@ -35,6 +51,19 @@ struct args_t
 	uint8_t delete:1;
 	uint8_t query:1;
 	uint8_t visible:1;
+	uint8_t tree:1;
+	uint8_t export:1;
+	uint8_t import:1;
+	uint8_t snapshot:1;
+	uint8_t load:1;
+	uint8_t invisible:1;
+	uint8_t serve:1;
+	uint8_t offline:1;
+	uint8_t carve:1;
+	uint8_t recover:1;
+	uint8_t replay:1;
+	uint8_t resume:1;
+	uint8_t occupancy:1;
 
 	ULONG type;
 
@@ -43,8 +72,44 @@ struct args_t
 
 	void *value;
 	uint32_t value_size;
+
+	char *file;
+	char *under;
+
+	// Only values whose data is in this set are shown
+	char *ioc_file;
+	struct ioc_t ioc;
+
+	// Values in this list are never shown or written
+	char *allow_file;
+	struct allow_t allow;
+
+	uint32_t threads;
+
+	// p99 enumeration latency in milliseconds and percent of the processors to stay under
+	uint8_t throttle:1;
+	uint32_t ceiling;
+	uint32_t cpu;
+
+	// Pipe or socket to serve on or connect to
+	char *server;
+
+	// Every internals call made is recorded to this file
+	char *trace_file;
+
+	// Where --export and --hive write their progress to, and resume from with --resume
+	char *checkpoint_file;
+	struct checkpoint_t checkpoint;
 };
 
+// Number of operations specified, only a single one is allowed
+static uint8_t operations(struct args_t *args)
+{
+	return args->create + args->edit + args->delete + args->query
+	     + args->export + args->import + args->snapshot + args->load
+	     + args->serve + args->offline + args->carve + args->replay;
+}
+
 void usage(char *name, FILE *f)
 {
 	// Set the name for the usage prompt
@@ -62,9 +127,30 @@ void usage(char *name, FILE *f)
 			"\t--delete,-d\t\tDelete an invisible registry key\n"
 			"\t--query,-q\t\tQuery an invisible registry key\n"
 			"\t--visible,-V\t\tMake the key visible\n"
+			"\t--tree,-y\t\tCreate or delete --key as a key with every key above it, and delete everything under it\n"
 			"\t--type,-t\t\tSpecify the data type of the registry key\n"
 			"\t--key,-k\t\tThe key to create as an invisible key\n"
 			"\t--value,-v\t\tThe data of the specified type to place into the key\n"
+			"\t--export,-x\t\tExport the key and its subkeys to a .reg file, including invisible names\n"
+			"\t--import,-i\t\tImport a .reg file written by --export or regedit\n"
+			"\t--snapshot,-s\t\tWrite the key and its subkeys to a snapshot file\n"
+			"\t--load,-l\t\tQuery a snapshot file, filtered by --type, --invisible and --under\n"
+			"\t--invisible,-I\t\tOnly show values with invisible names\n"
+			"\t--under,-u\t\tOnly show values under a key with this name\n"
+			"\t--hive,-H\t\tQuery a hive file offline, like a --query with wildcards under its root\n"
+			"\t--carve,-R\t\tFind hives in a raw disk or memory image and query them like --hive\n"
+			"\t--ioc,-M\t\tOnly show values of --query, --hive or --carve whose data has a hash in this file\n"
+			"\t--allow,-A\t\tSkip values listed in this file when sweeping with --query, --snapshot, --hive or --carve\n"
+			"\t--recover,-D\t\tAlso recover deleted keys and values from the free space of --hive or --carve\n"
+			"\t--serve,-S\t\tServe --connect requests on a named pipe, or a Unix socket outside of Windows\n"
+			"\t--connect,-C\t\tSend --create/--edit/--delete/--query to a running --serve instead\n"
+			"\t--threads,-T\t\tThreads used to expand wildcards in --key, defaults to one per processor\n"
+			"\t--occupancy,-O\t\tPrint how busy each stage of a --query with wildcards, --hive or --carve was\n"
+			"\t--throttle,-L\t\tKeep enumeration under a p99 latency in ms and a percent of the processors, as ms[:percent]\n"
+			"\t--trace,-E\t\tRecord every registry call made by the operation to a trace file\n"
+			"\t--checkpoint,-K\t\tWrite the progress of --export or --hive to this file every 10 seconds\n"
+			"\t--resume,-U\t\tCarry on from the --checkpoint file, after the output written by then\n"
+			"\t--replay,-P\t\tReplay a trace file against the in-memory registry and time it, outside of Windows\n"
 			"\n"
 			"Only the following hives are supported:\n"
 			" HKLM          = HKEY_LOCAL_MACHINE\n"
@@ -72,20 +158,52 @@ void usage(char *name, FILE *f)
 			" HKCR          = HKEY_CLASSES_ROOT\n"
 			" HKCC          = HKEY_CURRENT_CONFIG\n"
 			" HKU           = HKEY_USERS\n"
-			"Only the following types are currently supported:\n"
-			" REG_NONE      = Value will be ignored, and is the default type\n"
-			" REG_SZ        = Value is expected to be a string\n"
-			" REG_EXPAND_SZ = Value is expected to be a string\n"
-			" REG_DWORD     = Value is expected to be a 32-bit integer\n"
-			" REG_QWORD     = Value is expected to be a 64-bit integer\n"
-			" REG_BINARY    = Value is expected to be the name of a file\n"
-			"                 This file is read into this program and placed into the key\n"
+			"Keys may use * and ? within a name, or ** for any number of keys.\n"
+			"With wildcards, --query and --delete also accept them in the value name, and\n"
+			"match only invisible values unless --visible is given\n"
+			"The following types are supported:\n"
+			" REG_NONE                       = Value will be ignored, and is the default type\n"
+			" REG_SZ                         = Value is expected to be a string\n"
+			" REG_EXPAND_SZ                  = Value is expected to be a string\n"
+			" REG_LINK                       = Value is expected to be a string, stored without a NUL\n"
+			" REG_MULTI_SZ                   = Value is expected to be strings separated by \\0\n"
+			" REG_DWORD                      = Value is expected to be a 32-bit integer, decimal or 0x hex\n"
+			" REG_DWORD_BIG_ENDIAN           = Value is expected to be a 32-bit integer, decimal or 0x hex\n"
+			" REG_QWORD                      = Value is expected to be a 64-bit integer, decimal or 0x hex\n"
+			" REG_BINARY                     = Value is expected to be the name of a file\n"
+			" REG_RESOURCE_LIST              = Value is expected to be the name of a file\n"
+			" REG_FULL_RESOURCE_DESCRIPTOR   = Value is expected to be the name of a file\n"
+			" REG_RESOURCE_REQUIREMENTS_LIST = Value is expected to be the name of a file\n"
+			"                                  This file is read into this program and placed into the key\n"
+			"Queries print binary data as hex bytes, and decode the resource types\n"
 			"\n"
 			"Examples:\n"
 			" " NAME " --key HKLM:\\SOFTWARE\\MICROSOFT\\Windows\\CurrentVersion\\Run\\KeyName --type REG_SZ --create --value \"calc.exe\"\n"
 			" " NAME " --key HKLM:\\SOFTWARE\\MICROSOFT\\Windows\\CurrentVersion\\Run\\KeyName --type REG_DWORD --edit --value 1337\n"
 			" " NAME " --key HKLM:\\SOFTWARE\\MICROSOFT\\Windows\\CurrentVersion\\Run\\KeyName --delete\n"
 			" " NAME " --key HKLM:\\SOFTWARE\\MICROSOFT\\Windows\\CurrentVersion\\Run\\KeyName --query\n"
+			" " NAME " --key HKLM:\\SOFTWARE\\Vendor\\App\\Hidden --create --tree\n"
+			" " NAME " --key HKLM:\\SOFTWARE\\Vendor\\App\\Hidden --delete --tree\n"
+			" " NAME " --key HKLM:\\SOFTWARE\\MICROSOFT\\Windows\\CurrentVersion\\Run --export run.reg\n"
+			" " NAME " --import run.reg\n"
+			" " NAME " --key HKLM:\\SOFTWARE --snapshot host.snap\n"
+			" " NAME " --load host.snap --type REG_SZ --invisible --under Run\n"
+			" " NAME " --hive SOFTWARE\n"
+			" " NAME " --carve disk.img --visible\n"
+			" " NAME " --hive SOFTWARE --recover\n"
+			" " NAME " --key HKLM:\\SOFTWARE\\**\\* --query --ioc bad.txt\n"
+			" " NAME " --key HKLM:\\SOFTWARE --snapshot host.snap --allow benign.txt\n"
+			" " NAME " --serve invisreg\n"
+			" " NAME " --connect invisreg --key HKLM:\\SOFTWARE\\MICROSOFT\\Windows\\CurrentVersion\\Run\\KeyName --query\n"
+			" " NAME " --key HKU:\\*\\SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\Run\\* --query\n"
+			" " NAME " --key HKLM:\\SOFTWARE --snapshot host.snap --throttle 5:25\n"
+			" " NAME " --key HKLM:\\SOFTWARE\\**\\* --query --trace host.trace\n"
+			" " NAME " --replay host.trace\n"
+			" " NAME " --key HKLM:\\SOFTWARE --export software.reg --checkpoint software.ckpt --resume\n"
+			" " NAME " --hive NTUSER.DAT --checkpoint ntuser.ckpt --resume >> ntuser.txt\n"
+			"\n"
+			"Names in exported files escape NUL as \\0 and other control characters as \\xHHHH,\n"
+			"key paths use the same escapes with a doubled backslash\n"
 			,
 			n);
 }
@@ -121,7 +239,7 @@ struct args_t parse_args(int32_t argc, char **argv, int32_t min_args)
 				if      (args.create)
 					set_errno(ETOOMANY);
 				// Only allow a single one of these operations
-				else if (args.edit || args.delete || args.query)
+				else if (operations(&args))
 					set_errno(EMULTIOPS);
 
 				args.create = 1;
@@ -132,7 +250,7 @@ struct args_t parse_args(int32_t argc, char **argv, int32_t min_args)
 				if      (args.edit)
 					set_errno(ETOOMANY);
 				// Only allow a single one of these operations
-				else if (args.create || args.delete || args.query)
+				else if (operations(&args))
 					set_errno(EMULTIOPS);
 
 				args.edit = 1;
@@ -143,7 +261,7 @@ struct args_t parse_args(int32_t argc, char **argv, int32_t min_args)
 				if      (args.delete)
 					set_errno(ETOOMANY);
 				// Only allow a single one of these operations
-				else if (args.create || args.edit || args.query)
+				else if (operations(&args))
 					set_errno(EMULTIOPS);
 
 				args.delete = 1;
@@ -154,11 +272,186 @@ struct args_t parse_args(int32_t argc, char **argv, int32_t min_args)
 				if      (args.query)
 					set_errno(ETOOMANY);
 				// Only allow a single one of these operations
-				else if (args.create || args.edit || args.delete)
+				else if (operations(&args))
 					set_errno(EMULTIOPS);
 
 				args.query = 1;
 			}
+			else if (check_arg("--export", "-x")
+			||       check_arg("--import", "-i")
+			||       check_arg("--snapshot", "-s")
+			||       check_arg("--load", "-l")
+			||       check_arg("--hive", "-H")
+			||       check_arg("--carve", "-R")
+			||       check_arg("--replay", "-P"))
+			{
+				// All of these operations take a file
+				uint8_t export = check_arg("--export", "-x");
+				uint8_t import = check_arg("--import", "-i");
+				uint8_t snapshot = check_arg("--snapshot", "-s");
+				uint8_t offline = check_arg("--hive", "-H");
+				uint8_t carve = check_arg("--carve", "-R");
+				uint8_t replay = check_arg("--replay", "-P");
+				uint8_t load = !export && !import && !snapshot && !offline && !carve && !replay;
+
+				// Only allow a single operation to be specified
+				if      ((export && args.export)
+				||       (import && args.import)
+				||       (snapshot && args.snapshot)
+				||       (offline && args.offline)
+				||       (carve && args.carve)
+				||       (replay && args.replay)
+				||       (load && args.load))
+					set_errno(ETOOMANY);
+				// Only allow a single one of these operations
+				else if (operations(&args))
+					set_errno(EMULTIOPS);
+				// Ensure that the arguments expected value is provided
+				else if (i + 1 < argc)
+					args.file = argv[++i];
+				else
+					set_errno(EMISSINGARGVAL);
+
+				args.export |= export;
+				args.import |= import;
+				args.snapshot |= snapshot;
+				args.load |= load;
+				args.offline |= offline;
+				args.carve |= carve;
+				args.replay |= replay;
+			}
+			else if (check_arg("--invisible", "-I"))
+			{
+				if (args.invisible)
+					set_errno(ETOOMANY);
+
+				args.invisible = 1;
+			}
+			else if (check_arg("--under", "-u"))
+			{
+				// Only allow a single one of these flags
+				if (args.under)
+					set_errno(ETOOMANY);
+				// Ensure that the arguments expected value is provided
+				else if (i + 1 < argc)
+					args.under = argv[++i];
+				else
+					set_errno(EMISSINGARGVAL);
+			}
+			else if (check_arg("--ioc", "-M"))
+			{
+				// Only allow a single one of these flags
+				if (args.ioc_file)
+					set_errno(ETOOMANY);
+				// Ensure that the arguments expected value is provided
+				else if (i + 1 < argc)
+					args.ioc_file = argv[++i];
+				else
+					set_errno(EMISSINGARGVAL);
+			}
+			else if (check_arg("--allow", "-A"))
+			{
+				// Only allow a single one of these flags
+				if (args.allow_file)
+					set_errno(ETOOMANY);
+				// Ensure that the arguments expected value is provided
+				else if (i + 1 < argc)
+					args.allow_file = argv[++i];
+				else
+					set_errno(EMISSINGARGVAL);
+			}
+			else if (check_arg("--trace", "-E"))
+			{
+				// Only allow a single one of these flags
+				if (args.trace_file)
+					set_errno(ETOOMANY);
+				// Ensure that the arguments expected value is provided
+				else if (i + 1 < argc)
+					args.trace_file = argv[++i];
+				else
+					set_errno(EMISSINGARGVAL);
+			}
+			else if (check_arg("--checkpoint", "-K"))
+			{
+				// Only allow a single one of these flags
+				if (args.checkpoint_file)
+					set_errno(ETOOMANY);
+				// Ensure that the arguments expected value is provided
+				else if (i + 1 < argc)
+					args.checkpoint_file = argv[++i];
+				else
+					set_errno(EMISSINGARGVAL);
+			}
+			else if (check_arg("--resume", "-U"))
+			{
+				if (args.resume)
+					set_errno(ETOOMANY);
+
+				args.resume = 1;
+			}
+			else if (check_arg("--serve", "-S")
+			||       check_arg("--connect", "-C"))
+			{
+				uint8_t serve = check_arg("--serve", "-S");
+
+				// Only allow a single one of these flags
+				if (args.server)
+					set_errno(ETOOMANY);
+				// Only allow a single one of these operations
+				else if (serve && operations(&args))
+					set_errno(EMULTIOPS);
+				// Ensure that the arguments expected value is provided
+				else if (i + 1 < argc)
+					args.server = argv[++i];
+				else
+					set_errno(EMISSINGARGVAL);
+
+				args.serve |= serve;
+			}
+			else if (check_arg("--threads", "-T"))
+			{
+				// Only allow a single one of these flags
+				if (args.threads)
+					set_errno(ETOOMANY);
+				// Ensure that the arguments expected value is provided
+				else if (i + 1 < argc)
+				{
+					args.threads = strtoul(argv[++i], 0, 10);
+					if (!args.threads)
+						set_errno(EINVAL);
+				}
+				else
+					set_errno(EMISSINGARGVAL);
+			}
+			else if (check_arg("--occupancy", "-O"))
+			{
+				if (args.occupancy)
+					set_errno(ETOOMANY);
+
+				args.occupancy = 1;
+			}
+			else if (check_arg("--throttle", "-L"))
+			{
+				// Only allow a single one of these flags
+				if (args.throttle)
+					set_errno(ETOOMANY);
+				// Ensure that the arguments expected value is provided
+				else if (i + 1 < argc)
+				{
+					char *end;
+					args.throttle = 1;
+					args.ceiling = strtoul(argv[++i], &end, 10);
+
+					if (*end == ':')
+						args.cpu = strtoul(end + 1, &end, 10);
+
+					// Either of them may be 0, but not both
+					if (*end || (!args.ceiling && !args.cpu) || args.cpu > 100)
+						set_errno(EINVAL);
+				}
+				else
+					set_errno(EMISSINGARGVAL);
+			}
 			else if (check_arg("--visible", "-V"))
 			{
 				if (args.visible)
@@ -166,6 +459,20 @@ struct args_t parse_args(int32_t argc, char **argv, int32_t min_args)
 
 				args.visible = 1;
 			}
+			else if (check_arg("--tree", "-y"))
+			{
+				if (args.tree)
+					set_errno(ETOOMANY);
+
+				args.tree = 1;
+			}
+			else if (check_arg("--recover", "-D"))
+			{
+				if (args.recover)
+					set_errno(ETOOMANY);
+
+				args.recover = 1;
+			}
 			else if (check_arg("--type", "-t"))
 			{
 				// Only allow a single one of these flags
@@ -177,20 +484,7 @@ struct args_t parse_args(int32_t argc, char **argv, int32_t min_args)
 					if (i <= argc + 1)
 					{
 						char *type = argv[++i];
-						if      (!strcmp(type, "REG_NONE"))
-							args.type = REG_NONE;
-						else if (!strcmp(type, "REG_SZ"))
-							args.type = REG_SZ;
-						else if (!strcmp(type, "REG_EXPAND_SZ"))
-							args.type = REG_EXPAND_SZ;
-						else if (!strcmp(type, "REG_DWORD"))
-							args.type = REG_DWORD;
-						else if (!strcmp(type, "REG_QWORD"))
-							args.type = REG_QWORD;
-						else if (!strcmp(type, "REG_BINARY"))
-							args.type = REG_BINARY;
-						else
-							set_errno(ETYPE);
+						codec_type(type, &args.type);
 					}
 					else
 						set_errno(EMISSINGARGVAL);
@@ -208,29 +502,15 @@ struct args_t parse_args(int32_t argc, char **argv, int32_t min_args)
 					{
 						char *key = argv[++i];
 
-						for (char *a = key; (*a) != 0x00; a++)
+						// Only the first ':' separates the hive, the backslash after it is optional
+						char *sep = strchr(key, ':');
+						if (sep)
 						{
-							if (*a == ':')
-							{
-								(*a) = 0x00;
-								args.path = a + 2;
-							}
-						}
+							args.path = sep + 1;
+							if (*args.path == '\\')
+								args.path++;
 
-						// Ensure the key is valid
-						if (args.path)
-						{
-							if      (!strcmp(key, "HKLM"))
-								args.hive = HKEY_LOCAL_MACHINE;
-							else if (!strcmp(key, "HKCU") || !strcmp(key, "HCU"))
-								args.hive = HKEY_CURRENT_USER;
-							else if (!strcmp(key, "HKCR"))
-								args.hive = HKEY_CLASSES_ROOT;
-							else if (!strcmp(key, "HKCC"))
-								args.hive = HKEY_CURRENT_CONFIG;
-							else if (!strcmp(key, "HKU"))
-								args.hive = HKEY_USERS;
-							else
+							if (!(args.hive = reg_hive(key, sep - key)))
 								set_errno(EHIVE);
 						}
 						else
@@ -262,6 +542,100 @@ struct args_t parse_args(int32_t argc, char **argv, int32_t min_args)
 				break;
 		}
 
+		// Only single values are sent to a server
+		if (!errno
+		&&   args.server
+		&&  !args.serve
+		&& (!(args.create || args.edit || args.delete || args.query)
+		||  (args.path && strpbrk(args.path, "*?"))))
+			set_errno(EINVAL);
+
+		// Only a single key is made or removed, and only here
+		if (!errno
+		&&   args.tree
+		&& (!(args.create || args.delete)
+		||    args.server
+		||   (args.path && strpbrk(args.path, "*?"))))
+			set_errno(EINVAL);
+
+		// Only hive files have free space to recover anything from
+		if (!errno
+		&&   args.recover
+		&&  !args.offline
+		&&  !args.carve)
+			set_errno(EINVAL);
+
+		// A replay makes no calls worth recording, and a client sends its calls to the server
+		if (!errno
+		&&   args.trace_file
+		&&  (args.replay || (args.server && !args.serve)))
+			set_errno(EINVAL);
+
+		// Only a single walk that writes as it goes can carry on from where it stopped
+		if (!errno
+		&&   args.checkpoint_file
+		&& ((!args.export && !args.offline) || args.recover))
+			set_errno(EINVAL);
+
+		if (!errno
+		&&   args.resume
+		&&  !args.checkpoint_file)
+			set_errno(EINVAL);
+
+		// Only sweeps that print what they find are staged
+		if (!errno
+		&&   args.occupancy
+		&& ((!args.query && !args.offline && !args.carve) || args.server))
+			set_errno(EINVAL);
+
+		// Resuming the output of --hive means cutting it back, which needs a file rather than a pipe
+		if (!errno
+		&&   args.checkpoint_file
+		&&   args.offline
+		&&   ftell(stdout) < 0)
+			set_errno(EINVAL);
+
+		// The same command with --resume added continues the checkpoint, and nothing else does
+		if (!errno
+		&&   args.checkpoint_file)
+		{
+			uint64_t id = 0;
+			for (int32_t i = 1; i < argc; i++)
+				if (strcmp(argv[i], "--resume") && strcmp(argv[i], "-U"))
+					id = hash64(argv[i], strlen(argv[i]) + 1, id);
+
+			if (!checkpoint_init(&args.checkpoint, args.checkpoint_file, id, CHECKPOINT_INTERVAL)
+			&&   args.resume)
+				checkpoint_load(&args.checkpoint);
+		}
+
+		// Matching needs values that are read, and the set is only loaded once the rest is known to be fine
+		if (!errno
+		&&   args.ioc_file)
+		{
+			if (!args.query && !args.offline && !args.carve)
+				set_errno(EINVAL);
+			else
+				ioc_load(&args.ioc, args.ioc_file);
+		}
+
+		if (!errno
+		&&   args.allow_file)
+		{
+			// A server answers with values that were never walked here, so there is nothing to apply it to
+			if ((!args.query && !args.snapshot && !args.offline && !args.carve)
+			||  (args.server && !args.serve))
+				set_errno(EINVAL);
+			else
+				allow_load(&args.allow, args.allow_file);
+		}
+
+		// Export and snapshot need the key to walk, and a server the value
+		if (!errno
+		&& (args.export || args.snapshot || (args.server && !args.serve))
+		&& !args.path)
+			set_errno(EKEY);
+
 		// Create/edit need type and value
 		if (!errno)
 		{
@@ -270,64 +644,42 @@ struct args_t parse_args(int32_t argc, char **argv, int32_t min_args)
 			{
 				if (value)
 				{
-					switch (args.type)
+					if (codec_file(args.type))
 					{
-						case REG_EXPAND_SZ:
-							/* fall through */
-						case REG_SZ:
-							// * 2 for UTF-16LE
-							args.value_size = strlen(value) * 2;
-							args.value = malloc(args.value_size);
+						FILE *f = fopen(value, "rb");
+						if (f)
+						{
+							fseek(f, 0, SEEK_END);
+							args.value_size = ftell(f);
+							rewind(f);
+							args.value = malloc(args.value_size ? args.value_size : 1);
 
 							if (args.value)
 							{
 								memset(args.value, 0, args.value_size);
-								MultiByteToWideChar(CP_OEMCP, 0, value, -1,
-												   (wchar_t *) args.value,
-												               args.value_size);
+								fread(args.value, 1, args.value_size, f);
 							}
-							break;
-						case REG_DWORD:
-							args.value_size = sizeof(uint32_t);
-							args.value = malloc(args.value_size);
 
-							if (args.value)
-							{
-								memset(args.value, 0, args.value_size);
-								sscanf(value, "%d", (uint32_t *) args.value);
-							}
-							break;
-						case REG_QWORD:
-							args.value_size = sizeof(uint64_t);
-							args.value = malloc(args.value_size);
+							fclose(f);
+						}
+						else
+							set_errno(EFILE);
+					}
+					else
+					{
+						// Sized first, then parsed again into a buffer that fits
+						int64_t size = codec_parse(args.type, value, 0, 0);
+						if (size >= 0)
+						{
+							args.value_size = size;
+							args.value = malloc(size ? size : 1);
 
 							if (args.value)
-							{
-								memset(args.value, 0, args.value_size);
-								sscanf(value, "%ld", (uint64_t *) args.value);
-							}
-							break;
-						case REG_BINARY:
-							FILE *f = fopen(value, "r");
-							if (f)
-							{
-								fseek(f, 0, SEEK_END);
-								args.value_size = ftell(f);
-								rewind(f);
-								args.value = malloc(args.value_size);
-
-								if (args.value)
-								{
-									memset(args.value, 0, args.value_size);
-									fread(args.value, 1, args.value_size, f);
-								}
-
-								fclose(f);
-							}
-							break;
-						default:
-							break;
-					};
+								codec_parse(args.type, value, args.value, size);
+							else
+								set_errno(ENOMEM);
+						}
+					}
 				}
 				else
 					set_errno(ENEEDVAL);
@@ -338,94 +690,1042 @@ struct args_t parse_args(int32_t argc, char **argv, int32_t min_args)
 	return args;
 }
 
-int32_t main(int32_t argc, char **argv)
+// Most values fit on the stack
+#define PRINT_STACK_SIZE 4096
+
+// Text form of data after prefix, or nothing when it's empty
+static void print_data(const char *prefix, ULONG type, const void *data, uint32_t size)
 {
-	int32_t r = 0;
-	struct args_t args = parse_args(argc, argv, 3);
+	char buf[PRINT_STACK_SIZE];
+	char *s = buf;
+	uint64_t max = CODEC_FORMAT_SIZE(size);
 
-	if (!errno)
-	{
-		if (args.help)
-			usage(argv[0], stdout);
+	if (max > sizeof(buf))
+		s = malloc(max);
 
-		uint8_t operation = 0;
+	if (s && codec_format(type, data, size, s, max) > 0)
+		printf("%s%s", prefix, s);
 
-		if (args.create || args.edit)
-			operation |= OPERATION_CREATE;
+	if (s != buf)
+		free(s);
+}
 
-		if (args.delete)
-			operation |= OPERATION_DELETE;
+void print_entry(struct key_data_t *entry)
+{
+	// Escaped the same way as exports, so that hidden names can be rendered
+	print_data("", REG_SZ, entry->name, entry->name_size);
+	printf(":\n");
 
-		if (args.query)
-			operation |= OPERATION_QUERY;
+	printf("\t%s\t", (entry->anomalies & ANOMALY_INVISIBLE) ? "INVISIBLE" : "VISIBLE\t");
 
-		if (args.visible)
-			operation |= MAKE_VISIBLE;
+	// Short names take two tabs to line the values up
+	const char *type = codec_name(entry->type);
+	if (type)
+		printf("%s%s", type, strlen(type) < 8 ? "\t" : "");
+	else
+		printf("hex(%lx)", (unsigned long) entry->type);
 
-		struct key_data_t *key_data = 0;
-		uint64_t num_keys = 0;
-		if (!reg(operation, args.hive, args.path, args.type, args.value, args.value_size, &key_data, &num_keys))
+	print_data("\t", entry->type, entry->value, entry->size);
+	printf("\n");
+
+	if (entry->anomalies)
+	{
+		printf("\tANOMALIES\t");
+		for (uint32_t a = 1, first = 1; a < (1 << ANOMALY_COUNT); a <<= 1)
 		{
-			if (args.query && key_data && num_keys)
+			if (entry->anomalies & a)
 			{
-				for (uint64_t i = 0; i < num_keys; i++)
-				{
-					if (key_data[i].name)
-					{
-						printf("%ls:\n", key_data[i].name);
-						printf("\t%s\t", (key_data[i].invis) ? "INVISIBLE" : "VISIBLE\t");
-						switch (key_data[i].type)
-						{
-							case REG_EXPAND_SZ:
-								printf("REG_EXPAND_SZ\t%ls\n", (wchar_t *) key_data[i].value);
-								break;
-							case REG_SZ:
-								printf("REG_SZ\t\t%ls\n", (wchar_t *) key_data[i].value);
-								break;
-							case REG_DWORD:
-								printf("REG_DWORD\t%d\n", *(uint32_t *) key_data[i].value);
-								break;
-							case REG_QWORD:
-								printf("REG_QWORD\t%ld\n", *(uint64_t *) key_data[i].value);
-								break;
-							case REG_BINARY:
-								printf("REG_BINARY\tTODO\n");
-								break;
-							case REG_NONE:
-								printf("REG_NONE\n");
-								break;
-							default:
-								printf("REG_UNK\n");
-								break;
-						};
-					}
-				}
-
-				free_key_data(key_data, num_keys);
+				printf("%s%s", first ? "" : ",", anomaly_str(a));
+				first = 0;
 			}
-
-			printf("Completed successfully!\n");
 		}
-		else
+		printf("\n");
+	}
+}
+
+// Whether an entry is to be shown, which is every entry without an IOC set
+static uint8_t ioc_filter(const struct ioc_t *ioc, struct key_data_t *entry, struct ioc_match_t *m)
+{
+	m->kind = 0;
+	return !ioc || ioc_match(ioc, entry->value, entry->size, m);
+}
+
+static void print_ioc(const struct ioc_match_t *m)
+{
+	if (m->kind & IOC_SHA256)
+	{
+		printf("\tIOC\t\tSHA256 ");
+		for (uint32_t i = 0; i < SHA256_SIZE; i++)
+			printf("%02x", m->sha256[i]);
+		printf("\n");
+	}
+
+	if (m->kind & IOC_FAST)
+		printf("\tIOC\t\tHASH64 %016llx\n", (unsigned long long) m->fast);
+}
+
+// Sweeps that print are split into stages on threads of their own, unless there is only the one processor
+static uint8_t staged(struct args_t *args)
+{
+	return (args->threads ? args->threads : thread_count()) > 1;
+}
+
+static void print_occupancy(struct pipeline_t *p)
+{
+	struct pipeline_stats_t stats[PIPELINE_STAGES + 1];
+	pipeline_stats(p, stats);
+
+	// A stage whose queue stays full while the one after it starves is the one holding the rest up
+	fprintf(stderr, "%-12s %12s %10s %10s %10s %10s\n", "Stage", "Records", "Queue avg", "Queue peak", "Starved", "Blocked");
+	fprintf(stderr, "%-12s %12llu %10s %10s %10s %10llu\n", stats[0].name,
+			(unsigned long long) stats[0].records, "-", "-", "-", (unsigned long long) stats[0].blocked);
+
+	for (uint32_t i = 1; i <= PIPELINE_STAGES; i++)
+		fprintf(stderr, "%-12s %12llu %8u.%u%% %8u.%u%% %10llu %10llu\n", stats[i].name,
+				(unsigned long long) stats[i].records,
+				stats[i].occupancy / 10, stats[i].occupancy % 10,
+				stats[i].peak / 10, stats[i].peak % 10,
+				(unsigned long long) stats[i].starved, (unsigned long long) stats[i].blocked);
+}
+
+struct glob_ctx_t
+{
+	struct args_t *args;
+	uint8_t operation;
+	const struct ioc_t *ioc;
+	const struct allow_t *allow;
+	struct allow_key_t key;		// Of the values being walked
+
+	// The last segment of the value name, which may be a pattern when querying or deleting
+	wchar_t *name;
+	uint32_t name_size;
+	uint8_t wild;
+
+	// Every value is wanted regardless of its name, and how many were
+	uint8_t every;
+	uint64_t matched;
+
+	// Values to delete, collected first so that deleting doesn't shift the enumeration
+	struct key_data_t *found;
+	uint64_t num_found;
+	uint64_t max_found;
+
+	// Queries are handed to the stages of this instead, when there is more than one processor
+	struct pipeline_t *pipeline;
+};
+
+static void glob_print_key(struct glob_ctx_t *g, const wchar_t *path, uint32_t path_size)
+{
+	char *s = malloc(REG_ESCAPE_SIZE(path_size));
+	if (s)
+	{
+		reg_escape(path, path_size, s, REG_ESCAPE_KEY);
+		printf("[%s%s%s]\n", reg_hive_name(g->args->hive), path_size ? "\\" : "", s);
+		free(s);
+	}
+}
+
+/*
+ * Invisible values are matched on the name after the leading NUL. reg()
+ * names a value by the path of its key and then the last segment, so only
+ * that segment is matched against the pattern, and a name that doesn't
+ * start with the path is only matched when the pattern has wildcards.
+ */
+static uint8_t glob_wanted(struct glob_ctx_t *g, const wchar_t *path, uint32_t path_size, struct key_data_t *entry)
+{
+	if (g->every)
+		return 1;
+
+	uint8_t invisible = (entry->anomalies & ANOMALY_LEADING_NUL) ? 1 : 0;
+	if (invisible == ((g->operation & MAKE_VISIBLE) ? 1 : 0))
+		return 0;
+
+	const wchar_t *name = &entry->name[invisible];
+	uint32_t name_size = entry->name_size - invisible * 2;
+	uint32_t skip = glob_prefix(path, path_size, name, name_size);
+
+	if (!skip && path_size && !g->wild)
+		return 0;
+
+	return glob_match(g->name, g->name_size, &name[skip / 2], name_size - skip);
+}
+
+// The name reg() gives a value in this key, freed by the caller
+static wchar_t *glob_value_name(struct glob_ctx_t *g, const wchar_t *path, uint32_t path_size, uint32_t *size)
+{
+	*size = path_size + 2 + g->name_size;
+
+	wchar_t *name = malloc(*size + 2);
+	if (!name)
+	{
+		set_errno(ENOMEM);
+		return 0;
+	}
+
+	memcpy(name, path, path_size);
+	name[path_size / 2] = L'\\';
+	memcpy(&name[path_size / 2 + 1], g->name, g->name_size);
+	name[*size / 2] = 0;
+
+	return name;
+}
+
+static int glob_value_cb(void *ctx, const wchar_t *path, uint32_t path_size, struct key_data_t *entry)
+{
+	struct glob_ctx_t *g = (struct glob_ctx_t *) ctx;
+
+	if (!entry)
+	{
+		if (g->allow)
+			allow_key(g->allow, g->args->hive, path, path_size, &g->key);
+
+		return 0;
+	}
+
+	if (!glob_wanted(g, path, path_size, entry))
+		return 0;
+
+	g->matched++;
+
+	// Straight from the enumeration buffer, before anything is copied or printed
+	if (g->allow && allow_match(g->allow, &g->key, entry))
+		return 0;
+
+	if ((g->operation & OPERATION_MASK) == OPERATION_QUERY)
+	{
+		struct ioc_match_t m;
+		if (ioc_filter(g->ioc, entry, &m))
 		{
-			r = 1;
-			fprintf(stderr, "Error: %s\n", errorstr(errno));
+			print_entry(entry);
+			print_ioc(&m);
 		}
+
+		return 0;
 	}
-	else
+
+	if (g->num_found == g->max_found)
 	{
-		fprintf(stderr, "Error: %s\n", errorstr(errno));
+		uint64_t max = g->max_found ? g->max_found * 2 : 16;
+		struct key_data_t *f = realloc(g->found, sizeof(struct key_data_t) * max);
+		if (!f)
+		{
+			set_errno(ENOMEM);
+			return -2;
+		}
 
-		if (argv)
-			usage(argv[0], stderr);
-		else
-			usage(0, stderr);
+		g->found = f;
+		g->max_found = max;
+	}
 
-		r = 1;
+	uint8_t invisible = (entry->anomalies & ANOMALY_LEADING_NUL) ? 1 : 0;
+	struct key_data_t *f = &g->found[g->num_found];
+	memset(f, 0, sizeof(struct key_data_t));
+	f->name_size = entry->name_size - invisible * 2;
+
+	if (!(f->name = malloc(f->name_size + 2)))
+	{
+		set_errno(ENOMEM);
+		return -2;
 	}
 
-	if (args.value)
-		free(args.value);
+	memcpy(f->name, &entry->name[invisible], f->name_size);
+	f->name[f->name_size / 2] = 0;
+	g->num_found++;
+
+	return 0;
+}
+
+static int glob_decode_cb(void *ctx, struct pipeline_item_t *item)
+{
+	struct glob_ctx_t *g = (struct glob_ctx_t *) ctx;
+
+	if (item->kind == PIPELINE_KEY)
+		return 1;
+
+	item->entry.anomalies = classify_name(item->entry.name, item->entry.name_size);
+
+	return glob_wanted(g, item->path, item->path_size, &item->entry);
+}
+
+static int glob_filter_cb(void *ctx, struct pipeline_item_t *item)
+{
+	struct glob_ctx_t *g = (struct glob_ctx_t *) ctx;
+
+	if (item->kind == PIPELINE_KEY)
+	{
+		if (g->allow)
+			allow_key(g->allow, g->args->hive, item->path, item->path_size, &g->key);
+
+		return 1;
+	}
+
+	if (g->allow && allow_match(g->allow, &g->key, &item->entry))
+		return 0;
+
+	return ioc_filter(g->ioc, &item->entry, &item->ioc);
+}
+
+static int glob_format_cb(void *ctx, struct pipeline_item_t *item)
+{
+	struct glob_ctx_t *g = (struct glob_ctx_t *) ctx;
+
+	if (item->kind == PIPELINE_KEY)
+		glob_print_key(g, item->path, item->path_size);
+	else
+	{
+		print_entry(&item->entry);
+		print_ioc(&item->ioc);
+	}
+
+	return 0;
+}
+
+static int glob_key_cb(void *ctx, HANDLE key, const wchar_t *path, uint32_t path_size)
+{
+	struct glob_ctx_t *g = (struct glob_ctx_t *) ctx;
+	struct args_t *args = g->args;
+	int r = 0;
+
+	// Enumeration only copies the raw values into the pipeline, its stages do the rest
+	if (g->pipeline)
+		return sweep_key(key, path, path_size, SWEEP_RAW, pipeline_sweep_cb, g->pipeline);
+
+	glob_print_key(g, path, path_size);
+
+	uint32_t name_size = 0;
+	wchar_t *name = 0;
+
+	switch (g->operation & OPERATION_MASK)
+	{
+		case OPERATION_CREATE:
+			if (!(name = glob_value_name(g, path, path_size, &name_size)))
+				r = -2;
+			else
+				r = reg_at(g->operation, key, name, name_size, args->type, args->value, args->value_size, 0, 0);
+
+			break;
+		case OPERATION_DELETE:
+			if (!g->wild)
+			{
+				if (!(name = glob_value_name(g, path, path_size, &name_size)))
+					r = -2;
+				else
+					r = reg_at(g->operation, key, name, name_size, 0, 0, 0, 0, 0);
+
+				// Not every matching key has the value
+				if (r && errno == EREGUNAVAIL)
+					r = 0;
+
+				break;
+			}
+			/* fall through */
+		case OPERATION_QUERY:
+			r = sweep_key(key, path, path_size, 0, glob_value_cb, g);
+
+			for (uint64_t i = 0; !r && i < g->num_found; i++)
+				r = reg_at(g->operation, key, g->found[i].name, g->found[i].name_size, 0, 0, 0, 0, 0);
+
+			free_key_data(g->found, g->num_found);
+			g->found = 0;
+			g->num_found = 0;
+			g->max_found = 0;
+			break;
+		default:
+			break;
+	};
+
+	if (name)
+		free(name);
+
+	return r;
+}
+
+// Run the operation on every key matching a --key with wildcards
+int glob_reg(struct args_t *args, uint8_t operation)
+{
+	int r = 0;
+
+	struct glob_ctx_t g;
+	memset(&g, 0, sizeof(struct glob_ctx_t));
+	g.args = args;
+	g.operation = operation;
+	g.ioc = args->ioc_file ? &args->ioc : 0;
+	g.allow = args->allow_file && (operation & OPERATION_MASK) == OPERATION_QUERY ? &args->allow : 0;
+
+	// The last segment is the name of the value
+	char *name = strrchr(args->path, '\\');
+	char *pattern = "";
+
+	if (name)
+	{
+		*name = 0;
+		pattern = args->path;
+		name++;
+	}
+	else
+		name = args->path;
+
+	g.wild = strpbrk(name, "*?") ? 1 : 0;
+
+	// Values can only be created with a real name
+	if (g.wild && (operation & OPERATION_MASK) == OPERATION_CREATE)
+	{
+		set_errno(EKEY);
+		r = -1;
+	}
+
+	// *2 here for UTF-16LE
+	uint32_t name_max = strlen(name) + 1;
+	if (!r && !(g.name = malloc(name_max * 2)))
+	{
+		set_errno(ENOMEM);
+		r = -2;
+	}
+
+	if (!r)
+	{
+		g.name_size = (MultiByteToWideChar(CP_OEMCP, 0, name, -1, g.name, name_max) - 1) * 2;
+
+		ACCESS_MASK access = KEY_READ;
+		if ((operation & OPERATION_MASK) != OPERATION_QUERY)
+			access |= KEY_SET_VALUE;
+
+		struct pipeline_stage_t stages[PIPELINE_STAGES] =
+		{
+			{ "Decode", glob_decode_cb, &g },
+			{ "Filter", glob_filter_cb, &g },
+			{ "Format", glob_format_cb, &g },
+		};
+
+		struct pipeline_t pipeline;
+		if ((operation & OPERATION_MASK) == OPERATION_QUERY
+		&&   staged(args)
+		&& !(r = pipeline_start(&pipeline, stages)))
+			g.pipeline = &pipeline;
+
+		if (!r)
+			r = glob_keys(args->hive, pattern, access, args->threads, glob_key_cb, &g);
+
+		// A stage that failed stopped the enumeration, and has the error that did it
+		if (g.pipeline)
+		{
+			int f = pipeline_finish(&pipeline);
+			if (f)
+				r = f;
+
+			if (args->occupancy)
+				print_occupancy(&pipeline);
+		}
+	}
+
+	if (g.name)
+		free(g.name);
+
+	return r;
+}
+
+/*
+ * A --query without wildcards that has to be filtered, walked like glob_reg
+ * so that the data is matched straight from the enumeration buffer rather
+ * than after reg() has copied every value. The value is looked for by the
+ * same name reg() gives it, the whole path, and like reg() a path that
+ * isn't a value lists every value of the key at that path instead.
+ */
+int filter_reg(struct args_t *args, uint8_t operation)
+{
+	int r = 0;
+
+	struct glob_ctx_t g;
+	memset(&g, 0, sizeof(struct glob_ctx_t));
+	g.args = args;
+	g.operation = operation;
+	g.ioc = args->ioc_file ? &args->ioc : 0;
+	g.allow = args->allow_file ? &args->allow : 0;
+
+	// The value is in the key before the last segment, a key directly under the hive is only listed
+	char *name = strrchr(args->path, '\\');
+	if (name)
+	{
+		// *2 here for UTF-16LE
+		uint32_t name_max = strlen(name + 1) + 1;
+		if (!(g.name = malloc(name_max * 2)))
+		{
+			set_errno(ENOMEM);
+			return -2;
+		}
+
+		g.name_size = (MultiByteToWideChar(CP_OEMCP, 0, name + 1, -1, g.name, name_max) - 1) * 2;
+
+		*name = 0;
+		r = sweep(args->hive, args->path, 0, glob_value_cb, &g);
+		*name = '\\';
+	}
+
+	if (!r && !g.matched)
+	{
+		g.every = 1;
+
+		// Neither a value nor a key, which reg() reports as a missing value
+		if ((r = sweep(args->hive, args->path, 0, glob_value_cb, &g)) && errno == EOPENKEY)
+			set_errno(EREGUNAVAIL);
+	}
+
+	if (g.name)
+		free(g.name);
+
+	return r;
+}
+
+struct snapshot_ctx_t
+{
+	struct snapshot_writer_t w;
+	HKEY hive;
+	const struct allow_t *allow;
+	struct allow_key_t key;
+};
+
+static int snapshot_cb(void *ctx, const wchar_t *path, uint32_t path_size, struct key_data_t *entry)
+{
+	struct snapshot_ctx_t *s = (struct snapshot_ctx_t *) ctx;
+
+	if (!entry)
+	{
+		if (s->allow)
+			allow_key(s->allow, s->hive, path, path_size, &s->key);
+
+		return snapshot_key(&s->w, s->hive, path, path_size);
+	}
+
+	if (s->allow && allow_match(s->allow, &s->key, entry))
+		return 0;
+
+	return snapshot_value(&s->w, entry);
+}
+
+int write_snapshot(struct args_t *args)
+{
+	struct snapshot_ctx_t s;
+	s.hive = args->hive;
+	s.allow = args->allow_file ? &args->allow : 0;
+
+	int r = snapshot_init(&s.w);
+	if (!r)
+		r = sweep(args->hive, args->path, SWEEP_RECURSIVE, snapshot_cb, &s);
+
+	if (!r)
+	{
+		char host[MAX_COMPUTERNAME_LENGTH + 1] = { 0 };
+		DWORD host_len = sizeof(host);
+		GetComputerNameA(host, &host_len);
+
+		FILE *f = fopen(args->file, "wb");
+		if (f)
+		{
+			r = snapshot_write(&s.w, f, host);
+			fclose(f);
+		}
+		else
+		{
+			set_errno(EFILE);
+			r = -1;
+		}
+	}
+
+	snapshot_free(&s.w);
+
+	return r;
+}
+
+struct load_ctx_t
+{
+	uint32_t path;
+};
+
+static int load_cb(void *ctx, struct snapshot_t *snap, uint64_t row)
+{
+	struct load_ctx_t *l = (struct load_ctx_t *) ctx;
+
+	// Rows are grouped by key, so only print the key when it changes
+	if (snap->row_paths[row] != l->path)
+	{
+		uint32_t size;
+		const wchar_t *path = snapshot_path(snap, row, &size);
+
+		char *s = malloc(REG_ESCAPE_SIZE(size));
+		if (s)
+		{
+			reg_escape(path, size, s, REG_ESCAPE_KEY);
+			printf("[%s]\n", s);
+			free(s);
+		}
+
+		l->path = snap->row_paths[row];
+	}
+
+	struct key_data_t entry;
+	entry.type = snap->types[row];
+	entry.name = (wchar_t *) snapshot_name(snap, row, &entry.name_size);
+	entry.value = (void *) snapshot_data(snap, row, &entry.size);
+	entry.anomalies = snap->anomalies[row];
+
+	print_entry(&entry);
+
+	return 0;
+}
+
+int load_snapshot(struct args_t *args)
+{
+	struct snapshot_t snap;
+
+	int r = snapshot_map(&snap, args->file);
+	if (!r)
+	{
+		struct snapshot_filter_t filter;
+		filter.type = args->type ? args->type : SNAPSHOT_ANY_TYPE;
+		filter.anomalies = args->invisible ? ANOMALY_INVISIBLE : 0;
+		filter.under = args->under;
+
+		struct load_ctx_t l = { 0xFFFFFFFF };
+		r = snapshot_query(&snap, &filter, load_cb, &l);
+
+		snapshot_unmap(&snap);
+	}
+
+	return r;
+}
+
+struct offline_ctx_t
+{
+	uint8_t visible;	// Show every value rather than only invisible ones
+	uint8_t printed;	// The key of the values being walked has been printed
+	const struct ioc_t *ioc;
+	const struct allow_t *allow;
+	struct allow_key_t key;
+};
+
+// Anomalies of the name of the key at the end of a path
+static uint32_t offline_classify_key(const wchar_t *path, uint32_t path_size)
+{
+	uint32_t name = path_size / 2;
+	while (name && path[name - 1] != L'\\')
+		name--;
+
+	return classify_name(&path[name], path_size - name * 2);
+}
+
+static void offline_key(struct offline_ctx_t *o, const wchar_t *path, uint32_t path_size)
+{
+	char *s = malloc(REG_ESCAPE_SIZE(path_size));
+	if (s)
+	{
+		reg_escape(path, path_size, s, REG_ESCAPE_KEY);
+		printf("[%s]\n", s);
+		free(s);
+	}
+
+	o->printed = 1;
+}
+
+// Print what a --query with wildcards would: invisible values unless --visible is given
+static int offline_cb(void *ctx, const wchar_t *path, uint32_t path_size, struct key_data_t *entry)
+{
+	struct offline_ctx_t *o = (struct offline_ctx_t *) ctx;
+
+	if (!entry)
+	{
+		o->printed = 0;
+
+		if (o->allow)
+			allow_key(o->allow, 0, path, path_size, &o->key);
+
+		// A key with an invisible name is worth showing even without values, unless only values matching an IOC are wanted
+		if (!o->ioc && offline_classify_key(path, path_size) & ANOMALY_INVISIBLE)
+			offline_key(o, path, path_size);
+
+		return 0;
+	}
+
+	struct ioc_match_t m;
+	if ((!o->visible && !(entry->anomalies & ANOMALY_INVISIBLE))
+	||  (o->allow && allow_match(o->allow, &o->key, entry))
+	||  !ioc_filter(o->ioc, entry, &m))
+		return 0;
+
+	if (!o->printed)
+		offline_key(o, path, path_size);
+
+	print_entry(entry);
+	print_ioc(&m);
+
+	return 0;
+}
+
+// offline_cb() split into the stages of a pipeline, values come from the hive already classified
+static int offline_decode_cb(void *ctx, struct pipeline_item_t *item)
+{
+	struct offline_ctx_t *o = (struct offline_ctx_t *) ctx;
+
+	if (item->kind == PIPELINE_KEY)
+	{
+		item->entry.anomalies = offline_classify_key(item->path, item->path_size);
+		return 1;
+	}
+
+	return o->visible || (item->entry.anomalies & ANOMALY_INVISIBLE);
+}
+
+static int offline_filter_cb(void *ctx, struct pipeline_item_t *item)
+{
+	struct offline_ctx_t *o = (struct offline_ctx_t *) ctx;
+
+	if (item->kind == PIPELINE_KEY)
+	{
+		if (o->allow)
+			allow_key(o->allow, 0, item->path, item->path_size, &o->key);
+
+		return 1;
+	}
+
+	if (o->allow && allow_match(o->allow, &o->key, &item->entry))
+		return 0;
+
+	return ioc_filter(o->ioc, &item->entry, &item->ioc);
+}
+
+static int offline_format_cb(void *ctx, struct pipeline_item_t *item)
+{
+	struct offline_ctx_t *o = (struct offline_ctx_t *) ctx;
+
+	if (item->kind == PIPELINE_KEY)
+	{
+		o->printed = 0;
+
+		if (!o->ioc && item->entry.anomalies & ANOMALY_INVISIBLE)
+			offline_key(o, item->path, item->path_size);
+
+		return 0;
+	}
+
+	if (!o->printed)
+		offline_key(o, item->path, item->path_size);
+
+	print_entry(&item->entry);
+	print_ioc(&item->ioc);
+
+	return 0;
+}
+
+// Deleted keys are shown by their invisible names, values like offline_cb() would
+static int slack_cb(void *ctx, struct hive_slack_t *found)
+{
+	struct offline_ctx_t *o = (struct offline_ctx_t *) ctx;
+
+	if (!o->visible && !(found->entry.anomalies & ANOMALY_INVISIBLE))
+		return 0;
+
+	struct ioc_match_t m = { 0 };
+	if (found->key ? !!o->ioc : !ioc_filter(o->ioc, &found->entry, &m))
+		return 0;
+
+	if (found->key)
+	{
+		printf("Deleted key at 0x%x ", found->offset);
+		offline_key(o, found->path, found->path_size);
+	}
+	else
+	{
+		printf("Deleted value at 0x%x%s\n", found->offset, found->intact ? "" : ", data overwritten");
+		print_entry(&found->entry);
+		print_ioc(&m);
+	}
+
+	return 0;
+}
+
+static int offline_flush(void *ctx, uint64_t *offset)
+{
+	return checkpoint_offset(stdout, offset);
+}
+
+static int offline_sweep(struct args_t *args, struct hive_t *h)
+{
+	struct offline_ctx_t o;
+	memset(&o, 0, sizeof(struct offline_ctx_t));
+	o.visible = args->visible;
+	o.ioc = args->ioc_file ? &args->ioc : 0;
+	o.allow = args->allow_file ? &args->allow : 0;
+
+	int r = 0;
+	struct checkpoint_t *cp = args->checkpoint_file ? &args->checkpoint : 0;
+	if (cp)
+	{
+		cp->flush = offline_flush;
+
+		// Anything printed after the checkpoint is printed again
+		if (cp->state && checkpoint_truncate(stdout, cp->offset))
+		{
+			set_errno(ECHECKPOINT);
+			return -1;
+		}
+	}
+
+	// Output of a checkpointed sweep has to be written by the time each checkpoint is
+	if (cp || !staged(args))
+		r = hive_sweep_checkpoint(h, offline_cb, &o, cp);
+	else
+	{
+		struct pipeline_stage_t stages[PIPELINE_STAGES] =
+		{
+			{ "Decode", offline_decode_cb, &o },
+			{ "Filter", offline_filter_cb, &o },
+			{ "Format", offline_format_cb, &o },
+		};
+
+		struct pipeline_t pipeline;
+		if (!(r = pipeline_start(&pipeline, stages)))
+		{
+			r = hive_sweep(h, pipeline_sweep_cb, &pipeline);
+
+			int f = pipeline_finish(&pipeline);
+			if (f)
+				r = f;
+
+			if (args->occupancy)
+				print_occupancy(&pipeline);
+		}
+	}
+
+	if (!r && args->recover)
+		r = hive_slack(h, slack_cb, &o);
+
+	return r;
+}
+
+int read_hive(struct args_t *args)
+{
+	struct hive_t h;
+
+	int r = hive_open(&h, args->file);
+	if (!r)
+	{
+		r = offline_sweep(args, &h);
+
+		hive_close(&h);
+	}
+
+	return r;
+}
+
+static int carve_cb(void *ctx, struct carve_hive_t *info, struct hive_t *hive)
+{
+	struct args_t *args = (struct args_t *) ctx;
+
+	printf("Hive at 0x%llx", (unsigned long long) info->offset);
+	if (info->base)
+	{
+		uint32_t len = 0;
+		while (len < 32 && info->name[len])
+			len++;
+
+		// A file name, so only printable characters are worth showing
+		printf(" (");
+		for (uint32_t i = 0; i < len; i++)
+			putchar(info->name[i] >= 0x20 && info->name[i] < 0x7F ? info->name[i] : '?');
+		printf(")");
+	}
+	else
+		printf(" (no base block)");
+
+	printf(", %u fragments, %llu of %llu bytes missing\n",
+		   info->fragments, (unsigned long long) info->missing, (unsigned long long) info->size);
+
+	return offline_sweep(args, hive);
+}
+
+int carve(struct args_t *args)
+{
+	return carve_image(args->file, carve_cb, args);
+}
+
+static void print_replay(const char *name, struct trace_call_stats_t *s)
+{
+	printf("%-20s %10llu %10llu %12.3f %12.3f\n", name,
+		   (unsigned long long) s->calls, (unsigned long long) s->mismatches,
+		   s->recorded / 1e6, s->replayed / 1e6);
+}
+
+int replay(struct args_t *args)
+{
+	struct trace_stats_t stats;
+	if (trace_replay(args->file, &stats))
+		return -1;
+
+	printf("Created %llu keys and %llu values the trace saw\n",
+		   (unsigned long long) stats.keys, (unsigned long long) stats.values);
+	printf("%-20s %10s %10s %12s %12s\n", "Call", "Calls", "Mismatched", "Recorded ms", "Replayed ms");
+
+	for (uint8_t call = 1; call < TRACE_CALLS; call++)
+		if (stats.call[call].calls)
+			print_replay(trace_call_name(call), &stats.call[call]);
+
+	print_replay("Total", &stats.total);
+
+	return 0;
+}
+
+int32_t main(int32_t argc, char **argv)
+{
+	int32_t r = 0;
+	struct args_t args = parse_args(argc, argv, 2);
+
+	if (!errno)
+	{
+		if (args.help)
+			usage(argv[0], stdout);
+
+		uint8_t operation = 0;
+
+		if (args.create || args.edit)
+			operation |= OPERATION_CREATE;
+
+		if (args.delete)
+			operation |= OPERATION_DELETE;
+
+		if (args.query)
+			operation |= OPERATION_QUERY;
+
+		if (args.visible)
+			operation |= MAKE_VISIBLE;
+
+		if (args.tree)
+			operation |= MAKE_KEY;
+
+		struct key_data_t *key_data = 0;
+		uint64_t num_keys = 0;
+		uint64_t line = 0;
+		int status = 0;
+
+		// Already validated by parse_args()
+		if (args.throttle)
+			throttle_init(args.ceiling * 1000, args.cpu, args.threads);
+
+		if (args.trace_file)
+			status = trace_start(args.trace_file);
+
+		if (status)
+			;
+		else if (args.serve)
+			status = server_run(args.server);
+		else if (args.server)
+		{
+			struct ipc_t c;
+			if (!(status = ipc_connect(&c, args.server)))
+			{
+				status = ipc_reg(&c, operation, args.hive, args.path, args.type, args.value, args.value_size, &key_data, &num_keys);
+				ipc_close(&c);
+			}
+		}
+		else if (args.snapshot)
+			status = write_snapshot(&args);
+		else if (args.load)
+			status = load_snapshot(&args);
+		else if (args.offline)
+			status = read_hive(&args);
+		else if (args.carve)
+			status = carve(&args);
+		else if (args.replay)
+			status = replay(&args);
+		else if (args.export || args.import)
+		{
+			// A resumed export is cut back to the checkpoint and carries on from there
+			FILE *f = 0;
+			if (args.resume)
+				f = fopen(args.file, "r+b");
+
+			if (!f)
+				f = fopen(args.file, args.export ? "wb" : "rb");
+
+			if (f)
+			{
+				if (args.resume && checkpoint_truncate(f, args.checkpoint.offset))
+				{
+					set_errno(ECHECKPOINT);
+					status = -1;
+				}
+				else if (args.export)
+					status = reg_export(args.hive, args.path, f, args.checkpoint_file ? &args.checkpoint : 0);
+				else
+					status = reg_import(f, &line);
+
+				fclose(f);
+			}
+			else
+			{
+				set_errno(EFILE);
+				status = -1;
+			}
+		}
+		else if (args.path && strpbrk(args.path, "*?"))
+			status = glob_reg(&args, operation);
+		else if (args.query && (args.ioc_file || args.allow_file))
+			status = filter_reg(&args, operation);
+		else
+			status = reg(operation, args.hive, args.path, args.type, args.value, args.value_size, &key_data, &num_keys);
+
+		// A trace that could not be written fails the operation, unless it already had
+		if (trace_stop() && !status)
+			status = -1;
+
+		// Finished, so there is nothing left to resume
+		if (!status && args.checkpoint_file)
+			status = checkpoint_done(&args.checkpoint);
+
+		if (!status)
+		{
+			if (args.query && key_data && num_keys)
+			{
+				for (uint64_t i = 0; i < num_keys; i++)
+				{
+					struct ioc_match_t m;
+					if (key_data[i].name && ioc_filter(args.ioc_file ? &args.ioc : 0, &key_data[i], &m))
+					{
+						print_entry(&key_data[i]);
+						print_ioc(&m);
+					}
+				}
+
+				free_key_data(key_data, num_keys);
+			}
+
+			printf("Completed successfully!\n");
+		}
+		else
+		{
+			r = 1;
+			if (line)
+				fprintf(stderr, "Error on line %llu: %s\n", (unsigned long long) line, errorstr(errno));
+			else
+				fprintf(stderr, "Error: %s\n", errorstr(errno));
+		}
+	}
+	else
+	{
+		fprintf(stderr, "Error: %s\n", errorstr(errno));
+
+		if (argv)
+			usage(argv[0], stderr);
+		else
+			usage(0, stderr);
+
+		r = 1;
+	}
+
+	if (args.value)
+		free(args.value);
+
+	ioc_free(&args.ioc);
+	allow_free(&args.allow);
+	checkpoint_free(&args.checkpoint);
 
 	return r;
 }
@@ -0,0 +1,83 @@
+#!/bin/sh
+# invisreg - suite of utilities for hiding registry keys
+# Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+# Runs --connect against a --serve of the in-memory registry, as in: sh test/ipc.sh ./invisreg-linux
+
+BIN=${1:-./invisreg-linux}
+DIR=$(mktemp -d)
+SOCK="$DIR/invisreg.sock"
+PID=
+
+trap '[ -n "$PID" ] && kill $PID 2>/dev/null; rm -rf "$DIR"' EXIT
+
+fail()
+{
+	echo "FAIL: $1"
+	exit 1
+}
+
+# Run the client and check that its output contains the given text
+expect()
+{
+	want="$1"
+	shift
+
+	out=$("$BIN" --connect "$SOCK" "$@" 2>&1)
+	case "$out" in
+		*"$want"*) ;;
+		*) fail "$* printed '$out', expected '$want'" ;;
+	esac
+}
+
+"$BIN" --serve "$SOCK" &
+PID=$!
+
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do
+	[ -S "$SOCK" ] && break
+	sleep 0.1
+done
+
+[ -S "$SOCK" ] || fail "the server never created $SOCK"
+
+# A second server must not take over the socket, nor may anything else be replaced
+"$BIN" --serve "$SOCK" >/dev/null 2>&1 && fail "a second server took over $SOCK"
+touch "$DIR/file"
+"$BIN" --serve "$DIR/file" >/dev/null 2>&1 && fail "the server replaced a regular file"
+[ -f "$DIR/file" ] || fail "the server removed a regular file"
+
+expect "Completed successfully!" --key 'HKLM:\SOFTWARE\Run' --type REG_SZ --create --value calc.exe
+expect "Completed successfully!" --key 'HKLM:\SOFTWARE\Count' --type REG_DWORD --create --value 1337
+
+expect "REG_SZ		calc.exe" --key 'HKLM:\SOFTWARE\Run' --query
+expect "REG_DWORD	1337" --key 'HKLM:\SOFTWARE' --query
+expect "INVISIBLE" --key 'HKLM:\SOFTWARE\Run' --query
+
+# Named by the whole path, as a local --create names it
+expect '\0SOFTWARE\\Run:' --key 'HKLM:\SOFTWARE\Run' --query
+
+expect "Completed successfully!" --key 'HKLM:\SOFTWARE\Count' --type REG_DWORD --edit --value 7
+expect "REG_DWORD	7" --key 'HKLM:\SOFTWARE\Count' --query
+
+expect "Completed successfully!" --key 'HKLM:\SOFTWARE\Run' --delete
+expect "Error" --key 'HKLM:\SOFTWARE\Run' --query
+
+out=$("$BIN" --connect "$SOCK" --key 'HKLM:\SOFTWARE' --query 2>&1)
+case "$out" in
+	*calc.exe*) fail "the deleted value is still listed" ;;
+esac
+
+echo "PASS: ipc"
@@ -0,0 +1,172 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Pushes records of random sizes through a small ring from one thread to
+ * another, so that the positions wrap around the buffer thousands of times
+ * and records regularly land right against its end, and checks every byte
+ * of every record on the way out.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <invis/ring.h>
+#include <invis/thread.h>
+
+#define RING_SIZE	4096
+#define RECORDS		1000000
+
+struct ring_test_t
+{
+	struct ring_t ring;
+	uint64_t records;
+	uint64_t bad;
+};
+
+// Both sides draw the same sizes from the same seed
+static uint32_t next_random(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return *state >> 32;
+}
+
+// Mostly small records, with empty ones and ones as large as the ring allows mixed in
+static uint32_t next_size(uint64_t *state, uint32_t max)
+{
+	uint32_t x = next_random(state);
+
+	switch (x & 15)
+	{
+		case 0:
+			return 0;
+		case 1:
+			return max;
+		case 2:
+		case 3:
+			return (x >> 4) % (max + 1);
+		default:
+			return (x >> 4) % 64;
+	}
+}
+
+static uint8_t pattern(uint64_t record, uint32_t offset)
+{
+	return (uint8_t) (record * 31 + offset);
+}
+
+static void consumer(void *arg)
+{
+	struct ring_test_t *t = (struct ring_test_t *) arg;
+	uint32_t max = ring_max_record(&t->ring);
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+	uint8_t *p;
+	uint32_t size;
+	while ((p = ring_peek(&t->ring, &size)))
+	{
+		uint32_t want = next_size(&state, max);
+		if (size != want)
+			t->bad++;
+		else
+		{
+			for (uint32_t i = 0; i < size; i++)
+			{
+				if (p[i] != pattern(t->records, i))
+				{
+					t->bad++;
+					break;
+				}
+			}
+		}
+
+		ring_release(&t->ring);
+		t->records++;
+	}
+}
+
+int main(void)
+{
+	struct ring_test_t t;
+	memset(&t, 0, sizeof(struct ring_test_t));
+
+	if (ring_init(&t.ring, RING_SIZE))
+	{
+		printf("FAIL: ring, could not allocate the ring\n");
+		return 1;
+	}
+
+	uint32_t max = ring_max_record(&t.ring);
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+	uint64_t bytes = 0;
+
+	struct thread_t thread;
+	if (thread_start(&thread, consumer, &t))
+	{
+		printf("FAIL: ring, could not start the consumer\n");
+		return 1;
+	}
+
+	uint64_t start = thread_now();
+
+	for (uint64_t i = 0; i < RECORDS; i++)
+	{
+		uint32_t size = next_size(&state, max);
+		uint8_t *p = ring_reserve(&t.ring, size);
+
+		for (uint32_t j = 0; j < size; j++)
+			p[j] = pattern(i, j);
+
+		ring_commit(&t.ring);
+		bytes += size;
+	}
+
+	ring_close(&t.ring);
+	thread_join(&thread);
+
+	uint64_t elapsed = thread_now() - start;
+
+	printf("records=%llu bytes=%llu laps=%llu elapsed=%llums blocked=%llu starved=%llu occupancy=%u peak=%u\n",
+		   (unsigned long long) t.records,
+		   (unsigned long long) bytes,
+		   (unsigned long long) (bytes / t.ring.size),
+		   (unsigned long long) elapsed / 1000,
+		   (unsigned long long) t.ring.blocked,
+		   (unsigned long long) t.ring.starved,
+		   ring_occupancy(&t.ring),
+		   ring_peak(&t.ring));
+
+	ring_free(&t.ring);
+
+	if (t.records != RECORDS || t.bad)
+	{
+		printf("FAIL: ring, %llu of %llu records read, %llu of them wrong\n",
+			   (unsigned long long) t.records,
+			   (unsigned long long) RECORDS,
+			   (unsigned long long) t.bad);
+		return 1;
+	}
+
+	printf("PASS: ring\n");
+
+	return 0;
+}
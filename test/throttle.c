@@ -0,0 +1,139 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Sweeps a tree of the in-memory registry with memreg_latency() slowing it
+ * down past a few calls in flight, and checks that the limit the throttle
+ * settles on keeps the p99 latency under the ceiling. The numbers are
+ * printed either way, so it doubles as a benchmark of the limiter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <invis/glob.h>
+#include <invis/memreg.h>
+#include <invis/ntdll.h>
+#include <invis/thread.h>
+#include <invis/throttle.h>
+
+// 12 * 12 * 12 keys under HKLM\Throttle
+#define FANOUT		12
+#define DEPTH		3
+
+// Calls take LATENCY microseconds until more than CAPACITY are in flight
+#define LATENCY		1000
+#define CAPACITY	4
+#define CEILING		3000
+#define THREADS		16
+
+// Sleeping overshoots, so the p99 is allowed this much over the ceiling
+#define SLACK		3
+
+static int create_tree(HANDLE parent, uint32_t depth)
+{
+	for (uint32_t i = 0; i < FANOUT; i++)
+	{
+		wchar_t name[3] = { L'K', L'A' + i, 0 };
+
+		UNICODE_STRING n = { 0 };
+		n.Buffer = name;
+		n.Length = 4;
+		n.MaximumLength = 4;
+
+		OBJECT_ATTRIBUTES attribs = { 0 };
+		attribs.Length = sizeof(OBJECT_ATTRIBUTES);
+		attribs.RootDirectory = parent;
+		attribs.ObjectName = &n;
+
+		HANDLE key;
+		if (NtCreateKey(&key, KEY_ALL_ACCESS, &attribs, 0, 0, REG_OPTION_NON_VOLATILE, 0) != STATUS_SUCCESS)
+			return -1;
+
+		int r = depth > 1 ? create_tree(key, depth - 1) : 0;
+		NtClose(key);
+
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
+static int count_key(void *ctx, HANDLE key, const wchar_t *path, uint32_t path_size)
+{
+	(*(uint64_t *) ctx)++;
+	return 0;
+}
+
+int main(void)
+{
+	init_ntdll();
+
+	HKEY root;
+	if (RegCreateKeyExW(HKEY_LOCAL_MACHINE, L"Throttle", 0, 0, REG_OPTION_NON_VOLATILE, KEY_ALL_ACCESS, 0, &root, 0) != ERROR_SUCCESS
+	||  create_tree((HANDLE) root, DEPTH))
+	{
+		printf("FAIL: throttle, could not create the tree\n");
+		return 1;
+	}
+
+	RegCloseKey(root);
+
+	memreg_latency(LATENCY, CAPACITY);
+	throttle_init(CEILING, 0, THREADS);
+
+	uint64_t keys = 0;
+	uint64_t start = thread_now();
+	int r = glob_keys(HKEY_LOCAL_MACHINE, "Throttle\\**", KEY_READ, THREADS, count_key, &keys);
+	uint64_t elapsed = thread_now() - start;
+
+	struct throttle_stats_t s;
+	throttle_stats(&s);
+
+	printf("keys=%llu elapsed=%llums calls=%llu waited=%llu limit=%u delay=%uns p99=%uus\n",
+		   (unsigned long long) keys,
+		   (unsigned long long) elapsed / 1000,
+		   (unsigned long long) s.calls,
+		   (unsigned long long) s.waited,
+		   s.limit,
+		   s.delay,
+		   s.p99);
+
+	// The latency stays under the ceiling with at most CEILING / LATENCY * CAPACITY calls in flight
+	const char *failed = 0;
+	if (r)
+		failed = "the sweep failed";
+	else if (keys != FANOUT + FANOUT * FANOUT + FANOUT * FANOUT * FANOUT + 1)
+		failed = "keys were missed";
+	else if (!s.limit || s.limit > CEILING / LATENCY * CAPACITY)
+		failed = "the limit did not settle under the ceiling";
+	else if (s.p99 > CEILING * SLACK)
+		failed = "the p99 latency is over the ceiling";
+
+	if (failed)
+	{
+		printf("FAIL: throttle, %s\n", failed);
+		return 1;
+	}
+
+	printf("PASS: throttle\n");
+
+	return 0;
+}
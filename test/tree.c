@@ -0,0 +1,234 @@
+/*
+ * invisreg - suite of utilities for hiding registry keys
+ * Copyright (C) 2023  Sabrina Andersen (NukingDragons)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Builds chains of keys with an invisible leaf under HKLM\Tree and tears
+ * them down again, once with reg_tree() walking each path a single time
+ * and once with a full-path NtCreateKey, or NtOpenKey and NtDeleteKey,
+ * per level. Checks that both leave the same keys behind, and prints the
+ * keys per second of each against the in-memory registry.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <invis/ntdll.h>
+#include <invis/reg.h>
+#include <invis/thread.h>
+
+#define CHAINS		2000
+#define MAX_DEPTH	64
+
+static const uint32_t depths[] = { 4, 16, 64 };
+
+/*
+ * Tree\Cnnnn\K\...\K\<NUL>L, depth keys under Tree, with the offset of the
+ * backslash in front of every level. Returns the size in bytes.
+ */
+static uint32_t chain_path(wchar_t *path, uint32_t *ends, uint32_t chain, uint32_t depth)
+{
+	uint32_t len = 0;
+	const wchar_t *top = L"Tree\\C";
+
+	while (*top)
+		path[len++] = *top++;
+
+	for (uint32_t d = 1000; d; d /= 10)
+		path[len++] = L'0' + chain / d % 10;
+
+	ends[0] = len;
+
+	for (uint32_t i = 1; i < depth; i++)
+	{
+		path[len++] = L'\\';
+		if (i == depth - 1)
+			path[len++] = 0;
+
+		path[len++] = i == depth - 1 ? L'L' : L'K';
+		ends[i] = len;
+	}
+
+	return len * 2;
+}
+
+static NTSTATUS full_open(HANDLE root, const wchar_t *path, uint32_t size, uint8_t create, HANDLE *key)
+{
+	UNICODE_STRING n = { 0 };
+	n.Buffer = (PWSTR) path;
+	n.Length = size;
+	n.MaximumLength = size;
+
+	OBJECT_ATTRIBUTES attribs = { 0 };
+	attribs.Length = sizeof(OBJECT_ATTRIBUTES);
+	attribs.RootDirectory = root;
+	attribs.ObjectName = &n;
+
+	if (create)
+		return NtCreateKey(key, KEY_ALL_ACCESS, &attribs, 0, 0, REG_OPTION_NON_VOLATILE, 0);
+
+	return NtOpenKey(key, KEY_ALL_ACCESS, &attribs);
+}
+
+// Every level from the root of the hive again, the way reg() used to
+static int full_create(HANDLE root, const wchar_t *path, const uint32_t *ends, uint32_t depth)
+{
+	for (uint32_t i = 0; i < depth; i++)
+	{
+		HANDLE key;
+		if (full_open(root, path, ends[i] * 2, 1, &key) != STATUS_SUCCESS)
+			return -1;
+
+		NtClose(key);
+	}
+
+	return 0;
+}
+
+static int full_delete(HANDLE root, const wchar_t *path, const uint32_t *ends, uint32_t depth)
+{
+	for (uint32_t i = depth; i--;)
+	{
+		HANDLE key;
+		if (full_open(root, path, ends[i] * 2, 0, &key) != STATUS_SUCCESS)
+			return -1;
+
+		NTSTATUS status = NtDeleteKey(key);
+		NtClose(key);
+
+		if (status != STATUS_SUCCESS)
+			return -1;
+	}
+
+	return 0;
+}
+
+// The invisible leaf of every chain is there, or none of the chains are
+static int check_chains(HANDLE root, uint32_t depth, uint8_t present)
+{
+	wchar_t path[16 + MAX_DEPTH * 3];
+	uint32_t ends[MAX_DEPTH];
+
+	for (uint32_t c = 0; c < CHAINS; c++)
+	{
+		uint32_t size = chain_path(path, ends, c, depth);
+
+		HANDLE key;
+		NTSTATUS status = full_open(root, path, present ? size : ends[0] * 2, 0, &key);
+		if (status == STATUS_SUCCESS)
+			NtClose(key);
+
+		if ((status == STATUS_SUCCESS) != present)
+			return -1;
+	}
+
+	return 0;
+}
+
+static double per_second(uint64_t keys, uint64_t usec)
+{
+	return usec ? keys * 1e6 / usec : 0;
+}
+
+int main(void)
+{
+	init_ntdll();
+
+	HKEY tree;
+	HANDLE root;
+	if (RegCreateKeyExW(HKEY_LOCAL_MACHINE, L"Tree", 0, 0, REG_OPTION_NON_VOLATILE, KEY_ALL_ACCESS, 0, &tree, 0) != ERROR_SUCCESS
+	||  reg_root(HKEY_LOCAL_MACHINE, KEY_ALL_ACCESS, &root))
+	{
+		printf("FAIL: tree, could not open the hive\n");
+		return 1;
+	}
+
+	RegCloseKey(tree);
+
+	wchar_t path[16 + MAX_DEPTH * 3];
+	uint32_t ends[MAX_DEPTH];
+	const char *failed = 0;
+
+	printf("%-8s %14s %14s %14s %14s\n", "depth", "create tree", "create full", "delete tree", "delete full");
+
+	for (uint32_t d = 0; !failed && d < sizeof(depths) / sizeof(depths[0]); d++)
+	{
+		uint32_t depth = depths[d];
+		uint64_t keys = (uint64_t) CHAINS * depth;
+		uint64_t elapsed[4] = { 0 };
+
+		// Relative handles first, then a full path per level
+		for (uint8_t full = 0; !failed && full < 2; full++)
+		{
+			uint64_t start = thread_now();
+
+			for (uint32_t c = 0; !failed && c < CHAINS; c++)
+			{
+				uint32_t size = chain_path(path, ends, c, depth);
+				uint32_t count = 0;
+
+				if (full)
+					failed = full_create(root, path, ends, depth) ? "a full path create failed" : 0;
+				else if (reg_tree(OPERATION_CREATE, HKEY_LOCAL_MACHINE, path, size, &count) || count != depth)
+					failed = "reg_tree() did not create every key";
+			}
+
+			elapsed[full] = thread_now() - start;
+
+			if (!failed && check_chains(root, depth, 1))
+				failed = "a chain is missing its invisible leaf";
+
+			start = thread_now();
+
+			for (uint32_t c = 0; !failed && c < CHAINS; c++)
+			{
+				chain_path(path, ends, c, depth);
+				uint32_t count = 0;
+
+				if (full)
+					failed = full_delete(root, path, ends, depth) ? "a full path delete failed" : 0;
+				else if (reg_tree(OPERATION_DELETE, HKEY_LOCAL_MACHINE, path, ends[0] * 2, &count) || count != depth)
+					failed = "reg_tree() did not delete every key";
+			}
+
+			elapsed[2 + full] = thread_now() - start;
+
+			if (!failed && check_chains(root, depth, 0))
+				failed = "a chain was left behind";
+		}
+
+		if (!failed)
+			printf("%-8u %13.2fM %13.2fM %13.2fM %13.2fM\n", depth,
+				   per_second(keys, elapsed[0]) / 1e6,
+				   per_second(keys, elapsed[1]) / 1e6,
+				   per_second(keys, elapsed[2]) / 1e6,
+				   per_second(keys, elapsed[3]) / 1e6);
+	}
+
+	NtClose(root);
+
+	if (failed)
+	{
+		printf("FAIL: tree, %s\n", failed);
+		return 1;
+	}
+
+	printf("PASS: tree\n");
+
+	return 0;
+}